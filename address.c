@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "keccak.h"
+#include "hex.h"
+#include "address.h"
+
+/*
+ * Monero addresses without the wallet. An address is
+ *
+ *   prefix | public spend key | public view key | [payment id] | checksum
+ *
+ * with a varint prefix for network and type, and the first 4 bytes of
+ * the Keccak-256 of everything before as checksum. It is written in
+ * the base58 of Monero: blocks of 8 bytes become 11 characters each,
+ * the last short block as many as it needs, so the length alone tells
+ * where the blocks are.
+ */
+#define BLOCK_SIZE          (8)
+#define BLOCK_CHARS         (11)
+#define CHECKSUM_SIZE       (4)
+#define ADDRESS_MAX_BYTES   (1 + 2 * ADDRESS_KEY_SIZE + ADDRESS_PAYID_SIZE + CHECKSUM_SIZE)
+
+static const char alphabet[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+static const int chars[BLOCK_SIZE + 1] = { 0, 2, 3, 5, 6, 7, 9, 10, 11 };
+
+/* prefixes of cryptonote_config.h by network and type, all one varint byte */
+static const unsigned char prefixes[3][3] = {
+    [ADDRESS_MAINNET]  = { [ADDRESS_STANDARD] = 18, [ADDRESS_INTEGRATED] = 19, [ADDRESS_SUBADDRESS] = 42 },
+    [ADDRESS_TESTNET]  = { [ADDRESS_STANDARD] = 53, [ADDRESS_INTEGRATED] = 54, [ADDRESS_SUBADDRESS] = 63 },
+    [ADDRESS_STAGENET] = { [ADDRESS_STANDARD] = 24, [ADDRESS_INTEGRATED] = 25, [ADDRESS_SUBADDRESS] = 36 },
+};
+
+static size_t encode(const unsigned char *data, size_t len, char *str);
+static int decode(const char *str, size_t len, unsigned char *data, size_t *out);
+
+
+/**
+ * Decodes an address and checks its checksum.
+ *
+ * @param str The address.
+ * @param addr Set to network, type and keys.
+ * @return 0 on success, -1 with errno EINVAL if it is no valid address.
+ */
+int address_decode(const char *str, struct address *addr)
+{
+    unsigned char data[ADDRESS_MAX_BYTES];
+    unsigned char hash[KECCAK_HASH_SIZE];
+    size_t len = 0;
+
+    memset(addr, 0, sizeof(*addr));
+    if (str == NULL || decode(str, strlen(str), data, &len) < 0 || len == 0) goto invalid;
+
+    int found = 0;
+    for (int net = 0; net < 3 && !found; net++) {
+        for (int type = 0; type < 3 && !found; type++) {
+            if (prefixes[net][type] != data[0]) continue;
+            addr->net = net;
+            addr->type = type;
+            found = 1;
+        }
+    }
+    size_t want = 1 + 2 * ADDRESS_KEY_SIZE + CHECKSUM_SIZE;
+    if (found && addr->type == ADDRESS_INTEGRATED) want += ADDRESS_PAYID_SIZE;
+    if (!found || len != want) goto invalid;
+
+    keccak256(data, len - CHECKSUM_SIZE, hash);
+    if (memcmp(hash, data + len - CHECKSUM_SIZE, CHECKSUM_SIZE) != 0) goto invalid;
+
+    memcpy(addr->spend, data + 1, ADDRESS_KEY_SIZE);
+    memcpy(addr->view, data + 1 + ADDRESS_KEY_SIZE, ADDRESS_KEY_SIZE);
+    if (addr->type == ADDRESS_INTEGRATED) {
+        memcpy(addr->payment_id, data + 1 + 2 * ADDRESS_KEY_SIZE, ADDRESS_PAYID_SIZE);
+    }
+    return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+
+/**
+ * Encodes an address with its checksum.
+ *
+ * @param addr Network, type and keys.
+ * @param str Set to the address.
+ * @param size Size of str, MAX_IADDR_SIZE + 1 fits every type.
+ * @return Length of the address, -1 if it does not fit.
+ */
+int address_encode(const struct address *addr, char *str, size_t size)
+{
+    unsigned char data[ADDRESS_MAX_BYTES];
+    unsigned char hash[KECCAK_HASH_SIZE];
+    size_t len = 0;
+
+    if (addr->net < 0 || addr->net > 2 || addr->type < 0 || addr->type > 2) return -1;
+    data[len++] = prefixes[addr->net][addr->type];
+    memcpy(data + len, addr->spend, ADDRESS_KEY_SIZE);
+    len += ADDRESS_KEY_SIZE;
+    memcpy(data + len, addr->view, ADDRESS_KEY_SIZE);
+    len += ADDRESS_KEY_SIZE;
+    if (addr->type == ADDRESS_INTEGRATED) {
+        memcpy(data + len, addr->payment_id, ADDRESS_PAYID_SIZE);
+        len += ADDRESS_PAYID_SIZE;
+    }
+    keccak256(data, len, hash);
+    memcpy(data + len, hash, CHECKSUM_SIZE);
+    len += CHECKSUM_SIZE;
+
+    if (size < (len / BLOCK_SIZE) * BLOCK_CHARS + chars[len % BLOCK_SIZE] + 1) return -1;
+    return (int)encode(data, len, str);
+}
+
+
+/**
+ * Builds the integrated address of a standard address and a payment
+ * id, what make_integrated_address of the wallet returns.
+ *
+ * @param standard The standard address.
+ * @param payment_id 16 hex characters.
+ * @param str Set to the integrated address.
+ * @param size Size of str, at least MAX_IADDR_SIZE + 1.
+ * @return 0 on success, -1 if the address or payment id is invalid.
+ */
+int address_integrate(const char *standard, const char *payment_id, char *str, size_t size)
+{
+    struct address addr;
+
+    if (address_decode(standard, &addr) < 0 || addr.type != ADDRESS_STANDARD) return -1;
+    if (payment_id == NULL || strlen(payment_id) != 2 * ADDRESS_PAYID_SIZE ||
+        hex2bin(payment_id, addr.payment_id, ADDRESS_PAYID_SIZE) < 0) return -1;
+    addr.type = ADDRESS_INTEGRATED;
+    return address_encode(&addr, str, size) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Splits an integrated address into its standard address and payment
+ * id, what split_integrated_address of the wallet returns.
+ *
+ * @param integrated The integrated address.
+ * @param standard Set to the standard address.
+ * @param size Size of standard, at least MAX_ADDR_SIZE.
+ * @param payment_id Set to the 16 hex characters, 17 bytes.
+ * @return 0 on success, -1 if it is no integrated address.
+ */
+int address_split(const char *integrated, char *standard, size_t size, char *payment_id)
+{
+    struct address addr;
+
+    if (address_decode(integrated, &addr) < 0 || addr.type != ADDRESS_INTEGRATED) return -1;
+    bin2hex(addr.payment_id, ADDRESS_PAYID_SIZE, payment_id);
+    addr.type = ADDRESS_STANDARD;
+    return address_encode(&addr, standard, size) < 0 ? -1 : 0;
+}
+
+
+/**
+ * @param net The network.
+ * @return Its name.
+ */
+const char *address_net_name(int net)
+{
+    switch (net) {
+        case ADDRESS_MAINNET:  return "mainnet";
+        case ADDRESS_TESTNET:  return "testnet";
+        case ADDRESS_STAGENET: return "stagenet";
+        default:               return "unknown";
+    }
+}
+
+
+/**
+ * @param type The address type.
+ * @return Its name.
+ */
+const char *address_type_name(int type)
+{
+    switch (type) {
+        case ADDRESS_STANDARD:   return "standard";
+        case ADDRESS_INTEGRATED: return "integrated";
+        case ADDRESS_SUBADDRESS: return "subaddress";
+        default:                 return "unknown";
+    }
+}
+
+
+/* base58 of len bytes, blockwise, big endian within a block */
+static size_t encode(const unsigned char *data, size_t len, char *str)
+{
+    size_t n = 0;
+
+    for (size_t at = 0; at < len; at += BLOCK_SIZE) {
+        size_t bytes = len - at < BLOCK_SIZE ? len - at : BLOCK_SIZE;
+        uint64_t num = 0;
+        for (size_t i = 0; i < bytes; i++) num = num << 8 | data[at + i];
+
+        for (int i = chars[bytes] - 1; i >= 0; i--) {
+            str[n + i] = alphabet[num % 58];
+            num /= 58;
+        }
+        n += chars[bytes];
+    }
+    str[n] = '\0';
+    return n;
+}
+
+
+/* inverse of encode, -1 on a character, length or block out of range */
+static int decode(const char *str, size_t len, unsigned char *data, size_t *out)
+{
+    size_t n = 0;
+
+    for (size_t at = 0; at < len; at += BLOCK_CHARS) {
+        size_t count = len - at < BLOCK_CHARS ? len - at : BLOCK_CHARS;
+        int bytes = -1;
+        for (int i = 0; i <= BLOCK_SIZE; i++) {
+            if (chars[i] == (int)count) bytes = i;
+        }
+        if (bytes < 1 || n + bytes > ADDRESS_MAX_BYTES) return -1;
+
+        unsigned __int128 num = 0;
+        for (size_t i = 0; i < count; i++) {
+            const char *c = strchr(alphabet, str[at + i]);
+            if (str[at + i] == '\0' || c == NULL) return -1;
+            num = num * 58 + (unsigned)(c - alphabet);
+        }
+        if (num >> (8 * bytes) != 0) return -1;
+
+        for (int i = bytes - 1; i >= 0; i--) {
+            data[n + i] = (unsigned char)num;
+            num >>= 8;
+        }
+        n += bytes;
+    }
+    *out = n;
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef ADDRESS_H
+#define ADDRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADDRESS_KEY_SIZE    (32)
+#define ADDRESS_PAYID_SIZE  (8)
+
+enum address_net {
+    ADDRESS_MAINNET,
+    ADDRESS_TESTNET,
+    ADDRESS_STAGENET,
+};
+
+enum address_type {
+    ADDRESS_STANDARD,
+    ADDRESS_INTEGRATED,
+    ADDRESS_SUBADDRESS,
+};
+
+struct address {
+    int net;
+    int type;
+    unsigned char spend[ADDRESS_KEY_SIZE];
+    unsigned char view[ADDRESS_KEY_SIZE];
+    unsigned char payment_id[ADDRESS_PAYID_SIZE];
+};
+
+int address_decode(const char *str, struct address *addr);
+int address_encode(const struct address *addr, char *str, size_t size);
+int address_integrate(const char *standard, const char *payment_id, char *str, size_t size);
+int address_split(const char *integrated, char *standard, size_t size, char *payment_id);
+const char *address_net_name(int net);
+const char *address_type_name(int type);
+
+#endif
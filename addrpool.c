@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "rpc_call.h"
+#include "addrpool.h"
+
+/*
+ * Pool of fresh subaddresses, so a checkout does not wait for the
+ * wallet. mnpd is the only producer: it appends at head, in batches
+ * of one create_address call with count, and never past tail + slots.
+ * Any number of mnp-payment processes take from tail: read tail and
+ * head, copy the slot, and claim it by moving tail on with a compare
+ * and swap. A slot is only rewritten after tail has passed it, so a
+ * copy that raced with a refill always loses the swap and is thrown
+ * away. Both counters only grow, so there is no ABA.
+ *
+ * The file is kept when mnpd stops. The addresses in it exist in the
+ * wallet already and are used up before new ones are created; the
+ * pool never holds more than the wallet looks ahead, so a payment to
+ * any of them is still found after a wallet restore.
+ */
+static int valid(const struct addrpool_head *h, size_t size);
+
+
+/**
+ * Maps the pool in the workdir, or creates it. A pool left by a
+ * previous mnpd for the same account is kept with its addresses.
+ *
+ * @param pool The pool.
+ * @param workdir The work directory.
+ * @param account Account the subaddresses are created in.
+ * @param want Addresses kept ready, at most ADDR_POOL_MAX.
+ * @param mode Permission of the pool file.
+ * @return 0 on success, -1 on error.
+ */
+int addrpool_open(struct addrpool *pool, const char *workdir, long account, size_t want, mode_t mode)
+{
+    char *tmp = NULL;
+    struct stat sb;
+    int fd = -1;
+
+    memset(pool, 0, sizeof(*pool));
+    if (want > ADDR_POOL_MAX) {
+        syslog(LOG_USER | LOG_WARNING, "address pool: %zu is beyond the wallet lookahead, %d kept ready",
+               want, ADDR_POOL_MAX);
+        want = ADDR_POOL_MAX;
+    }
+    pool->want = want;
+    if (asprintf(&pool->path, "%s/%s", workdir, ADDR_POOL_FILE) == -1) {
+        pool->path = NULL;
+        return -1;
+    }
+
+    size_t n = 64;
+    while (n < want) n *= 2;
+    pool->size = sizeof(struct addrpool_head) + n * sizeof(struct addrpool_slot);
+
+    /* the addresses of the last run are still unused */
+    fd = open(pool->path, O_RDWR | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, &sb) == 0 && (size_t)sb.st_size == pool->size) {
+        pool->head = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (pool->head != MAP_FAILED && valid(pool->head, pool->size) && pool->head->account == (uint32_t)account) {
+            close(fd);
+            pool->slot = (struct addrpool_slot *)(pool->head + 1);
+            if (verbose) syslog(LOG_USER | LOG_INFO, "address pool is up : %s %zu ready", pool->path,
+                                addrpool_ready(pool));
+            return 0;
+        }
+        if (pool->head != MAP_FAILED) munmap(pool->head, pool->size);
+        pool->head = NULL;
+    }
+    if (fd >= 0) close(fd);
+
+    /* built aside and renamed, so mnp-payment never maps a half initialised pool */
+    if (asprintf(&tmp, "%s.%d", pool->path, getpid()) == -1) {
+        tmp = NULL;
+        goto error;
+    }
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == -1 || fchmod(fd, mode) == -1 || ftruncate(fd, pool->size) == -1) goto error;
+
+    pool->head = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pool->head == MAP_FAILED) {
+        pool->head = NULL;
+        goto error;
+    }
+    pool->slot = (struct addrpool_slot *)(pool->head + 1);
+
+    pool->head->version = ADDR_POOL_VERSION;
+    pool->head->slots = n;
+    pool->head->slot_size = sizeof(struct addrpool_slot);
+    pool->head->account = (uint32_t)account;
+    pool->head->created = time(NULL);
+    pool->head->head = 0;
+    pool->head->tail = 0;
+    __atomic_store_n(&pool->head->magic, ADDR_POOL_MAGIC, __ATOMIC_RELEASE);
+
+    if (rename(tmp, pool->path) == -1) goto error;
+    close(fd);
+    free(tmp);
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "address pool is up : %s %zu slots", pool->path, n);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not create address pool %s: %s", pool->path, strerror(errno));
+    if (fd >= 0) close(fd);
+    if (tmp != NULL) unlink(tmp);
+    free(tmp);
+    addrpool_close(pool);
+    return -1;
+}
+
+
+/**
+ * Tops the pool up once it is down to half. The missing addresses
+ * are created with as few create_address calls as the wallet allows.
+ *
+ * @param pool The pool.
+ * @param rpc The NEW_SUBADDR rpc of mnpd.
+ * @return Number of addresses added, -1 if the wallet failed.
+ */
+int addrpool_refill(struct addrpool *pool, struct rpc_wallet *rpc)
+{
+    int added = 0;
+
+    if (pool->head == NULL || addrpool_ready(pool) > pool->want / 2) return 0;
+    pool->refills++;
+
+    while (addrpool_ready(pool) < pool->want) {
+        size_t count = pool->want - addrpool_ready(pool);
+        if (count > ADDR_POOL_BATCH) count = ADDR_POOL_BATCH;
+
+        rpc->idx = (int)count;
+        if (rpc_call(rpc) < 0) {
+            /* rpc_call has freed the error part of a failed reply already */
+            rpc->reply = NULL;
+            rpc->idx = 0;
+            pool->failed++;
+            syslog(LOG_USER | LOG_ERR, "address pool: create_address failed, %zu ready", addrpool_ready(pool));
+            return -1;
+        }
+        rpc->idx = 0;
+
+        cJSON *result = cJSON_GetObjectItem(rpc->reply, "result");
+        cJSON *addresses = cJSON_GetObjectItem(result, "addresses");
+        cJSON *indices = cJSON_GetObjectItem(result, "address_indices");
+        int got = 0;
+        uint64_t h = pool->head->head;
+        for (int i = 0; i < cJSON_GetArraySize(addresses) && i < cJSON_GetArraySize(indices); i++) {
+            const char *address = cJSON_GetStringValue(cJSON_GetArrayItem(addresses, i));
+            const cJSON *index = cJSON_GetArrayItem(indices, i);
+            if (address == NULL || !cJSON_IsNumber(index) || strlen(address) >= MAX_ADDR_SIZE) continue;
+            if (h - __atomic_load_n(&pool->head->tail, __ATOMIC_ACQUIRE) >= pool->head->slots) break;
+
+            struct addrpool_slot *s = &pool->slot[h & (pool->head->slots - 1)];
+            s->account = pool->head->account;
+            s->index = (uint32_t)index->valuedouble;
+            snprintf(s->address, sizeof(s->address), "%s", address);
+            h++;
+            got++;
+        }
+        __atomic_store_n(&pool->head->head, h, __ATOMIC_RELEASE);
+        cJSON_Delete(rpc->reply);
+        rpc->reply = NULL;
+
+        pool->created += got;
+        added += got;
+        if (got == 0) break;
+    }
+    if (verbose) syslog(LOG_USER | LOG_INFO, "address pool: %d created, %zu ready", added, addrpool_ready(pool));
+    return added;
+}
+
+
+/**
+ * @param pool The pool.
+ * @return Number of addresses ready to be taken.
+ */
+size_t addrpool_ready(const struct addrpool *pool)
+{
+    if (pool->head == NULL) return 0;
+    uint64_t tail = __atomic_load_n(&pool->head->tail, __ATOMIC_ACQUIRE);
+    return (size_t)(pool->head->head - tail);
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param pool The pool.
+ */
+void addrpool_stats(const struct addrpool *pool)
+{
+    if (pool->head == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "address pool: %zu ready, %lu taken, %lu created, %lu refills, %lu failed",
+           addrpool_ready(pool), (unsigned long)pool->head->tail, pool->created, pool->refills, pool->failed);
+    printf("address pool: %zu ready, %lu taken, %lu created, %lu refills, %lu failed\n",
+           addrpool_ready(pool), (unsigned long)pool->head->tail, pool->created, pool->refills, pool->failed);
+    fflush(stdout);
+}
+
+
+/**
+ * Unmaps the pool. The file and its addresses are kept for the next run.
+ *
+ * @param pool The pool.
+ */
+void addrpool_close(struct addrpool *pool)
+{
+    if (pool->head != NULL) munmap(pool->head, pool->size);
+    free(pool->path);
+    pool->head = NULL;
+    pool->path = NULL;
+}
+
+
+/**
+ * Takes a fresh subaddress from the pool mnpd keeps in the workdir.
+ * Safe to call from any number of processes at once.
+ *
+ * @param workdir The work directory.
+ * @param account Account the subaddress has to belong to.
+ * @param index Set to the subaddress index.
+ * @param address Set to the subaddress, MAX_ADDR_SIZE bytes.
+ * @return 1 if one was taken, 0 if there is no pool or it is empty, -1 on error.
+ */
+int addrpool_pop(const char *workdir, long account, long *index, char *address)
+{
+    struct addrpool_head *h = NULL;
+    struct addrpool_slot slot;
+    struct stat sb;
+    char *path = NULL;
+    int ret = 0;
+
+    if (workdir == NULL || asprintf(&path, "%s/%s", workdir, ADDR_POOL_FILE) == -1) return 0;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    free(path);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+
+    if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(*h)) goto out;
+    h = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        h = NULL;
+        ret = -1;
+        goto out;
+    }
+    if (!valid(h, sb.st_size) || h->account != (uint32_t)account) goto out;
+
+    struct addrpool_slot *slots = (struct addrpool_slot *)(h + 1);
+    uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+    for (;;) {
+        if (tail >= __atomic_load_n(&h->head, __ATOMIC_ACQUIRE)) break;
+        memcpy(&slot, &slots[tail & (h->slots - 1)], sizeof(slot));
+        if (__atomic_compare_exchange_n(&h->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            slot.address[MAX_ADDR_SIZE - 1] = '\0';
+            *index = slot.index;
+            memcpy(address, slot.address, MAX_ADDR_SIZE);
+            ret = 1;
+            break;
+        }
+    }
+
+out:
+    if (h != NULL) munmap(h, sb.st_size);
+    close(fd);
+    return ret;
+}
+
+
+/* pool file that was fully set up, with a layout this build knows */
+static int valid(const struct addrpool_head *h, size_t size)
+{
+    return __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == ADDR_POOL_MAGIC &&
+           h->version == ADDR_POOL_VERSION && h->slot_size == sizeof(struct addrpool_slot) &&
+           h->slots > 0 && (h->slots & (h->slots - 1)) == 0 &&
+           sizeof(struct addrpool_head) + (size_t)h->slots * sizeof(struct addrpool_slot) <= size;
+}
@@ -0,0 +1,53 @@
+#ifndef ADDRPOOL_H
+#define ADDRPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "globaldefs.h"
+#include "rpc_call.h"
+
+#define ADDR_POOL_MAGIC     (0x6c6f6f7072646461ULL)
+#define ADDR_POOL_VERSION   (1)
+
+struct addrpool_slot {
+    uint32_t account;
+    uint32_t index;
+    char address[MAX_ADDR_SIZE];
+};
+
+struct addrpool_head {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t account;
+    int64_t  created;
+    unsigned char pad0[32];
+    /* own cache line, written by mnpd on refill */
+    uint64_t head;
+    unsigned char pad1[56];
+    /* own cache line, claimed by mnp-payment */
+    uint64_t tail;
+    unsigned char pad2[56];
+};
+
+struct addrpool {
+    char *path;
+    size_t size;
+    size_t want;
+    struct addrpool_head *head;
+    struct addrpool_slot *slot;
+    unsigned long refills;
+    unsigned long created;
+    unsigned long failed;
+};
+
+int addrpool_open(struct addrpool *pool, const char *workdir, long account, size_t want, mode_t mode);
+int addrpool_refill(struct addrpool *pool, struct rpc_wallet *rpc);
+size_t addrpool_ready(const struct addrpool *pool);
+void addrpool_stats(const struct addrpool *pool);
+void addrpool_close(struct addrpool *pool);
+int addrpool_pop(const char *workdir, long account, long *index, char *address);
+
+#endif
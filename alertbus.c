@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "alertbus.h"
+
+/*
+ * Alert bus for the shared pipes txid, double_spend_alert and
+ * rpc_connection_alert. mnpd is the only writer: every pipe has a
+ * bounded ring of messages that is written in order, one message per
+ * write(). A message is at most ALERT_MSG_SIZE < PIPE_BUF bytes, so
+ * each write is atomic and readers never see interleaved lines.
+ *
+ * Delivery opens the pipe O_WRONLY|O_NONBLOCK, which only succeeds
+ * when a reader is attached, writes what fits and closes it again.
+ * The reader gets the queued lines followed by EOF, just like it did
+ * with one forked writer per message.
+ *
+ * A full ring either tells the caller to hold back (block), drops the
+ * oldest message (drop-oldest) or appends to a spill file in the
+ * workdir that is read back in order once the ring has room (spill).
+ */
+static const char *alert_names[ALERT_PIPES] = { TXID_PIPE, DS_ALERT_PIPE, RPC_CONN_ALERT };
+static const char *policy_names[] = { "block", "drop-oldest", "spill" };
+
+static void alertbus_tick(void *data);
+static void pipe_flush(struct alertbus *bus, struct alert_pipe *p);
+static void ring_push(struct alertbus *bus, struct alert_pipe *p, const char *msg, size_t len);
+static int spill_write(struct alert_pipe *p, const char *msg, size_t len);
+static void spill_read(struct alertbus *bus, struct alert_pipe *p);
+static int spill_save(struct alertbus *bus, struct alert_pipe *p);
+
+
+/**
+ * Allocates the rings and reopens spill files left by a previous run.
+ *
+ * @param bus The alert bus.
+ * @param loop The event loop of mnpd.
+ * @param workdir The work directory holding the pipes.
+ * @param cap Number of messages per ring.
+ * @param policy What to do when a ring is full.
+ * @return 0 on success, -1 on error.
+ */
+int alertbus_init(struct alertbus *bus, struct evloop *loop, const char *workdir,
+                  size_t cap, enum alert_overflow policy)
+{
+    struct stat sb;
+
+    memset(bus, 0, sizeof(*bus));
+    bus->cap = cap > 0 ? cap : ALERT_RING;
+    bus->policy = policy;
+
+    for (int i = 0; i < ALERT_PIPES; i++) {
+        struct alert_pipe *p = &bus->pipe[i];
+
+        p->spill_fd = -1;
+        snprintf(p->name, sizeof(p->name), "%s", alert_names[i]);
+        if (snprintf(p->path, sizeof(p->path), "%s/%s", workdir, p->name) >= (int)sizeof(p->path) ||
+            snprintf(p->spill, sizeof(p->spill), "%s/%s.%s", workdir, ALERT_SPILL_FILE, p->name) >= (int)sizeof(p->spill)) {
+            errno = ENAMETOOLONG;
+            goto error;
+        }
+
+        p->ring = calloc(bus->cap, sizeof(struct alert_msg));
+        if (p->ring == NULL) goto error;
+
+        /* messages spilled before a restart are delivered first */
+        p->spill_fd = open(p->spill, O_RDWR | O_CLOEXEC);
+        if (p->spill_fd == -1 && errno != ENOENT) goto error;
+        if (p->spill_fd >= 0 && fstat(p->spill_fd, &sb) == 0) p->spill_end = sb.st_size;
+        if (p->spill_end > 0 && verbose) {
+            syslog(LOG_USER | LOG_INFO, "alert bus resumes %lld spilled bytes for %s", (long long)p->spill_end, p->name);
+        }
+    }
+
+    if (evloop_tick(loop, ALERT_POLL_MS, alertbus_tick, bus) == -1) goto error;
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start alert bus: %s", strerror(errno));
+    alertbus_close(bus);
+    return -1;
+}
+
+
+/**
+ * Queues one message for a shared pipe and tries to deliver it.
+ *
+ * @param bus The alert bus.
+ * @param name Name of the pipe (txid, double_spend_alert, rpc_connection_alert).
+ * @param msg The message, one line without newline.
+ * @return 0 if queued, 1 if the ring is full and the policy is block, -1 on error.
+ */
+int alertbus_post(struct alertbus *bus, const char *name, const char *msg)
+{
+    struct alert_pipe *p = NULL;
+    size_t len = strcspn(msg, "\n");
+
+    for (int i = 0; i < ALERT_PIPES; i++) {
+        if (strcmp(bus->pipe[i].name, name) == 0) p = &bus->pipe[i];
+    }
+    if (p == NULL || len >= ALERT_MSG_SIZE) return -1;
+
+    if (p->spill_end > p->spill_off) {
+        /* keep the order: once spilling, everything goes to the file */
+        if (spill_write(p, msg, len) < 0) return -1;
+    } else if (p->count == bus->cap) {
+        switch (bus->policy) {
+            case ALERT_BLOCK:
+                return 1;
+            case ALERT_DROP_OLDEST:
+                p->head = (p->head + 1) % bus->cap;
+                p->count--;
+                p->dropped++;
+                ring_push(bus, p, msg, len);
+                break;
+            case ALERT_SPILL:
+                if (spill_write(p, msg, len) < 0) return -1;
+                break;
+        }
+    } else {
+        ring_push(bus, p, msg, len);
+    }
+    p->queued++;
+
+    pipe_flush(bus, p);
+    return 0;
+}
+
+
+/**
+ * Delivers whatever the attached readers can take.
+ *
+ * @param bus The alert bus.
+ */
+void alertbus_flush(struct alertbus *bus)
+{
+    for (int i = 0; i < ALERT_PIPES; i++) pipe_flush(bus, &bus->pipe[i]);
+}
+
+
+/**
+ * Logs the counters of every pipe.
+ *
+ * @param bus The alert bus.
+ */
+void alertbus_stats(const struct alertbus *bus)
+{
+    for (int i = 0; i < ALERT_PIPES; i++) {
+        const struct alert_pipe *p = &bus->pipe[i];
+        syslog(LOG_USER | LOG_INFO, "alert %s: queued %lu delivered %lu dropped %lu spilled %lu pending %zu+%lld bytes",
+               p->name, p->queued, p->delivered, p->dropped, p->spilled, p->count,
+               (long long)(p->spill_end - p->spill_off));
+        fprintf(stdout, "alert %s: queued %lu delivered %lu dropped %lu spilled %lu pending %zu+%lld bytes\n",
+                p->name, p->queued, p->delivered, p->dropped, p->spilled, p->count,
+                (long long)(p->spill_end - p->spill_off));
+    }
+    fflush(stdout);
+}
+
+
+/**
+ * Saves undelivered messages to the spill files and frees the rings.
+ *
+ * @param bus The alert bus.
+ */
+void alertbus_close(struct alertbus *bus)
+{
+    for (int i = 0; i < ALERT_PIPES; i++) {
+        struct alert_pipe *p = &bus->pipe[i];
+        if (p->ring != NULL && p->count > 0 && spill_save(bus, p) < 0) {
+            syslog(LOG_USER | LOG_ERR, "alert %s: %zu messages not delivered", p->name, p->count);
+        }
+        if (p->spill_fd >= 0) close(p->spill_fd);
+        free(p->ring);
+        p->ring = NULL;
+        p->spill_fd = -1;
+    }
+}
+
+
+/**
+ * Maps the [mnpd] alert_overflow setting to a policy.
+ *
+ * @param name block, drop-oldest or spill.
+ * @return The policy, or -1 if unknown.
+ */
+int alertbus_policy(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+        if (strcmp(name, policy_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+
+static void alertbus_tick(void *data)
+{
+    alertbus_flush(data);
+}
+
+
+static void pipe_flush(struct alertbus *bus, struct alert_pipe *p)
+{
+    char buf[ALERT_MSG_SIZE + 1];
+
+    if (p->count == 0) spill_read(bus, p);
+    if (p->count == 0) return;
+
+    /* ENXIO: nobody is reading, try again on the next tick */
+    int fd = open(p->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) return;
+
+    while (p->count > 0) {
+        struct alert_msg *m = &p->ring[p->head];
+        memcpy(buf, m->data, m->len);
+        buf[m->len] = '\n';
+
+        /* <= PIPE_BUF: all or nothing */
+        if (write(fd, buf, m->len + 1) != (ssize_t)(m->len + 1)) break;
+
+        p->head = (p->head + 1) % bus->cap;
+        p->count--;
+        p->delivered++;
+        if (p->count == 0) spill_read(bus, p);
+    }
+    close(fd);
+}
+
+
+static void ring_push(struct alertbus *bus, struct alert_pipe *p, const char *msg, size_t len)
+{
+    struct alert_msg *m = &p->ring[(p->head + p->count) % bus->cap];
+
+    memcpy(m->data, msg, len);
+    m->len = len;
+    p->count++;
+}
+
+
+static int spill_write(struct alert_pipe *p, const char *msg, size_t len)
+{
+    char buf[ALERT_MSG_SIZE + 1];
+
+    if (p->spill_fd == -1) p->spill_fd = open(p->spill, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (p->spill_fd == -1) {
+        syslog(LOG_USER | LOG_ERR, "error: open spill %s: %s", p->spill, strerror(errno));
+        return -1;
+    }
+
+    memcpy(buf, msg, len);
+    buf[len] = '\n';
+    if (pwrite(p->spill_fd, buf, len + 1, p->spill_end) != (ssize_t)(len + 1)) {
+        syslog(LOG_USER | LOG_ERR, "error: write spill %s: %s", p->spill, strerror(errno));
+        return -1;
+    }
+    if (p->spilled++ == 0) syslog(LOG_USER | LOG_ERR, "alert %s: ring full, spilling to %s", p->name, p->spill);
+    p->spill_end += len + 1;
+    return 0;
+}
+
+
+/* Moves spilled lines back into the ring, oldest first. */
+static void spill_read(struct alertbus *bus, struct alert_pipe *p)
+{
+    char buf[ALERT_RING_READ];
+
+    while (p->spill_end > p->spill_off && p->count < bus->cap) {
+        ssize_t n = pread(p->spill_fd, buf, sizeof(buf), p->spill_off);
+        if (n <= 0) {
+            syslog(LOG_USER | LOG_ERR, "error: read spill %s: %s", p->spill, n == 0 ? "truncated" : strerror(errno));
+            p->spill_end = p->spill_off;
+            break;
+        }
+
+        char *line = buf;
+        char *nl;
+        while (p->count < bus->cap && (nl = memchr(line, '\n', buf + n - line)) != NULL) {
+            if (nl - line < ALERT_MSG_SIZE) ring_push(bus, p, line, nl - line);
+            p->spill_off += nl - line + 1;
+            line = nl + 1;
+        }
+        if (line == buf) {
+            /* a line without newline: torn by a crash, skip it */
+            p->spill_off = p->spill_end;
+        }
+    }
+
+    if (p->spill_fd >= 0 && p->spill_off > 0 && p->spill_off >= p->spill_end) {
+        if (ftruncate(p->spill_fd, 0) == -1) {
+            syslog(LOG_USER | LOG_ERR, "error: truncate spill %s: %s", p->spill, strerror(errno));
+        }
+        p->spill_off = 0;
+        p->spill_end = 0;
+    }
+}
+
+
+/* Writes ring + unread spill to a new spill file, so nothing is lost on restart. */
+static int spill_save(struct alertbus *bus, struct alert_pipe *p)
+{
+    char buf[ALERT_RING_READ];
+    char *tmp = NULL;
+    int ok = 0;
+
+    if (asprintf(&tmp, "%s.%d", p->spill, getpid()) == -1) return -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) goto out;
+
+    for (size_t n = 0; n < p->count; n++) {
+        struct alert_msg *m = &p->ring[(p->head + n) % bus->cap];
+        memcpy(buf, m->data, m->len);
+        buf[m->len] = '\n';
+        if (write(fd, buf, m->len + 1) != (ssize_t)(m->len + 1)) goto out;
+    }
+    for (off_t off = p->spill_off; off < p->spill_end; ) {
+        ssize_t n = pread(p->spill_fd, buf, sizeof(buf), off);
+        if (n <= 0 || write(fd, buf, n) != n) goto out;
+        off += n;
+    }
+    ok = fsync(fd) == 0 && rename(tmp, p->spill) == 0;
+
+out:
+    if (!ok) syslog(LOG_USER | LOG_ERR, "error: save spill %s: %s", p->spill, strerror(errno));
+    if (fd >= 0) close(fd);
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,50 @@
+#ifndef ALERTBUS_H
+#define ALERTBUS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "globaldefs.h"
+#include "evloop.h"
+
+enum alert_overflow {
+    ALERT_BLOCK,
+    ALERT_DROP_OLDEST,
+    ALERT_SPILL,
+};
+
+struct alert_msg {
+    size_t len;
+    char data[ALERT_MSG_SIZE];
+};
+
+struct alert_pipe {
+    char name[ALERT_NAME_SIZE];
+    char path[FIFO_PATH_SIZE];
+    char spill[FIFO_PATH_SIZE];
+    struct alert_msg *ring;
+    size_t head;
+    size_t count;
+    int spill_fd;
+    off_t spill_off;
+    off_t spill_end;
+    unsigned long queued;
+    unsigned long delivered;
+    unsigned long dropped;
+    unsigned long spilled;
+};
+
+struct alertbus {
+    enum alert_overflow policy;
+    size_t cap;
+    struct alert_pipe pipe[ALERT_PIPES];
+};
+
+int alertbus_init(struct alertbus *bus, struct evloop *loop, const char *workdir,
+                  size_t cap, enum alert_overflow policy);
+int alertbus_post(struct alertbus *bus, const char *name, const char *msg);
+void alertbus_flush(struct alertbus *bus);
+void alertbus_stats(const struct alertbus *bus);
+void alertbus_close(struct alertbus *bus);
+int alertbus_policy(const char *name);
+
+#endif
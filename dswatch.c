@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "rpc_call.h"
+#include "dswatch.h"
+
+/*
+ * Double-spend watch of mnpd. mnp checks double_spend_seen once, when it
+ * hands a transfer over; with --notify-at 1 or a txpool [policy] tier
+ * that is before the transaction is mined, and a later double-spend
+ * attempt would go unseen.
+ *
+ * Every transfer mnpd gets with 0 confirmations is watched until it is
+ * ds_watch_depth blocks deep. At each main loop turn mnpd asks the
+ * wallet for all incoming and txpool transfers since the lowest height
+ * watched, one get_transfers call however many are open, and compares:
+ *
+ *   double_spend_seen  flips either way
+ *   state              txpool -> mined is expected, anything else
+ *                      (dropped from the txpool, back from mined) is not
+ *
+ * A flip is reported through the alert callback, which writes it to
+ * double_spend_alert. A transaction is only gone when two checks in a
+ * row miss it, and one gone for DS_WATCH_MAX seconds is given up.
+ */
+static struct dswatch_tx *find(struct dswatch *dw, const char *txid);
+static void drop(struct dswatch *dw, size_t i);
+static void scan(struct dswatch *dw, const cJSON *list, int state, char *hit);
+
+static const char *states[] = {
+    [DSWATCH_POOL]  = "pool",
+    [DSWATCH_MINED] = "mined",
+    [DSWATCH_GONE]  = "gone",
+};
+
+
+/**
+ * Sets up an empty watch.
+ *
+ * @param dw The watch.
+ * @param depth Confirmations until a transfer is no longer watched, 0 = off.
+ * @param alert Called for every flip.
+ */
+void dswatch_init(struct dswatch *dw, long long depth, void (*alert)(const struct dswatch_tx *tx))
+{
+    memset(dw, 0, sizeof(*dw));
+    dw->depth = depth;
+    dw->alert = alert;
+}
+
+
+/**
+ * Watches a transfer if it came without confirmation. Transfers of the
+ * same transaction share one entry, the first recipient is kept.
+ *
+ * @param dw The watch.
+ * @param event The transfer event.
+ * @param height Height of the chain when the transfer came, 0 if unknown.
+ * @return 1 if it is watched now, 0 if not, -1 on error.
+ */
+int dswatch_add(struct dswatch *dw, const cJSON *event, long long height)
+{
+    const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+    const char *address = cJSON_GetStringValue(cJSON_GetObjectItem(event, "address"));
+    const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+    const cJSON *confirmations = cJSON_GetObjectItem(event, "confirmations");
+
+    if (dw->depth <= 0 || txid == NULL) return 0;
+    if (cJSON_IsNumber(confirmations) && confirmations->valuedouble >= 1) return 0;
+    if (find(dw, txid) != NULL) return 1;
+
+    struct dswatch_tx *tx = realloc(dw->tx, (dw->count + 1) * sizeof(*tx));
+    if (tx == NULL) return -1;
+    dw->tx = tx;
+    tx = &dw->tx[dw->count];
+    memset(tx, 0, sizeof(*tx));
+    tx->txid = strdup(txid);
+    tx->recipient = strdup(payment_id != NULL && strcmp(payment_id, PAYNULL) != 0 ? payment_id :
+                           address != NULL ? address : "");
+    if (tx->txid == NULL || tx->recipient == NULL) {
+        free(tx->txid);
+        free(tx->recipient);
+        return -1;
+    }
+    tx->double_spend = cJSON_IsTrue(cJSON_GetObjectItem(event, "double_spend"));
+    tx->state = DSWATCH_POOL;
+    /* it was in the txpool at this height, it can only be mined later */
+    tx->since = height > 0 ? height : -1;
+    tx->added = time(NULL);
+    dw->count++;
+    if (verbose) syslog(LOG_USER | LOG_INFO, "dswatch: watching %s", txid);
+    return 1;
+}
+
+
+/**
+ * Asks the wallet for the watched transfers with one call and reports
+ * what flipped. Transfers deep enough are dropped.
+ *
+ * @param dw The watch.
+ * @param rpc The GET_TRANSFERS rpc of mnpd.
+ * @param height Current height of the chain.
+ * @return Number of flips, -1 if the wallet could not be asked.
+ */
+int dswatch_check(struct dswatch *dw, struct rpc_wallet *rpc, long long height)
+{
+    if (dw->count == 0) return 0;
+
+    long long low = -1;
+    for (size_t i = 0; i < dw->count; i++) {
+        /* height unknown when it came: a block may have been found meanwhile */
+        if (dw->tx[i].since < 0) dw->tx[i].since = height > 1 ? height - 1 : height;
+        if (dw->tx[i].since > 0 && (low < 0 || dw->tx[i].since < low)) low = dw->tx[i].since;
+    }
+    rpc->min_height = low > 0 ? low - 1 : 0;
+    if (rpc_call(rpc) < 0) {
+        /* rpc_call has freed the error part of it already */
+        rpc->reply = NULL;
+        return -1;
+    }
+    dw->checks++;
+
+    const cJSON *result = cJSON_GetObjectItem(rpc->reply, "result");
+    char *hit = calloc(dw->count, 1);
+    if (hit == NULL) {
+        cJSON_Delete(rpc->reply);
+        rpc->reply = NULL;
+        return -1;
+    }
+    unsigned long before = dw->alerts;
+    scan(dw, cJSON_GetObjectItem(result, "pool"), DSWATCH_POOL, hit);
+    scan(dw, cJSON_GetObjectItem(result, "in"), DSWATCH_MINED, hit);
+    cJSON_Delete(rpc->reply);
+    rpc->reply = NULL;
+
+    time_t now = time(NULL);
+    for (size_t i = dw->count; i-- > 0;) {
+        struct dswatch_tx *tx = &dw->tx[i];
+        /* one miss may be the wallet lagging behind, two are not */
+        if (hit[i]) tx->misses = 0;
+        else if (tx->state != DSWATCH_GONE && ++tx->misses >= 2) {
+            tx->state = DSWATCH_GONE;
+            dw->alerts++;
+            dw->alert(tx);
+        }
+        if ((tx->state == DSWATCH_MINED && tx->confirmations >= dw->depth) ||
+            (tx->state == DSWATCH_GONE && now - tx->added > DS_WATCH_MAX)) {
+            if (verbose) syslog(LOG_USER | LOG_INFO, "dswatch: done with %s (%s)", tx->txid, states[tx->state]);
+            drop(dw, i);
+        }
+    }
+    free(hit);
+    return (int)(dw->alerts - before);
+}
+
+
+/**
+ * Name of a watch state as used in events.
+ *
+ * @param state The state.
+ * @return The name.
+ */
+const char *dswatch_state_name(int state)
+{
+    if (state < DSWATCH_POOL || state > DSWATCH_GONE) return "unknown";
+    return states[state];
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param dw The watch.
+ */
+void dswatch_stats(const struct dswatch *dw)
+{
+    if (dw->depth <= 0) return;
+    syslog(LOG_USER | LOG_INFO, "dswatch: %zu watched, %lu checks, %lu alerts", dw->count, dw->checks, dw->alerts);
+    printf("dswatch: %zu watched, %lu checks, %lu alerts\n", dw->count, dw->checks, dw->alerts);
+    fflush(stdout);
+}
+
+
+/**
+ * Frees the watch. Open transfers are not watched after a restart.
+ *
+ * @param dw The watch.
+ */
+void dswatch_close(struct dswatch *dw)
+{
+    while (dw->count > 0) drop(dw, dw->count - 1);
+    free(dw->tx);
+    dw->tx = NULL;
+}
+
+
+/* the wallet lists a transaction once per transfer, any of them will do */
+static void scan(struct dswatch *dw, const cJSON *list, int state, char *hit)
+{
+    const cJSON *trans = NULL;
+
+    cJSON_ArrayForEach(trans, list) {
+        const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(trans, "txid"));
+        if (txid == NULL) continue;
+        struct dswatch_tx *tx = find(dw, txid);
+        if (tx == NULL || hit[tx - dw->tx]) continue;
+        hit[tx - dw->tx] = 1;
+
+        const cJSON *confirmations = cJSON_GetObjectItem(trans, "confirmations");
+        int double_spend = cJSON_IsTrue(cJSON_GetObjectItem(trans, "double_spend_seen"));
+        tx->confirmations = cJSON_IsNumber(confirmations) ? (long long)confirmations->valuedouble : 0;
+        int flipped = double_spend != tx->double_spend ||
+                      (state != tx->state && !(tx->state == DSWATCH_POOL && state == DSWATCH_MINED));
+        tx->double_spend = double_spend;
+        tx->state = state;
+        if (flipped) {
+            dw->alerts++;
+            dw->alert(tx);
+        }
+    }
+}
+
+
+static struct dswatch_tx *find(struct dswatch *dw, const char *txid)
+{
+    for (size_t i = 0; i < dw->count; i++) {
+        if (strcmp(dw->tx[i].txid, txid) == 0) return &dw->tx[i];
+    }
+    return NULL;
+}
+
+
+static void drop(struct dswatch *dw, size_t i)
+{
+    free(dw->tx[i].txid);
+    free(dw->tx[i].recipient);
+    dw->tx[i] = dw->tx[--dw->count];
+}
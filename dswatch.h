@@ -0,0 +1,42 @@
+#ifndef DSWATCH_H
+#define DSWATCH_H
+
+#include <stddef.h>
+#include <time.h>
+#include "./cjson/cJSON.h"
+#include "rpc_call.h"
+
+enum dswatch_state {
+    DSWATCH_POOL,
+    DSWATCH_MINED,
+    DSWATCH_GONE,
+};
+
+struct dswatch_tx {
+    char *txid;
+    char *recipient;
+    int double_spend;
+    int state;
+    long long confirmations;
+    long long since;
+    int misses;
+    time_t added;
+};
+
+struct dswatch {
+    struct dswatch_tx *tx;
+    size_t count;
+    long long depth;
+    void (*alert)(const struct dswatch_tx *tx);
+    unsigned long checks;
+    unsigned long alerts;
+};
+
+void dswatch_init(struct dswatch *dw, long long depth, void (*alert)(const struct dswatch_tx *tx));
+int dswatch_add(struct dswatch *dw, const cJSON *event, long long height);
+int dswatch_check(struct dswatch *dw, struct rpc_wallet *rpc, long long height);
+const char *dswatch_state_name(int state);
+void dswatch_stats(const struct dswatch *dw);
+void dswatch_close(struct dswatch *dw);
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "ed25519.h"
+
+/*
+ * Just enough of ed25519 to derive Monero subaddresses: point
+ * compression, addition and scalar multiplication, and the reduction
+ * of a hash modulo the group order l. No signatures.
+ *
+ * Field elements are 5 limbs of 51 bits, products go through 128 bit
+ * integers. Points are in extended coordinates (X:Y:Z:T) with
+ * x = X/Z, y = Y/Z, xy = T/Z; the addition formula is complete, so it
+ * doubles as well. Scalar multiplication adds on every bit and picks
+ * the result by mask, the time does not depend on the scalar.
+ * The reduction modulo l follows TweetNaCl (public domain).
+ */
+#define MASK51 ((1ULL << 51) - 1)
+
+/* field constants, filled in by init() */
+static uint64_t fe_d2[5];
+static uint64_t fe_sqrtm1[5];
+static uint64_t fe_dconst[5];
+static struct ed25519_point base;
+static int ready = 0;
+
+/* compressed base point, y = 4/5 */
+static const unsigned char base_y[ED25519_SIZE] = {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+};
+
+/* l = 2^252 + 27742317777372353535851937790883648493, little endian */
+static const int64_t L[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10,
+};
+
+static void init(void);
+static int decompress(struct ed25519_point *p, const unsigned char *s);
+static void fe_set(uint64_t *r, uint64_t v);
+static void fe_frombytes(uint64_t *r, const unsigned char *s);
+static void fe_tobytes(unsigned char *s, const uint64_t *a);
+static void fe_add(uint64_t *r, const uint64_t *a, const uint64_t *b);
+static void fe_sub(uint64_t *r, const uint64_t *a, const uint64_t *b);
+static void fe_mul(uint64_t *r, const uint64_t *a, const uint64_t *b);
+static void fe_pow(uint64_t *r, const uint64_t *a, const unsigned char *e);
+static int fe_iszero(const uint64_t *a);
+static int fe_isneg(const uint64_t *a);
+static void point_cmov(struct ed25519_point *r, const struct ed25519_point *p, uint64_t bit);
+static void modl(unsigned char *r, int64_t *x);
+
+
+/**
+ * Decompresses a point: y and the sign of x.
+ *
+ * @param p Set to the point.
+ * @param s ED25519_SIZE bytes.
+ * @return 0 on success, -1 if it is not on the curve.
+ */
+int ed25519_decompress(struct ed25519_point *p, const unsigned char *s)
+{
+    init();
+    return decompress(p, s);
+}
+
+
+/**
+ * Compresses a point.
+ *
+ * @param s Set to ED25519_SIZE bytes.
+ * @param p The point.
+ */
+void ed25519_compress(unsigned char *s, const struct ed25519_point *p)
+{
+    uint64_t zi[5], x[5], y[5];
+    unsigned char e[ED25519_SIZE];
+
+    /* 1 / Z = Z^(p - 2) */
+    memset(e, 0xff, sizeof(e));
+    e[0] = 0xeb;
+    e[31] = 0x7f;
+    fe_pow(zi, p->z, e);
+    fe_mul(x, p->x, zi);
+    fe_mul(y, p->y, zi);
+    fe_tobytes(s, y);
+    s[31] |= (unsigned char)(fe_isneg(x) << 7);
+}
+
+
+/**
+ * Adds two points. r may be p or q.
+ *
+ * @param r Set to p + q.
+ * @param p A point.
+ * @param q A point.
+ */
+void ed25519_add(struct ed25519_point *r, const struct ed25519_point *p, const struct ed25519_point *q)
+{
+    uint64_t a[5], b[5], c[5], d[5], e[5], f[5], g[5], h[5], t[5];
+
+    init();
+    fe_sub(a, p->y, p->x);
+    fe_sub(t, q->y, q->x);
+    fe_mul(a, a, t);
+    fe_add(b, p->y, p->x);
+    fe_add(t, q->y, q->x);
+    fe_mul(b, b, t);
+    fe_mul(c, p->t, q->t);
+    fe_mul(c, c, fe_d2);
+    fe_mul(d, p->z, q->z);
+    fe_add(d, d, d);
+    fe_sub(e, b, a);
+    fe_sub(f, d, c);
+    fe_add(g, d, c);
+    fe_add(h, b, a);
+    fe_mul(r->x, e, f);
+    fe_mul(r->y, g, h);
+    fe_mul(r->t, e, h);
+    fe_mul(r->z, f, g);
+}
+
+
+/**
+ * Multiplies a point by a scalar, in constant time.
+ *
+ * @param r Set to k * p.
+ * @param k ED25519_SIZE bytes, little endian.
+ * @param p The point.
+ */
+void ed25519_scalarmult(struct ed25519_point *r, const unsigned char *k, const struct ed25519_point *p)
+{
+    struct ed25519_point acc, sum;
+
+    memset(&acc, 0, sizeof(acc));
+    fe_set(acc.y, 1);
+    fe_set(acc.z, 1);
+    for (int i = 255; i >= 0; i--) {
+        ed25519_add(&acc, &acc, &acc);
+        ed25519_add(&sum, &acc, p);
+        point_cmov(&acc, &sum, (k[i / 8] >> (i & 7)) & 1);
+    }
+    *r = acc;
+}
+
+
+/**
+ * Multiplies the base point by a scalar.
+ *
+ * @param r Set to k * G.
+ * @param k ED25519_SIZE bytes, little endian.
+ */
+void ed25519_scalarmult_base(struct ed25519_point *r, const unsigned char *k)
+{
+    init();
+    ed25519_scalarmult(r, k, &base);
+}
+
+
+/**
+ * Reduces 32 bytes modulo l, sc_reduce32 of Monero.
+ *
+ * @param s ED25519_SIZE bytes, little endian, reduced in place.
+ */
+void ed25519_reduce(unsigned char *s)
+{
+    int64_t x[64];
+
+    for (int i = 0; i < 64; i++) x[i] = i < ED25519_SIZE ? s[i] : 0;
+    modl(s, x);
+}
+
+
+/**
+ * @param s ED25519_SIZE bytes, little endian.
+ * @return 1 if s is a reduced scalar, below l, 0 if not.
+ */
+int ed25519_scalar_valid(const unsigned char *s)
+{
+    for (int i = ED25519_SIZE - 1; i >= 0; i--) {
+        if (s[i] < L[i]) return 1;
+        if (s[i] > L[i]) return 0;
+    }
+    return 0;
+}
+
+
+/* d = -121665/121666, 2d, sqrt(-1) = 2^((p - 1) / 4) and the base point */
+static void init(void)
+{
+    uint64_t num[5], den[5], two[5];
+    unsigned char e[ED25519_SIZE];
+
+    if (__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) return;
+
+    uint64_t zero[5] = { 0 };
+    fe_set(num, 121665);
+    fe_sub(num, zero, num);
+    fe_set(den, 121666);
+    memset(e, 0xff, sizeof(e));
+    e[0] = 0xeb;
+    e[31] = 0x7f;
+    fe_pow(den, den, e);
+    fe_mul(fe_dconst, num, den);
+    fe_add(fe_d2, fe_dconst, fe_dconst);
+
+    memset(e, 0xff, sizeof(e));
+    e[0] = 0xfb;
+    e[31] = 0x1f;
+    fe_set(two, 2);
+    fe_pow(fe_sqrtm1, two, e);
+
+    decompress(&base, base_y);
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+
+/* ed25519_decompress without init(), init() needs it for the base point */
+static int decompress(struct ed25519_point *p, const unsigned char *s)
+{
+    uint64_t one[5], u[5], v[5], v3[5], x[5], check[5], t[5];
+    unsigned char e[ED25519_SIZE], raw[ED25519_SIZE], back[ED25519_SIZE];
+
+    fe_set(one, 1);
+    fe_frombytes(p->y, s);
+
+    /* y has to be canonical, below 2^255 - 19 */
+    memcpy(raw, s, ED25519_SIZE);
+    raw[31] &= 0x7f;
+    fe_tobytes(back, p->y);
+    if (memcmp(raw, back, ED25519_SIZE) != 0) return -1;
+
+    /* x^2 = (y^2 - 1) / (d y^2 + 1), x = u v^3 (u v^7)^((p - 5) / 8) */
+    fe_mul(u, p->y, p->y);
+    fe_mul(v, u, fe_dconst);
+    fe_sub(u, u, one);
+    fe_add(v, v, one);
+    fe_mul(v3, v, v);
+    fe_mul(v3, v3, v);
+    fe_mul(x, v3, v3);
+    fe_mul(x, x, v);
+    fe_mul(x, x, u);
+
+    memset(e, 0xff, sizeof(e));
+    e[0] = 0xfd;
+    e[31] = 0x0f;
+    fe_pow(x, x, e);
+    fe_mul(x, x, v3);
+    fe_mul(x, x, u);
+
+    fe_mul(check, x, x);
+    fe_mul(check, check, v);
+    fe_sub(t, check, u);
+    if (!fe_iszero(t)) {
+        fe_add(t, check, u);
+        if (!fe_iszero(t)) return -1;
+        fe_mul(x, x, fe_sqrtm1);
+    }
+    if (fe_iszero(x) && (s[31] >> 7)) return -1;
+    if (fe_isneg(x) != (s[31] >> 7)) {
+        uint64_t zero[5] = { 0 };
+        fe_sub(x, zero, x);
+    }
+
+    memcpy(p->x, x, sizeof(x));
+    fe_set(p->z, 1);
+    fe_mul(p->t, p->x, p->y);
+    return 0;
+}
+
+
+static void fe_set(uint64_t *r, uint64_t v)
+{
+    r[0] = v;
+    r[1] = r[2] = r[3] = r[4] = 0;
+}
+
+
+static void fe_frombytes(uint64_t *r, const unsigned char *s)
+{
+    uint64_t w[4];
+
+    for (int i = 0; i < 4; i++) {
+        w[i] = 0;
+        for (int j = 7; j >= 0; j--) w[i] = w[i] << 8 | s[8 * i + j];
+    }
+    r[0] = w[0] & MASK51;
+    r[1] = (w[0] >> 51 | w[1] << 13) & MASK51;
+    r[2] = (w[1] >> 38 | w[2] << 26) & MASK51;
+    r[3] = (w[2] >> 25 | w[3] << 39) & MASK51;
+    r[4] = (w[3] >> 12) & MASK51;
+}
+
+
+/* fully reduced, below 2^255 - 19 */
+static void fe_tobytes(unsigned char *s, const uint64_t *a)
+{
+    uint64_t t[5], w[4];
+
+    memcpy(t, a, sizeof(t));
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 4; i++) {
+            t[i + 1] += t[i] >> 51;
+            t[i] &= MASK51;
+        }
+        t[0] += 19 * (t[4] >> 51);
+        t[4] &= MASK51;
+    }
+    /* t < 2^255 now; subtract p if t >= p */
+    uint64_t q = (t[0] + 19) >> 51;
+    q = (t[1] + q) >> 51;
+    q = (t[2] + q) >> 51;
+    q = (t[3] + q) >> 51;
+    q = (t[4] + q) >> 51;
+    t[0] += 19 * q;
+    for (int i = 0; i < 4; i++) {
+        t[i + 1] += t[i] >> 51;
+        t[i] &= MASK51;
+    }
+    t[4] &= MASK51;
+
+    w[0] = t[0] | t[1] << 51;
+    w[1] = t[1] >> 13 | t[2] << 38;
+    w[2] = t[2] >> 26 | t[3] << 25;
+    w[3] = t[3] >> 39 | t[4] << 12;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 8; j++) s[8 * i + j] = (unsigned char)(w[i] >> (8 * j));
+    }
+}
+
+
+static void fe_add(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    for (int i = 0; i < 5; i++) r[i] = a[i] + b[i];
+}
+
+
+/* a + 2p - b, so no limb goes negative */
+static void fe_sub(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    r[0] = a[0] + 0xfffffffffffdaULL - b[0];
+    for (int i = 1; i < 5; i++) r[i] = a[i] + 0xffffffffffffeULL - b[i];
+    for (int i = 0; i < 4; i++) {
+        r[i + 1] += r[i] >> 51;
+        r[i] &= MASK51;
+    }
+    r[0] += 19 * (r[4] >> 51);
+    r[4] &= MASK51;
+}
+
+
+static void fe_mul(uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    unsigned __int128 t[5];
+    uint64_t b19[5];
+
+    for (int i = 1; i < 5; i++) b19[i] = 19 * b[i];
+    t[0] = (unsigned __int128)a[0] * b[0] + (unsigned __int128)a[1] * b19[4] + (unsigned __int128)a[2] * b19[3] +
+           (unsigned __int128)a[3] * b19[2] + (unsigned __int128)a[4] * b19[1];
+    t[1] = (unsigned __int128)a[0] * b[1] + (unsigned __int128)a[1] * b[0] + (unsigned __int128)a[2] * b19[4] +
+           (unsigned __int128)a[3] * b19[3] + (unsigned __int128)a[4] * b19[2];
+    t[2] = (unsigned __int128)a[0] * b[2] + (unsigned __int128)a[1] * b[1] + (unsigned __int128)a[2] * b[0] +
+           (unsigned __int128)a[3] * b19[4] + (unsigned __int128)a[4] * b19[3];
+    t[3] = (unsigned __int128)a[0] * b[3] + (unsigned __int128)a[1] * b[2] + (unsigned __int128)a[2] * b[1] +
+           (unsigned __int128)a[3] * b[0] + (unsigned __int128)a[4] * b19[4];
+    t[4] = (unsigned __int128)a[0] * b[4] + (unsigned __int128)a[1] * b[3] + (unsigned __int128)a[2] * b[2] +
+           (unsigned __int128)a[3] * b[1] + (unsigned __int128)a[4] * b[0];
+
+    for (int i = 0; i < 4; i++) {
+        t[i + 1] += (uint64_t)(t[i] >> 51);
+        t[i] &= MASK51;
+    }
+    uint64_t c = (uint64_t)(t[4] >> 51);
+    t[4] &= MASK51;
+    t[0] += (unsigned __int128)c * 19;
+    t[1] += (uint64_t)(t[0] >> 51);
+    t[0] &= MASK51;
+
+    for (int i = 0; i < 5; i++) r[i] = (uint64_t)t[i];
+}
+
+
+/* a^e, e little endian, square and multiply; e is public */
+static void fe_pow(uint64_t *r, const uint64_t *a, const unsigned char *e)
+{
+    uint64_t acc[5], base_[5];
+
+    memcpy(base_, a, sizeof(base_));
+    fe_set(acc, 1);
+    for (int i = 255; i >= 0; i--) {
+        fe_mul(acc, acc, acc);
+        if ((e[i / 8] >> (i & 7)) & 1) fe_mul(acc, acc, base_);
+    }
+    memcpy(r, acc, sizeof(acc));
+}
+
+
+static int fe_iszero(const uint64_t *a)
+{
+    unsigned char s[ED25519_SIZE];
+    unsigned char acc = 0;
+
+    fe_tobytes(s, a);
+    for (int i = 0; i < ED25519_SIZE; i++) acc |= s[i];
+    return acc == 0;
+}
+
+
+static int fe_isneg(const uint64_t *a)
+{
+    unsigned char s[ED25519_SIZE];
+
+    fe_tobytes(s, a);
+    return s[0] & 1;
+}
+
+
+static void point_cmov(struct ed25519_point *r, const struct ed25519_point *p, uint64_t bit)
+{
+    uint64_t mask = 0 - bit;
+
+    for (int i = 0; i < 5; i++) {
+        r->x[i] ^= mask & (r->x[i] ^ p->x[i]);
+        r->y[i] ^= mask & (r->y[i] ^ p->y[i]);
+        r->z[i] ^= mask & (r->z[i] ^ p->z[i]);
+        r->t[i] ^= mask & (r->t[i] ^ p->t[i]);
+    }
+}
+
+
+/* x (64 limbs of 8 bits) modulo l into 32 bytes */
+static void modl(unsigned char *r, int64_t *x)
+{
+    int64_t carry;
+    int i, j;
+
+    for (i = 63; i >= 32; --i) {
+        carry = 0;
+        for (j = i - 32; j < i - 12; ++j) {
+            x[j] += carry - 16 * x[i] * L[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+    carry = 0;
+    for (j = 0; j < 32; j++) {
+        x[j] += carry - (x[31] >> 4) * L[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; j++) x[j] -= carry * L[j];
+    for (i = 0; i < 32; i++) {
+        x[i + 1] += x[i] >> 8;
+        r[i] = (unsigned char)(x[i] & 255);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef ED25519_H
+#define ED25519_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ED25519_SIZE (32)
+
+struct ed25519_point {
+    uint64_t x[5];
+    uint64_t y[5];
+    uint64_t z[5];
+    uint64_t t[5];
+};
+
+int ed25519_decompress(struct ed25519_point *p, const unsigned char *s);
+void ed25519_compress(unsigned char *s, const struct ed25519_point *p);
+void ed25519_add(struct ed25519_point *r, const struct ed25519_point *p, const struct ed25519_point *q);
+void ed25519_scalarmult(struct ed25519_point *r, const unsigned char *k, const struct ed25519_point *p);
+void ed25519_scalarmult_base(struct ed25519_point *r, const unsigned char *k);
+void ed25519_reduce(unsigned char *s);
+int ed25519_scalar_valid(const unsigned char *s);
+
+#endif
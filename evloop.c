@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "evloop.h"
+
+/*
+ * Minimal epoll event loop used by mnpd. A source is a file descriptor
+ * plus handler, a tick is a handler called every interval_ms.
+ */
+
+
+/**
+ * Creates the epoll instance.
+ *
+ * @param loop The loop to initialise.
+ * @return 0 on success, -1 on error.
+ */
+int evloop_init(struct evloop *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return loop->epfd == -1 ? -1 : 0;
+}
+
+
+/**
+ * Watches a file descriptor.
+ *
+ * @param loop The event loop.
+ * @param src The source. Must stay valid until evloop_del().
+ * @param events EPOLLIN, EPOLLOUT, ...
+ * @return 0 on success, -1 on error.
+ */
+int evloop_add(struct evloop *loop, struct ev_source *src, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+
+int evloop_mod(struct evloop *loop, struct ev_source *src, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, src->fd, &ev);
+}
+
+
+int evloop_del(struct evloop *loop, struct ev_source *src)
+{
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+
+/**
+ * Registers a periodic handler.
+ *
+ * @param loop The event loop.
+ * @param interval_ms Interval in milliseconds.
+ * @param handler Function to call.
+ * @param data Passed to handler.
+ * @return 0 on success, -1 if all EVLOOP_MAX_TICKS are in use.
+ */
+int evloop_tick(struct evloop *loop, long long interval_ms, void (*handler)(void *data), void *data)
+{
+    if (loop->nticks >= EVLOOP_MAX_TICKS) return -1;
+
+    struct ev_tick *tick = &loop->tick[loop->nticks++];
+    tick->interval = interval_ms;
+    tick->due = evloop_now() + interval_ms;
+    tick->handler = handler;
+    tick->data = data;
+    return 0;
+}
+
+
+/**
+ * Dispatches events and ticks for timeout_ms milliseconds.
+ *
+ * @param loop The event loop.
+ * @param timeout_ms How long to run.
+ * @return 0 when the time is up, -1 if interrupted by a signal.
+ */
+int evloop_run(struct evloop *loop, long long timeout_ms)
+{
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    long long end = evloop_now() + timeout_ms;
+
+    for (;;) {
+        long long now = evloop_now();
+        long long wait = end - now;
+
+        for (int i = 0; i < loop->nticks; i++) {
+            struct ev_tick *tick = &loop->tick[i];
+            if (tick->due <= now) {
+                tick->handler(tick->data);
+                tick->due = now + tick->interval;
+            }
+            if (tick->due - now < wait) wait = tick->due - now;
+        }
+        if (now >= end) return 0;
+        if (wait < 0) wait = 0;
+
+        int n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, (int)wait);
+        if (n == -1) {
+            if (errno == EINTR) return -1;
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct ev_source *src = events[i].data.ptr;
+            src->handler(src, events[i].events);
+        }
+    }
+}
+
+
+/**
+ * Returns the monotonic clock in milliseconds.
+ */
+long long evloop_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+void evloop_close(struct evloop *loop)
+{
+    if (loop->epfd >= 0) close(loop->epfd);
+    loop->epfd = -1;
+}
@@ -0,0 +1,37 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+
+#define EVLOOP_MAX_TICKS  (16)
+#define EVLOOP_MAX_EVENTS (64)
+
+struct ev_source {
+    int fd;
+    void (*handler)(struct ev_source *src, uint32_t events);
+    void *data;
+};
+
+struct ev_tick {
+    long long interval;
+    long long due;
+    void (*handler)(void *data);
+    void *data;
+};
+
+struct evloop {
+    int epfd;
+    int nticks;
+    struct ev_tick tick[EVLOOP_MAX_TICKS];
+};
+
+int evloop_init(struct evloop *loop);
+int evloop_add(struct evloop *loop, struct ev_source *src, uint32_t events);
+int evloop_mod(struct evloop *loop, struct ev_source *src, uint32_t events);
+int evloop_del(struct evloop *loop, struct ev_source *src);
+int evloop_tick(struct evloop *loop, long long interval_ms, void (*handler)(void *data), void *data);
+int evloop_run(struct evloop *loop, long long timeout_ms);
+long long evloop_now(void);
+void evloop_close(struct evloop *loop);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Follows the mnpd event ring and prints one line per event.
+ *
+ * cc -O2 -o ringtail example/ringtail.c -I.
+ * ./ringtail /tmp/mywallet/.mnpd.ring
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mnp-ring.h"
+
+int main(int argc, char **argv)
+{
+    struct mnp_ring_reader r;
+    struct mnp_ring_event ev;
+    const char *path = argc > 1 ? argv[1] : "/tmp/mywallet/.mnpd.ring";
+
+    while (mnp_ring_open(&r, path) == -1) {
+        perror(path);
+        sleep(1);
+    }
+    if (argc > 2 && strcmp(argv[2], "-r") == 0) mnp_ring_rewind(&r);
+
+    for (;;) {
+        if (mnp_ring_next(&r, &ev, 1000) == 0) {
+            if (!mnp_ring_stale(&r)) continue;
+            mnp_ring_close(&r);
+            while (mnp_ring_open(&r, path) == -1) sleep(1);
+            continue;
+        }
+
+        printf("%llu %lld %s ", (unsigned long long)ev.id, (long long)ev.time, ev.type);
+        for (size_t i = 0; i < sizeof(ev.txid); i++) printf("%02x", ev.txid[i]);
+        printf(" %llu %u/%u conf=%u%s %s %s lost=%llu\n", (unsigned long long)ev.amount,
+               ev.account, ev.subaddr_index, ev.confirmations,
+               ev.flags & MNP_RING_DOUBLE_SPEND ? " double_spend" : "",
+               ev.payment_id, ev.address, (unsigned long long)r.lost);
+        fflush(stdout);
+    }
+}
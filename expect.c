@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "expect.h"
+
+/*
+ * .mnp.expect holds the payments mnp-payment has handed out: what
+ * amount is expected on which subaddress or payment id, and until
+ * when. It is an open-addressing hash table of fixed records, mapped
+ * by mnp-payment to register and by mnpd to match every transfer,
+ * so a verdict costs one probe and no process or database call.
+ *
+ * Every access holds an exclusive flock, registering is rare and a
+ * match updates the record. When 3/4 of the slots are used the table
+ * is rebuilt into a new file without the records that expired more
+ * than EXPECT_KEEP seconds ago, and renamed over the old one. Other
+ * processes notice the new inode and map it again.
+ *
+ * A payment may come in several transfers. Confirmed transfers are
+ * summed up in the record until the expected amount is reached; the
+ * last EXPECT_SEEN of them are remembered by a fingerprint of txid and
+ * amount, so a transfer handed over twice is not counted twice.
+ *
+ * Each record is an invoice with a lifecycle:
+ *
+ *   REQUEST -> WAITING -> COMPLETED
+ *      |          |
+ *      v          v
+ *   TIMEOUT     FAILED
+ *
+ * WAITING once a transfer is seen, COMPLETED when the sum is reached,
+ * TIMEOUT or FAILED (something, but not enough) when it expires. The
+ * state is mirrored into invoices/<name>, one line per invoice.
+ *
+ * key: kind (subaddress or payment id) and id, which is
+ *      account << 32 | subaddress index or the 8 byte payment id.
+ */
+static int expect_attach(struct expect *ex);
+static void expect_detach(struct expect *ex);
+static int expect_lock(struct expect *ex);
+static int expect_init(int fd, uint32_t slots);
+static struct expect_rec *expect_probe(struct expect_head *head, struct expect_rec *rec,
+                                       int kind, uint64_t id, int create);
+static int expect_rebuild(struct expect *ex);
+static uint64_t mix(uint64_t x);
+static uint64_t fingerprint(const char *txid, uint64_t amount);
+static void status_unlink(const struct expect *ex, const struct expect_rec *rec);
+
+static const char *verdicts[] = {
+    [VERDICT_UNKNOWN]    = "unknown",
+    [VERDICT_EXACT]      = "exact",
+    [VERDICT_UNDERPAID]  = "underpaid",
+    [VERDICT_OVERPAID]   = "overpaid",
+    [VERDICT_EXPIRED]    = "expired",
+    [VERDICT_UNEXPECTED] = "unexpected",
+    [VERDICT_DUPLICATE]  = "duplicate",
+};
+
+static const char *states[] = {
+    [EXPECT_REQUEST]   = "REQUEST",
+    [EXPECT_WAITING]   = "WAITING",
+    [EXPECT_COMPLETED] = "COMPLETED",
+    [EXPECT_TIMEOUT]   = "TIMEOUT",
+    [EXPECT_FAILED]    = "FAILED",
+};
+
+
+/**
+ * Opens (and creates if missing) the registry in the work directory.
+ *
+ * @param ex The registry handle to fill.
+ * @param workdir The work directory.
+ * @return 0 on success, -1 on error.
+ */
+int expect_open(struct expect *ex, const char *workdir)
+{
+    memset(ex, 0, sizeof(*ex));
+    ex->fd = -1;
+    asprintf(&ex->path, "%s/%s", workdir, EXPECT_FILE);
+    if (ex->path == NULL) return -1;
+
+    if (expect_attach(ex) < 0) {
+        free(ex->path);
+        ex->path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Builds the key of a payment.
+ *
+ * @param payment_id 16 hex characters, NULL or all zero for none.
+ * @param account Account of the subaddress.
+ * @param subaddr Subaddress index, used if there is no payment id.
+ * @param kind Set to EXPECT_PAYID or EXPECT_SUBADDR.
+ * @param id Set to the id.
+ * @return 0 on success, -1 if neither is valid.
+ */
+int expect_key(const char *payment_id, long account, long subaddr, int *kind, uint64_t *id)
+{
+    char *end = NULL;
+
+    if (payment_id != NULL && strcmp(payment_id, PAYNULL) != 0 && strlen(payment_id) == MAX_PAYID_SIZE) {
+        errno = 0;
+        *id = strtoull(payment_id, &end, 16);
+        if (errno == 0 && *end == '\0') {
+            *kind = EXPECT_PAYID;
+            return 0;
+        }
+    }
+    if (account < 0 || subaddr < 0 || account > UINT32_MAX || subaddr > UINT32_MAX) return -1;
+    *kind = EXPECT_SUBADDR;
+    *id = (uint64_t)account << 32 | (uint64_t)subaddr;
+    return 0;
+}
+
+
+/**
+ * Registers an expected payment. A payment registered before under the
+ * same key is replaced.
+ *
+ * @param ex The registry handle.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param amount Expected amount in atomic units.
+ * @param expires Time the payment is due, 0 = never.
+ * @return 0 on success, -1 on error.
+ */
+int expect_add(struct expect *ex, int kind, uint64_t id, uint64_t amount, time_t expires)
+{
+    if (expect_lock(ex) < 0) return -1;
+
+    if (ex->head->used * 4 >= (uint64_t)ex->head->slots * 3 && expect_rebuild(ex) < 0) {
+        flock(ex->fd, LOCK_UN);
+        return -1;
+    }
+
+    struct expect_rec *r = expect_probe(ex->head, ex->rec, kind, id, 1);
+    if (r == NULL) {
+        syslog(LOG_USER | LOG_ERR, "expected payments are full: %s", ex->path);
+        flock(ex->fd, LOCK_UN);
+        return -1;
+    }
+    r->state = EXPECT_REQUEST;
+    r->amount = amount;
+    r->received = 0;
+    r->transfers = 0;
+    memset(r->seen, 0, sizeof(r->seen));
+    r->created = time(NULL);
+    r->expires = expires;
+    msync(ex->head, ex->size, MS_ASYNC);
+
+    flock(ex->fd, LOCK_UN);
+    return 0;
+}
+
+
+/**
+ * Looks up an expected payment.
+ *
+ * @param ex The registry handle.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param out Set to the record.
+ * @return 1 if found, 0 if not, -1 on error.
+ */
+int expect_get(struct expect *ex, int kind, uint64_t id, struct expect_rec *out)
+{
+    if (expect_lock(ex) < 0) return -1;
+    struct expect_rec *r = expect_probe(ex->head, ex->rec, kind, id, 0);
+    if (r != NULL) *out = *r;
+    flock(ex->fd, LOCK_UN);
+    return r != NULL;
+}
+
+
+/**
+ * Matches a received transfer against the expected payment. A confirmed
+ * transfer is added to what has been received; once that reaches the
+ * expected amount the payment is COMPLETED. Any transfer moves a
+ * REQUEST to WAITING. The verdict is about the sum: underpaid means
+ * still missing.
+ *
+ * @param ex The registry handle.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param txid The txid of the transfer.
+ * @param amount Received amount in atomic units.
+ * @param confirmed 0 if the transfer is not in a block yet, it is not counted.
+ * @param out Set to the record after the match, may be NULL.
+ * @param changed Set to 1 if the state changed, may be NULL.
+ * @return The verdict, -1 on error.
+ */
+int expect_match(struct expect *ex, int kind, uint64_t id, const char *txid, uint64_t amount,
+                 int confirmed, struct expect_rec *out, int *changed)
+{
+    int verdict = -1;
+
+    if (changed != NULL) *changed = 0;
+    if (expect_lock(ex) < 0) return -1;
+
+    struct expect_rec *r = expect_probe(ex->head, ex->rec, kind, id, 0);
+    if (r == NULL) {
+        flock(ex->fd, LOCK_UN);
+        return VERDICT_UNKNOWN;
+    }
+
+    uint64_t fp = fingerprint(txid, amount);
+    for (uint32_t i = 0; i < EXPECT_SEEN && i < r->transfers; i++) {
+        if (r->seen[i] == fp) verdict = VERDICT_DUPLICATE;
+    }
+
+    if (verdict == VERDICT_DUPLICATE) {
+        /*NOP*/
+    } else if (r->state == EXPECT_COMPLETED) {
+        verdict = VERDICT_UNEXPECTED;
+    } else if (r->state == EXPECT_TIMEOUT || r->state == EXPECT_FAILED ||
+               (r->expires > 0 && time(NULL) > r->expires)) {
+        verdict = VERDICT_EXPIRED;
+    } else {
+        uint32_t from = r->state;
+        uint64_t total = r->received + amount;
+        if (total == r->amount) {
+            verdict = VERDICT_EXACT;
+        } else if (total < r->amount) {
+            verdict = VERDICT_UNDERPAID;
+        } else {
+            verdict = VERDICT_OVERPAID;
+        }
+        if (confirmed) {
+            r->received = total;
+            r->seen[r->transfers % EXPECT_SEEN] = fp;
+            r->transfers++;
+            if (verdict != VERDICT_UNDERPAID) r->state = EXPECT_COMPLETED;
+        }
+        if (r->state == EXPECT_REQUEST) r->state = EXPECT_WAITING;
+        if (changed != NULL) *changed = r->state != from;
+    }
+    if (out != NULL) *out = *r;
+
+    flock(ex->fd, LOCK_UN);
+    return verdict;
+}
+
+
+/**
+ * Takes a counted transfer back out of a payment, after a reorg dropped
+ * its block. What it added to the sum is subtracted and its fingerprint
+ * forgotten, so it counts again once it is mined. A COMPLETED or
+ * WAITING payment is open again: WAITING if something is left, REQUEST
+ * if not.
+ *
+ * @param ex The registry handle.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param txid The txid of the transfer.
+ * @param amount Its amount in atomic units.
+ * @param out Set to the record after the change.
+ * @return 1 if the transfer was counted and is taken out, 0 if it was not counted, -1 on error.
+ */
+int expect_revoke(struct expect *ex, int kind, uint64_t id, const char *txid, uint64_t amount,
+                  struct expect_rec *out)
+{
+    int ret = 0;
+
+    if (expect_lock(ex) < 0) return -1;
+
+    struct expect_rec *r = expect_probe(ex->head, ex->rec, kind, id, 0);
+    uint64_t fp = fingerprint(txid, amount);
+    for (uint32_t i = 0; r != NULL && i < EXPECT_SEEN && i < r->transfers; i++) {
+        if (r->seen[i] != fp) continue;
+        /* the last one counted takes its place in the ring */
+        uint32_t last = (r->transfers - 1) % EXPECT_SEEN;
+        r->seen[i] = r->seen[last];
+        r->seen[last] = 0;
+        r->transfers--;
+        r->received = r->received > amount ? r->received - amount : 0;
+        if (r->state == EXPECT_COMPLETED || r->state == EXPECT_WAITING) {
+            r->state = r->received > 0 ? EXPECT_WAITING : EXPECT_REQUEST;
+        }
+        *out = *r;
+        ret = 1;
+        break;
+    }
+
+    flock(ex->fd, LOCK_UN);
+    return ret;
+}
+
+
+/**
+ * Ends an invoice that is due: REQUEST becomes TIMEOUT, WAITING becomes
+ * FAILED. Nothing happens if it was registered again with another due
+ * time in the meantime, or is not open any more.
+ *
+ * @param ex The registry handle.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param due The due time the timer was set for.
+ * @param out Set to the record after the change.
+ * @return 1 if the state changed, 0 if not, -1 on error.
+ */
+int expect_expire(struct expect *ex, int kind, uint64_t id, time_t due, struct expect_rec *out)
+{
+    int ret = 0;
+
+    if (expect_lock(ex) < 0) return -1;
+
+    struct expect_rec *r = expect_probe(ex->head, ex->rec, kind, id, 0);
+    if (r != NULL && r->expires == due && (r->state == EXPECT_REQUEST || r->state == EXPECT_WAITING)) {
+        r->state = r->state == EXPECT_REQUEST ? EXPECT_TIMEOUT : EXPECT_FAILED;
+        *out = *r;
+        ret = 1;
+    }
+
+    flock(ex->fd, LOCK_UN);
+    return ret;
+}
+
+
+/**
+ * Copies the open invoices (REQUEST or WAITING) that have a due time.
+ *
+ * @param ex The registry handle.
+ * @param list Set to a malloc'd array of records.
+ * @param count Set to the number of records.
+ * @return 0 on success, -1 on error.
+ */
+int expect_pending(struct expect *ex, struct expect_rec **list, size_t *count)
+{
+    *list = NULL;
+    *count = 0;
+    if (expect_lock(ex) < 0) return -1;
+
+    *list = malloc(((size_t)ex->head->count + 1) * sizeof(struct expect_rec));
+    if (*list == NULL) {
+        flock(ex->fd, LOCK_UN);
+        return -1;
+    }
+    for (uint32_t i = 0; i < ex->head->slots; i++) {
+        const struct expect_rec *r = &ex->rec[i];
+        if (r->kind != EXPECT_SUBADDR && r->kind != EXPECT_PAYID) continue;
+        if (r->expires == 0 || (r->state != EXPECT_REQUEST && r->state != EXPECT_WAITING)) continue;
+        (*list)[(*count)++] = *r;
+    }
+
+    flock(ex->fd, LOCK_UN);
+    return 0;
+}
+
+
+/**
+ * Writes the status file of an invoice, replacing the old one:
+ * "STATE received expected transfers expires".
+ *
+ * @param workdir The work directory.
+ * @param rec The record.
+ * @return 0 on success, -1 on error.
+ */
+int expect_status(const char *workdir, const struct expect_rec *rec)
+{
+    char name[32];
+    char *path = NULL;
+    char *tmp = NULL;
+    int ret = -1;
+
+    expect_name(rec, name, sizeof(name));
+    if (asprintf(&path, "%s/%s/%s", workdir, INVOICE_DIR, name) == -1) return -1;
+    if (asprintf(&tmp, "%s.%d", path, (int)getpid()) == -1) {
+        free(path);
+        return -1;
+    }
+
+    FILE *f = fopen(tmp, "w");
+    if (f != NULL) {
+        fprintf(f, "%s %llu %llu %u %lld\n", expect_state_name(rec->state), (unsigned long long)rec->received,
+                (unsigned long long)rec->amount, rec->transfers, (long long)rec->expires);
+        if (fclose(f) == 0 && rename(tmp, path) == 0) ret = 0;
+    }
+    if (ret < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not write %s: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    return ret;
+}
+
+
+/**
+ * Name of an invoice: the payment id or account-index of the subaddress.
+ *
+ * @param rec The record.
+ * @param buf Output buffer.
+ * @param size Size of buf, 24 is enough.
+ */
+void expect_name(const struct expect_rec *rec, char *buf, size_t size)
+{
+    if (rec->kind == EXPECT_PAYID) {
+        snprintf(buf, size, "%016llx", (unsigned long long)rec->id);
+    } else {
+        snprintf(buf, size, "%u-%u", (unsigned)(rec->id >> 32), (unsigned)(rec->id & 0xffffffff));
+    }
+}
+
+
+/**
+ * Name of an invoice state, as in tests/create_db.sql.
+ *
+ * @param state The state.
+ * @return The name.
+ */
+const char *expect_state_name(int state)
+{
+    if (state < 0 || state > EXPECT_FAILED) return "UNKNOWN";
+    return states[state];
+}
+
+
+/**
+ * Name of a verdict as used in events.
+ *
+ * @param verdict The verdict.
+ * @return The name.
+ */
+const char *expect_verdict_name(int verdict)
+{
+    if (verdict < 0 || verdict > VERDICT_DUPLICATE) return "unknown";
+    return verdicts[verdict];
+}
+
+
+/**
+ * Unmaps and closes the registry.
+ *
+ * @param ex The registry handle.
+ */
+void expect_close(struct expect *ex)
+{
+    expect_detach(ex);
+    free(ex->path);
+    ex->path = NULL;
+}
+
+
+static int expect_attach(struct expect *ex)
+{
+    struct stat st;
+
+    ex->fd = open(ex->path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (ex->fd == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not open %s: %s", ex->path, strerror(errno));
+        return -1;
+    }
+
+    if (flock(ex->fd, LOCK_EX) == -1 || fstat(ex->fd, &st) == -1) goto error;
+    if (st.st_size < (off_t)sizeof(struct expect_head) && expect_init(ex->fd, EXPECT_SLOTS) < 0) goto error;
+
+    struct expect_head head;
+    if (pread(ex->fd, &head, sizeof(head), 0) != sizeof(head) || head.magic != EXPECT_MAGIC ||
+        head.version != EXPECT_VERSION) {
+        syslog(LOG_USER | LOG_ERR, "%s is not a table of expected payments", ex->path);
+        goto error;
+    }
+
+    ex->size = sizeof(struct expect_head) + (size_t)head.slots * sizeof(struct expect_rec);
+    ex->head = mmap(NULL, ex->size, PROT_READ | PROT_WRITE, MAP_SHARED, ex->fd, 0);
+    if (ex->head == MAP_FAILED) {
+        ex->head = NULL;
+        goto error;
+    }
+    ex->rec = (struct expect_rec *)(ex->head + 1);
+    ex->ino = st.st_ino;
+
+    flock(ex->fd, LOCK_UN);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not map %s: %s", ex->path, strerror(errno));
+    close(ex->fd);
+    ex->fd = -1;
+    return -1;
+}
+
+
+static void expect_detach(struct expect *ex)
+{
+    if (ex->head != NULL) munmap(ex->head, ex->size);
+    if (ex->fd >= 0) close(ex->fd);
+    ex->head = NULL;
+    ex->rec = NULL;
+    ex->fd = -1;
+}
+
+
+/* Takes the lock on the current table, mapping it again if it was rebuilt. */
+static int expect_lock(struct expect *ex)
+{
+    struct stat st;
+
+    for (;;) {
+        if (ex->fd < 0 && expect_attach(ex) < 0) return -1;
+        if (flock(ex->fd, LOCK_EX) == -1) return -1;
+        if (stat(ex->path, &st) == 0 && st.st_ino == ex->ino) return 0;
+        flock(ex->fd, LOCK_UN);
+        expect_detach(ex);
+    }
+}
+
+
+static int expect_init(int fd, uint32_t slots)
+{
+    struct expect_head head;
+
+    memset(&head, 0, sizeof(head));
+    head.magic = EXPECT_MAGIC;
+    head.version = EXPECT_VERSION;
+    head.slots = slots;
+
+    if (ftruncate(fd, sizeof(head) + (off_t)slots * sizeof(struct expect_rec)) == -1) return -1;
+    if (pwrite(fd, &head, sizeof(head), 0) != sizeof(head)) return -1;
+    return 0;
+}
+
+
+/*
+ * Linear probing. Finds the record of a key or, with create, claims
+ * a free slot for it. Returns NULL if not found or the table is full.
+ */
+static struct expect_rec *expect_probe(struct expect_head *head, struct expect_rec *rec,
+                                       int kind, uint64_t id, int create)
+{
+    uint32_t mask = head->slots - 1;
+    uint64_t hash = mix(id ^ ((uint64_t)kind << 56));
+
+    /* records are only dropped by expect_rebuild, a free slot ends the chain */
+    for (uint32_t i = 0; i < head->slots; i++) {
+        struct expect_rec *r = &rec[(hash + i) & mask];
+
+        if (r->kind == EXPECT_FREE) {
+            if (!create) return NULL;
+            memset(r, 0, sizeof(*r));
+            r->kind = kind;
+            r->id = id;
+            head->used++;
+            head->count++;
+            return r;
+        }
+        if (r->kind == (uint32_t)kind && r->id == id) return r;
+    }
+    return NULL;
+}
+
+
+/* Copies the live records into a new file of the right size. Called locked. */
+static int expect_rebuild(struct expect *ex)
+{
+    time_t cutoff = time(NULL) - EXPECT_KEEP;
+    uint64_t live = 0;
+
+    for (uint32_t i = 0; i < ex->head->slots; i++) {
+        const struct expect_rec *r = &ex->rec[i];
+        if ((r->kind == EXPECT_SUBADDR || r->kind == EXPECT_PAYID) && (r->expires == 0 || r->expires >= cutoff)) live++;
+    }
+
+    uint32_t slots = EXPECT_SLOTS;
+    while (live * 2 > slots && slots < (UINT32_C(1) << 31)) slots *= 2;
+
+    char *tmp = NULL;
+    asprintf(&tmp, "%s.%d", ex->path, (int)getpid());
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1 || flock(fd, LOCK_EX) == -1 || expect_init(fd, slots) < 0) goto error;
+
+    size_t size = sizeof(struct expect_head) + (size_t)slots * sizeof(struct expect_rec);
+    struct expect_head *head = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (head == MAP_FAILED) goto error;
+
+    struct expect_rec *rec = (struct expect_rec *)(head + 1);
+    for (uint32_t i = 0; i < ex->head->slots; i++) {
+        const struct expect_rec *r = &ex->rec[i];
+        if (r->kind != EXPECT_SUBADDR && r->kind != EXPECT_PAYID) continue;
+        if (r->expires != 0 && r->expires < cutoff) {
+            status_unlink(ex, r);
+            continue;
+        }
+        struct expect_rec *n = expect_probe(head, rec, r->kind, r->id, 1);
+        if (n != NULL) *n = *r;
+    }
+    munmap(head, size);
+
+    if (rename(tmp, ex->path) == -1) goto error;
+    free(tmp);
+    if (verbose) syslog(LOG_USER | LOG_INFO, "expected payments rebuilt: %llu entries, %u slots",
+                        (unsigned long long)live, slots);
+
+    /* continue on the new file, its lock is already held */
+    struct stat st;
+    expect_detach(ex);
+    ex->fd = fd;
+    if (fstat(fd, &st) == -1) {
+        expect_detach(ex);
+        return -1;
+    }
+    ex->size = size;
+    ex->ino = st.st_ino;
+    ex->head = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ex->head == MAP_FAILED) {
+        ex->head = NULL;
+        expect_detach(ex);
+        return -1;
+    }
+    ex->rec = (struct expect_rec *)(ex->head + 1);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not rebuild %s: %s", ex->path, strerror(errno));
+    if (fd != -1) close(fd);
+    unlink(tmp);
+    free(tmp);
+    return -1;
+}
+
+
+/* splitmix64 finalizer, ids are small integers or random */
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+
+/* FNV-1a over txid and amount, 0 is never returned */
+static uint64_t fingerprint(const char *txid, uint64_t amount)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (const char *c = txid != NULL ? txid : ""; *c; c++) {
+        h ^= (unsigned char)*c;
+        h *= 0x100000001b3ULL;
+    }
+    h = mix(h ^ amount);
+    return h != 0 ? h : 1;
+}
+
+
+/* removes the status file of an invoice dropped from the table */
+static void status_unlink(const struct expect *ex, const struct expect_rec *rec)
+{
+    char name[32];
+    char *path = NULL;
+
+    expect_name(rec, name, sizeof(name));
+    if (asprintf(&path, "%.*s%s/%s", (int)(strrchr(ex->path, '/') - ex->path + 1), ex->path, INVOICE_DIR, name) == -1) return;
+    unlink(path);
+    free(path);
+}
@@ -0,0 +1,81 @@
+#ifndef EXPECT_H
+#define EXPECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "globaldefs.h"
+
+enum expect_kind {
+    EXPECT_FREE,
+    EXPECT_SUBADDR,
+    EXPECT_PAYID,
+};
+
+enum expect_state {
+    EXPECT_REQUEST,
+    EXPECT_WAITING,
+    EXPECT_COMPLETED,
+    EXPECT_TIMEOUT,
+    EXPECT_FAILED,
+};
+
+enum expect_verdict {
+    VERDICT_UNKNOWN,
+    VERDICT_EXACT,
+    VERDICT_UNDERPAID,
+    VERDICT_OVERPAID,
+    VERDICT_EXPIRED,
+    VERDICT_UNEXPECTED,
+    VERDICT_DUPLICATE,
+};
+
+struct expect_head {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint64_t count;
+    uint64_t used;
+    uint64_t reserved[4];
+};
+
+struct expect_rec {
+    uint32_t kind;
+    uint32_t state;
+    uint64_t id;
+    uint64_t amount;
+    uint64_t received;
+    int64_t  created;
+    int64_t  expires;
+    uint32_t transfers;
+    uint32_t reserved;
+    uint64_t seen[EXPECT_SEEN];
+};
+
+struct expect {
+    int fd;
+    ino_t ino;
+    char *path;
+    size_t size;
+    struct expect_head *head;
+    struct expect_rec *rec;
+};
+
+int expect_open(struct expect *ex, const char *workdir);
+int expect_key(const char *payment_id, long account, long subaddr, int *kind, uint64_t *id);
+int expect_add(struct expect *ex, int kind, uint64_t id, uint64_t amount, time_t expires);
+int expect_get(struct expect *ex, int kind, uint64_t id, struct expect_rec *out);
+int expect_match(struct expect *ex, int kind, uint64_t id, const char *txid, uint64_t amount,
+                 int confirmed, struct expect_rec *out, int *changed);
+int expect_revoke(struct expect *ex, int kind, uint64_t id, const char *txid, uint64_t amount,
+                  struct expect_rec *out);
+int expect_expire(struct expect *ex, int kind, uint64_t id, time_t due, struct expect_rec *out);
+int expect_pending(struct expect *ex, struct expect_rec **list, size_t *count);
+int expect_status(const char *workdir, const struct expect_rec *rec);
+void expect_name(const struct expect_rec *rec, char *buf, size_t size);
+const char *expect_verdict_name(int verdict);
+const char *expect_state_name(int state);
+void expect_close(struct expect *ex);
+
+#endif
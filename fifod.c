@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "fifod.h"
+
+/*
+ * FIFO delivery server. Every transfer pipe is opened O_RDWR, which
+ * never blocks on Linux, and the payload is written into the pipe
+ * buffer right away. A reader attaching to the pipe is reported by
+ * inotify (IN_OPEN). Then mnpd closes its end, the reader gets the
+ * payload followed by EOF, and the pipe is unlinked - like the forked
+ * writer did before, but in one process.
+ *
+ * A reader that was already blocked in open() may attach before the
+ * watch exists. New entries are therefore also checked FIONREAD for a
+ * few sweeps: an empty pipe means the payload has been read. Entries
+ * without inotify watch (max_user_watches reached) are swept until
+ * delivered.
+ *
+ * All memory is allocated up front for fifo_max entries.
+ */
+static void fifod_inotify(struct ev_source *src, uint32_t events);
+static void fifod_sweep(void *data);
+static void fifod_finish(struct fifod *fifod, int idx, int remove);
+static void fifod_fork(struct fifod *fifod, const char *path, const char *payload);
+static void wdmap_put(struct fifod *fifod, int idx);
+static int wdmap_get(const struct fifod *fifod, int wd);
+static void wdmap_del(struct fifod *fifod, int wd);
+
+
+/**
+ * Sets up inotify and the entry table.
+ *
+ * @param fifod The delivery server.
+ * @param loop The event loop of mnpd.
+ * @param max Maximum number of outstanding pipes.
+ * @return 0 on success, -1 on error.
+ */
+int fifod_init(struct fifod *fifod, struct evloop *loop, size_t max)
+{
+    struct rlimit rl;
+
+    memset(fifod, 0, sizeof(*fifod));
+    fifod->loop = loop;
+    fifod->free = -1;
+
+    /* one descriptor per outstanding pipe */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < max + FIFOD_RESERVED_FD && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > max + FIFOD_RESERVED_FD) ?
+                          max + FIFOD_RESERVED_FD : rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (rl.rlim_cur < max + FIFOD_RESERVED_FD && rl.rlim_cur > 2 * FIFOD_RESERVED_FD) {
+            syslog(LOG_USER | LOG_ERR, "RLIMIT_NOFILE %lu limits fifo_max to %lu",
+                   (unsigned long)rl.rlim_cur, (unsigned long)(rl.rlim_cur - FIFOD_RESERVED_FD));
+            max = rl.rlim_cur - FIFOD_RESERVED_FD;
+        }
+    }
+
+    fifod->max = max;
+    for (fifod->mapsize = 64; fifod->mapsize < 2 * max; fifod->mapsize *= 2);
+
+    fifod->entry = calloc(max, sizeof(struct fifo_entry));
+    fifod->wdmap = calloc(fifod->mapsize, sizeof(int));
+    fifod->sweep = calloc(max, sizeof(int));
+    if (fifod->entry == NULL || fifod->wdmap == NULL || fifod->sweep == NULL) goto error;
+
+    for (size_t i = 0; i < max; i++) {
+        fifod->entry[i].fd = -1;
+        fifod->entry[i].wd = -1;
+        fifod->entry[i].next = (i + 1 < max) ? (int)i + 1 : -1;
+    }
+    fifod->free = max > 0 ? 0 : -1;
+
+    fifod->inotify.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    fifod->inotify.handler = fifod_inotify;
+    fifod->inotify.data = fifod;
+    if (fifod->inotify.fd == -1 || evloop_add(loop, &fifod->inotify, EPOLLIN) == -1) goto error;
+    if (evloop_tick(loop, FIFOD_SWEEP_MS, fifod_sweep, fifod) == -1) goto error;
+
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start fifo delivery: %s", strerror(errno));
+    fifod_close(fifod);
+    return -1;
+}
+
+
+/**
+ * Delivers "payload\n" to the next reader of a named pipe.
+ *
+ * @param fifod The delivery server.
+ * @param path Path of the named pipe.
+ * @param payload Content to deliver.
+ * @return 0 if queued, 1 if a writer was forked (table full), -1 on error.
+ */
+int fifod_deliver(struct fifod *fifod, const char *path, const char *payload)
+{
+    struct stat sb;
+
+    if (strlen(path) >= FIFO_PATH_SIZE || strlen(payload) + 1 > PIPE_BUF) return -1;
+
+    if (fifod->free < 0) {
+        fifod_fork(fifod, path, payload);
+        return 1;
+    }
+
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &sb) == -1 || !S_ISFIFO(sb.st_mode)) {
+        syslog(LOG_USER | LOG_ERR, "error: open fifo %s: %s", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    if (dprintf(fd, "%s\n", payload) < 0) {
+        syslog(LOG_USER | LOG_ERR, "error: write fifo %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    int idx = fifod->free;
+    struct fifo_entry *e = &fifod->entry[idx];
+    fifod->free = e->next;
+    fifod->used++;
+
+    e->fd = fd;
+    strcpy(e->path, path);
+    e->wd = inotify_add_watch(fifod->inotify.fd, path, IN_OPEN | IN_ATTRIB);
+    if (e->wd == -1) {
+        if (errno == ENOSPC) syslog(LOG_USER | LOG_ERR, "inotify max_user_watches reached, polling %s", path);
+        e->sweeps = -1;
+    } else {
+        wdmap_put(fifod, idx);
+        e->sweeps = FIFOD_SWEEPS;
+    }
+
+    if (!e->in_sweep) {
+        fifod->sweep[fifod->nsweep++] = idx;
+        e->in_sweep = 1;
+    }
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "named pipe fifo is up : %s", path);
+    return 0;
+}
+
+
+/**
+ * Closes every outstanding pipe and frees the table.
+ *
+ * @param fifod The delivery server.
+ */
+void fifod_close(struct fifod *fifod)
+{
+    if (fifod->entry != NULL) {
+        for (size_t i = 0; i < fifod->max; i++) {
+            if (fifod->entry[i].fd >= 0) close(fifod->entry[i].fd);
+        }
+    }
+    if (fifod->inotify.fd >= 0) close(fifod->inotify.fd);
+    free(fifod->entry);
+    free(fifod->wdmap);
+    free(fifod->sweep);
+    fifod->entry = NULL;
+    fifod->wdmap = NULL;
+    fifod->sweep = NULL;
+    fifod->inotify.fd = -1;
+}
+
+
+static void fifod_inotify(struct ev_source *src, uint32_t events)
+{
+    struct fifod *fifod = src->data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct stat sb;
+    ssize_t len;
+
+    while ((len = read(src->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            int idx = wdmap_get(fifod, ev->wd);
+            if (idx < 0) continue;
+
+            struct fifo_entry *e = &fifod->entry[idx];
+            if (ev->mask & IN_OPEN) {
+                /* a reader is attached */
+                fifod_finish(fifod, idx, 1);
+            } else if ((ev->mask & IN_ATTRIB) && fstat(e->fd, &sb) == 0 && sb.st_nlink == 0) {
+                /* somebody else removed the pipe */
+                fifod_finish(fifod, idx, 0);
+            } else if (ev->mask & IN_IGNORED) {
+                wdmap_del(fifod, e->wd);
+                e->wd = -1;
+                e->sweeps = -1;
+                if (!e->in_sweep) {
+                    fifod->sweep[fifod->nsweep++] = idx;
+                    e->in_sweep = 1;
+                }
+            }
+        }
+    }
+}
+
+
+/* Checks new and unwatched pipes for a reader that has emptied them. */
+static void fifod_sweep(void *data)
+{
+    struct fifod *fifod = data;
+    size_t keep = 0;
+
+    for (size_t i = 0; i < fifod->nsweep; i++) {
+        int idx = fifod->sweep[i];
+        struct fifo_entry *e = &fifod->entry[idx];
+        int queued = 0;
+
+        if (e->fd >= 0 && ioctl(e->fd, FIONREAD, &queued) == 0 && queued == 0) fifod_finish(fifod, idx, 1);
+
+        if (e->fd < 0 || e->sweeps == 0 || (e->sweeps > 0 && --e->sweeps == 0)) {
+            e->in_sweep = 0;
+            continue;
+        }
+        fifod->sweep[keep++] = idx;
+    }
+    fifod->nsweep = keep;
+}
+
+
+static void fifod_finish(struct fifod *fifod, int idx, int remove)
+{
+    struct fifo_entry *e = &fifod->entry[idx];
+
+    if (e->wd >= 0) {
+        wdmap_del(fifod, e->wd);
+        inotify_rm_watch(fifod->inotify.fd, e->wd);
+        e->wd = -1;
+    }
+
+    close(e->fd);
+    e->fd = -1;
+    if (remove && unlink(e->path) == -1 && errno != ENOENT) {
+        syslog(LOG_USER | LOG_ERR, "error: unlink fifo %s: %s", e->path, strerror(errno));
+    }
+    if (verbose) syslog(LOG_USER | LOG_INFO, "named pipe fifo delivered : %s", e->path);
+
+    e->next = fifod->free;
+    fifod->free = idx;
+    fifod->used--;
+    fifod->delivered++;
+}
+
+
+/* Table is full: fall back to a blocking writer process. */
+static void fifod_fork(struct fifod *fifod, const char *path, const char *payload)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        syslog(LOG_USER | LOG_ERR, "error: fork: %s", strerror(errno));
+    } else if (pid == 0) {
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd == -1 || dprintf(fd, "%s\n", payload) < 0) _exit(EXIT_FAILURE);
+        unlink(path);
+        close(fd);
+        _exit(EXIT_SUCCESS);
+    } else {
+        if (fifod->forked++ == 0) syslog(LOG_USER | LOG_ERR, "fifo_max %zu reached, forking writers", fifod->max);
+    }
+}
+
+
+/*
+ * wd -> entry index. Open addressing with linear probing, deletion
+ * shifts the following cluster back so no tombstones are needed.
+ */
+static void wdmap_put(struct fifod *fifod, int idx)
+{
+    size_t mask = fifod->mapsize - 1;
+    size_t i = (size_t)fifod->entry[idx].wd & mask;
+
+    while (fifod->wdmap[i] != 0) i = (i + 1) & mask;
+    fifod->wdmap[i] = idx + 1;
+}
+
+
+static int wdmap_get(const struct fifod *fifod, int wd)
+{
+    size_t mask = fifod->mapsize - 1;
+
+    for (size_t i = (size_t)wd & mask; fifod->wdmap[i] != 0; i = (i + 1) & mask) {
+        if (fifod->entry[fifod->wdmap[i] - 1].wd == wd) return fifod->wdmap[i] - 1;
+    }
+    return -1;
+}
+
+
+static void wdmap_del(struct fifod *fifod, int wd)
+{
+    size_t mask = fifod->mapsize - 1;
+    size_t i = (size_t)wd & mask;
+
+    while (fifod->wdmap[i] != 0 && fifod->entry[fifod->wdmap[i] - 1].wd != wd) i = (i + 1) & mask;
+    if (fifod->wdmap[i] == 0) return;
+
+    fifod->wdmap[i] = 0;
+    for (size_t j = (i + 1) & mask; fifod->wdmap[j] != 0; j = (j + 1) & mask) {
+        size_t home = (size_t)fifod->entry[fifod->wdmap[j] - 1].wd & mask;
+        /* move j back into the hole if its home is not in (i, j] */
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            fifod->wdmap[i] = fifod->wdmap[j];
+            fifod->wdmap[j] = 0;
+            i = j;
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef FIFOD_H
+#define FIFOD_H
+
+#include <stddef.h>
+#include "globaldefs.h"
+#include "evloop.h"
+
+struct fifo_entry {
+    int fd;
+    int wd;
+    int next;
+    int sweeps;
+    int in_sweep;
+    char path[FIFO_PATH_SIZE];
+};
+
+struct fifod {
+    struct evloop *loop;
+    struct ev_source inotify;
+    struct fifo_entry *entry;
+    int *wdmap;
+    int *sweep;
+    size_t nsweep;
+    size_t max;
+    size_t mapsize;
+    size_t used;
+    int free;
+    unsigned long delivered;
+    unsigned long forked;
+};
+
+int fifod_init(struct fifod *fifod, struct evloop *loop, size_t max);
+int fifod_deliver(struct fifod *fifod, const char *path, const char *payload);
+void fifod_close(struct fifod *fifod);
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "hex.h"
+#include "pending.h"
+#include "txindex.h"
+#include "txpath.h"
+#include "gc.h"
+
+/*
+ * Garbage collector of mnpd. Every GC_SCAN_MS the transactions tree is
+ * read, GC_SCAN_BUDGET entries per tick, and two kinds of transaction
+ * directories are queued:
+ *
+ *   delivered: no pipe left (mnpd unlinks a pipe once it is read),
+ *              untouched for gc_retention seconds.
+ *   expired:   pipes nobody read within gc_expire seconds, and no
+ *              running mnp is tracking the txid. This includes pipes
+ *              whose mnp died before it handed the payment to mnpd.
+ *
+ * The queue is worked off in the tick with unlinkat(2) relative to
+ * directory fds, at most gc_rate removals per second, so a large
+ * backlog never stalls the event loop. Shard directories are kept,
+ * there are at most 65536 of them. Directories changed after the scan
+ * are left for the next one.
+ *
+ * The scan keeps one open directory per level and resumes where the
+ * last tick stopped, so a tree of 100k transactions never stalls the
+ * pipes, subscribers or invoice timers for the whole walk.
+ *
+ * The txid index is compacted to txid_retention once per GC_COMPACT_MS,
+ * in a child process: it copies the whole index.
+ */
+static void gc_tick(void *data);
+static void scan_start(struct gc *gc);
+static void scan_step(struct gc *gc);
+static int descend(struct gc *gc, const char *name);
+static void ascend(struct gc *gc);
+static void compact(struct gc *gc);
+static size_t consider(struct gc *gc, int dfd, const char *rel, const char *name, time_t now);
+static int sweep(struct gc *gc, const char *rel, long *budget);
+static void load_live(struct gc *gc);
+static int is_live(const struct gc *gc, const char *txid);
+static int cmp_txid(const void *a, const void *b);
+
+
+/**
+ * Opens the transactions tree and starts the collector tick.
+ *
+ * @param gc The collector.
+ * @param loop Event loop of mnpd.
+ * @param workdir The work directory.
+ * @param layout Layout of the transactions tree.
+ * @param retention Seconds a delivered transaction directory is kept.
+ * @param expire Seconds an unread pipe is kept, 0 = forever.
+ * @param rate Max. removals per second, 0 = no limit.
+ * @param txid_age Seconds a txid stays in the index, 0 = forever.
+ * @return 0 on success, -1 on error.
+ */
+int gc_init(struct gc *gc, struct evloop *loop, const char *workdir, int layout,
+            time_t retention, time_t expire, long rate, time_t txid_age)
+{
+    char *txdir = NULL;
+
+    memset(gc, 0, sizeof(*gc));
+    gc->loop = loop;
+    gc->levels = txpath_shards(layout);
+    gc->retention = retention;
+    gc->expire = expire;
+    gc->rate = rate;
+    gc->txid_age = txid_age;
+    gc->depth = -1;
+    gc->next_scan = evloop_now() + GC_SCAN_MS;
+    gc->next_compact = evloop_now() + GC_COMPACT_MS;
+
+    if (asprintf(&txdir, "%s/%s", workdir, TRANSACTION_DIR) == -1) return -1;
+    gc->txfd = open(txdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (gc->txfd == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not open %s: %s", txdir, strerror(errno));
+        free(txdir);
+        return -1;
+    }
+    free(txdir);
+
+    gc->workdir = strdup(workdir);
+    if (gc->workdir == NULL || evloop_tick(loop, GC_TICK_MS, gc_tick, gc) < 0) {
+        gc_close(gc);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param gc The collector.
+ */
+void gc_stats(const struct gc *gc)
+{
+    if (gc->workdir == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "gc: %lu scans, removed %lu dirs %lu pipes, kept %lu tracked, queued %zu",
+           gc->scans, gc->dirs, gc->pipes, gc->kept, gc->nqueue - gc->next);
+    printf("gc: %lu scans, removed %lu dirs %lu pipes, kept %lu tracked, queued %zu\n",
+           gc->scans, gc->dirs, gc->pipes, gc->kept, gc->nqueue - gc->next);
+    fflush(stdout);
+}
+
+
+/**
+ * Frees the collector. Queued directories are left for the next start.
+ *
+ * @param gc The collector.
+ */
+void gc_close(struct gc *gc)
+{
+    if (gc->workdir == NULL) return;
+    while (gc->depth >= 0) ascend(gc);
+    for (size_t i = gc->next; i < gc->nqueue; i++) free(gc->queue[i]);
+    free(gc->queue);
+    free(gc->live);
+    free(gc->workdir);
+    close(gc->txfd);
+    gc->queue = NULL;
+    gc->live = NULL;
+    gc->workdir = NULL;
+    gc->txfd = -1;
+}
+
+
+static void gc_tick(void *data)
+{
+    struct gc *gc = data;
+    long long now = evloop_now();
+    int status;
+
+    /* hooks may have reaped it already, waitpid then fails with ECHILD */
+    if (gc->compactor > 0 && waitpid(gc->compactor, &status, WNOHANG) != 0) gc->compactor = 0;
+
+    if (gc->depth >= 0) scan_step(gc);
+
+    if (gc->next >= gc->nqueue) {
+        if (gc->depth >= 0) return;
+        if (now >= gc->next_compact) {
+            gc->next_compact = now + GC_COMPACT_MS;
+            compact(gc);
+        }
+        if (now >= gc->next_scan) {
+            gc->next_scan = now + GC_SCAN_MS;
+            scan_start(gc);
+        }
+        return;
+    }
+
+    /* token bucket in 1/1000 removals, at most one second of burst */
+    long budget = LONG_MAX;
+    if (gc->rate > 0) {
+        gc->credit += (long long)gc->rate * GC_TICK_MS;
+        if (gc->credit > gc->rate * 1000LL) gc->credit = gc->rate * 1000LL;
+        budget = gc->credit / 1000;
+    }
+    long start = budget;
+    while (budget > 0 && gc->next < gc->nqueue) {
+        if (sweep(gc, gc->queue[gc->next], &budget) == 1) break;
+        free(gc->queue[gc->next]);
+        gc->queue[gc->next++] = NULL;
+        gc->started = 0;
+    }
+    if (gc->rate > 0) gc->credit -= (start - budget) * 1000LL;
+
+    if (gc->next >= gc->nqueue) {
+        free(gc->queue);
+        gc->queue = NULL;
+        gc->nqueue = 0;
+        gc->next = 0;
+    }
+}
+
+
+static void scan_start(struct gc *gc)
+{
+    gc->scanned = time(NULL);
+    gc->scans++;
+    load_live(gc);
+    if (descend(gc, ".") == 0) scan_step(gc);
+}
+
+
+/* reads the tree on from where the last tick stopped, GC_SCAN_BUDGET entries at most */
+static void scan_step(struct gc *gc)
+{
+    long budget = GC_SCAN_BUDGET;
+
+    while (gc->depth >= 0 && budget > 0) {
+        struct dirent *de = readdir(gc->dir[gc->depth]);
+        if (de == NULL) {
+            ascend(gc);
+            continue;
+        }
+        if (de->d_name[0] == '.') continue;
+        budget--;
+        if (gc->depth < gc->levels) {
+            if (txpath_is_hex(de->d_name, TX_SHARD_WIDTH)) descend(gc, de->d_name);
+        } else if (txpath_is_hex(de->d_name, MAX_TXID_SIZE)) {
+            budget -= (long)consider(gc, dirfd(gc->dir[gc->depth]), gc->rel[gc->depth], de->d_name, gc->scanned);
+        }
+    }
+    if (gc->depth < 0 && verbose && gc->nqueue > gc->next) {
+        syslog(LOG_USER | LOG_INFO, "gc: %zu transaction dirs to remove", gc->nqueue - gc->next);
+    }
+}
+
+
+/* opens a directory one level below the current one, "." is the transactions directory */
+static int descend(struct gc *gc, const char *name)
+{
+    int parent = gc->depth < 0 ? gc->txfd : dirfd(gc->dir[gc->depth]);
+    char *rel = NULL;
+
+    if (gc->depth >= gc->levels) return -1;
+    if (gc->depth < 0 ? (rel = strdup(name)) == NULL : asprintf(&rel, "%s/%s", gc->rel[gc->depth], name) == -1) {
+        return -1;
+    }
+    int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *d = fd == -1 ? NULL : fdopendir(fd);
+    if (d == NULL) {
+        if (fd != -1) close(fd);
+        free(rel);
+        return -1;
+    }
+    gc->depth++;
+    gc->dir[gc->depth] = d;
+    gc->rel[gc->depth] = rel;
+    return 0;
+}
+
+
+static void ascend(struct gc *gc)
+{
+    closedir(gc->dir[gc->depth]);
+    free(gc->rel[gc->depth]);
+    gc->dir[gc->depth] = NULL;
+    gc->rel[gc->depth] = NULL;
+    gc->depth--;
+}
+
+
+/* compacts the txid index in a child, it copies every slot */
+static void compact(struct gc *gc)
+{
+    struct txidx idx;
+
+    if (gc->txid_age == 0 || gc->compactor > 0) return;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        syslog(LOG_USER | LOG_ERR, "gc: fork: %s", strerror(errno));
+    } else if (pid == 0) {
+        if (txidx_open(&idx, gc->workdir) < 0) _exit(EXIT_FAILURE);
+        int ret = txidx_compact(&idx, gc->txid_age);
+        txidx_close(&idx);
+        _exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+    } else {
+        gc->compactor = pid;
+    }
+}
+
+
+/* queues a transaction directory if it is delivered or expired, returns the entries it read */
+static size_t consider(struct gc *gc, int dfd, const char *rel, const char *name, time_t now)
+{
+    struct stat sb;
+    size_t entries = 0;
+
+    int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return 0;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return 0;
+    }
+    time_t newest = sb.st_mtime;
+
+    DIR *d = fdopendir(fd);
+    if (d == NULL) {
+        close(fd);
+        return 0;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        entries++;
+        if (fstatat(fd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && sb.st_ctime > newest) newest = sb.st_ctime;
+    }
+    closedir(d);
+
+    /* without the pending journal there is no telling which pipes are tracked */
+    if (entries > 0 && gc->live == NULL) return entries;
+
+    time_t limit = entries > 0 ? gc->expire : gc->retention;
+    if (limit == 0 || now - newest < limit) return entries;
+    if (is_live(gc, name)) {
+        gc->kept++;
+        return entries;
+    }
+
+    char **q = realloc(gc->queue, (gc->nqueue + 1) * sizeof(char *));
+    if (q == NULL) return entries;
+    gc->queue = q;
+    if (asprintf(&gc->queue[gc->nqueue], "%s/%s", rel, name) == -1) return entries;
+    gc->nqueue++;
+    return entries;
+}
+
+
+/*
+ * Removes the pipes of a queued directory and then the directory,
+ * one unlinkat per budget unit.
+ * Returns 1 if the budget ran out before, 0 when the entry is done.
+ */
+static int sweep(struct gc *gc, const char *rel, long *budget)
+{
+    struct stat sb;
+
+    int fd = openat(gc->txfd, rel, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return 0;
+    if (!gc->started) {
+        /* our own unlinks change it as well, so only before the first one */
+        if (fstat(fd, &sb) == -1 || sb.st_mtime > gc->scanned) {
+            close(fd);
+            return 0;
+        }
+        gc->started = 1;
+    }
+
+    DIR *d = fdopendir(fd);
+    if (d == NULL) {
+        close(fd);
+        return 0;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        if (*budget <= 0) {
+            closedir(d);
+            return 1;
+        }
+        (*budget)--;
+        if (unlinkat(fd, de->d_name, 0) == 0) {
+            gc->pipes++;
+        } else if (errno != ENOENT) {
+            syslog(LOG_USER | LOG_ERR, "gc: could not remove %s/%s: %s", rel, de->d_name, strerror(errno));
+        }
+    }
+    closedir(d);
+
+    if (*budget <= 0) return 1;
+    (*budget)--;
+    if (unlinkat(gc->txfd, rel, AT_REMOVEDIR) == 0) {
+        gc->dirs++;
+        if (verbose) syslog(LOG_USER | LOG_INFO, "gc: removed %s/%s", TRANSACTION_DIR, rel + 2);
+    } else if (errno != ENOENT && errno != ENOTEMPTY) {
+        syslog(LOG_USER | LOG_ERR, "gc: could not remove %s: %s", rel, strerror(errno));
+    }
+    return 0;
+}
+
+
+/* txids a running mnp is tracking, sorted */
+static void load_live(struct gc *gc)
+{
+    struct pending_rec *recs = NULL;
+    size_t count = 0;
+
+    free(gc->live);
+    gc->live = NULL;
+    gc->nlive = 0;
+    if (pending_replay(gc->workdir, &recs, &count) < 0) return;
+
+    gc->live = malloc((count + 1) * TXID_BIN_SIZE);
+    if (gc->live != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            if (recs[i].pid <= 0 || (kill(recs[i].pid, 0) == -1 && errno == ESRCH)) continue;
+            memcpy(gc->live[gc->nlive++], recs[i].txid, TXID_BIN_SIZE);
+        }
+        qsort(gc->live, gc->nlive, TXID_BIN_SIZE, cmp_txid);
+    }
+    free(recs);
+}
+
+
+static int is_live(const struct gc *gc, const char *txid)
+{
+    unsigned char bin[TXID_BIN_SIZE];
+
+    if (hex2bin(txid, bin, TXID_BIN_SIZE) < 0) return 0;
+    return bsearch(bin, gc->live, gc->nlive, TXID_BIN_SIZE, cmp_txid) != NULL;
+}
+
+
+static int cmp_txid(const void *a, const void *b)
+{
+    return memcmp(a, b, TXID_BIN_SIZE);
+}
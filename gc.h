@@ -0,0 +1,46 @@
+#ifndef GC_H
+#define GC_H
+
+#include <dirent.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include "globaldefs.h"
+#include "txindex.h"
+#include "evloop.h"
+
+struct gc {
+    struct evloop *loop;
+    char *workdir;
+    int txfd;
+    int levels;
+    time_t retention;
+    time_t expire;
+    time_t txid_age;
+    long rate;
+    long long credit;
+    char **queue;
+    size_t nqueue;
+    size_t next;
+    int started;
+    time_t scanned;
+    int depth;
+    DIR *dir[TX_SHARD_LEVELS + 1];
+    char *rel[TX_SHARD_LEVELS + 1];
+    pid_t compactor;
+    unsigned char (*live)[TXID_BIN_SIZE];
+    size_t nlive;
+    long long next_scan;
+    long long next_compact;
+    unsigned long scans;
+    unsigned long dirs;
+    unsigned long pipes;
+    unsigned long kept;
+};
+
+int gc_init(struct gc *gc, struct evloop *loop, const char *workdir, int layout,
+            time_t retention, time_t expire, long rate, time_t txid_age);
+void gc_stats(const struct gc *gc);
+void gc_close(struct gc *gc);
+
+#endif
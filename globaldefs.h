@@ -11,6 +11,99 @@
 #define DEBUG           (0)
 #define CONFIG_FILE     ".mnp.ini"
 #define TMP_TXID_FILE   ".mnp.txid"
+#define TXID_INDEX_FILE ".mnp.txidx"
+#define TXIDX_MAGIC     (0x3178646974706e6dULL)
+#define TXIDX_SLOTS     (1 << 16)
+#define EXPECT_FILE     ".mnp.expect"
+#define EXPECT_MAGIC    (0x7463657078706e6dULL)
+#define EXPECT_SLOTS    (1 << 12)
+#define EXPECT_EXPIRE   (2 * 60 * 60)
+#define EXPECT_KEEP     (7 * 86400)
+#define EXPECT_VERSION  (3)
+#define EXPECT_SEEN     (8)
+#define INVOICE_DIR     "invoices"
+#define INVOICE_TICK_MS (1000)
+#define TXID_RETENTION  (30)
+#define PENDING_FILE    ".mnp.pending"
+#define PENDING_SNAP_FILE ".mnp.pending.snap"
+#define PENDING_SNAP_SIZE (4096)
+#define IPC_SOCKET      ".mnpd.sock"
+#define IPC_TIMEOUT     (1)
+#define IPC_MAX_MSG     (MAX_DATA_SIZE)
+#define IPC_RCVBUF      (1 << 20)
+#define FIFO_MAX        (100000)
+#define FIFO_PATH_SIZE  (256)
+#define FIFOD_SWEEPS    (3)
+#define FIFOD_SWEEP_MS  (1000)
+#define FIFOD_RESERVED_FD (64)
+#define ALERT_PIPES     (3)
+#define ALERT_RING      (1024)
+#define ALERT_MSG_SIZE  (256)
+#define ALERT_NAME_SIZE (32)
+#define ALERT_POLL_MS   (100)
+#define ALERT_RING_READ (16 * ALERT_MSG_SIZE)
+#define ALERT_SPILL_FILE ".mnp.spill"
+#define JOURNAL_DIR     "journal"
+#define JOURNAL_CONSUMERS "consumers"
+#define JOURNAL_SEGMENT (4 << 20)
+#define JOURNAL_MAX_BYTES (256ULL << 20)
+#define JOURNAL_RETENTION (7)
+#define JOURNAL_SYNC_MS (1000)
+#define JOURNAL_RETRIES (3)
+#define JOURNAL_MAX_REC (1 << 20)
+#define JOURNAL_SUFFIX  ".log"
+#define PUB_SOCKET      ".mnpd.pub"
+#define PUB_MAX_SUBS    (64)
+#define PUB_QUEUE       (1024)
+#define PUB_MAX_FILTER  (1024)
+#define PUB_MAX_TYPES   (8)
+#define SHM_RING_FILE   ".mnpd.ring"
+#define SHM_RING_MAX    (1 << 20)
+#define WEBHOOK_MAX_URLS (4)
+#define WEBHOOK_MAX_SOCKS (4 * WEBHOOK_MAX_URLS)
+#define WEBHOOK_BATCH   (100)
+#define WEBHOOK_WINDOW  (200)
+#define WEBHOOK_TIMEOUT (10)
+#define WEBHOOK_MAX_BODY (1 << 20)
+#define WEBHOOK_POLL_MS (20)
+#define WEBHOOK_BACKOFF_MS (1000)
+#define WEBHOOK_BACKOFF_MAX_MS (60000)
+#define WEBHOOK_CONSUMER "webhook"
+#define HOOK_WORKERS    (4)
+#define HOOK_QUEUE      (1024)
+#define HOOK_TIMEOUT    (60)
+#define HOOK_RETRIES    (3)
+#define HOOK_TEMPFAIL   (75)
+#define HOOK_MAX_ARGS   (32)
+#define HOOK_POLL_MS    (100)
+#define HOOK_KILL_MS    (5000)
+#define HOOK_BACKOFF_MS (1000)
+#define GC_RETENTION    (86400)
+#define GC_EXPIRE       (7 * 86400)
+#define GC_RATE         (1000)
+#define DS_WATCH_DEPTH  (10)
+#define DS_WATCH_MAX    (86400)
+#define REORG_FILE      ".mnp.confirmed"
+#define REORG_DEPTH     (60)
+#define ADDR_POOL_FILE  ".mnp.addrpool"
+#define SUBADDR_FILE    ".mnp.subaddr"
+#define SUBADDR_LOOKAHEAD (200)
+#define ADDR_POOL_MAX   (200)
+#define ADDR_POOL_BATCH (64)
+#define PAYMENT_BATCH   (256)
+#define BATCH_ADDR_MAX  (1000)
+#define PAY_SOCKET      ".mnp-payment.sock"
+#define PAY_MAX_CLIENTS (64)
+#define PAY_MAX_LINE    (4096)
+#define SUBADDR_CACHE   (1024)
+#define GC_TICK_MS      (100)
+#define GC_SCAN_BUDGET  (1000)
+#define GC_SCAN_MS      (60000)
+#define GC_COMPACT_MS   (3600000)
+#define TRASH_SUFFIX    ".trash."
+#define LISTEN_TIMEOUT  (125 * 60)
+#define LISTEN_LINGER   (60)
+#define LISTEN_TICK_MS  (1000)
 #define TXID_PIPE       "txid"
 #define DS_ALERT_PIPE   "double_spend_alert"
 #define RPC_CONN_ALERT  "rpc_connection_alert"
@@ -37,6 +130,37 @@ struct Config {
     const char  *cfg_workdir;
     const char  *cfg_mode;
     const char  *cfg_pipe;
+    const char  *cfg_retention;
+    const char  *cfg_layout;
+    const char  *mnpd_fifo_max;
+    const char  *mnpd_alert_ring;
+    const char  *mnpd_alert_overflow;
+    const char  *mnpd_journal_segment;
+    const char  *mnpd_journal_max_bytes;
+    const char  *mnpd_journal_retention;
+    const char  *mnpd_pub_max_subscribers;
+    const char  *mnpd_pub_queue;
+    const char  *mnpd_shm_ring;
+    const char  *mnpd_webhook_url;
+    const char  *mnpd_webhook_batch;
+    const char  *mnpd_webhook_window;
+    const char  *mnpd_webhook_timeout;
+    const char  *mnpd_hook_cmd;
+    const char  *mnpd_hook_types;
+    const char  *mnpd_hook_workers;
+    const char  *mnpd_hook_queue;
+    const char  *mnpd_hook_timeout;
+    const char  *mnpd_hook_retries;
+    const char  *mnpd_gc_retention;
+    const char  *mnpd_gc_expire;
+    const char  *mnpd_gc_rate;
+    const char  *mnpd_ledger;
+    const char  *mnpd_ds_watch_depth;
+    const char  *mnpd_daemon;
+    const char  *mnpd_reorg_depth;
+    const char  *mnpd_addr_pool;
+    const char  *mnppayment_address;
+    const char  *mnppayment_view_key;
 };
 
 enum notify {
@@ -59,17 +183,35 @@ enum notify {
 
 #define GET_TXID_CMD    "get_transfer_by_txid"
 #define GET_PAYMENT_CMD "get_bulk_payments"
+#define GET_TRANSFERS_CMD "get_transfers"
 
 #define SPEND_PROOF_CMD "check_spend_proof"
 #define TX_PROOF_CMD    "check_tx_proof"
 
 #define TRANSACTION_DIR "transactions"
+#define TX_SHARD_LEVELS (2)
+#define TX_SHARD_WIDTH  (2)
+
+#define EV_TRANSFER     "transfer"
+#define EV_ALERT        "alert"
+#define EV_TXID         "txid"
+#define EV_DOUBLE_SPEND "double_spend"
+#define EV_RPC_ALERT    "rpc_alert"
+#define EV_OVERFLOW     "overflow"
+#define EV_PROGRESS     "progress"
+#define EV_PAID         "paid-in-full"
+#define EV_INVOICE      "invoice"
+#define EV_REORG        "reorg"
+#define EV_REVOKED      "revoked"
 
 #define PAYNULL         "0000000000000000"
 #define NOPARAMS        NULL
 #define CONTENT_TYPE    "Content-Type: application/json"
 #define JSON_RPC        "2.0"
 #define POLL_INTERVAL   (5)
+#define SPENDABLE_AGE   (10)
+#define MAX_BLOCK_NUM   (500000000)
+#define UNLOCK_DELTA    (120)
 #define RES_TIMEOUT     (10)
 #define CONNECTTIMEOUT  (5)
 #endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include "hex.h"
+
+
+/**
+ * Converts a hex string into binary.
+ *
+ * @param hex The hex string, exactly 2 * size characters.
+ * @param bin Output buffer of size bytes.
+ * @param size Number of bytes to convert.
+ * @return 0 on success, -1 on invalid input.
+ */
+int hex2bin(const char *hex, unsigned char *bin, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        unsigned int byte;
+        if (hex[2 * i] == '\0' || hex[2 * i + 1] == '\0') return -1;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return -1;
+        bin[i] = (unsigned char)byte;
+    }
+    return 0;
+}
+
+
+/**
+ * Converts binary into a lower case hex string.
+ *
+ * @param bin Input buffer of size bytes.
+ * @param size Number of bytes to convert.
+ * @param hex Output buffer of at least 2 * size + 1 characters.
+ */
+void bin2hex(const unsigned char *bin, size_t size, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[bin[i] >> 4];
+        hex[2 * i + 1] = digits[bin[i] & 0x0f];
+    }
+    hex[2 * size] = '\0';
+}
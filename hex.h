@@ -0,0 +1,9 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+
+int hex2bin(const char *hex, unsigned char *bin, size_t size);
+void bin2hex(const unsigned char *bin, size_t size, char *hex);
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "evloop.h"
+#include "hooks.h"
+
+extern char **environ;
+
+/*
+ * Exec hooks of mnpd. A fixed number of workers run the configured
+ * command once per event, further events wait in a bounded queue.
+ * The command is started with posix_spawn, without a shell, gets the
+ * event as one JSON line on stdin and its fields as MNP_* variables,
+ * e.g. MNP_TYPE, MNP_TXID, MNP_AMOUNT, MNP_FIFO.
+ *
+ * Exit code 0 is success. EX_TEMPFAIL (75), death by a signal and a
+ * timeout are retried with backoff up to hook_retries times, other
+ * exit codes are logged as failed. Each handler runs in its own
+ * process group so a timeout also stops what it started.
+ *
+ * Workers are reaped through a pidfd in the event loop. Other children
+ * of mnpd, the forked fifo writers, are reaped by the tick.
+ */
+
+static void on_exit_fd(struct ev_source *src, uint32_t events);
+static void on_tick(void *data);
+static void dispatch(struct hooks *h);
+static int spawn(struct hooks *h, struct hook_worker *w, struct hook_job *job);
+static void finish(struct hook_worker *w, int status);
+static char **make_env(const char *line, int attempt);
+static void free_env(char **env);
+
+
+/**
+ * Starts the hook workers.
+ *
+ * @param h The hooks.
+ * @param loop Event loop of mnpd.
+ * @param cmd Command and arguments, separated by blanks.
+ * @param types Comma separated event types to run for, NULL or "" = all.
+ * @param workers Max. handlers running at once.
+ * @param qlen Max. events waiting for a worker.
+ * @param timeout Seconds a handler may run, 0 = no limit.
+ * @param retries Retries of a handler that failed temporarily.
+ * @return 0 on success, -1 on error.
+ */
+int hooks_init(struct hooks *h, struct evloop *loop, const char *cmd, const char *types,
+               size_t workers, size_t qlen, long timeout, int retries)
+{
+    char *save = NULL;
+
+    memset(h, 0, sizeof(*h));
+    h->loop = loop;
+    h->nworkers = workers > 0 ? workers : HOOK_WORKERS;
+    h->qlen = qlen > 0 ? qlen : HOOK_QUEUE;
+    h->timeout = timeout * 1000LL;
+    h->retries = retries;
+
+    h->argv = calloc(HOOK_MAX_ARGS + 1, sizeof(char *));
+    h->worker = calloc(h->nworkers, sizeof(struct hook_worker));
+    h->queue = calloc(h->qlen, sizeof(struct hook_job));
+    h->retry = calloc(h->qlen, sizeof(struct hook_job));
+    char *args = strdup(cmd);
+    if (h->argv == NULL || h->worker == NULL || h->queue == NULL || h->retry == NULL || args == NULL) {
+        free(args);
+        goto error;
+    }
+
+    int argc = 0;
+    for (char *arg = strtok_r(args, " \t", &save); arg != NULL && argc < HOOK_MAX_ARGS;
+         arg = strtok_r(NULL, " \t", &save)) {
+        h->argv[argc++] = strdup(arg);
+    }
+    free(args);
+    if (argc == 0) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (types != NULL) {
+        char *list = strdup(types);
+        for (char *t = strtok_r(list, ", ", &save); t != NULL && h->ntypes < PUB_MAX_TYPES;
+             t = strtok_r(NULL, ", ", &save)) {
+            snprintf(h->type[h->ntypes++], sizeof(h->type[0]), "%s", t);
+        }
+        free(list);
+    }
+
+    for (size_t i = 0; i < h->nworkers; i++) {
+        h->worker[i].src.fd = -1;
+        h->worker[i].src.handler = on_exit_fd;
+        h->worker[i].src.data = &h->worker[i];
+        h->worker[i].hooks = h;
+    }
+
+    if (evloop_tick(loop, HOOK_POLL_MS, on_tick, h) < 0) goto error;
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "hooks are up : %s with %zu workers", cmd, h->nworkers);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start hook %s: %s", cmd, strerror(errno));
+    hooks_close(h);
+    return -1;
+}
+
+
+/**
+ * Queues an event for the handler.
+ *
+ * @param h The hooks.
+ * @param event The event.
+ * @param line The event serialised.
+ */
+void hooks_post(struct hooks *h, const cJSON *event, const char *line)
+{
+    if (h->argv == NULL) return;
+
+    if (h->ntypes > 0) {
+        const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(event, "type"));
+        int found = 0;
+        for (int i = 0; type != NULL && i < h->ntypes && !found; i++) found = strcmp(type, h->type[i]) == 0;
+        if (!found) return;
+    }
+
+    if (h->count == h->qlen) {
+        if (h->gap++ == 0) syslog(LOG_USER | LOG_ERR, "hook queue of %zu is full, dropping events", h->qlen);
+        h->dropped++;
+        return;
+    }
+    if (h->gap > 0) {
+        syslog(LOG_USER | LOG_ERR, "hook queue: %lu events dropped", h->gap);
+        h->gap = 0;
+    }
+
+    struct hook_job *job = &h->queue[(h->head + h->count) % h->qlen];
+    job->line = strdup(line);
+    job->attempt = 0;
+    job->due = 0;
+    if (job->line == NULL) return;
+    h->count++;
+
+    dispatch(h);
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param h The hooks.
+ */
+void hooks_stats(const struct hooks *h)
+{
+    if (h->argv == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "hook %s: started %lu done %lu failed %lu retried %lu timeouts %lu dropped %lu"
+           " running %zu queued %zu", h->argv[0], h->started, h->done, h->failed, h->retried, h->timeouts,
+           h->dropped, h->running, h->count + h->nretry);
+    printf("hook %s: started %lu done %lu failed %lu retried %lu timeouts %lu dropped %lu running %zu queued %zu\n",
+           h->argv[0], h->started, h->done, h->failed, h->retried, h->timeouts, h->dropped, h->running,
+           h->count + h->nretry);
+    fflush(stdout);
+}
+
+
+/**
+ * Frees the hooks. Running handlers are left to finish, queued events
+ * are given up; they are still in the journal.
+ *
+ * @param h The hooks.
+ */
+void hooks_close(struct hooks *h)
+{
+    if (h->count + h->nretry > 0) {
+        syslog(LOG_USER | LOG_ERR, "hook: %zu queued events not run", h->count + h->nretry);
+    }
+    for (size_t i = 0; h->worker != NULL && i < h->nworkers; i++) {
+        struct hook_worker *w = &h->worker[i];
+        if (w->src.fd >= 0) {
+            evloop_del(h->loop, &w->src);
+            close(w->src.fd);
+        }
+        free(w->job.line);
+    }
+    for (size_t i = 0; i < h->count; i++) free(h->queue[(h->head + i) % h->qlen].line);
+    for (size_t i = 0; i < h->nretry; i++) free(h->retry[i].line);
+    for (size_t i = 0; h->argv != NULL && h->argv[i] != NULL; i++) free(h->argv[i]);
+    free(h->argv);
+    free(h->worker);
+    free(h->queue);
+    free(h->retry);
+    memset(h, 0, sizeof(*h));
+}
+
+
+static void on_exit_fd(struct ev_source *src, uint32_t events)
+{
+    struct hook_worker *w = src->data;
+    int status;
+    (void)events;
+
+    if (w->pid > 0 && waitpid(w->pid, &status, WNOHANG) == w->pid) {
+        finish(w, status);
+        dispatch(w->hooks);
+    }
+}
+
+
+/* reaps, enforces timeouts and starts retries that are due */
+static void on_tick(void *data)
+{
+    struct hooks *h = data;
+    long long now = evloop_now();
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < h->nworkers; i++) {
+            if (h->worker[i].pid == pid) {
+                finish(&h->worker[i], status);
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < h->nworkers; i++) {
+        struct hook_worker *w = &h->worker[i];
+        if (w->pid <= 0 || w->deadline == 0 || now < w->deadline) continue;
+        if (!w->killed) {
+            syslog(LOG_USER | LOG_ERR, "hook %s: pid %d timed out after %lld s",
+                   h->argv[0], (int)w->pid, h->timeout / 1000);
+            kill(-w->pid, SIGTERM);
+            w->killed = 1;
+            w->deadline = now + HOOK_KILL_MS;
+            h->timeouts++;
+        } else {
+            kill(-w->pid, SIGKILL);
+            w->deadline = 0;
+        }
+    }
+
+    dispatch(h);
+}
+
+
+/* Hands queued events to idle workers; retries that are due go first. */
+static void dispatch(struct hooks *h)
+{
+    long long now = evloop_now();
+
+    while (h->running < h->nworkers) {
+        struct hook_job job;
+        size_t i = 0;
+
+        while (i < h->nretry && h->retry[i].due > now) i++;
+        if (i < h->nretry) {
+            job = h->retry[i];
+            h->retry[i] = h->retry[--h->nretry];
+        } else if (h->count > 0) {
+            job = h->queue[h->head];
+            h->head = (h->head + 1) % h->qlen;
+            h->count--;
+        } else {
+            return;
+        }
+
+        struct hook_worker *w = h->worker;
+        while (w->pid > 0) w++;
+        if (spawn(h, w, &job) < 0) {
+            h->failed++;
+            free(job.line);
+        }
+    }
+}
+
+
+static int spawn(struct hooks *h, struct hook_worker *w, struct hook_job *job)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t all, none;
+    int p[2];
+    pid_t pid;
+
+    char **env = make_env(job->line, job->attempt);
+    if (env == NULL || pipe2(p, O_CLOEXEC) == -1) {
+        syslog(LOG_USER | LOG_ERR, "hook %s: %s", h->argv[0], strerror(errno));
+        free_env(env);
+        return -1;
+    }
+
+    /* handlers start with default signals, mnpd ignores SIGPIPE and SIGCHLD */
+    sigfillset(&all);
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, p[0], STDIN_FILENO);
+
+    int ret = posix_spawnp(&pid, h->argv[0], &fa, &attr, h->argv, env);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    free_env(env);
+    close(p[0]);
+
+    if (ret != 0) {
+        syslog(LOG_USER | LOG_ERR, "hook %s: could not start: %s", h->argv[0], strerror(ret));
+        close(p[1]);
+        return -1;
+    }
+
+    /* an event is far below the pipe buffer, this does not block */
+    fcntl(p[1], F_SETFL, O_NONBLOCK);
+    if (write(p[1], job->line, strlen(job->line)) < 0 || write(p[1], "\n", 1) < 0) {
+        if (DEBUG) syslog(LOG_USER | LOG_DEBUG, "hook %s: stdin: %s", h->argv[0], strerror(errno));
+    }
+    close(p[1]);
+
+    w->pid = pid;
+    w->job = *job;
+    w->started = evloop_now();
+    w->deadline = h->timeout > 0 ? w->started + h->timeout : 0;
+    w->killed = 0;
+    h->running++;
+    h->started++;
+
+    w->src.fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (w->src.fd >= 0 && evloop_add(h->loop, &w->src, EPOLLIN) < 0) {
+        close(w->src.fd);
+        w->src.fd = -1;
+    }
+    /* without a pidfd the tick reaps it */
+    return 0;
+}
+
+
+static void finish(struct hook_worker *w, int status)
+{
+    struct hooks *h = w->hooks;
+    int temporary = w->killed || WIFSIGNALED(status) ||
+                    (WIFEXITED(status) && WEXITSTATUS(status) == HOOK_TEMPFAIL);
+
+    if (w->src.fd >= 0) {
+        evloop_del(h->loop, &w->src);
+        close(w->src.fd);
+        w->src.fd = -1;
+    }
+    h->running--;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && !w->killed) {
+        h->done++;
+        if (verbose) syslog(LOG_USER | LOG_INFO, "hook %s: pid %d done in %lld ms",
+                            h->argv[0], (int)w->pid, evloop_now() - w->started);
+        free(w->job.line);
+    } else if (temporary && w->job.attempt < h->retries && h->nretry < h->qlen) {
+        struct hook_job *job = &h->retry[h->nretry++];
+        *job = w->job;
+        job->attempt++;
+        job->due = evloop_now() + ((long long)HOOK_BACKOFF_MS << (job->attempt < 6 ? job->attempt - 1 : 5));
+        h->retried++;
+        syslog(LOG_USER | LOG_ERR, "hook %s: pid %d %s %d, retry %d of %d", h->argv[0], (int)w->pid,
+               WIFSIGNALED(status) ? "killed by signal" : "exit", WIFSIGNALED(status) ?
+               WTERMSIG(status) : WEXITSTATUS(status), job->attempt, h->retries);
+    } else {
+        h->failed++;
+        syslog(LOG_USER | LOG_ERR, "hook %s: pid %d %s %d, event given up: %s", h->argv[0], (int)w->pid,
+               WIFSIGNALED(status) ? "killed by signal" : "exit", WIFSIGNALED(status) ?
+               WTERMSIG(status) : WEXITSTATUS(status), w->job.line);
+        free(w->job.line);
+    }
+
+    w->pid = 0;
+    w->job.line = NULL;
+    w->killed = 0;
+}
+
+
+/* environ of mnpd plus MNP_<FIELD> for every plain field of the event */
+static char **make_env(const char *line, int attempt)
+{
+    size_t n = 0;
+    while (environ[n] != NULL) n++;
+
+    cJSON *event = cJSON_Parse(line);
+    if (event == NULL) return NULL;
+
+    char **env = calloc(n + cJSON_GetArraySize(event) + 2, sizeof(char *));
+    if (env == NULL) {
+        cJSON_Delete(event);
+        return NULL;
+    }
+    memcpy(env, environ, n * sizeof(char *));
+
+    size_t k = n;
+    cJSON *item;
+    cJSON_ArrayForEach(item, event) {
+        char key[64];
+        char *value = NULL;
+        size_t i = 0;
+
+        for (const char *c = item->string; c != NULL && *c && i < sizeof(key) - 1; c++, i++) {
+            key[i] = isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+        }
+        key[i] = '\0';
+
+        if (cJSON_IsString(item)) asprintf(&value, "MNP_%s=%s", key, item->valuestring);
+        else if (cJSON_IsBool(item)) asprintf(&value, "MNP_%s=%s", key, cJSON_IsTrue(item) ? "true" : "false");
+        else if (cJSON_IsNumber(item)) asprintf(&value, "MNP_%s=%.0f", key, item->valuedouble);
+        if (value != NULL) env[k++] = value;
+    }
+    asprintf(&env[k++], "MNP_ATTEMPT=%d", attempt);
+    env[k] = NULL;
+    cJSON_Delete(event);
+    return env;
+}
+
+
+/* frees what make_env added after the inherited strings */
+static void free_env(char **env)
+{
+    size_t n = 0;
+
+    if (env == NULL) return;
+    while (environ[n] != NULL) n++;
+    for (char **e = env + n; *e != NULL; e++) free(*e);
+    free(env);
+}
@@ -0,0 +1,59 @@
+#ifndef HOOKS_H
+#define HOOKS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "evloop.h"
+
+struct hooks;
+
+struct hook_job {
+    char *line;
+    int attempt;
+    long long due;
+};
+
+struct hook_worker {
+    struct ev_source src;
+    struct hooks *hooks;
+    pid_t pid;
+    struct hook_job job;
+    long long started;
+    long long deadline;
+    int killed;
+};
+
+struct hooks {
+    struct evloop *loop;
+    char **argv;
+    int ntypes;
+    char type[PUB_MAX_TYPES][32];
+    size_t nworkers;
+    size_t running;
+    long long timeout;
+    int retries;
+    struct hook_worker *worker;
+    struct hook_job *queue;
+    size_t qlen;
+    size_t head;
+    size_t count;
+    struct hook_job *retry;
+    size_t nretry;
+    unsigned long started;
+    unsigned long done;
+    unsigned long failed;
+    unsigned long retried;
+    unsigned long timeouts;
+    unsigned long dropped;
+    unsigned long gap;
+};
+
+int hooks_init(struct hooks *h, struct evloop *loop, const char *cmd, const char *types,
+               size_t workers, size_t qlen, long timeout, int retries);
+void hooks_post(struct hooks *h, const cJSON *event, const char *line);
+void hooks_stats(const struct hooks *h);
+void hooks_close(struct hooks *h);
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "expect.h"
+#include "invoice.h"
+
+/*
+ * Expiry timers of the invoices in .mnp.expect. Every open invoice
+ * (REQUEST or WAITING) with a due time sits in a min-heap ordered by
+ * that time; the heap is loaded from the table at start and fed by
+ * mnp-payment with an "invoice" message for each new request. Once a
+ * second the due ones are popped and ended in the table: TIMEOUT if
+ * nothing came in, FAILED if some but not all of it did. Invoices paid
+ * or registered again in the meantime are left alone by expect_expire,
+ * so a stale timer costs one probe.
+ *
+ * Every change is written to invoices/<name> and published as an
+ * "invoice" event.
+ */
+static void invoice_tick(void *data);
+static int push(struct invoice *inv, int64_t due, uint32_t kind, uint64_t id);
+static void pop(struct invoice *inv);
+
+
+/**
+ * Loads the open invoices and starts the expiry tick.
+ *
+ * @param inv The invoice timers.
+ * @param loop Event loop of mnpd.
+ * @param ex The opened registry of expected payments.
+ * @param workdir The work directory.
+ * @param publish Called with every invoice event.
+ * @return 0 on success, -1 on error.
+ */
+int invoice_init(struct invoice *inv, struct evloop *loop, struct expect *ex, const char *workdir,
+                 void (*publish)(cJSON *event))
+{
+    struct expect_rec *recs = NULL;
+    size_t count = 0;
+    char *dir = NULL;
+
+    memset(inv, 0, sizeof(*inv));
+    inv->loop = loop;
+    inv->expect = ex;
+    inv->publish = publish;
+
+    if (asprintf(&dir, "%s/%s", workdir, INVOICE_DIR) == -1) return -1;
+    if (mkdir(dir, S_IRWXU) == -1 && errno != EEXIST) {
+        syslog(LOG_USER | LOG_ERR, "could not create %s: %s", dir, strerror(errno));
+        free(dir);
+        return -1;
+    }
+    free(dir);
+
+    inv->workdir = strdup(workdir);
+    if (inv->workdir == NULL || expect_pending(ex, &recs, &count) < 0) {
+        invoice_close(inv);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) push(inv, recs[i].expires, recs[i].kind, recs[i].id);
+    free(recs);
+    if (verbose) syslog(LOG_USER | LOG_INFO, "invoice: %zu open", inv->count);
+
+    if (evloop_tick(loop, INVOICE_TICK_MS, invoice_tick, inv) < 0) {
+        invoice_close(inv);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Takes up an invoice mnp-payment has just registered: starts its
+ * timer and publishes the REQUEST.
+ *
+ * @param inv The invoice timers.
+ * @param msg The message, with payment_id or account and subaddr_index.
+ * @return 0 on success, -1 if there is no such invoice.
+ */
+int invoice_watch(struct invoice *inv, const cJSON *msg)
+{
+    const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "payment_id"));
+    const cJSON *account = cJSON_GetObjectItem(msg, "account");
+    const cJSON *subaddr = cJSON_GetObjectItem(msg, "subaddr_index");
+    long major = cJSON_IsNumber(account) ? (long)account->valuedouble : -1;
+    long minor = cJSON_IsNumber(subaddr) ? (long)subaddr->valuedouble : -1;
+    struct expect_rec rec;
+    int kind;
+    uint64_t id;
+
+    if (inv->workdir == NULL) return -1;
+    if (expect_key(payment_id, major, minor, &kind, &id) < 0) return -1;
+    if (expect_get(inv->expect, kind, id, &rec) != 1) return -1;
+
+    inv->requests++;
+    if (rec.expires > 0 && rec.state == EXPECT_REQUEST) push(inv, rec.expires, rec.kind, rec.id);
+
+    cJSON *event = invoice_event(&rec, NULL);
+    inv->publish(event);
+    cJSON_Delete(event);
+    return 0;
+}
+
+
+/**
+ * Takes a transfer a reorg dropped back out of its invoice. An invoice
+ * open again gets its timer back; one already due ends at the next tick.
+ *
+ * @param inv The invoice timers.
+ * @param kind EXPECT_SUBADDR or EXPECT_PAYID.
+ * @param id The id, see expect_key().
+ * @param txid The revoked transfer.
+ * @param amount Its amount in atomic units.
+ * @return The invoice event, to be freed with cJSON_Delete, or NULL if it was not counted.
+ */
+cJSON *invoice_revoke(struct invoice *inv, int kind, uint64_t id, const char *txid, uint64_t amount)
+{
+    struct expect_rec rec;
+
+    if (expect_revoke(inv->expect, kind, id, txid, amount, &rec) != 1) return NULL;
+    if (rec.expires > 0 && (rec.state == EXPECT_REQUEST || rec.state == EXPECT_WAITING)) {
+        push(inv, rec.expires, rec.kind, rec.id);
+    }
+    return invoice_changed(inv, &rec, txid);
+}
+
+
+/**
+ * Records a new state of an invoice in its status file.
+ *
+ * @param inv The invoice timers.
+ * @param rec The record after the change.
+ * @param txid The transfer that changed it, may be NULL.
+ * @return The invoice event, to be freed with cJSON_Delete.
+ */
+cJSON *invoice_changed(struct invoice *inv, const struct expect_rec *rec, const char *txid)
+{
+    if (inv->workdir != NULL) expect_status(inv->workdir, rec);
+    if (verbose) {
+        char name[24];
+        expect_name(rec, name, sizeof(name));
+        syslog(LOG_USER | LOG_INFO, "invoice %s: %s", name, expect_state_name(rec->state));
+    }
+    return invoice_event(rec, txid);
+}
+
+
+/**
+ * Builds the event for the state of an invoice.
+ *
+ * @param rec The record.
+ * @param txid The transfer that changed it, may be NULL.
+ * @return The event, to be freed with cJSON_Delete.
+ */
+cJSON *invoice_event(const struct expect_rec *rec, const char *txid)
+{
+    cJSON *event = cJSON_CreateObject();
+    char num[24];
+
+    cJSON_AddStringToObject(event, "type", EV_INVOICE);
+    cJSON_AddStringToObject(event, "state", expect_state_name(rec->state));
+    if (rec->kind == EXPECT_PAYID) {
+        expect_name(rec, num, sizeof(num));
+        cJSON_AddStringToObject(event, "payment_id", num);
+    } else {
+        cJSON_AddNumberToObject(event, "account", (double)(rec->id >> 32));
+        cJSON_AddNumberToObject(event, "subaddr_index", (double)(rec->id & 0xffffffff));
+    }
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec->received);
+    cJSON_AddStringToObject(event, "amount", num);
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec->amount);
+    cJSON_AddStringToObject(event, "expected", num);
+    cJSON_AddNumberToObject(event, "transfers", rec->transfers);
+    cJSON_AddNumberToObject(event, "expires", (double)rec->expires);
+    if (txid != NULL) cJSON_AddStringToObject(event, "txid", txid);
+    return event;
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param inv The invoice timers.
+ */
+void invoice_stats(const struct invoice *inv)
+{
+    if (inv->workdir == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "invoice: %lu requests, %lu timed out, %lu failed, %zu timers",
+           inv->requests, inv->timeouts, inv->failed, inv->count);
+    printf("invoice: %lu requests, %lu timed out, %lu failed, %zu timers\n",
+           inv->requests, inv->timeouts, inv->failed, inv->count);
+    fflush(stdout);
+}
+
+
+/**
+ * Frees the timers. They are loaded from the table again at the next start.
+ *
+ * @param inv The invoice timers.
+ */
+void invoice_close(struct invoice *inv)
+{
+    free(inv->heap);
+    free(inv->workdir);
+    inv->heap = NULL;
+    inv->workdir = NULL;
+    inv->count = 0;
+    inv->size = 0;
+}
+
+
+static void invoice_tick(void *data)
+{
+    struct invoice *inv = data;
+    time_t now = time(NULL);
+    struct expect_rec rec;
+
+    while (inv->count > 0 && inv->heap[0].due < now) {
+        struct invoice_timer t = inv->heap[0];
+        pop(inv);
+        if (expect_expire(inv->expect, t.kind, t.id, t.due, &rec) != 1) continue;
+
+        if (rec.state == EXPECT_TIMEOUT) inv->timeouts++;
+        else inv->failed++;
+        cJSON *event = invoice_changed(inv, &rec, NULL);
+        inv->publish(event);
+        cJSON_Delete(event);
+    }
+}
+
+
+static int push(struct invoice *inv, int64_t due, uint32_t kind, uint64_t id)
+{
+    if (inv->count == inv->size) {
+        size_t size = inv->size ? inv->size * 2 : 64;
+        struct invoice_timer *heap = realloc(inv->heap, size * sizeof(*heap));
+        if (heap == NULL) return -1;
+        inv->heap = heap;
+        inv->size = size;
+    }
+
+    size_t i = inv->count++;
+    while (i > 0 && inv->heap[(i - 1) / 2].due > due) {
+        inv->heap[i] = inv->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    inv->heap[i] = (struct invoice_timer){ due, kind, id };
+    return 0;
+}
+
+
+static void pop(struct invoice *inv)
+{
+    struct invoice_timer last = inv->heap[--inv->count];
+    size_t i = 0;
+
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= inv->count) break;
+        if (c + 1 < inv->count && inv->heap[c + 1].due < inv->heap[c].due) c++;
+        if (last.due <= inv->heap[c].due) break;
+        inv->heap[i] = inv->heap[c];
+        i = c;
+    }
+    if (inv->count > 0) inv->heap[i] = last;
+}
@@ -0,0 +1,38 @@
+#ifndef INVOICE_H
+#define INVOICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./cjson/cJSON.h"
+#include "evloop.h"
+#include "expect.h"
+
+struct invoice_timer {
+    int64_t due;
+    uint32_t kind;
+    uint64_t id;
+};
+
+struct invoice {
+    struct evloop *loop;
+    struct expect *expect;
+    char *workdir;
+    void (*publish)(cJSON *event);
+    struct invoice_timer *heap;
+    size_t count;
+    size_t size;
+    unsigned long requests;
+    unsigned long timeouts;
+    unsigned long failed;
+};
+
+int invoice_init(struct invoice *inv, struct evloop *loop, struct expect *ex, const char *workdir,
+                 void (*publish)(cJSON *event));
+int invoice_watch(struct invoice *inv, const cJSON *msg);
+cJSON *invoice_revoke(struct invoice *inv, int kind, uint64_t id, const char *txid, uint64_t amount);
+cJSON *invoice_changed(struct invoice *inv, const struct expect_rec *rec, const char *txid);
+cJSON *invoice_event(const struct expect_rec *rec, const char *txid);
+void invoice_stats(const struct invoice *inv);
+void invoice_close(struct invoice *inv);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "ipc.h"
+
+/*
+ * mnp hands events over to mnpd as JSON datagrams on a unix socket
+ * in the work directory. Datagrams keep message boundaries and are
+ * never lost on a local socket, a full queue blocks the sender.
+ */
+static int ipc_addr(const char *workdir, struct sockaddr_un *addr);
+
+
+/**
+ * Sends one message to mnpd.
+ *
+ * @param workdir The work directory.
+ * @param msg The message.
+ * @return 0 on success, -1 if mnpd is not reachable.
+ */
+int ipc_send(const char *workdir, const cJSON *msg)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = { .tv_sec = IPC_TIMEOUT, .tv_usec = 0 };
+
+    if (ipc_addr(workdir, &addr) < 0) return -1;
+
+    char *buf = cJSON_PrintUnformatted(msg);
+    if (buf == NULL) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        free(buf);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    ssize_t ret = sendto(fd, buf, strlen(buf), 0, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret == -1 && DEBUG) syslog(LOG_USER | LOG_DEBUG, "mnpd not reachable: %s", strerror(errno));
+
+    close(fd);
+    free(buf);
+    return ret == -1 ? -1 : 0;
+}
+
+
+/**
+ * Binds the mnpd socket. A stale socket file is replaced.
+ *
+ * @param workdir The work directory.
+ * @param mode Permission of the socket file.
+ * @return The socket, or -1 on error (or if another mnpd is running).
+ */
+int ipc_listen(const char *workdir, mode_t mode)
+{
+    struct sockaddr_un addr;
+
+    if (ipc_addr(workdir, &addr) < 0) {
+        syslog(LOG_USER | LOG_ERR, "socket path too long: %s/%s", workdir, IPC_SOCKET);
+        return -1;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) return -1;
+    int alive = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    close(probe);
+
+    if (alive) {
+        syslog(LOG_USER | LOG_ERR, "another mnpd is listening on %s", addr.sun_path);
+        return -1;
+    }
+    unlink(addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) return -1;
+
+    int size = IPC_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || chmod(addr.sun_path, mode) == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not bind %s: %s", addr.sun_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * Receives one message.
+ *
+ * @param fd The mnpd socket.
+ * @return The parsed message (caller frees with cJSON_Delete), or NULL if none is queued.
+ */
+cJSON *ipc_recv(int fd)
+{
+    char buf[IPC_MAX_MSG + 1];
+
+    for (;;) {
+        ssize_t len = recv(fd, buf, IPC_MAX_MSG, 0);
+        if (len < 0) return NULL;
+
+        buf[len] = '\0';
+        cJSON *msg = cJSON_Parse(buf);
+        if (msg != NULL) return msg;
+        syslog(LOG_USER | LOG_ERR, "invalid message dropped: %.64s", buf);
+    }
+}
+
+
+/**
+ * Removes the mnpd socket file.
+ *
+ * @param workdir The work directory.
+ */
+void ipc_unlink(const char *workdir)
+{
+    struct sockaddr_un addr;
+
+    if (ipc_addr(workdir, &addr) == 0) unlink(addr.sun_path);
+}
+
+
+static int ipc_addr(const char *workdir, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    int len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", workdir, IPC_SOCKET);
+    return (len < 0 || len >= (int)sizeof(addr->sun_path)) ? -1 : 0;
+}
@@ -0,0 +1,12 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <sys/types.h>
+#include "./cjson/cJSON.h"
+
+int ipc_send(const char *workdir, const cJSON *msg);
+int ipc_listen(const char *workdir, mode_t mode);
+cJSON *ipc_recv(int fd);
+void ipc_unlink(const char *workdir);
+
+#endif
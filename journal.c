@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "globaldefs.h"
+#include "crc32.h"
+#include "journal.h"
+
+/*
+ * Append-only event journal in <workdir>/journal. mnpd is the only
+ * writer. Every event is one record: a struct journal_rec header with
+ * a CRC32 over header and payload, followed by the JSON payload.
+ * Records carry a sequence number that never repeats. A segment file
+ * is named after the sequence number of its first record and a new
+ * one is started once the current one exceeds the segment size.
+ * Old segments are removed by size and age, the active one never.
+ *
+ * Readers keep their own position: a consumer name maps to a file in
+ * journal/consumers holding the next sequence number to read. Reading
+ * past the end waits on inotify for the writer.
+ */
+static int seg_list(const char *dir, uint64_t **bases, size_t *n);
+static char *seg_path(const char *dir, uint64_t base);
+static uint32_t rec_crc(const struct journal_rec *h, const char *data);
+static int seg_scan(int fd, uint64_t *next, off_t *end);
+static int seg_roll(struct journal *j);
+static int reader_open_seg(struct journal_reader *r, uint64_t seq);
+static int reader_next_seg(struct journal_reader *r);
+static int reader_wait(struct journal_reader *r, int timeout_ms);
+
+
+/**
+ * Opens the journal for appending. A record torn by a crash at the
+ * end of the last segment is cut off.
+ *
+ * @param j The journal.
+ * @param workdir The work directory.
+ * @param seg_size Size in bytes after which a new segment is started.
+ * @param max_bytes Total size kept, 0 = unlimited.
+ * @param max_age Seconds a segment is kept, 0 = forever.
+ * @param dmode Permission of the journal directories.
+ * @param fmode Permission of the segment files.
+ * @return 0 on success, -1 on error.
+ */
+int journal_open(struct journal *j, const char *workdir, size_t seg_size, uint64_t max_bytes,
+                 time_t max_age, mode_t dmode, mode_t fmode)
+{
+    uint64_t *bases = NULL;
+    size_t n = 0;
+    char *consumers = NULL;
+
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    j->seg_size = seg_size > 0 ? seg_size : JOURNAL_SEGMENT;
+    j->max_bytes = max_bytes;
+    j->max_age = max_age;
+    j->mode = fmode;
+
+    asprintf(&j->dir, "%s/%s", workdir, JOURNAL_DIR);
+    asprintf(&consumers, "%s/%s", j->dir, JOURNAL_CONSUMERS);
+    if ((mkdir(j->dir, dmode) == -1 && errno != EEXIST) ||
+        (mkdir(consumers, dmode) == -1 && errno != EEXIST)) {
+        goto error;
+    }
+    free(consumers);
+    consumers = NULL;
+
+    if (seg_list(j->dir, &bases, &n) < 0) goto error;
+
+    if (n == 0) {
+        j->next = 1;
+        if (seg_roll(j) < 0) goto error;
+    } else {
+        char *path = seg_path(j->dir, bases[n - 1]);
+        j->fd = open(path, O_RDWR | O_APPEND | O_CLOEXEC);
+        free(path);
+        if (j->fd == -1) goto error;
+
+        j->base = bases[n - 1];
+        j->next = j->base;
+        if (seg_scan(j->fd, &j->next, &j->size) < 0) goto error;
+
+        struct stat sb;
+        if (fstat(j->fd, &sb) == 0 && sb.st_size > j->size) {
+            syslog(LOG_USER | LOG_ERR, "journal: cut %lld torn bytes", (long long)(sb.st_size - j->size));
+            if (ftruncate(j->fd, j->size) == -1) goto error;
+        }
+    }
+    free(bases);
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "journal is up : %s next %llu", j->dir, (unsigned long long)j->next);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not open journal %s: %s", j->dir, strerror(errno));
+    free(consumers);
+    free(bases);
+    journal_close(j);
+    return -1;
+}
+
+
+/**
+ * Returns the sequence number the next appended record will get.
+ *
+ * @param j The journal.
+ * @return The sequence number.
+ */
+uint64_t journal_next(const struct journal *j)
+{
+    return j->next;
+}
+
+
+/**
+ * Appends one record.
+ *
+ * @param j The journal.
+ * @param data The payload.
+ * @param len Length of the payload.
+ * @return 0 on success, -1 on error.
+ */
+int journal_append(struct journal *j, const char *data, size_t len)
+{
+    struct journal_rec h;
+
+    if (j->fd < 0 || len > JOURNAL_MAX_REC) return -1;
+    if (j->size > 0 && j->size + sizeof(h) + len > j->seg_size && seg_roll(j) < 0) return -1;
+
+    h.len = len;
+    h.seq = j->next;
+    h.stamp = time(NULL);
+    h.crc = rec_crc(&h, data);
+
+    struct iovec iov[2] = { { &h, sizeof(h) }, { (void *)data, len } };
+    ssize_t n = writev(j->fd, iov, 2);
+    if (n != (ssize_t)(sizeof(h) + len)) {
+        syslog(LOG_USER | LOG_ERR, "error: write journal: %s", n < 0 ? strerror(errno) : "short write");
+        if (n > 0 && ftruncate(j->fd, j->size) == -1) {
+            syslog(LOG_USER | LOG_ERR, "error: truncate journal: %s", strerror(errno));
+        }
+        return -1;
+    }
+
+    j->size += n;
+    j->next++;
+    j->dirty = 1;
+    return 0;
+}
+
+
+/**
+ * Flushes appended records to disk.
+ *
+ * @param j The journal.
+ */
+void journal_sync(struct journal *j)
+{
+    if (j->fd >= 0 && j->dirty) {
+        fdatasync(j->fd);
+        j->dirty = 0;
+    }
+}
+
+
+/**
+ * Removes the oldest segments beyond the size or age limit.
+ *
+ * @param j The journal.
+ */
+void journal_retain(struct journal *j)
+{
+    uint64_t *bases = NULL;
+    size_t n = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    struct stat sb;
+
+    if (seg_list(j->dir, &bases, &n) < 0) return;
+
+    off_t *size = calloc(n, sizeof(off_t));
+    time_t *mtime = calloc(n, sizeof(time_t));
+    if (size == NULL || mtime == NULL) goto out;
+
+    for (size_t i = 0; i < n; i++) {
+        char *path = seg_path(j->dir, bases[i]);
+        if (stat(path, &sb) == 0) {
+            size[i] = sb.st_size;
+            mtime[i] = sb.st_mtime;
+            total += sb.st_size;
+        }
+        free(path);
+    }
+
+    /* oldest first, never the active segment */
+    for (size_t i = 0; i + 1 < n && bases[i] != j->base; i++) {
+        int over = j->max_bytes > 0 && total > j->max_bytes;
+        int old = j->max_age > 0 && mtime[i] < now - j->max_age;
+        if (!over && !old) break;
+
+        char *path = seg_path(j->dir, bases[i]);
+        if (unlink(path) == 0) {
+            total -= size[i];
+            if (verbose) syslog(LOG_USER | LOG_INFO, "journal: removed segment %s", path);
+        }
+        free(path);
+    }
+
+out:
+    free(size);
+    free(mtime);
+    free(bases);
+}
+
+
+/**
+ * Flushes and closes the journal.
+ *
+ * @param j The journal.
+ */
+void journal_close(struct journal *j)
+{
+    journal_sync(j);
+    if (j->fd >= 0) close(j->fd);
+    j->fd = -1;
+    free(j->dir);
+    j->dir = NULL;
+}
+
+
+/**
+ * Opens the journal for reading.
+ *
+ * @param r The reader.
+ * @param workdir The work directory.
+ * @param consumer Name of the consumer whose offset is kept, or NULL.
+ * @return 0 on success, -1 on error.
+ */
+int journal_reader_open(struct journal_reader *r, const char *workdir, const char *consumer)
+{
+    uint64_t seq = 0;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    asprintf(&r->dir, "%s/%s", workdir, JOURNAL_DIR);
+
+    if (consumer != NULL) {
+        for (const char *c = consumer; *c; c++) {
+            if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_') {
+                fprintf(stderr, "mnp: consumer name may only contain [A-Za-z0-9_-]\n");
+                goto error;
+            }
+        }
+        asprintf(&r->offset, "%s/%s/%s", r->dir, JOURNAL_CONSUMERS, consumer);
+
+        FILE *f = fopen(r->offset, "r");
+        if (f != NULL) {
+            unsigned long long saved;
+            if (fscanf(f, "%llu", &saved) == 1 && saved > 0) seq = saved;
+            fclose(f);
+        }
+    }
+
+    r->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (r->inotify == -1 ||
+        inotify_add_watch(r->inotify, r->dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "mnp: could not watch %s: %s\n", r->dir, strerror(errno));
+        goto error;
+    }
+
+    r->bufsize = MAX_DATA_SIZE;
+    r->buf = malloc(r->bufsize);
+    if (r->buf == NULL) goto error;
+
+    return journal_reader_seek(r, seq);
+
+error:
+    journal_reader_close(r);
+    return -1;
+}
+
+
+/**
+ * Moves the reader to a sequence number. A number that is no longer
+ * retained starts at the oldest record.
+ *
+ * @param r The reader.
+ * @param seq The sequence number to read next, 0 = oldest.
+ * @return 0 on success, -1 on error.
+ */
+int journal_reader_seek(struct journal_reader *r, uint64_t seq)
+{
+    if (r->fd >= 0) close(r->fd);
+    r->fd = -1;
+    r->next = seq;
+    r->retries = 0;
+
+    return reader_open_seg(r, r->next) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Reads the next record.
+ *
+ * @param r The reader.
+ * @param seq Set to the sequence number of the record.
+ * @param data Set to the payload, valid until the next call.
+ * @param len Set to the length of the payload.
+ * @param timeout_ms Time to wait for the writer, -1 = forever, 0 = don't wait.
+ * @return 1 if a record was read, 0 on timeout, -1 on error.
+ */
+int journal_reader_next(struct journal_reader *r, uint64_t *seq, const char **data, size_t *len, int timeout_ms)
+{
+    struct journal_rec h;
+
+    for (;;) {
+        if (r->fd < 0) {
+            int reto = reader_open_seg(r, r->next);
+            if (reto < 0) return -1;
+            if (reto == 0) {
+                if ((reto = reader_wait(r, timeout_ms)) <= 0) return reto;
+                continue;
+            }
+        }
+
+        ssize_t n = pread(r->fd, &h, sizeof(h), r->off);
+        int complete = 0;
+        if (n == sizeof(h) && h.len <= JOURNAL_MAX_REC) {
+            if (h.len + 1 > r->bufsize) {
+                char *buf = realloc(r->buf, h.len + 1);
+                if (buf == NULL) return -1;
+                r->buf = buf;
+                r->bufsize = h.len + 1;
+            }
+            complete = pread(r->fd, r->buf, h.len, r->off + sizeof(h)) == (ssize_t)h.len;
+        } else if (n == sizeof(h)) {
+            complete = -1;
+        }
+
+        if (complete == 1 && rec_crc(&h, r->buf) == h.crc) {
+            r->off += sizeof(h) + h.len;
+            r->retries = 0;
+            if (h.seq < r->next) continue;
+
+            r->buf[h.len] = '\0';
+            r->next = h.seq + 1;
+            *seq = h.seq;
+            *data = r->buf;
+            *len = h.len;
+            return 1;
+        }
+
+        if (complete != 0 && ++r->retries > JOURNAL_RETRIES) {
+            /* not a write in progress: give up on this segment */
+            syslog(LOG_USER | LOG_ERR, "journal: corrupt record in segment %llu at %lld",
+                   (unsigned long long)r->base, (long long)r->off);
+            fprintf(stderr, "mnp: corrupt record in journal segment %llu at %lld\n",
+                    (unsigned long long)r->base, (long long)r->off);
+            r->retries = 0;
+            r->off = lseek(r->fd, 0, SEEK_END);
+        }
+
+        /* end of segment: go on with the next one or wait for the writer */
+        if (complete == 0) {
+            int retn = reader_next_seg(r);
+            if (retn < 0) return -1;
+            if (retn > 0) continue;
+        }
+        int retw = reader_wait(r, complete == 0 ? timeout_ms : JOURNAL_SYNC_MS / 100);
+        if (retw < 0 || (retw == 0 && complete == 0)) return retw;
+    }
+}
+
+
+/**
+ * Stores the position of the reader for its consumer name.
+ *
+ * @param r The reader.
+ * @return 0 on success, -1 on error.
+ */
+int journal_reader_commit(struct journal_reader *r)
+{
+    char *tmp = NULL;
+    int ok = 0;
+
+    if (r->offset == NULL) return 0;
+    if (asprintf(&tmp, "%s.%d", r->offset, getpid()) == -1) return -1;
+
+    FILE *f = fopen(tmp, "w");
+    if (f != NULL) {
+        ok = fprintf(f, "%llu\n", (unsigned long long)r->next) > 0;
+        ok = (fclose(f) == 0) && ok && rename(tmp, r->offset) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "mnp: could not store offset %s: %s\n", r->offset, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+
+/**
+ * Closes the reader.
+ *
+ * @param r The reader.
+ */
+void journal_reader_close(struct journal_reader *r)
+{
+    if (r->fd >= 0) close(r->fd);
+    if (r->inotify > 0) close(r->inotify);
+    free(r->dir);
+    free(r->offset);
+    free(r->buf);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+
+static int seg_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* Sorted first sequence numbers of all segments. */
+static int seg_list(const char *dir, uint64_t **bases, size_t *n)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    size_t cap = 0;
+
+    *bases = NULL;
+    *n = 0;
+    if (d == NULL) return -1;
+
+    while ((de = readdir(d)) != NULL) {
+        char *end = NULL;
+        unsigned long long base = strtoull(de->d_name, &end, 10);
+        if (end == de->d_name || strcmp(end, JOURNAL_SUFFIX) != 0) continue;
+
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 16;
+            uint64_t *grown = realloc(*bases, cap * sizeof(uint64_t));
+            if (grown == NULL) {
+                closedir(d);
+                return -1;
+            }
+            *bases = grown;
+        }
+        (*bases)[(*n)++] = base;
+    }
+    closedir(d);
+
+    if (*n > 0) qsort(*bases, *n, sizeof(uint64_t), seg_cmp);
+    return 0;
+}
+
+
+static char *seg_path(const char *dir, uint64_t base)
+{
+    char *path = NULL;
+    asprintf(&path, "%s/%020llu%s", dir, (unsigned long long)base, JOURNAL_SUFFIX);
+    return path;
+}
+
+
+static uint32_t rec_crc(const struct journal_rec *h, const char *data)
+{
+    uint32_t crc = crc32(0, (const char *)h + sizeof(h->crc), sizeof(*h) - sizeof(h->crc));
+    return crc32(crc, data, h->len);
+}
+
+
+/* Walks the valid records of a segment. */
+static int seg_scan(int fd, uint64_t *next, off_t *end)
+{
+    struct journal_rec h;
+    char *buf = malloc(JOURNAL_MAX_REC);
+    off_t off = 0;
+
+    if (buf == NULL) return -1;
+    while (pread(fd, &h, sizeof(h), off) == sizeof(h) && h.len <= JOURNAL_MAX_REC &&
+           pread(fd, buf, h.len, off + sizeof(h)) == (ssize_t)h.len && rec_crc(&h, buf) == h.crc) {
+        off += sizeof(h) + h.len;
+        *next = h.seq + 1;
+    }
+    free(buf);
+    *end = off;
+    return 0;
+}
+
+
+/* Starts a new segment named after the next sequence number. */
+static int seg_roll(struct journal *j)
+{
+    char *path = seg_path(j->dir, j->next);
+
+    journal_sync(j);
+    if (j->fd >= 0) close(j->fd);
+
+    j->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, j->mode);
+    if (j->fd == -1) {
+        syslog(LOG_USER | LOG_ERR, "error: open journal segment %s: %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    if (fchmod(j->fd, j->mode) == -1) {
+        syslog(LOG_USER | LOG_ERR, "error: chmod journal segment %s: %s", path, strerror(errno));
+    }
+    free(path);
+
+    j->base = j->next;
+    j->size = 0;
+    return 0;
+}
+
+
+/* Opens the segment holding seq. Returns 1 if open, 0 if the journal is empty. */
+static int reader_open_seg(struct journal_reader *r, uint64_t seq)
+{
+    uint64_t *bases = NULL;
+    size_t n = 0;
+    size_t i = 0;
+
+    if (seg_list(r->dir, &bases, &n) < 0) {
+        fprintf(stderr, "mnp: could not read %s: %s\n", r->dir, strerror(errno));
+        return -1;
+    }
+    if (n == 0) {
+        free(bases);
+        return 0;
+    }
+
+    if (seq < bases[0]) {
+        if (seq > 0) {
+            syslog(LOG_USER | LOG_ERR, "journal: %llu is gone, resuming at %llu",
+                   (unsigned long long)seq, (unsigned long long)bases[0]);
+            fprintf(stderr, "mnp: journal %llu is gone, resuming at %llu\n",
+                    (unsigned long long)seq, (unsigned long long)bases[0]);
+        }
+        r->next = bases[0];
+    }
+    while (i + 1 < n && bases[i + 1] <= seq) i++;
+
+    char *path = seg_path(r->dir, bases[i]);
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    r->base = bases[i];
+    r->off = 0;
+    free(bases);
+
+    if (r->fd == -1) {
+        /* removed by retention in between */
+        return errno == ENOENT ? reader_open_seg(r, r->next) : -1;
+    }
+    return 1;
+}
+
+
+/* Switches to the segment after the current one. Returns 1 if there is one. */
+static int reader_next_seg(struct journal_reader *r)
+{
+    uint64_t *bases = NULL;
+    size_t n = 0;
+    int ret = 0;
+
+    if (seg_list(r->dir, &bases, &n) < 0) return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (bases[i] <= r->base) continue;
+
+        char *path = seg_path(r->dir, bases[i]);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        free(path);
+        if (fd == -1) continue;
+
+        close(r->fd);
+        r->fd = fd;
+        r->base = bases[i];
+        r->off = 0;
+        ret = 1;
+        break;
+    }
+    free(bases);
+    return ret;
+}
+
+
+/* Waits for the writer. Returns 1 on activity, 0 on timeout. */
+static int reader_wait(struct journal_reader *r, int timeout_ms)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { r->inotify, POLLIN, 0 };
+
+    if (timeout_ms == 0) return 0;
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) return errno == EINTR ? 0 : -1;
+    while (read(r->inotify, buf, sizeof(buf)) > 0);
+    return ret > 0;
+}
@@ -0,0 +1,56 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+struct journal_rec {
+    uint32_t crc;
+    uint32_t len;
+    uint64_t seq;
+    int64_t  stamp;
+};
+
+struct journal {
+    char *dir;
+    int fd;
+    uint64_t base;
+    uint64_t next;
+    off_t size;
+    size_t seg_size;
+    uint64_t max_bytes;
+    time_t max_age;
+    mode_t mode;
+    int dirty;
+};
+
+struct journal_reader {
+    char *dir;
+    char *offset;
+    int fd;
+    int inotify;
+    uint64_t base;
+    uint64_t next;
+    off_t off;
+    int retries;
+    char *buf;
+    size_t bufsize;
+};
+
+int journal_open(struct journal *j, const char *workdir, size_t seg_size, uint64_t max_bytes,
+                 time_t max_age, mode_t dmode, mode_t fmode);
+uint64_t journal_next(const struct journal *j);
+int journal_append(struct journal *j, const char *data, size_t len);
+void journal_sync(struct journal *j);
+void journal_retain(struct journal *j);
+void journal_close(struct journal *j);
+
+int journal_reader_open(struct journal_reader *r, const char *workdir, const char *consumer);
+int journal_reader_seek(struct journal_reader *r, uint64_t seq);
+int journal_reader_next(struct journal_reader *r, uint64_t *seq, const char **data, size_t *len, int timeout_ms);
+int journal_reader_commit(struct journal_reader *r);
+void journal_reader_close(struct journal_reader *r);
+
+#endif
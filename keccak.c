@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "keccak.h"
+
+#define KECCAK_ROUNDS   (24)
+#define KECCAK_RATE     (136)
+#define ROTL64(x, y)    (((x) << (y)) | ((x) >> (64 - (y))))
+
+static const uint64_t rc[KECCAK_ROUNDS] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
+    0x000000000000808bULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008aULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800aULL, 0x800000008000000aULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+static const int rotc[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44,
+};
+static const int piln[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1,
+};
+
+static void keccakf(uint64_t st[25]);
+static uint64_t load64(const unsigned char *p);
+
+
+/*
+ * Computes the Keccak-256 of a buffer, as Monero uses it: the original
+ * Keccak padding, not the one of SHA3-256.
+ *
+ * Parameters:
+ *   buf: Pointer to the data
+ *   len: Length of the data in bytes
+ *   hash: Set to the KECCAK_HASH_SIZE bytes of the hash
+ */
+void keccak256(const void *buf, size_t len, unsigned char *hash)
+{
+    const unsigned char *p = buf;
+    unsigned char last[KECCAK_RATE];
+    uint64_t st[25];
+
+    memset(st, 0, sizeof(st));
+    for (; len >= KECCAK_RATE; len -= KECCAK_RATE, p += KECCAK_RATE) {
+        for (int i = 0; i < KECCAK_RATE / 8; i++) st[i] ^= load64(p + 8 * i);
+        keccakf(st);
+    }
+
+    memset(last, 0, sizeof(last));
+    memcpy(last, p, len);
+    last[len] = 0x01;
+    last[KECCAK_RATE - 1] |= 0x80;
+    for (int i = 0; i < KECCAK_RATE / 8; i++) st[i] ^= load64(last + 8 * i);
+    keccakf(st);
+
+    for (int i = 0; i < KECCAK_HASH_SIZE; i++) hash[i] = (unsigned char)(st[i / 8] >> (8 * (i % 8)));
+}
+
+
+/* the permutation, 24 rounds over the 5x5 lanes */
+static void keccakf(uint64_t st[25])
+{
+    uint64_t bc[5], t;
+
+    for (int round = 0; round < KECCAK_ROUNDS; round++) {
+        for (int i = 0; i < 5; i++) bc[i] = st[i] ^ st[i + 5] ^ st[i + 10] ^ st[i + 15] ^ st[i + 20];
+        for (int i = 0; i < 5; i++) {
+            t = bc[(i + 4) % 5] ^ ROTL64(bc[(i + 1) % 5], 1);
+            for (int j = 0; j < 25; j += 5) st[j + i] ^= t;
+        }
+
+        t = st[1];
+        for (int i = 0; i < 24; i++) {
+            int j = piln[i];
+            bc[0] = st[j];
+            st[j] = ROTL64(t, rotc[i]);
+            t = bc[0];
+        }
+
+        for (int j = 0; j < 25; j += 5) {
+            for (int i = 0; i < 5; i++) bc[i] = st[j + i];
+            for (int i = 0; i < 5; i++) st[j + i] ^= (~bc[(i + 1) % 5]) & bc[(i + 2) % 5];
+        }
+
+        st[0] ^= rc[round];
+    }
+}
+
+
+/* little endian, whatever the host is */
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
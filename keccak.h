@@ -0,0 +1,11 @@
+#ifndef KECCAK_H
+#define KECCAK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KECCAK_HASH_SIZE (32)
+
+void keccak256(const void *buf, size_t len, unsigned char *hash);
+
+#endif
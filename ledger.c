@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+#include "globaldefs.h"
+#include "ledger.h"
+
+/*
+ * Optional SQLite ledger of mnpd. Every invoice, transfer and change
+ * of an invoice state mnpd publishes is written into it, so reports
+ * are local SQL queries:
+ *
+ *   invoices   one row per invoice, the latest state
+ *   transfers  one row per transfer event, with the verdict
+ *   states     the history of every invoice, one row per change
+ *
+ * The rows of one block go into one transaction: the first write opens
+ * it, the next block height commits it. At most one block of rows is
+ * lost in a crash, the journal has them all. The database is in WAL
+ * mode, so a report reading it does not hold up mnpd.
+ *
+ * Built only if CMake finds SQLite; without it ledger_open fails.
+ */
+#ifdef HAVE_SQLITE3
+static const char *schema =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=NORMAL;"
+    "CREATE TABLE IF NOT EXISTS invoices ("
+    " name TEXT PRIMARY KEY, payment_id TEXT, account INTEGER, subaddr_index INTEGER,"
+    " state TEXT NOT NULL, expected INTEGER, received INTEGER, transfers INTEGER,"
+    " expires INTEGER, created INTEGER, updated INTEGER);"
+    "CREATE TABLE IF NOT EXISTS transfers ("
+    " seq INTEGER PRIMARY KEY, txid TEXT NOT NULL, address TEXT, payment_id TEXT,"
+    " account INTEGER, subaddr_index INTEGER, amount INTEGER, confirmations INTEGER,"
+    " double_spend INTEGER, verdict TEXT, height INTEGER, time INTEGER);"
+    "CREATE TABLE IF NOT EXISTS states ("
+    " seq INTEGER PRIMARY KEY, name TEXT NOT NULL, state TEXT NOT NULL,"
+    " received INTEGER, txid TEXT, height INTEGER, time INTEGER);"
+    "CREATE INDEX IF NOT EXISTS invoices_payment_id ON invoices (payment_id);"
+    "CREATE INDEX IF NOT EXISTS invoices_subaddr ON invoices (account, subaddr_index);"
+    "CREATE INDEX IF NOT EXISTS transfers_txid ON transfers (txid);"
+    "CREATE INDEX IF NOT EXISTS transfers_payment_id ON transfers (payment_id);"
+    "CREATE INDEX IF NOT EXISTS transfers_subaddr ON transfers (account, subaddr_index);"
+    "CREATE INDEX IF NOT EXISTS states_name ON states (name, seq);";
+
+static const char *statements[LEDGER_STMTS] = {
+    [LEDGER_TRANSFER] =
+        "INSERT OR IGNORE INTO transfers (seq, txid, address, payment_id, account, subaddr_index,"
+        " amount, confirmations, double_spend, verdict, height, time)"
+        " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12)",
+    [LEDGER_INVOICE] =
+        "INSERT INTO invoices (name, payment_id, account, subaddr_index, state, expected, received,"
+        " transfers, expires, created, updated)"
+        " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?10)"
+        " ON CONFLICT (name) DO UPDATE SET state = ?5, expected = ?6, received = ?7, transfers = ?8,"
+        " expires = ?9, updated = ?10,"
+        " created = CASE WHEN ?5 = 'REQUEST' THEN ?10 ELSE created END",
+    [LEDGER_STATE] =
+        "INSERT OR IGNORE INTO states (seq, name, state, received, txid, height, time)"
+        " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)",
+};
+
+static void failed(struct ledger *led, const char *what);
+static void begin(struct ledger *led);
+static void bind_text(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key);
+static void bind_int(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key);
+static void bind_amount(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key);
+static void step(struct ledger *led, sqlite3_stmt *stmt);
+#endif
+
+
+/**
+ * Opens or creates the ledger and prepares its statements.
+ *
+ * @param led The ledger.
+ * @param workdir The work directory.
+ * @param file The database, relative to workdir unless it starts with /.
+ * @return 0 on success, -1 on error.
+ */
+int ledger_open(struct ledger *led, const char *workdir, const char *file)
+{
+    memset(led, 0, sizeof(*led));
+    led->height = -1;
+#ifdef HAVE_SQLITE3
+    int ret = file[0] == '/' ? asprintf(&led->path, "%s", file) : asprintf(&led->path, "%s/%s", workdir, file);
+    if (ret == -1) {
+        led->path = NULL;
+        return -1;
+    }
+
+    if (sqlite3_open_v2(led->path, &led->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK ||
+        sqlite3_exec(led->db, schema, NULL, NULL, NULL) != SQLITE_OK) {
+        failed(led, "open");
+        ledger_close(led);
+        return -1;
+    }
+    for (int i = 0; i < LEDGER_STMTS; i++) {
+        if (sqlite3_prepare_v3(led->db, statements[i], -1, SQLITE_PREPARE_PERSISTENT, &led->stmt[i], NULL) != SQLITE_OK) {
+            failed(led, "prepare");
+            ledger_close(led);
+            return -1;
+        }
+    }
+    if (verbose) syslog(LOG_USER | LOG_INFO, "ledger %s (SQLite %s)", led->path, sqlite3_libversion());
+    return 0;
+#else
+    syslog(LOG_USER | LOG_ERR, "ledger %s/%s: built without SQLite", workdir, file);
+    return -1;
+#endif
+}
+
+
+/**
+ * Writes an event into the ledger: a transfer into transfers, an invoice
+ * into invoices and states. Other events are not kept.
+ *
+ * @param led The ledger.
+ * @param event The published event, with seq and time.
+ */
+void ledger_record(struct ledger *led, const cJSON *event)
+{
+#ifdef HAVE_SQLITE3
+    if (led->db == NULL) return;
+    const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(event, "type"));
+    if (type == NULL) return;
+
+    if (strcmp(type, EV_TRANSFER) == 0) {
+        sqlite3_stmt *st = led->stmt[LEDGER_TRANSFER];
+        begin(led);
+        bind_int(st, 1, event, "seq");
+        bind_text(st, 2, event, "txid");
+        bind_text(st, 3, event, "address");
+        bind_text(st, 4, event, "payment_id");
+        bind_int(st, 5, event, "account");
+        bind_int(st, 6, event, "subaddr_index");
+        bind_amount(st, 7, event, "amount");
+        bind_int(st, 8, event, "confirmations");
+        sqlite3_bind_int(st, 9, cJSON_IsTrue(cJSON_GetObjectItem(event, "double_spend")));
+        bind_text(st, 10, event, "verdict");
+        sqlite3_bind_int64(st, 11, led->height);
+        bind_int(st, 12, event, "time");
+        step(led, st);
+    } else if (strcmp(type, EV_INVOICE) == 0) {
+        const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+        const cJSON *account = cJSON_GetObjectItem(event, "account");
+        const cJSON *subaddr = cJSON_GetObjectItem(event, "subaddr_index");
+        char name[48];
+        if (payment_id != NULL) {
+            snprintf(name, sizeof(name), "%s", payment_id);
+        } else if (cJSON_IsNumber(account) && cJSON_IsNumber(subaddr)) {
+            snprintf(name, sizeof(name), "%.0f-%.0f", account->valuedouble, subaddr->valuedouble);
+        } else {
+            return;
+        }
+
+        sqlite3_stmt *st = led->stmt[LEDGER_INVOICE];
+        begin(led);
+        sqlite3_bind_text(st, 1, name, -1, SQLITE_TRANSIENT);
+        bind_text(st, 2, event, "payment_id");
+        bind_int(st, 3, event, "account");
+        bind_int(st, 4, event, "subaddr_index");
+        bind_text(st, 5, event, "state");
+        bind_amount(st, 6, event, "expected");
+        bind_amount(st, 7, event, "amount");
+        bind_int(st, 8, event, "transfers");
+        bind_int(st, 9, event, "expires");
+        bind_int(st, 10, event, "time");
+        step(led, st);
+
+        st = led->stmt[LEDGER_STATE];
+        bind_int(st, 1, event, "seq");
+        sqlite3_bind_text(st, 2, name, -1, SQLITE_TRANSIENT);
+        bind_text(st, 3, event, "state");
+        bind_amount(st, 4, event, "amount");
+        bind_text(st, 5, event, "txid");
+        sqlite3_bind_int64(st, 6, led->height);
+        bind_int(st, 7, event, "time");
+        step(led, st);
+    }
+#else
+    (void)led;
+    (void)event;
+#endif
+}
+
+
+/**
+ * Commits the rows of the last block. Called with every new block height.
+ *
+ * @param led The ledger.
+ * @param height The new height.
+ */
+void ledger_block(struct ledger *led, long long height)
+{
+#ifdef HAVE_SQLITE3
+    if (led->db != NULL && led->open) {
+        if (sqlite3_exec(led->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) failed(led, "commit");
+        led->open = 0;
+        led->commits++;
+    }
+#endif
+    led->height = height;
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param led The ledger.
+ */
+void ledger_stats(const struct ledger *led)
+{
+    if (led->path == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "ledger: %lu rows in %lu blocks, %lu errors",
+           led->rows, led->commits, led->errors);
+    printf("ledger: %lu rows in %lu blocks, %lu errors\n", led->rows, led->commits, led->errors);
+    fflush(stdout);
+}
+
+
+/**
+ * Commits the open block and closes the ledger.
+ *
+ * @param led The ledger.
+ */
+void ledger_close(struct ledger *led)
+{
+#ifdef HAVE_SQLITE3
+    if (led->db != NULL) {
+        ledger_block(led, led->height);
+        for (int i = 0; i < LEDGER_STMTS; i++) sqlite3_finalize(led->stmt[i]);
+        sqlite3_close(led->db);
+    }
+#endif
+    free(led->path);
+    memset(led, 0, sizeof(*led));
+}
+
+
+#ifdef HAVE_SQLITE3
+static void failed(struct ledger *led, const char *what)
+{
+    led->errors++;
+    syslog(LOG_USER | LOG_ERR, "ledger %s: %s: %s", led->path, what,
+           led->db != NULL ? sqlite3_errmsg(led->db) : strerror(errno));
+}
+
+
+static void begin(struct ledger *led)
+{
+    if (led->open) return;
+    if (sqlite3_exec(led->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+        failed(led, "begin");
+        return;
+    }
+    led->open = 1;
+}
+
+
+static void bind_text(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key)
+{
+    const char *value = cJSON_GetStringValue(cJSON_GetObjectItem(event, key));
+    if (value != NULL) sqlite3_bind_text(stmt, col, value, -1, SQLITE_TRANSIENT);
+    else sqlite3_bind_null(stmt, col);
+}
+
+
+static void bind_int(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key)
+{
+    const cJSON *value = cJSON_GetObjectItem(event, key);
+    if (cJSON_IsNumber(value)) sqlite3_bind_int64(stmt, col, (sqlite3_int64)value->valuedouble);
+    else sqlite3_bind_null(stmt, col);
+}
+
+
+/* amounts are strings in the events, piconero beyond the 53 bits of a double */
+static void bind_amount(sqlite3_stmt *stmt, int col, const cJSON *event, const char *key)
+{
+    const char *value = cJSON_GetStringValue(cJSON_GetObjectItem(event, key));
+    if (value != NULL) sqlite3_bind_int64(stmt, col, (sqlite3_int64)strtoull(value, NULL, 10));
+    else sqlite3_bind_null(stmt, col);
+}
+
+
+static void step(struct ledger *led, sqlite3_stmt *stmt)
+{
+    if (sqlite3_step(stmt) == SQLITE_DONE) led->rows++;
+    else failed(led, "insert");
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include "./cjson/cJSON.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+enum ledger_stmt {
+    LEDGER_TRANSFER,
+    LEDGER_INVOICE,
+    LEDGER_STATE,
+    LEDGER_STMTS,
+};
+
+struct ledger {
+    struct sqlite3 *db;
+    struct sqlite3_stmt *stmt[LEDGER_STMTS];
+    char *path;
+    long long height;
+    int open;
+    unsigned long rows;
+    unsigned long commits;
+    unsigned long errors;
+};
+
+int ledger_open(struct ledger *led, const char *workdir, const char *file);
+void ledger_record(struct ledger *led, const cJSON *event);
+void ledger_block(struct ledger *led, long long height);
+void ledger_stats(const struct ledger *led);
+void ledger_close(struct ledger *led);
+
+#endif
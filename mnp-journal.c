@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* std. c libraries */
+#include <errno.h>
+#include <getopt.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* system headers */
+#include <syslog.h>
+
+/* third party libraries */
+#include "./inih/ini.h"
+
+/* local headers */
+#include "globaldefs.h"
+#include "journal.h"
+
+/* verbose is extern @ globaldefs.h. Be noisy.*/
+int verbose = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static const struct option options[] = {
+    {"help"         , no_argument      , NULL, 'h'},
+    {"workdir"      , required_argument, NULL, 'w'},
+    {"consumer"     , required_argument, NULL, 'c'},
+    {"seek"         , required_argument, NULL, 's'},
+    {"batch"        , required_argument, NULL, 'b'},
+    {"follow"       , no_argument      , NULL, 'f'},
+    {"version"      , no_argument      , NULL, 'v'},
+    {NULL, 0, NULL, 0}
+};
+
+static char *optstring = "hw:c:s:b:fv";
+static void usage(int status);
+static int handler(void *user, const char *section, const char *name, const char *value);
+static void initshutdown(int);
+static void printmnp(void);
+
+
+/**
+ * Main function to execute the Monero Named Pipes Journal program.
+ *
+ * Prints the events journaled by mnpd as JSON lines, starting at the
+ * stored offset of --consumer or at --seek.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char **argv)
+{
+    /* open syslog /var/log/messages and /var/log/syslog */
+    openlog("mnp-journal:", LOG_PID, LOG_USER);
+
+    /* signal handler for shutdown */
+    signal(SIGHUP, initshutdown);
+    signal(SIGINT, initshutdown);
+    signal(SIGTERM, initshutdown);
+    signal(SIGPIPE, initshutdown);
+
+    /* variables are set by getopt and/or config parser handler()*/
+    int opt, lindex = -1;
+    char *workdir = NULL;
+    char *consumer = NULL;
+    unsigned long long seek = 0;
+    long batch = 1;
+    int follow = 0;
+    int ret = EXIT_SUCCESS;
+
+    /* prepare for reading the config ini file */
+    const char *homedir;
+
+    if ((homedir = getenv("HOME")) == NULL) {
+        homedir = getpwuid(getuid())->pw_dir;
+    }
+
+    char *ini = NULL;
+    asprintf(&ini, "%s/%s", homedir, CONFIG_FILE);
+
+    /* parse config ini file */
+    struct Config config;
+    memset(&config, 0, sizeof config);
+
+    if (ini_parse(ini, handler, &config) < 0) {
+        fprintf(stderr, "can't load %s. try make install.\n", ini);
+        exit(EXIT_FAILURE);
+    }
+    free(ini);
+
+    /* get command line options */
+    while ((opt = getopt_long(argc, argv, optstring, options, &lindex)) != -1) {
+        switch (opt) {
+            case 'h':
+                usage(EXIT_SUCCESS);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'w':
+                workdir = strndup(optarg, MAX_DATA_SIZE);
+                break;
+            case 'c':
+                consumer = strndup(optarg, MAX_DATA_SIZE);
+                break;
+            case 's':
+                seek = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                batch = atol(optarg);
+                if (batch < 1) {
+                    fprintf(stderr, "mnp-journal: --batch must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                follow = 1;
+                break;
+            case 'v':
+                printmnp();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                usage(EXIT_FAILURE);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    /* if no command line option is set - use the config ini file */
+    if (workdir == NULL && config.cfg_workdir != NULL) {
+        workdir = strndup(config.cfg_workdir, MAX_DATA_SIZE);
+    }
+    if (workdir == NULL) {
+        fprintf(stderr, "mnp-journal: workdir is missing\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct journal_reader reader;
+    if (journal_reader_open(&reader, workdir, consumer) < 0) {
+        fprintf(stderr, "mnp-journal: could not open the journal in %s. Is mnpd running?\n", workdir);
+        exit(EXIT_FAILURE);
+    }
+    if (seek > 0 && journal_reader_seek(&reader, seek) < 0) {
+        journal_reader_close(&reader);
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * Events are printed first and the offset is stored after every
+     * --batch events: a consumer that dies in between sees the last
+     * batch again (at-least-once).
+     */
+    long pending = 0;
+    while (running) {
+        uint64_t seq;
+        const char *data;
+        size_t len;
+
+        int retn = journal_reader_next(&reader, &seq, &data, &len, follow ? JOURNAL_SYNC_MS : 0);
+        if (retn < 0) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+        if (retn == 0) {
+            if (pending > 0 && fflush(stdout) == 0 && journal_reader_commit(&reader) == 0) pending = 0;
+            if (!follow) break;
+            continue;
+        }
+
+        fwrite(data, 1, len, stdout);
+        fputc('\n', stdout);
+        if (++pending >= batch) {
+            if (fflush(stdout) != 0) {
+                ret = EXIT_FAILURE;
+                break;
+            }
+            if (journal_reader_commit(&reader) == 0) pending = 0;
+        }
+    }
+
+    if (pending > 0 && ret == EXIT_SUCCESS && fflush(stdout) == 0) journal_reader_commit(&reader);
+    journal_reader_close(&reader);
+    free(workdir);
+    free(consumer);
+    closelog();
+    exit(ret);
+}
+
+
+/**
+ * Prints user help information.
+ *
+ * @param status The status code to determine the output stream (0 for success, non-zero for error).
+ */
+static void usage(int status)
+{
+    int ok = status ? 0 : 1;
+    if (ok)
+    fprintf(stdout,
+    "Usage: mnp-journal [OPTION]\n\n"
+    "  -w, --workdir  [WORKDIR]\n"
+    "               work directory of mnpd.\n\n"
+    "  -c, --consumer [NAME]\n"
+    "               start where NAME left off and remember\n"
+    "               the position. Without NAME start at the\n"
+    "               oldest event.\n\n"
+    "  -s, --seek [SEQ]\n"
+    "               start at event number SEQ (replay).\n\n"
+    "  -b, --batch [N]\n"
+    "               remember the position every N events.\n"
+    "               default = 1.\n\n"
+    "  -f, --follow\n"
+    "               wait for new events.\n\n"
+    "  -v, --version\n"
+    "               Display the version number of mnp.\n\n"
+    "  -h, --help   Display this help message.\n"
+    );
+    else
+    fprintf(stderr,
+    "Use mnp-journal --help for more information\n"
+    "Monero Named Pipes Journal.\n"
+    );
+}
+
+
+/**
+ * Parses the INI file and handles the configuration settings.
+ *
+ * @param user A pointer to the user data structure (Config).
+ * @param section The section name in the INI file.
+ * @param name The name of the setting in the INI file.
+ * @param value The value of the setting in the INI file.
+ * @return 1 on success, 0 on failure.
+ */
+static int handler(void *user, const char *section, const char *name,
+                   const char *value)
+{
+    struct Config *pconfig = (struct Config*)user;
+
+    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+    if (MATCH("cfg", "workdir")) {
+        pconfig->cfg_workdir = strndup(value, MAX_DATA_SIZE);
+    } else {
+        return 0;  /* unknown section/name, error */
+    }
+    return 1;
+}
+
+
+/**
+ * Handles the shutdown signal and stops the main loop.
+ *
+ * @param sig The signal number received.
+ */
+static void initshutdown(int sig)
+{
+    running = 0;
+}
+
+
+/**
+ * Prints the version information of Monero Named Pipes.
+ */
+static void printmnp(void)
+{
+                printf(ANSI_RESET_ALL
+                MONERO_ORANGE "Monero "
+                MONERO_GREY "Named Pipes Journal | "
+                ANSI_RESET_ALL "mnp-journal Version %s\n", VERSION);
+}
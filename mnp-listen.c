@@ -0,0 +1,684 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* std. c libraries */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* system headers */
+#include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/* third party libraries */
+#include "./inih/ini.h"
+#include "./cjson/cJSON.h"
+
+/* local headers */
+#include "globaldefs.h"
+#include "evloop.h"
+#include "txpath.h"
+
+/* verbose is extern @ globaldefs.h. Be noisy.*/
+int verbose = 0;
+
+static volatile sig_atomic_t running = 1;
+
+enum format {
+    FORMAT_JSON,
+    FORMAT_TSV,
+};
+
+struct listen_pipe {
+    struct ev_source src;
+    struct listen_pipe *next;
+    char *path;
+    char *txid;
+    char *name;
+    int alert;
+    long long deadline;
+    size_t len;
+    char buf[MAX_DATA_SIZE];
+};
+
+struct listen_dir {
+    int wd;
+    char *path;
+    char *txid;
+    long long last;
+};
+
+struct listen_shard {
+    int wd;
+    int depth;
+    char *path;
+};
+
+static const struct option options[] = {
+    {"help"         , no_argument      , NULL, 'h'},
+    {"workdir"      , required_argument, NULL, 'w'},
+    {"format"       , required_argument, NULL, 'f'},
+    {"timeout"      , required_argument, NULL, 't'},
+    {"alerts"       , no_argument      , NULL, 'a'},
+    {"verbose"      , no_argument      , NULL, 'V'},
+    {"version"      , no_argument      , NULL, 'v'},
+    {NULL, 0, NULL, 0}
+};
+
+static char *optstring = "hw:f:t:aVv";
+static void usage(int status);
+static int handler(void *user, const char *section, const char *name, const char *value);
+static void initshutdown(int);
+static void printmnp(void);
+static void on_inotify(struct ev_source *src, uint32_t events);
+static void on_pipe(struct ev_source *src, uint32_t events);
+static void on_tick(void *data);
+static void watch_shard(const char *path, int depth);
+static void scan_shard(size_t idx);
+static void watch_dir(const char *path, const char *txid);
+static void scan_dir(size_t idx);
+static void open_pipe(const char *dir, const char *txid, const char *name, int alert);
+static void close_pipe(struct listen_pipe *p);
+static void emit(const char *type, const char *txid, const char *recipient, const char *amount, const char *path);
+
+static struct evloop loop;
+static struct ev_source notify = { -1, on_inotify, NULL };
+static char *workdir = NULL;
+static char *txdir = NULL;
+static int levels = 0;
+static int workdir_wd = -1;
+static enum format format = FORMAT_JSON;
+static long long timeout_ms = LISTEN_TIMEOUT * 1000LL;
+static int alerts = 0;
+static struct listen_pipe *pipes = NULL;
+static struct listen_dir *dirs = NULL;
+static size_t ndirs = 0;
+static struct listen_shard *shards = NULL;
+static size_t nshards = 0;
+
+
+/**
+ * Main function to execute the Monero Named Pipes Listener program.
+ *
+ * Reads every transfer pipe mnp creates below the workdir, including
+ * the ones that already exist, and prints one line per payment. One
+ * inotify instance and one epoll loop replace an inotifywait and a
+ * backgrounded cat per pipe.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return 0 on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char **argv)
+{
+    /* open syslog /var/log/messages and /var/log/syslog */
+    openlog("mnp-listen:", LOG_PID, LOG_USER);
+
+    /* signal handler for shutdown */
+    signal(SIGHUP, initshutdown);
+    signal(SIGINT, initshutdown);
+    signal(SIGTERM, initshutdown);
+    signal(SIGPIPE, initshutdown);
+
+    /* variables are set by getopt and/or config parser handler()*/
+    int opt, lindex = -1;
+
+    /* prepare for reading the config ini file */
+    const char *homedir;
+
+    if ((homedir = getenv("HOME")) == NULL) {
+        homedir = getpwuid(getuid())->pw_dir;
+    }
+
+    char *ini = NULL;
+    asprintf(&ini, "%s/%s", homedir, CONFIG_FILE);
+
+    /* parse config ini file */
+    struct Config config;
+    memset(&config, 0, sizeof config);
+
+    if (ini_parse(ini, handler, &config) < 0) {
+        fprintf(stderr, "can't load %s. try make install.\n", ini);
+        exit(EXIT_FAILURE);
+    }
+    free(ini);
+
+    /* get command line options */
+    while ((opt = getopt_long(argc, argv, optstring, options, &lindex)) != -1) {
+        switch (opt) {
+            case 'h':
+                usage(EXIT_SUCCESS);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'w':
+                workdir = strndup(optarg, MAX_DATA_SIZE);
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0 || strcmp(optarg, "jsonl") == 0) {
+                    format = FORMAT_JSON;
+                } else if (strcmp(optarg, "tsv") == 0) {
+                    format = FORMAT_TSV;
+                } else {
+                    fprintf(stderr, "mnp-listen: --format is json or tsv\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                timeout_ms = atoll(optarg) * 1000LL;
+                break;
+            case 'a':
+                alerts = 1;
+                break;
+            case 'V':
+                verbose = 1;
+                break;
+            case 'v':
+                printmnp();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                usage(EXIT_FAILURE);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    /* if no command line option is set - use the config ini file */
+    if (workdir == NULL && config.cfg_workdir != NULL) {
+        workdir = strndup(config.cfg_workdir, MAX_DATA_SIZE);
+    }
+    if (workdir == NULL) {
+        fprintf(stderr, "mnp-listen: workdir is missing\n");
+        exit(EXIT_FAILURE);
+    }
+    asprintf(&txdir, "%s/%s", workdir, TRANSACTION_DIR);
+    int layout = txpath_layout(config.cfg_layout);
+    if (layout < 0) {
+        fprintf(stderr, "mnp-listen: layout %s is neither flat nor sharded\n", config.cfg_layout);
+        exit(EXIT_FAILURE);
+    }
+    levels = txpath_shards(layout);
+
+    /* one line per event, also when stdout is a pipe */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    notify.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify.fd == -1 || evloop_init(&loop) < 0 || evloop_add(&loop, &notify, EPOLLIN) < 0 ||
+        evloop_tick(&loop, LISTEN_TICK_MS, on_tick, NULL) < 0) {
+        fprintf(stderr, "mnp-listen: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (alerts) {
+        workdir_wd = inotify_add_watch(notify.fd, workdir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+        open_pipe(workdir, NULL, TXID_PIPE, 1);
+        open_pipe(workdir, NULL, DS_ALERT_PIPE, 1);
+        open_pipe(workdir, NULL, RPC_CONN_ALERT, 1);
+    }
+
+    watch_shard(txdir, 0);
+    if (nshards == 0) {
+        fprintf(stderr, "mnp-listen: could not watch %s. try mnp --init.\n", txdir);
+        exit(EXIT_FAILURE);
+    }
+    if (verbose) fprintf(stderr, "mnp-listen: watching %s, %zu transactions\n", txdir, ndirs);
+
+    while (running) evloop_run(&loop, LISTEN_TICK_MS);
+
+    while (pipes != NULL) close_pipe(pipes);
+    for (size_t i = 0; i < ndirs; i++) {
+        free(dirs[i].path);
+        free(dirs[i].txid);
+    }
+    for (size_t i = 0; i < nshards; i++) free(shards[i].path);
+    free(dirs);
+    free(shards);
+    close(notify.fd);
+    evloop_close(&loop);
+    free(txdir);
+    free(workdir);
+    closelog();
+    exit(EXIT_SUCCESS);
+}
+
+
+/**
+ * Handles inotify events: new transaction directories, new pipes in
+ * them and, with --alerts, recreated alert pipes.
+ */
+static void on_inotify(struct ev_source *src, uint32_t events)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    (void)events;
+
+    while ((len = read(src->fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost: look at everything again */
+                for (size_t i = 0; i < nshards; i++) scan_shard(i);
+                for (size_t i = 0; i < ndirs; i++) scan_dir(i);
+                continue;
+            }
+            if (ev->len == 0) {
+                if (ev->mask & IN_IGNORED) {
+                    for (size_t i = 0; i < ndirs; i++) {
+                        if (dirs[i].wd != ev->wd) continue;
+                        free(dirs[i].path);
+                        free(dirs[i].txid);
+                        dirs[i] = dirs[--ndirs];
+                        break;
+                    }
+                    for (size_t i = 0; i < nshards; i++) {
+                        if (shards[i].wd != ev->wd) continue;
+                        free(shards[i].path);
+                        shards[i] = shards[--nshards];
+                        break;
+                    }
+                }
+                continue;
+            }
+
+            size_t i = 0;
+            while (i < nshards && shards[i].wd != ev->wd) i++;
+            if (i < nshards) {
+                if (ev->mask & IN_ISDIR) {
+                    char *path = NULL;
+                    asprintf(&path, "%s/%s", shards[i].path, ev->name);
+                    if (shards[i].depth < levels) watch_shard(path, shards[i].depth + 1);
+                    else watch_dir(path, ev->name);
+                    free(path);
+                }
+            } else if (ev->wd == workdir_wd) {
+                if (strcmp(ev->name, TXID_PIPE) == 0 || strcmp(ev->name, DS_ALERT_PIPE) == 0 ||
+                    strcmp(ev->name, RPC_CONN_ALERT) == 0) {
+                    /* recreated by mnp --init: let go of the old one */
+                    for (struct listen_pipe *p = pipes; p != NULL; p = p->next) {
+                        if (p->alert && strcmp(p->name, ev->name) == 0) {
+                            close_pipe(p);
+                            break;
+                        }
+                    }
+                    open_pipe(workdir, NULL, ev->name, 1);
+                }
+            } else {
+                for (i = 0; i < ndirs; i++) {
+                    if (dirs[i].wd != ev->wd) continue;
+                    dirs[i].last = evloop_now();
+                    open_pipe(dirs[i].path, dirs[i].txid, ev->name, 0);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * Reads a pipe. A transfer pipe is printed when the writer closed it,
+ * alert pipes are kept open and printed line by line.
+ */
+static void on_pipe(struct ev_source *src, uint32_t events)
+{
+    struct listen_pipe *p = src->data;
+    ssize_t n;
+
+    while ((n = read(src->fd, p->buf + p->len, sizeof(p->buf) - 1 - p->len)) > 0) {
+        p->len += n;
+        if (p->len == sizeof(p->buf) - 1) break;
+    }
+    p->buf[p->len] = '\0';
+
+    if (p->alert) {
+        char *line = p->buf;
+        char *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            size_t len = strcspn(line, " ");
+            const char *type = strcmp(p->name, DS_ALERT_PIPE) == 0 ? EV_DOUBLE_SPEND :
+                               strcmp(p->name, RPC_CONN_ALERT) == 0 ? EV_RPC_ALERT : EV_TXID;
+            if (line[len] == ' ') line[len++] = '\0';
+            emit(type, line, line + len, NULL, p->path);
+            line = nl + 1;
+        }
+        /* a line longer than the buffer is cut */
+        p->len = line == p->buf && p->len == sizeof(p->buf) - 1 ? 0 : strlen(line);
+        memmove(p->buf, line, p->len);
+        return;
+    }
+
+    /* HUP: a writer has been there and is gone, the payload is complete */
+    if (events & EPOLLHUP || p->len == sizeof(p->buf) - 1) {
+        if (p->len > 0) {
+            p->buf[strcspn(p->buf, "\n")] = '\0';
+            emit(EV_TRANSFER, p->txid, p->name, p->buf, p->path);
+        }
+        close_pipe(p);
+    }
+}
+
+
+/**
+ * Applies the pipe timeouts and stops watching quiet transaction
+ * directories.
+ */
+static void on_tick(void *data)
+{
+    long long now = evloop_now();
+    (void)data;
+
+    for (struct listen_pipe *p = pipes, *next; p != NULL; p = next) {
+        next = p->next;
+        if (p->deadline > 0 && now >= p->deadline) {
+            syslog(LOG_USER | LOG_ERR, "timeout occurred while reading from %s", p->path);
+            emit("timeout", p->txid, p->name, NULL, p->path);
+            close_pipe(p);
+        }
+    }
+
+    for (size_t i = 0; i < ndirs; i++) {
+        if (now - dirs[i].last < LISTEN_LINGER * 1000LL) continue;
+        int busy = 0;
+        for (struct listen_pipe *p = pipes; p != NULL && !busy; p = p->next) {
+            busy = p->txid != NULL && strcmp(p->txid, dirs[i].txid) == 0;
+        }
+        /* IN_IGNORED removes the entry */
+        if (!busy) inotify_rm_watch(notify.fd, dirs[i].wd);
+        dirs[i].last = now;
+    }
+}
+
+
+/**
+ * Watches a shard directory of the transactions tree and whatever is in it.
+ * Depth 0 is the transactions directory itself; at the last depth the
+ * children are transaction directories.
+ */
+static void watch_shard(const char *path, int depth)
+{
+    for (size_t i = 0; i < nshards; i++) {
+        if (strcmp(shards[i].path, path) == 0) return;
+    }
+
+    int wd = inotify_add_watch(notify.fd, path, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd == -1) {
+        if (errno != ENOENT && errno != ENOTDIR) fprintf(stderr, "mnp-listen: could not watch %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    struct listen_shard *s = realloc(shards, (nshards + 1) * sizeof(struct listen_shard));
+    if (s == NULL) {
+        inotify_rm_watch(notify.fd, wd);
+        return;
+    }
+    shards = s;
+    shards[nshards].wd = wd;
+    shards[nshards].depth = depth;
+    shards[nshards].path = strdup(path);
+    nshards++;
+
+    scan_shard(nshards - 1);
+}
+
+
+static void scan_shard(size_t idx)
+{
+    /* watch_shard may move the array, keep copies */
+    char *path = strdup(shards[idx].path);
+    int depth = shards[idx].depth;
+
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+            char *child = NULL;
+            asprintf(&child, "%s/%s", path, de->d_name);
+            if (depth < levels) watch_shard(child, depth + 1);
+            else watch_dir(child, de->d_name);
+            free(child);
+        }
+        closedir(dir);
+    }
+    free(path);
+}
+
+
+/**
+ * Watches a transaction directory for pipes and reads the ones in it.
+ * Old directories without pipes are not watched.
+ */
+static void watch_dir(const char *path, const char *txid)
+{
+    struct stat sb;
+
+    for (size_t i = 0; i < ndirs; i++) {
+        if (strcmp(dirs[i].path, path) == 0) return;
+    }
+
+    int wd = inotify_add_watch(notify.fd, path, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd == -1) {
+        if (errno != ENOENT && errno != ENOTDIR) fprintf(stderr, "mnp-listen: could not watch %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    struct listen_dir *d = realloc(dirs, (ndirs + 1) * sizeof(struct listen_dir));
+    if (d == NULL) {
+        inotify_rm_watch(notify.fd, wd);
+        return;
+    }
+    dirs = d;
+    dirs[ndirs].wd = wd;
+    dirs[ndirs].path = strdup(path);
+    dirs[ndirs].txid = strdup(txid);
+    dirs[ndirs].last = evloop_now();
+    if (stat(path, &sb) == 0 && time(NULL) - sb.st_mtime > LISTEN_LINGER) {
+        dirs[ndirs].last -= LISTEN_LINGER * 1000LL;
+    }
+    ndirs++;
+
+    scan_dir(ndirs - 1);
+}
+
+
+static void scan_dir(size_t idx)
+{
+    DIR *dir = opendir(dirs[idx].path);
+    if (dir != NULL) {
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            if (de->d_type == DT_FIFO || de->d_type == DT_UNKNOWN) open_pipe(dirs[idx].path, dirs[idx].txid, de->d_name, 0);
+        }
+        closedir(dir);
+    }
+}
+
+
+static void open_pipe(const char *dir, const char *txid, const char *name, int alert)
+{
+    struct listen_pipe *p;
+    char *path = NULL;
+    struct stat sb;
+
+    asprintf(&path, "%s/%s", dir, name);
+    for (p = pipes; p != NULL; p = p->next) {
+        if (strcmp(p->path, path) == 0) {
+            free(path);
+            return;
+        }
+    }
+    if (lstat(path, &sb) == -1 || !S_ISFIFO(sb.st_mode)) {
+        free(path);
+        return;
+    }
+
+    p = calloc(1, sizeof(struct listen_pipe));
+    if (p == NULL) {
+        free(path);
+        return;
+    }
+
+    /*
+     * Transfer pipes are opened for reading only, so the end of the
+     * writer shows as HUP. Alert pipes get a new message per writer
+     * and are held open read-write: they never see EOF.
+     */
+    p->src.fd = open(path, (alert ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+    p->src.handler = on_pipe;
+    p->src.data = p;
+    if (p->src.fd == -1 || evloop_add(&loop, &p->src, EPOLLIN) < 0) {
+        fprintf(stderr, "mnp-listen: could not open %s: %s\n", path, strerror(errno));
+        if (p->src.fd >= 0) close(p->src.fd);
+        free(p);
+        free(path);
+        return;
+    }
+    p->path = path;
+    p->txid = txid != NULL ? strdup(txid) : NULL;
+    p->name = strdup(name);
+    p->alert = alert;
+    p->deadline = !alert && timeout_ms > 0 ? evloop_now() + timeout_ms : 0;
+    p->next = pipes;
+    pipes = p;
+
+    if (verbose) fprintf(stderr, "mnp-listen: reading %s\n", path);
+}
+
+
+static void close_pipe(struct listen_pipe *p)
+{
+    struct listen_pipe **pp = &pipes;
+
+    while (*pp != p) pp = &(*pp)->next;
+    *pp = p->next;
+
+    evloop_del(&loop, &p->src);
+    close(p->src.fd);
+    free(p->path);
+    free(p->txid);
+    free(p->name);
+    free(p);
+}
+
+
+/* one line per event, the fields are named like the events of mnpd */
+static void emit(const char *type, const char *txid, const char *recipient, const char *amount, const char *path)
+{
+    if (format == FORMAT_TSV) {
+        printf("%s\t%s\t%s\t%s\t%s\n", type, txid ? txid : "", recipient ? recipient : "",
+               amount ? amount : "", path);
+        return;
+    }
+
+    cJSON *event = cJSON_CreateObject();
+    cJSON_AddStringToObject(event, "type", type);
+    if (txid != NULL) cJSON_AddStringToObject(event, "txid", txid);
+    if (recipient != NULL && *recipient) cJSON_AddStringToObject(event, "recipient", recipient);
+    if (amount != NULL) cJSON_AddStringToObject(event, "amount", amount);
+    cJSON_AddStringToObject(event, "path", path);
+    char *line = cJSON_PrintUnformatted(event);
+    if (line != NULL) puts(line);
+    free(line);
+    cJSON_Delete(event);
+}
+
+
+static void usage(int status)
+{
+    int ok = status ? 0 : 1;
+    if (ok)
+    fprintf(stdout,
+    "Usage: mnp-listen [OPTION]\n\n"
+    "  -w, --workdir  [WORKDIR]\n"
+    "               work directory of mnp.\n\n"
+    "  -f, --format [json|tsv]\n"
+    "               one JSON object per line or tab separated\n"
+    "               type, txid, recipient, amount and path.\n"
+    "               default = json.\n\n"
+    "  -t, --timeout [SECONDS]\n"
+    "               give up a pipe that is not written after\n"
+    "               SECONDS. 0 = wait forever. default = 7500.\n\n"
+    "  -a, --alerts\n"
+    "               also read the txid, double_spend_alert and\n"
+    "               rpc_connection_alert pipes.\n\n"
+    "  -V, --verbose\n"
+    "               report watched pipes on stderr.\n\n"
+    "  -v, --version\n"
+    "               Display the version number of mnp.\n\n"
+    "  -h, --help   Display this help message.\n"
+    );
+    else
+    fprintf(stderr,
+    "Use mnp-listen --help for more information\n"
+    "Monero Named Pipes Listener.\n"
+    );
+}
+
+
+static int handler(void *user, const char *section, const char *name,
+                   const char *value)
+{
+    struct Config *pconfig = (struct Config*)user;
+
+    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+    if (MATCH("cfg", "workdir")) {
+        pconfig->cfg_workdir = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "layout")) {
+        pconfig->cfg_layout = strndup(value, MAX_DATA_SIZE);
+    } else {
+        return 0;  /* unknown section/name, error */
+    }
+    return 1;
+}
+
+
+static void initshutdown(int sig)
+{
+    running = 0;
+}
+
+
+static void printmnp(void)
+{
+                printf(ANSI_RESET_ALL
+                MONERO_ORANGE "Monero "
+                MONERO_GREY "Named Pipes Listener | "
+                ANSI_RESET_ALL "mnp-listen Version %s\n", VERSION);
+}
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* system headers */
@@ -48,12 +49,54 @@
 #include "./inih/ini.h"
 
 /* local headers */
+#include "address.h"
+#include "addrpool.h"
 #include "delquotes.h"
+#include "expect.h"
 #include "globaldefs.h"
+#include "evloop.h"
+#include "ipc.h"
+#include "paysrv.h"
 #include "rpc_call.h"
+#include "subaddr.h"
 #include "validate.h"
 #include "wallet.h"
 
+int verbose = 0;
+
+/* local subaddress derivation, set up if [mnppayment] view_key is set */
+static struct subaddr deriver;
+static int derive = 0;
+
+/* subaddresses the wallet told, they never change */
+static struct {
+    long account;
+    long index;
+    char address[MAX_ADDR_SIZE];
+} known[SUBADDR_CACHE];
+
+static volatile sig_atomic_t running = 1;
+
+/* one line of mnp-payment --batch */
+struct request {
+    char payid[MAX_PAYID_SIZE + 1];
+    char *amount;
+    long count;
+    long subaddr;
+    const char *error;
+};
+
+/* what mnp-payment --serve keeps warm between requests */
+struct server {
+    struct rpc_wallet *monero_wallet;
+    struct expect *ex;
+    const char *workdir;
+    const char *account;
+    const char *amount;
+    long expire;
+    char *standard;
+};
+
 static const struct option options[] = {
     {"help"         , no_argument      , NULL, 'h'},
     {"rpc_user"     , required_argument, NULL, 'u'},
@@ -66,15 +109,40 @@ static const struct option options[] = {
     {"newaddr"      , no_argument      , NULL, 'n'},
     {"version"      , no_argument      , NULL, 'v'},
     {"list"         , no_argument      , NULL, 'l'},
+    {"expire"       , required_argument, NULL, 'e'},
+    {"workdir"      , required_argument, NULL, 'w'},
+    {"batch"        , no_argument      , NULL, 'b'},
+    {"derive"       , required_argument, NULL, 'd'},
+    {"selftest"     , no_argument      , NULL, 't'},
+    {"serve"        , no_argument      , NULL, 'S'},
     {NULL, 0, NULL, 0}
 };
 
 static int handler(void *user, const char *section,
                    const char *name, const char *value);
-static char *optstring = "hu:r:i:p:a:x:s:nvl";
+static char *optstring = "hu:r:i:p:a:x:s:nvle:w:bd:tS";
 static void usage(int status);
 static void printmnp(void);
 static char *readStdin(void);
+static char *make_uri(const char *address, const char *amount);
+static void register_payment(struct expect *ex, const char *workdir, const char *payment_id,
+                             const char *account, long subaddr, const char *amount, long expire);
+static int batch(struct rpc_wallet *monero_wallet, const char *workdir, const char *account,
+                 const char *amount, long expire, char *standard);
+static int serve(struct rpc_wallet *monero_wallet, const char *workdir, const char *account,
+                 const char *amount, long expire, char *standard);
+static void answer(void *data, char **line, size_t n, FILE *out);
+static void initshutdown(int);
+static void parse_request(char *line, const char *amount, struct request *req);
+static int lookup_subaddr(struct rpc_wallet *monero_wallet, const char *workdir, const char *account, long index,
+                          char *address);
+static void hand_out(struct expect *ex, const char *workdir, const char *address, const char *account,
+                     long subaddr, const char *amount, long expire);
+static int derive_range(const char *account, const char *range);
+static int selftest(struct rpc_wallet *monero_wallet, const char *account);
+static int run_requests(struct rpc_wallet *monero_wallet, struct expect *ex, const char *workdir,
+                        const char *account, long expire, char *standard, struct request *req, size_t n,
+                        FILE *out);
 
 
 /**
@@ -95,9 +163,15 @@ int main(int argc, char **argv)
     char *account = NULL;
     char *amount = NULL;
     char *paymentId = NULL;
+    char *workdir = NULL;
+    long expire = EXPECT_EXPIRE;
     int subaddr = -1;
     int list = 0;
     int new = 0;
+    int bulk = 0;
+    int test = 0;
+    int server = 0;
+    char *range = NULL;
     int ret = 0;
 
     /* prepare for reading the config ini file */
@@ -114,6 +188,7 @@ int main(int argc, char **argv)
 
     /* parse config ini file */
     struct Config config;
+    memset(&config, 0, sizeof config);
 
     if (ini_parse(ini, handler, &config) < 0) {
         fprintf(stderr, "can't load %s. try make install.\n", ini);
@@ -156,6 +231,28 @@ int main(int argc, char **argv)
             case 'n':
                 new = 1;
                 break;
+            case 'b':
+                bulk = 1;
+                break;
+            case 'd':
+                range = strndup(optarg, MAX_DATA_SIZE);
+                break;
+            case 't':
+                test = 1;
+                break;
+            case 'S':
+                server = 1;
+                break;
+            case 'e':
+                expire = atol(optarg);
+                if (expire < 0) {
+                    fprintf(stderr, "Invalid expire\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                workdir = strndup(optarg, MAX_DATA_SIZE);
+                break;
             case 'x':
                 amount = strndup(optarg, MAX_DATA_SIZE);
                 int val = val_amount(amount);
@@ -182,22 +279,48 @@ int main(int argc, char **argv)
         rpc_host = strndup(config.rpc_host, MAX_DATA_SIZE);
     } if (rpc_port == NULL) {
         rpc_port = strndup(config.rpc_port, MAX_DATA_SIZE);
+    } if (workdir == NULL && config.cfg_workdir != NULL) {
+        workdir = strndup(config.cfg_workdir, MAX_DATA_SIZE);
     }
 
-    if (!(list == 1 || (subaddr >= 0) || (new == 1))) {
+    if (!(list == 1 || (subaddr >= 0) || (new == 1) || (bulk == 1) || (range != NULL) || (test == 1) || (server == 1))) {
         if (optind < argc) {
             paymentId = (char *)argv[optind];
         }
         if (paymentId == NULL) {
             paymentId = readStdin();
         }
-        int valid = val_hex_input(paymentId, MAX_PAYID_SIZE);
+        int valid = val_payment_id(paymentId);
         if (valid < 0) {
             fprintf(stderr, "Invalid payment Id\n");
             exit(EXIT_FAILURE);
         }
     }
 
+    /* with the primary address integrated addresses need no wallet */
+    char standard[MAX_ADDR_SIZE] = "";
+    if (config.mnppayment_address != NULL && config.mnppayment_address[0] != '\0') {
+        struct address primary;
+        if (address_decode(config.mnppayment_address, &primary) < 0 || primary.type != ADDRESS_STANDARD) {
+            fprintf(stderr, "Invalid address in [mnppayment]. a standard address is needed\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(standard, sizeof(standard), "%s", config.mnppayment_address);
+    }
+
+    /* with the private view key as well subaddresses need no wallet either */
+    if (config.mnppayment_view_key != NULL && config.mnppayment_view_key[0] != '\0') {
+        if (subaddr_init(&deriver, standard, config.mnppayment_view_key) < 0) {
+            fprintf(stderr, "Invalid view_key in [mnppayment]. it has to belong to the address\n");
+            exit(EXIT_FAILURE);
+        }
+        derive = 1;
+    }
+    if ((range != NULL || test == 1) && derive == 0) {
+        fprintf(stderr, "--derive and --selftest need address and view_key in [mnppayment]\n");
+        exit(EXIT_FAILURE);
+    }
+
     struct rpc_wallet *monero_wallet = (struct rpc_wallet*)malloc(END_RPC_SIZE * sizeof(struct rpc_wallet));
 
     /* initialise monero_wallet with NULL */
@@ -212,6 +335,7 @@ int main(int argc, char **argv)
         monero_wallet[i].payid = NULL;
         monero_wallet[i].saddr = NULL;
         monero_wallet[i].idx = 0;
+        monero_wallet[i].min_height = 0;
         monero_wallet[i].reply = NULL;
     }
 
@@ -251,6 +375,37 @@ int main(int argc, char **argv)
     /* if no account is set - use the default account 0 */
     if (account == NULL) asprintf(&account, "0");
 
+    /* mnp-payment --derive 0-9999, no wallet at all */
+    if (range != NULL) {
+        ret = derive_range(account, range);
+        subaddr_wipe(&deriver);
+        return ret < 0 ? EXIT_FAILURE : 0;
+    }
+
+    /* mnp-payment --selftest */
+    if (test == 1) {
+        ret = selftest(monero_wallet, account);
+        subaddr_wipe(&deriver);
+        return ret < 0 ? EXIT_FAILURE : 0;
+    }
+
+    /* mnp-payment --serve, requests on .mnp-payment.sock */
+    if (server == 1) {
+        ret = serve(monero_wallet, workdir, account, amount, expire, standard);
+        subaddr_wipe(&deriver);
+        free(monero_wallet);
+        free(account);
+        return ret < 0 ? EXIT_FAILURE : 0;
+    }
+
+    /* mnp-payment --batch < requests */
+    if (bulk == 1) {
+        ret = batch(monero_wallet, workdir, account, amount, expire, standard);
+        free(monero_wallet);
+        free(account);
+        return ret < 0 ? EXIT_FAILURE : 0;
+    }
+
     /* mnp-payment --list */
     if (list == 1) {
           if (0 > (ret = rpc_call(&monero_wallet[GET_LIST]))) {
@@ -280,7 +435,19 @@ int main(int argc, char **argv)
      * mnp-payment --amount 10 --subaddr 1
      * returns uri with subaddress at idx 1 + amount
      */
-    if (subaddr >= 0) {
+    if (subaddr >= 0 && derive == 1) {
+        char local[MAX_ADDR_SIZE];
+        int known = subaddr_known(workdir, monero_wallet, (uint32_t)subaddr);
+        if (known == 0) {
+            fprintf(stderr, "subaddress %d was never handed out, the wallet does not watch it\n", subaddr);
+            exit(EXIT_FAILURE);
+        }
+        if (known < 0 || subaddr_derive(&deriver, (uint32_t)atol(account), (uint32_t)subaddr, local, sizeof(local)) < 0) {
+            fprintf(stderr, "could not derive subaddress %d\n", subaddr);
+            exit(EXIT_FAILURE);
+        }
+        hand_out(NULL, workdir, local, account, subaddr, amount, expire);
+    } else if (subaddr >= 0) {
           monero_wallet[GET_SUBADDR].idx = subaddr;
 
           if (0 > (ret = rpc_call(&monero_wallet[GET_SUBADDR]))) {
@@ -311,6 +478,7 @@ int main(int argc, char **argv)
             cJSON *uri = cJSON_GetObjectItem(result, "uri");
 
             fprintf(stdout, "%s\n", delQuotes(cJSON_Print(uri)));
+            register_payment(NULL, workdir, NULL, account, subaddr, amount, expire);
         }
     }
 
@@ -320,7 +488,34 @@ int main(int argc, char **argv)
      * mnp-payment --amount 10 --newaddr
      * returns uri with new subaddress, amount
      */
-    if (new == 1) {
+    if (new == 1 && derive == 1) {
+        char local[MAX_ADDR_SIZE];
+        uint32_t index = 0;
+        if (subaddr_next(workdir, monero_wallet, 1, &index) < 0 ||
+            subaddr_derive(&deriver, (uint32_t)atol(account), index, local, sizeof(local)) < 0) {
+            fprintf(stderr, "could not take a new subaddress index in %s. try mnp --init.\n", workdir ?: "");
+            exit(EXIT_FAILURE);
+        }
+        hand_out(NULL, workdir, local, account, index, amount, expire);
+    } else if (new == 1) {
+        char pooled[MAX_ADDR_SIZE];
+        long pooled_index = -1;
+
+        /* taken from the pool mnpd keeps ready, no wallet call at all */
+        if (addrpool_pop(workdir, atol(account), &pooled_index, pooled) == 1) {
+            if (amount == NULL) {
+                fprintf(stdout, "%s\n", pooled);
+            } else {
+                char *uri = make_uri(pooled, amount);
+                fprintf(stdout, "%s\n", uri);
+                free(uri);
+                register_payment(NULL, workdir, NULL, account, pooled_index, amount, expire);
+            }
+            free(monero_wallet);
+            free(account);
+            return 0;
+        }
+
         if (0 > (ret = rpc_call(&monero_wallet[NEW_SUBADDR]))) {
             fprintf(stderr, "could not connect to host: %s:%s\n", monero_wallet[NEW_SUBADDR].host,
                                                                   monero_wallet[NEW_SUBADDR].port);
@@ -328,6 +523,7 @@ int main(int argc, char **argv)
         }
         cJSON *result = cJSON_GetObjectItem(monero_wallet[NEW_SUBADDR].reply, "result");
         cJSON *address = cJSON_GetObjectItem(result, "address");
+        cJSON *address_index = cJSON_GetObjectItem(result, "address_index");
         char *retaddr = delQuotes(cJSON_Print(address));
         monero_wallet[MK_URI].saddr = strndup(retaddr, MAX_ADDR_SIZE);
 
@@ -346,6 +542,9 @@ int main(int argc, char **argv)
             cJSON *uri = cJSON_GetObjectItem(result, "uri");
 
             fprintf(stdout, "%s\n", delQuotes(cJSON_Print(uri)));
+            if (cJSON_IsNumber(address_index)) {
+                register_payment(NULL, workdir, NULL, account, (long)address_index->valuedouble, amount, expire);
+            }
         }
     }
 
@@ -355,8 +554,22 @@ int main(int argc, char **argv)
      * mnp-payment --amount 10 1234567890abcdef
      * returns uri with new integrated adddress + paymentid + amount
      */
-    if (paymentId != NULL) {
-        if (val_hex_input(paymentId, MAX_PAYID_SIZE) < 0) {
+    if (paymentId != NULL && standard[0] != '\0') {
+        char iaddr[MAX_IADDR_SIZE + 1];
+        if (address_integrate(standard, paymentId, iaddr, sizeof(iaddr)) < 0) {
+            fprintf(stderr, "Invalid payment Id. (16 characters hex)\n");
+            exit(EXIT_FAILURE);
+        }
+        if (amount == NULL) {
+            fprintf(stdout, "%s\n", iaddr);
+        } else {
+            char *uri = make_uri(iaddr, amount);
+            fprintf(stdout, "%s\n", uri);
+            free(uri);
+            register_payment(NULL, workdir, paymentId, account, -1, amount, expire);
+        }
+    } else if (paymentId != NULL) {
+        if (val_payment_id(paymentId) < 0) {
             fprintf(stderr, "Invalid payment Id. (16 characters hex)\n");
             exit(EXIT_FAILURE);
         }
@@ -388,6 +601,7 @@ int main(int argc, char **argv)
             cJSON *uri = cJSON_GetObjectItem(result, "uri");
 
             fprintf(stdout, "%s\n", delQuotes(cJSON_Print(uri)));
+            register_payment(NULL, workdir, paymentId, account, -1, amount, expire);
         }
     }
 
@@ -424,6 +638,549 @@ static char *readStdin(void)
 }
 
 
+/**
+ * Builds the URI make_uri of the wallet returns for a subaddress and
+ * an amount, without asking it: tx_amount is in XMR with 12 decimals.
+ *
+ * @param address The subaddress.
+ * @param amount Amount in piconero.
+ * @return The URI, to be freed by the caller.
+ */
+static char *make_uri(const char *address, const char *amount)
+{
+    unsigned long long pico = strtoull(amount, NULL, 10);
+    char *uri = NULL;
+
+    if (asprintf(&uri, "monero:%s?tx_amount=%llu.%012llu", address, pico / 1000000000000ULL,
+                 pico % 1000000000000ULL) == -1) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    return uri;
+}
+
+
+/**
+ * Answers a stream of requests on stdin, one per line, in input order:
+ *
+ *   PAYMENT_ID [AMOUNT]   integrated address, or its URI
+ *   newaddr [AMOUNT]      fresh subaddress, or its URI
+ *   newaddr *COUNT        COUNT fresh subaddresses
+ *   subaddr INDEX [AMOUNT] subaddress at INDEX, or its URI
+ *
+ * A line without an amount takes the one of --amount. Lines are read
+ * in chunks of PAYMENT_BATCH. The subaddresses of a chunk come from the
+ * pool of mnpd first, then from as few create_address calls as the
+ * wallet allows; all calls share one connection to the wallet and the
+ * URIs are built here. Integrated addresses are encoded here as well,
+ * from the primary address of the config, or else of the first one the
+ * wallet made. A request that fails prints "error: ..." in its
+ * place, so the output stays aligned with the input.
+ *
+ * @param monero_wallet The rpc calls.
+ * @param workdir The work directory, NULL to register nothing.
+ * @param account Account of the subaddresses.
+ * @param amount Amount of lines without one, or NULL.
+ * @param expire Seconds until a registered payment is due, 0 = never.
+ * @param standard Primary address, "" if unknown, MAX_ADDR_SIZE bytes.
+ * @return 0 on success, -1 if a request failed.
+ */
+static int batch(struct rpc_wallet *monero_wallet, const char *workdir, const char *account,
+                 const char *amount, long expire, char *standard)
+{
+    struct request req[PAYMENT_BATCH];
+    struct expect ex;
+    struct expect *exp = NULL;
+    char *line = NULL;
+    size_t len = 0;
+    size_t n = 0;
+    int failed = 0;
+
+    if (wallet_keepalive(1) < 0) {
+        fprintf(stderr, "mnp-payment: could not set up the wallet connection\n");
+        return -1;
+    }
+    if (workdir != NULL && expect_open(&ex, workdir) == 0) exp = &ex;
+    else if (workdir != NULL) fprintf(stderr, "mnp-payment: could not register the payments in %s. try mnp --init.\n", workdir);
+
+    for (;;) {
+        ssize_t got = getline(&line, &len, stdin);
+        if (got != -1) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[strspn(line, " \t")] == '\0') continue;
+            parse_request(line, amount, &req[n++]);
+        }
+        if (n == PAYMENT_BATCH || (got == -1 && n > 0)) {
+            failed |= run_requests(monero_wallet, exp, workdir, account, expire, standard, req, n, stdout);
+            for (size_t i = 0; i < n; i++) free(req[i].amount);
+            n = 0;
+        }
+        if (got == -1) break;
+    }
+
+    free(line);
+    if (exp != NULL) expect_close(exp);
+    wallet_keepalive(0);
+    return failed ? -1 : 0;
+}
+
+
+/**
+ * Answers requests on .mnp-payment.sock in the workdir until SIGINT or
+ * SIGTERM. A client writes the lines of --batch, plus
+ *
+ *   subaddr INDEX [AMOUNT]
+ *
+ * and reads one line per address in return. The wallet connection, the
+ * payment registry, the primary address and the subaddresses the wallet
+ * told stay open and cached for all clients, so a request costs one
+ * round trip on the socket instead of a process start.
+ *
+ * @param monero_wallet The rpc calls.
+ * @param workdir The work directory.
+ * @param account Account of the subaddresses.
+ * @param amount Amount of lines without one, or NULL.
+ * @param expire Seconds until a registered payment is due, 0 = never.
+ * @param standard Primary address, "" if unknown, MAX_ADDR_SIZE bytes.
+ * @return 0 on a clean shutdown, -1 if the socket could not be set up.
+ */
+static int serve(struct rpc_wallet *monero_wallet, const char *workdir, const char *account,
+                 const char *amount, long expire, char *standard)
+{
+    struct evloop loop;
+    struct paysrv srv;
+    struct expect ex;
+    struct server ctx = { monero_wallet, NULL, workdir, account, amount, expire, standard };
+
+    if (workdir == NULL) {
+        fprintf(stderr, "mnp-payment: --serve needs the workdir\n");
+        return -1;
+    }
+    if (wallet_keepalive(1) < 0) {
+        fprintf(stderr, "mnp-payment: could not set up the wallet connection\n");
+        return -1;
+    }
+    if (expect_open(&ex, workdir) == 0) ctx.ex = &ex;
+    else fprintf(stderr, "mnp-payment: could not register the payments in %s. try mnp --init.\n", workdir);
+
+    if (evloop_init(&loop) < 0 ||
+        paysrv_init(&srv, &loop, workdir, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP, PAY_MAX_CLIENTS, answer, &ctx) < 0) {
+        fprintf(stderr, "mnp-payment: could not listen on %s/%s\n", workdir, PAY_SOCKET);
+        if (ctx.ex != NULL) expect_close(ctx.ex);
+        wallet_keepalive(0);
+        return -1;
+    }
+
+    signal(SIGINT, initshutdown);
+    signal(SIGTERM, initshutdown);
+    signal(SIGHUP, initshutdown);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stdout, "Listening on %s/%s\n", workdir, PAY_SOCKET);
+    fflush(stdout);
+
+    while (running) evloop_run(&loop, 1000);
+
+    if (verbose) paysrv_stats(&srv);
+    paysrv_close(&srv);
+    evloop_close(&loop);
+    if (ctx.ex != NULL) expect_close(ctx.ex);
+    wallet_keepalive(0);
+    return 0;
+}
+
+
+/* paysrv_answer of --serve: the lines of one read as one --batch chunk */
+static void answer(void *data, char **line, size_t n, FILE *out)
+{
+    struct server *ctx = data;
+    struct request req[PAYMENT_BATCH];
+    size_t used = 0;
+
+    for (size_t i = 0; i < n && used < PAYMENT_BATCH; i++) {
+        if (line[i][strspn(line[i], " \t")] == '\0') continue;
+        parse_request(line[i], ctx->amount, &req[used++]);
+    }
+    if (used == 0) return;
+    run_requests(ctx->monero_wallet, ctx->ex, ctx->workdir, ctx->account, ctx->expire, ctx->standard,
+                 req, used, out);
+    for (size_t i = 0; i < used; i++) free(req[i].amount);
+}
+
+
+/* splits a --batch line into its request, error set if it is none */
+static void parse_request(char *line, const char *amount, struct request *req)
+{
+    char *save = NULL;
+    char *first = strtok_r(line, " \t", &save);
+    char *second = strtok_r(NULL, " \t", &save);
+
+    memset(req, 0, sizeof(*req));
+    req->count = 1;
+    req->subaddr = -1;
+    if (strcmp(first, "subaddr") == 0) {
+        /* subaddr INDEX [AMOUNT] */
+        req->subaddr = second != NULL && val_amount(second) == 0 ? atol(second) : -1;
+        if (req->subaddr < 0 || req->subaddr > UINT32_MAX) {
+            req->error = "invalid subaddress index";
+            return;
+        }
+        second = strtok_r(NULL, " \t", &save);
+    }
+    if (strtok_r(NULL, " \t", &save) != NULL) {
+        req->error = "too many fields";
+        return;
+    }
+    if (req->subaddr >= 0) {
+        /* NOP */
+    } else if (strcmp(first, "newaddr") == 0) {
+        if (second != NULL && second[0] == '*') {
+            req->count = val_amount(second + 1) == 0 ? atol(second + 1) : 0;
+            if (req->count < 1 || req->count > BATCH_ADDR_MAX) req->error = "invalid count";
+            second = NULL;
+            if (req->error != NULL || amount == NULL) return;
+        }
+    } else if (val_payment_id(first) == 0) {
+        snprintf(req->payid, sizeof(req->payid), "%s", first);
+    } else {
+        req->error = "invalid payment id";
+        return;
+    }
+    if (second != NULL && (second[0] == '\0' || val_amount(second) < 0)) {
+        req->error = "invalid amount";
+        return;
+    }
+    if (second != NULL) req->amount = strndup(second, MAX_DATA_SIZE);
+    else if (amount != NULL) req->amount = strndup(amount, MAX_DATA_SIZE);
+}
+
+
+/*
+ * the subaddress at index: derived, cached, or asked from the wallet; -1 if there is none.
+ * A derived one must be known to the wallet, as for --subaddr.
+ */
+static int lookup_subaddr(struct rpc_wallet *monero_wallet, const char *workdir, const char *account, long index,
+                          char *address)
+{
+    long major = atol(account);
+
+    if (derive == 1) {
+        if (subaddr_known(workdir, monero_wallet, (uint32_t)index) != 1) return -1;
+        return subaddr_derive(&deriver, (uint32_t)major, (uint32_t)index, address, MAX_ADDR_SIZE);
+    }
+
+    size_t slot = (size_t)index % SUBADDR_CACHE;
+    if (known[slot].address[0] != '\0' && known[slot].account == major && known[slot].index == index) {
+        memcpy(address, known[slot].address, MAX_ADDR_SIZE);
+        return 0;
+    }
+
+    struct rpc_wallet *rpc = &monero_wallet[GET_SUBADDR];
+    rpc->idx = (int)index;
+    int ret = rpc_call(rpc);
+    rpc->idx = 0;
+    if (ret < 0) {
+        /* rpc_call has freed the error part of a failed reply already */
+        rpc->reply = NULL;
+        return -1;
+    }
+    const cJSON *addresses = cJSON_GetObjectItem(cJSON_GetObjectItem(rpc->reply, "result"), "addresses");
+    const char *found = cJSON_GetStringValue(cJSON_GetObjectItem(cJSON_GetArrayItem(addresses, 0), "address"));
+    struct address check;
+    ret = found != NULL && address_decode(found, &check) == 0 ? 0 : -1;
+    if (ret == 0) {
+        snprintf(address, MAX_ADDR_SIZE, "%s", found);
+        known[slot].account = major;
+        known[slot].index = index;
+        memcpy(known[slot].address, address, MAX_ADDR_SIZE);
+    }
+    cJSON_Delete(rpc->reply);
+    rpc->reply = NULL;
+    return ret;
+}
+
+
+/* answers one chunk of --batch in input order to out, 1 if a request failed */
+static int run_requests(struct rpc_wallet *monero_wallet, struct expect *ex, const char *workdir,
+                        const char *account, long expire, char *standard, struct request *req, size_t n,
+                        FILE *out)
+{
+    struct rpc_wallet *rpc = &monero_wallet[NEW_SUBADDR];
+    long total = 0, got = 0, next = 0;
+    int failed = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (req[i].error == NULL && req[i].payid[0] == '\0' && req[i].subaddr < 0) total += req[i].count;
+    }
+    char (*addr)[MAX_ADDR_SIZE] = total > 0 ? malloc(total * sizeof(*addr)) : NULL;
+    long *index = total > 0 ? malloc(total * sizeof(*index)) : NULL;
+    if (total > 0 && (addr == NULL || index == NULL)) total = 0;
+
+    /* all subaddresses of the chunk up front: derived, or pool first, then in bulk;
+     * derived no more than the wallet looks ahead, subaddr_next tells it in between */
+    while (got < total && derive == 1) {
+        long n = total - got > SUBADDR_LOOKAHEAD ? SUBADDR_LOOKAHEAD : total - got;
+        uint32_t base = 0;
+        if (subaddr_next(workdir, monero_wallet, (uint32_t)n, &base) < 0 ||
+            subaddr_bulk(&deriver, (uint32_t)atol(account), base, (size_t)n, addr + got) < 0) {
+            total = got;
+            break;
+        }
+        for (long i = 0; i < n; i++) index[got + i] = (long)base + i;
+        got += n;
+    }
+    while (got < total && addrpool_pop(workdir, atol(account), &index[got], addr[got]) == 1) got++;
+    while (got < total) {
+        rpc->idx = total - got > ADDR_POOL_BATCH ? ADDR_POOL_BATCH : (int)(total - got);
+        if (rpc_call(rpc) < 0) {
+            /* rpc_call has freed the error part of a failed reply already */
+            rpc->reply = NULL;
+            break;
+        }
+        cJSON *result = cJSON_GetObjectItem(rpc->reply, "result");
+        cJSON *addresses = cJSON_GetObjectItem(result, "addresses");
+        cJSON *indices = cJSON_GetObjectItem(result, "address_indices");
+        long before = got;
+        if (!cJSON_IsArray(addresses)) {
+            addresses = cJSON_GetObjectItem(result, "address");
+            indices = cJSON_GetObjectItem(result, "address_index");
+        }
+        for (int i = 0; got < total; i++) {
+            const cJSON *a = cJSON_IsArray(addresses) ? cJSON_GetArrayItem(addresses, i) : i == 0 ? addresses : NULL;
+            const cJSON *x = cJSON_IsArray(indices) ? cJSON_GetArrayItem(indices, i) : i == 0 ? indices : NULL;
+            if (!cJSON_IsString(a) || !cJSON_IsNumber(x)) break;
+            snprintf(addr[got], MAX_ADDR_SIZE, "%s", a->valuestring);
+            index[got++] = (long)x->valuedouble;
+        }
+        cJSON_Delete(rpc->reply);
+        rpc->reply = NULL;
+        if (got == before) break;
+    }
+    rpc->idx = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (req[i].error != NULL) {
+            fprintf(out, "error: %s\n", req[i].error);
+            failed = 1;
+        } else if (req[i].subaddr >= 0) {
+            char known_addr[MAX_ADDR_SIZE];
+            if (lookup_subaddr(monero_wallet, workdir, account, req[i].subaddr, known_addr) < 0) {
+                fprintf(out, "error: no such subaddress\n");
+                failed = 1;
+            } else if (req[i].amount == NULL) {
+                fprintf(out, "%s\n", known_addr);
+            } else {
+                char *uri = make_uri(known_addr, req[i].amount);
+                fprintf(out, "%s\n", uri);
+                free(uri);
+                register_payment(ex, workdir, NULL, account, req[i].subaddr, req[i].amount, expire);
+            }
+        } else if (req[i].payid[0] != '\0') {
+            struct rpc_wallet *mk = &monero_wallet[MK_IADDR];
+            char local[MAX_IADDR_SIZE + 1];
+            char payid[MAX_PAYID_SIZE + 1];
+            const char *iaddr = NULL;
+            if (standard[0] != '\0') {
+                if (address_integrate(standard, req[i].payid, local, sizeof(local)) == 0) iaddr = local;
+            } else {
+                /* the first one comes from the wallet, its primary address does the rest */
+                mk->payid = req[i].payid;
+                if (rpc_call(mk) >= 0) {
+                    iaddr = cJSON_GetStringValue(cJSON_GetObjectItem(cJSON_GetObjectItem(mk->reply, "result"),
+                                                                     "integrated_address"));
+                } else {
+                    mk->reply = NULL;
+                }
+                if (iaddr != NULL && address_split(iaddr, standard, MAX_ADDR_SIZE, payid) < 0) standard[0] = '\0';
+            }
+            if (iaddr == NULL) {
+                fprintf(out, "error: no integrated address from the wallet\n");
+                failed = 1;
+            } else if (req[i].amount == NULL) {
+                fprintf(out, "%s\n", iaddr);
+            } else {
+                char *uri = make_uri(iaddr, req[i].amount);
+                fprintf(out, "%s\n", uri);
+                free(uri);
+                register_payment(ex, workdir, req[i].payid, account, -1, req[i].amount, expire);
+            }
+            cJSON_Delete(mk->reply);
+            mk->reply = NULL;
+            mk->payid = NULL;
+        } else {
+            for (long k = 0; k < req[i].count; k++, next++) {
+                if (next >= got) {
+                    fprintf(out, "error: no subaddress from the wallet\n");
+                    failed = 1;
+                } else if (req[i].amount == NULL) {
+                    fprintf(out, "%s\n", addr[next]);
+                } else {
+                    char *uri = make_uri(addr[next], req[i].amount);
+                    fprintf(out, "%s\n", uri);
+                    free(uri);
+                    register_payment(ex, workdir, NULL, account, index[next], req[i].amount, expire);
+                }
+            }
+        }
+    }
+    fflush(out);
+
+    free(addr);
+    free(index);
+    return failed;
+}
+
+
+/* prints the address, or its URI and registers the payment if there is an amount */
+static void hand_out(struct expect *ex, const char *workdir, const char *address, const char *account,
+                     long subaddr, const char *amount, long expire)
+{
+    if (amount == NULL) {
+        fprintf(stdout, "%s\n", address);
+        return;
+    }
+    char *uri = make_uri(address, amount);
+    fprintf(stdout, "%s\n", uri);
+    free(uri);
+    register_payment(ex, workdir, NULL, account, subaddr, amount, expire);
+}
+
+
+/**
+ * Prints "INDEX SUBADDRESS" for a range of indices of the account,
+ * derived on all cores. Nothing is handed out or registered.
+ *
+ * @param account The account.
+ * @param range FIRST-LAST or a single index.
+ * @return 0 on success, -1 on error.
+ */
+static int derive_range(const char *account, const char *range)
+{
+    char *end = NULL;
+    unsigned long first = strtoul(range, &end, 10);
+    unsigned long last = first;
+
+    if (end == range || (*end != '\0' && *end != '-')) goto invalid;
+    if (*end == '-') {
+        const char *to = end + 1;
+        last = strtoul(to, &end, 10);
+        if (end == to || *end != '\0') goto invalid;
+    }
+    if (last < first || last > UINT32_MAX) goto invalid;
+
+    /* in chunks, so a large range does not need all its memory at once */
+    for (unsigned long at = first; at <= last; at += PAYMENT_BATCH * 16) {
+        size_t count = last - at + 1 < PAYMENT_BATCH * 16 ? last - at + 1 : PAYMENT_BATCH * 16;
+        char (*out)[MAX_ADDR_SIZE] = malloc(count * sizeof(*out));
+        if (out == NULL || subaddr_bulk(&deriver, (uint32_t)atol(account), (uint32_t)at, count, out) < 0) {
+            fprintf(stderr, "could not derive subaddresses\n");
+            free(out);
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) fprintf(stdout, "%lu %s\n", at + i, out[i]);
+        free(out);
+    }
+    fflush(stdout);
+    return 0;
+
+invalid:
+    fprintf(stderr, "Invalid range. FIRST-LAST\n");
+    return -1;
+}
+
+
+/**
+ * Derives every subaddress the wallet has in the account and compares
+ * it with what get_address returns.
+ *
+ * @param monero_wallet The rpc calls, GET_LIST is used.
+ * @param account The account.
+ * @return 0 if all of them match, -1 if not or the wallet failed.
+ */
+static int selftest(struct rpc_wallet *monero_wallet, const char *account)
+{
+    char local[MAX_ADDR_SIZE];
+    int checked = 0, wrong = 0;
+
+    if (rpc_call(&monero_wallet[GET_LIST]) < 0) {
+        monero_wallet[GET_LIST].reply = NULL;
+        fprintf(stderr, "could not connect to host: %s:%s\n", monero_wallet[GET_LIST].host,
+                                                              monero_wallet[GET_LIST].port);
+        return -1;
+    }
+    const cJSON *addresses = cJSON_GetObjectItem(cJSON_GetObjectItem(monero_wallet[GET_LIST].reply, "result"),
+                                                 "addresses");
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, addresses) {
+        const cJSON *index = cJSON_GetObjectItem(item, "address_index");
+        const char *address = cJSON_GetStringValue(cJSON_GetObjectItem(item, "address"));
+        if (!cJSON_IsNumber(index) || address == NULL) continue;
+        checked++;
+        if (subaddr_derive(&deriver, (uint32_t)atol(account), (uint32_t)index->valuedouble, local,
+                           sizeof(local)) < 0 || strcmp(local, address) != 0) {
+            fprintf(stdout, "%d/%d: wallet %s, derived %s\n", atoi(account), (int)index->valuedouble,
+                    address, local);
+            wrong++;
+        }
+    }
+    cJSON_Delete(monero_wallet[GET_LIST].reply);
+    monero_wallet[GET_LIST].reply = NULL;
+    fprintf(stdout, "%d subaddresses checked, %d wrong\n", checked, wrong);
+    return wrong == 0 && checked > 0 ? 0 : -1;
+}
+
+
+/**
+ * Registers the payment an URI asks for, so mnpd can tell if it was
+ * paid exactly, too little or too much. The invoice starts as REQUEST
+ * in its status file, and mnpd is told to time it. A missing workdir
+ * only warns, the URI has been printed already.
+ *
+ * @param ex The open expected payments, or NULL to open them here.
+ * @param workdir The work directory.
+ * @param payment_id Payment id of an integrated address, or NULL.
+ * @param account Account of the subaddress.
+ * @param subaddr Subaddress index if there is no payment id.
+ * @param amount Expected amount in piconero.
+ * @param expire Seconds until the payment is due, 0 = never.
+ */
+static void register_payment(struct expect *ex, const char *workdir, const char *payment_id,
+                             const char *account, long subaddr, const char *amount, long expire)
+{
+    struct expect own;
+    struct expect_rec rec;
+    int kind;
+    uint64_t id;
+
+    if (workdir == NULL || expect_key(payment_id, atol(account), subaddr, &kind, &id) < 0) return;
+    if (ex == NULL) {
+        if (expect_open(&own, workdir) < 0) {
+            fprintf(stderr, "mnp-payment: could not register the payment in %s. try mnp --init.\n", workdir);
+            return;
+        }
+        ex = &own;
+    }
+    if (expect_add(ex, kind, id, strtoull(amount, NULL, 10), expire > 0 ? time(NULL) + expire : 0) < 0) {
+        fprintf(stderr, "mnp-payment: could not register the payment in %s\n", workdir);
+        if (ex == &own) expect_close(&own);
+        return;
+    }
+    if (expect_get(ex, kind, id, &rec) == 1) expect_status(workdir, &rec);
+    if (ex == &own) expect_close(&own);
+
+    /* mnpd picks up the timer at its next start if it is not running */
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", EV_INVOICE);
+    if (kind == EXPECT_PAYID) {
+        cJSON_AddStringToObject(msg, "payment_id", payment_id);
+    } else {
+        cJSON_AddNumberToObject(msg, "account", (double)atol(account));
+        cJSON_AddNumberToObject(msg, "subaddr_index", (double)subaddr);
+    }
+    if (ipc_send(workdir, msg) < 0 && verbose) syslog(LOG_USER | LOG_INFO, "mnpd is not running");
+    cJSON_Delete(msg);
+}
+
+
 /**
  * Parses the INI file and handles the configuration settings.
  *
@@ -449,7 +1206,13 @@ static int handler(void *user, const char *section, const char *name,
         pconfig->rpc_port = strndup(value, MAX_DATA_SIZE);
     } else if (MATCH("mnp", "account")) {
         pconfig->mnp_account = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "workdir")) {
+        pconfig->cfg_workdir = strndup(value, MAX_DATA_SIZE);
     } else if (MATCH("mnppayment", "subaddress")) {
+    } else if (MATCH("mnppayment", "address")) {
+        pconfig->mnppayment_address = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnppayment", "view_key")) {
+        pconfig->mnppayment_view_key = strndup(value, MAX_DATA_SIZE);
     } else {
         return 0;  /* unknown section/name, error */
     }
@@ -489,10 +1252,32 @@ static void usage(int status)
     "  -s  --subaddr [INDEX]\n"
     "               returns subaddress on INDEX.\n\n"
     "  -n  --newaddr\n"
-    "               returns a new created subaddress.\n\n"
+    "               returns a new created subaddress, taken\n"
+    "               from the pool of mnpd if there is one.\n\n"
     "  -x  --amount [AMOUNT]\n"
     "               The amount is specified in pcionero.\n"
-    "               returns an URI string.\n\n"
+    "               returns an URI string and registers the\n"
+    "               expected payment for mnpd.\n\n"
+    "  -e  --expire [SECONDS]\n"
+    "               the registered payment is due in SECONDS.\n"
+    "               0 = never. default 7200.\n\n"
+    "  -b  --batch\n"
+    "               reads requests from stdin, one per line:\n"
+    "               PAYMENT_ID [AMOUNT], newaddr [AMOUNT],\n"
+    "               newaddr *COUNT or subaddr INDEX [AMOUNT].\n"
+    "               answers them in order.\n\n"
+    "  -S  --serve\n"
+    "               answers the requests of --batch on the\n"
+    "               socket .mnp-payment.sock in the workdir,\n"
+    "               with the wallet connection kept open.\n\n"
+    "  -d  --derive [FIRST-LAST]\n"
+    "               prints the subaddresses of a range of\n"
+    "               indices, derived locally on all cores.\n\n"
+    "  -t  --selftest\n"
+    "               compares the derived subaddresses with\n"
+    "               the ones of the wallet.\n\n"
+    "  -w  --workdir [PATH]\n"
+    "               working directory of mnpd.\n\n"
     "  -v, --version\n"
     "               Display the version number of mnp.\n\n"
     "  -h, --help   Display this help message.\n"
@@ -515,3 +1300,15 @@ static void printmnp(void)
                 MONERO_GREY "Named Pipes Payment | "
                 ANSI_RESET_ALL "mnp-payment Version %s\n", VERSION);
 }
+
+
+/**
+ * Handles the shutdown signal and stops --serve.
+ *
+ * @param sig The signal number received, unused.
+ */
+static void initshutdown(int sig)
+{
+    (void)sig;
+    running = 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * mnp-ring.h - reader side of the shared-memory event ring of mnpd.
+ *
+ * mnpd (single producer) publishes fixed-size event records into the
+ * file <workdir>/.mnpd.ring when [mnpd] shm_ring is set. Any number of
+ * processes on the same host map it and read at their own pace. The
+ * fast path is a few loads from shared memory, no syscalls. A reader
+ * with nothing to do sleeps on a futex; mnpd only calls FUTEX_WAKE
+ * when somebody sleeps.
+ *
+ * The ring never waits for readers. A reader that falls more than
+ * `slots` events behind skips ahead and the skipped events are added
+ * to `lost`. Every record carries the journal sequence number (`id`),
+ * so lost events can be fetched with mnp-journal --seek.
+ *
+ * This header has no dependencies besides libc:
+ *
+ *     struct mnp_ring_reader r;
+ *     struct mnp_ring_event ev;
+ *     mnp_ring_open(&r, "/tmp/mywallet/.mnpd.ring");
+ *     while (mnp_ring_next(&r, &ev, -1) == 1) { ... }
+ *     mnp_ring_close(&r);
+ */
+#ifndef MNP_RING_H
+#define MNP_RING_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define MNP_RING_MAGIC          (0x00676e6972706e6dULL)
+#define MNP_RING_VERSION        (1)
+#define MNP_RING_DOUBLE_SPEND   (1u << 0)
+#define MNP_RING_SPINS          (1000)
+
+struct mnp_ring_event {
+    uint64_t id;
+    int64_t  time;
+    uint64_t amount;
+    uint32_t account;
+    uint32_t subaddr_index;
+    uint32_t confirmations;
+    uint32_t flags;
+    unsigned char txid[32];
+    char type[24];
+    char payment_id[24];
+    char address[112];
+    unsigned char reserved[16];
+};
+
+struct mnp_ring_slot {
+    uint64_t stamp;
+    struct mnp_ring_event ev;
+};
+
+struct mnp_ring_head {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t reserved0;
+    int64_t  created;
+    unsigned char pad0[32];
+    /* own cache line, written by mnpd on every event */
+    uint64_t head;
+    uint32_t futex;
+    uint32_t waiters;
+    unsigned char pad1[48];
+};
+
+struct mnp_ring_reader {
+    int fd;
+    size_t size;
+    struct mnp_ring_head *head;
+    struct mnp_ring_slot *slot;
+    uint64_t next;
+    uint64_t lost;
+};
+
+
+/**
+ * Maps the ring. Reading starts with the next event published.
+ *
+ * @param r The reader.
+ * @param path Path of the ring, <workdir>/.mnpd.ring.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+static inline int mnp_ring_open(struct mnp_ring_reader *r, const char *path)
+{
+    struct stat sb;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (r->fd == -1) return -1;
+
+    if (fstat(r->fd, &sb) == -1 || (size_t)sb.st_size < sizeof(struct mnp_ring_head)) goto invalid;
+    r->size = sb.st_size;
+    r->head = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (r->head == MAP_FAILED) {
+        r->head = NULL;
+        goto error;
+    }
+
+    if (r->head->magic != MNP_RING_MAGIC || r->head->version != MNP_RING_VERSION ||
+        r->head->slot_size != sizeof(struct mnp_ring_slot) || r->head->slots == 0 ||
+        (r->head->slots & (r->head->slots - 1)) != 0 ||
+        sizeof(struct mnp_ring_head) + (size_t)r->head->slots * sizeof(struct mnp_ring_slot) > r->size) {
+        goto invalid;
+    }
+
+    r->slot = (struct mnp_ring_slot *)(r->head + 1);
+    r->next = __atomic_load_n(&r->head->head, __ATOMIC_ACQUIRE);
+    return 0;
+
+invalid:
+    errno = EINVAL;
+error:
+    if (r->head != NULL) munmap(r->head, r->size);
+    close(r->fd);
+    r->fd = -1;
+    r->head = NULL;
+    return -1;
+}
+
+
+/**
+ * Moves the reader back to the oldest event still in the ring.
+ *
+ * @param r The reader.
+ */
+static inline void mnp_ring_rewind(struct mnp_ring_reader *r)
+{
+    uint64_t h = __atomic_load_n(&r->head->head, __ATOMIC_ACQUIRE);
+    r->next = h > r->head->slots + 1 ? h - r->head->slots : 1;
+}
+
+
+/**
+ * Copies the next event.
+ *
+ * @param r The reader.
+ * @param ev Receives the event.
+ * @param timeout_ms Time to wait for mnpd, -1 = forever, 0 = don't wait.
+ * @return 1 if an event was copied, 0 on timeout or signal.
+ */
+static inline int mnp_ring_next(struct mnp_ring_reader *r, struct mnp_ring_event *ev, int timeout_ms)
+{
+    uint64_t mask = r->head->slots - 1;
+    int spins = 0;
+
+    for (;;) {
+        uint64_t h = __atomic_load_n(&r->head->head, __ATOMIC_ACQUIRE);
+
+        if (r->next < h) {
+            if (h - r->next > r->head->slots) {
+                r->lost += h - r->head->slots - r->next;
+                r->next = h - r->head->slots;
+            }
+
+            struct mnp_ring_slot *s = &r->slot[r->next & mask];
+            if (__atomic_load_n(&s->stamp, __ATOMIC_ACQUIRE) == r->next) {
+                memcpy(ev, &s->ev, sizeof(*ev));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&s->stamp, __ATOMIC_RELAXED) == r->next) {
+                    r->next++;
+                    return 1;
+                }
+            }
+
+            /* overwritten while copying, or mnpd died in the middle of it */
+            if (++spins > MNP_RING_SPINS) {
+                r->lost++;
+                r->next++;
+                spins = 0;
+            }
+            continue;
+        }
+
+        if (timeout_ms == 0) return 0;
+
+        uint32_t f = __atomic_load_n(&r->head->futex, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&r->head->waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->head->head, __ATOMIC_SEQ_CST) != h) {
+            __atomic_sub_fetch(&r->head->waiters, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        long ret = syscall(SYS_futex, &r->head->futex, FUTEX_WAIT, f, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+        __atomic_sub_fetch(&r->head->waiters, 1, __ATOMIC_SEQ_CST);
+        if (ret == -1 && (errno == ETIMEDOUT || errno == EINTR)) return 0;
+    }
+}
+
+
+/**
+ * Tells whether mnpd has replaced the ring (restart); reopen then.
+ *
+ * @param r The reader.
+ * @return 1 if the mapped ring is no longer in use.
+ */
+static inline int mnp_ring_stale(const struct mnp_ring_reader *r)
+{
+    struct stat sb;
+    return fstat(r->fd, &sb) == -1 || sb.st_nlink == 0;
+}
+
+
+/**
+ * Unmaps the ring.
+ *
+ * @param r The reader.
+ */
+static inline void mnp_ring_close(struct mnp_ring_reader *r)
+{
+    if (r->head != NULL) munmap(r->head, r->size);
+    if (r->fd >= 0) close(r->fd);
+    r->head = NULL;
+    r->fd = -1;
+}
+
+#endif
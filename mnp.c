@@ -29,16 +29,19 @@
 #include <fcntl.h>
 #include <ftw.h>
 #include <getopt.h>
+#include <glob.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* system headers */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <syslog.h>
 
 /* third party libraries */
@@ -49,7 +52,13 @@
 /* local headers */
 #include "delquotes.h"
 #include "globaldefs.h"
+#include "hex.h"
+#include "ipc.h"
+#include "pending.h"
+#include "policy.h"
 #include "rpc_call.h"
+#include "txindex.h"
+#include "txpath.h"
 #include "validate.h"
 #include "wallet.h"
 
@@ -58,6 +67,9 @@ int verbose = 0;
 
 static volatile sig_atomic_t running = 1;
 
+/* [policy] tiers of .mnp.ini */
+static struct policy policy;
+
 static const struct option options[] = {
     {"help"         , no_argument      , NULL, 'h'},
     {"rpc_user"     , required_argument, NULL, 'u'},
@@ -75,28 +87,37 @@ static const struct option options[] = {
     {"tx-proof"     , no_argument      , NULL, 'x'},
     {"init"         , no_argument      , NULL, 't'},
     {"retry"        , no_argument      , NULL, 'R'},
+    {"recover"      , no_argument      , NULL, 'e'},
     {"cleanup"      , no_argument      , NULL, 'c'},
+    {"migrate"      , no_argument      , NULL, 'M'},
     {"version"      , no_argument      , NULL, 'v'},
     {"verbose"      , no_argument      , &verbose, 1},
     {NULL, 0, NULL, 0}
 };
 
-static const char *optstring = ":hu:r:i:p:a:w:o:n:m:g:d:sxtcRv";
+static const char *optstring = ":hu:r:i:p:a:w:o:n:m:g:d:sxtcMRev";
 static void usage(int status);
 static int handler(void *user, const char *section, const char *name, const char *value);
 static void initshutdown(int);
 static int remove_callback(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
 static int remove_directory(const char *path);
+static void empty_trash(const char *workdir, int len);
 static void printmnp(void);
 static char *readStdin(void);
 static char *get_confirm(const cJSON *transfer);
 static char *get_locked(const cJSON *transfer);
+static long long get_number(const cJSON *transfer, const char *name);
+static long long get_unlock_height(const cJSON *transfer, long long height);
+static long long wait_for_height(struct rpc_wallet *monero_wallet, long long target, int poll_interval,
+                                 int *slept);
 static char *proof(const struct rpc_wallet *monero_wallet);
 static char *proof_confirm(const struct rpc_wallet *monero_wallet);
 static char *proof_received(const struct rpc_wallet *monero_wallet);
 static cJSON *get_transfers(struct rpc_wallet *monero_wallet);
 static void write_to_pipe(const char *pipe, const char *content);
 static int get_env_int(const char *name, int fallback);
+static int recover(const char *workdir, char *const *rpc_args);
+static int strictest(const cJSON *transfers, int notify, int confirmation, int *needed);
 
 
 /**
@@ -147,9 +168,11 @@ int main(int argc, char **argv)
     int tx_proof = 0;
     int init = 0;
     int cleanup = 0;
+    int migrate = 0;
     int confirmation = 0;
     int notify = CONFIRMED;
     int retry = 0;
+    int resume = 0;
     int ret = EXIT_FAILURE;
     int fd = -1;
 
@@ -173,6 +196,7 @@ int main(int argc, char **argv)
         syslog(LOG_USER | LOG_ERR, "Can't load %s. Try: make install\n", ini);
         goto cleanup;
     }
+    if (policy.invalid) goto cleanup;
 
    /* get command line options */
     while((opt = getopt_long(argc, argv, optstring, options, &lindex)) != -1) {
@@ -230,12 +254,18 @@ int main(int argc, char **argv)
             case 'R':
                 retry = 1;
                 break;
+            case 'e':
+                resume = 1;
+                break;
             case 't':
                 init = 1;
                 break;
             case 'c':
                 cleanup = 1;
                 break;
+            case 'M':
+                migrate = 1;
+                break;
             case 'v':
                 printmnp();
                 ret = EXIT_SUCCESS;
@@ -259,6 +289,16 @@ int main(int argc, char **argv)
         }
     }
 
+    /* the wallet options given here, trackers resumed by --recover get them too */
+    char *rpc_args[11];
+    int nargs = 0;
+    if (rpc_user != NULL) { rpc_args[nargs++] = "--rpc_user"; rpc_args[nargs++] = rpc_user; }
+    if (rpc_password != NULL) { rpc_args[nargs++] = "--rpc_password"; rpc_args[nargs++] = rpc_password; }
+    if (rpc_host != NULL) { rpc_args[nargs++] = "--rpc_host"; rpc_args[nargs++] = rpc_host; }
+    if (rpc_port != NULL) { rpc_args[nargs++] = "--rpc_port"; rpc_args[nargs++] = rpc_port; }
+    if (account != NULL) { rpc_args[nargs++] = "--account"; rpc_args[nargs++] = account; }
+    rpc_args[nargs] = NULL;
+
     /* if no command line option is set - use the config ini file */
     if (account == NULL) {
         account = strndup(config.mnp_account, MAX_DATA_SIZE);
@@ -276,8 +316,23 @@ int main(int argc, char **argv)
         verbose = atoi(config.mnp_verbose);
     }
 
+    int layout = txpath_layout(config.cfg_layout);
+    if (layout < 0) {
+        syslog(LOG_USER | LOG_ERR, "layout %s is neither flat nor sharded", config.cfg_layout);
+        fprintf(stderr, "mnp: layout %s is neither flat nor sharded\n", config.cfg_layout);
+        goto cleanup;
+    }
+
+
+    /*
+     * mnp --recover
+     */
+    if (resume) {
+        ret = recover(workdir, rpc_args) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+        goto cleanup;
+    }
 
-    if (init == 0 && cleanup == 0) {
+    if (init == 0 && cleanup == 0 && migrate == 0) {
         if (optind < argc) {
             txid = strndup(argv[optind], MAX_TXID_SIZE);
         }
@@ -301,31 +356,26 @@ int main(int argc, char **argv)
         }
         
         if (sp_proof == 0 && tx_proof == 0 && !retry) {
-            char *mnp_txid_file = NULL;
-            asprintf(&mnp_txid_file, "%s/%s", workdir, TMP_TXID_FILE);
-            FILE *file = fopen(mnp_txid_file, "a+");
-            if (file == NULL) {
-                fprintf(stderr, "Error opening tmp file.\n");
+            struct txidx idx;
+            if (txidx_open(&idx, workdir) < 0) {
+                fprintf(stderr, "Error opening txid index.\n");
                 ret = EXIT_FAILURE;
                 goto cleanup;
             }
 
-            /* Test, if the current txid is already existing in temp file */
-            char line[MAX_TXID_SIZE + 1];
-            int txid_found = 0;
-            while (fgets(line, sizeof(line), file)) {
-                line[strcspn(line, "\n")] = '\0'; // Entferne das Zeilenumbruchzeichen
-                if (strncmp(line, txid, MAX_TXID_SIZE) == 0) {
-                    txid_found = 1;
-                    break;
-                }
+            /* Test, if the current txid is already known. If not, claim it. */
+            int txid_new = txidx_insert(&idx, txid);
+            if (txid_new >= 0 && txidx_full(&idx)) {
+                int days = config.cfg_retention ? atoi(config.cfg_retention) : TXID_RETENTION;
+                txidx_compact(&idx, (time_t)days * 24 * 60 * 60);
             }
+            txidx_close(&idx);
 
-            /* If the current txid is not found in temp file, add it to the file */
-            if (!txid_found) {
-                fprintf(file, "%s\n", txid);
-                fclose(file);
-            } else {
+            if (txid_new < 0) {
+                fprintf(stderr, "Error writing txid index.\n");
+                ret = EXIT_FAILURE;
+                goto cleanup;
+            } else if (txid_new == 0 && !pending_orphaned(workdir, txid)) {
                 ret = EXIT_SUCCESS;
                 goto cleanup;
             }
@@ -347,6 +397,23 @@ int main(int argc, char **argv)
         syslog(LOG_USER | LOG_DEBUG, "pipe mode_t = %03o and mode = %s\n", pmode, config.cfg_pipe);
     }
 
+    /*
+     * mnp --migrate
+     */
+    if (migrate) {
+        long moved = txpath_migrate(workdir, layout, mode);
+        if (moved < 0) {
+            fprintf(stderr, "mnp: could not migrate %s/%s\n", workdir, TRANSACTION_DIR);
+            goto cleanup;
+        }
+        if (verbose) syslog(LOG_USER | LOG_INFO, "%ld transactions moved to the %s layout", moved,
+                            layout == TX_LAYOUT_SHARDED ? "sharded" : "flat");
+        fprintf(stderr, "%ld transactions moved to the %s layout\n", moved,
+                layout == TX_LAYOUT_SHARDED ? "sharded" : "flat");
+        ret = EXIT_SUCCESS;
+        goto cleanup;
+    }
+
     /* initialise monero_wallet with NULL */
     for (int i = 0; i < END_RPC_SIZE; i++) {
         monero_wallet[i].monero_rpc_method = i;
@@ -369,6 +436,7 @@ int main(int argc, char **argv)
         monero_wallet[i].message = NULL;
         monero_wallet[i].signature = NULL;
         monero_wallet[i].proof = NULL;
+        monero_wallet[i].min_height = 0;
         monero_wallet[i].reply = NULL;
     }
 
@@ -500,6 +568,11 @@ int main(int argc, char **argv)
             ret = EXIT_FAILURE;
             goto cleanup;
         }
+        if (val_address(adr) < 0) {
+            fprintf(stderr, "Invalid address. wrong network, checksum or length\n");
+            ret = EXIT_FAILURE;
+            goto cleanup;
+        }
 
         monero_wallet[CHECK_TX_PROOF].signature = strndup(signature, MAX_DATA_SIZE);
         monero_wallet[CHECK_TX_PROOF].saddr = strndup(adr, MAX_ADDR_SIZE);
@@ -587,19 +660,30 @@ int main(int argc, char **argv)
         if (verbose) fprintf(stderr, "transactions dir is up : %s\n", txdir);
 
         /*
-         * creat directory /tmp/mywallet/.mnp.txid
+         * create txid index /tmp/mywallet/.mnp.txidx
          */
-        char *mnp_txid_file = NULL;
-        asprintf(&mnp_txid_file, "%s/%s", workdir, TMP_TXID_FILE);
-        FILE *file = fopen(mnp_txid_file, "a+");
-        if (file == NULL) {
-            fprintf(stderr, "Error opening tmp file.\n");
+        struct txidx idx;
+        if (txidx_open(&idx, workdir) < 0) {
+            fprintf(stderr, "Error opening txid index.\n");
             ret = EXIT_FAILURE;
             goto cleanup;
         }
-        fclose(file);
-        if (verbose) syslog(LOG_USER | LOG_INFO, ".mnp.txid file is up : %s", mnp_txid_file);
-        if (verbose) fprintf(stderr, ".mnp.txid file is up : %s\n", mnp_txid_file);
+        if (verbose) syslog(LOG_USER | LOG_INFO, "txid index is up : %s", idx.path);
+        if (verbose) fprintf(stderr, "txid index is up : %s\n", idx.path);
+        txidx_close(&idx);
+
+        /*
+         * create directory /tmp/mywallet/invoices
+         */
+        char *invdir = NULL;
+        asprintf(&invdir, "%s/%s", workdir, INVOICE_DIR);
+        if (mkdir(invdir, mode) == -1 && errno != EEXIST) {
+            syslog(LOG_USER | LOG_ERR, "could not create %s error: %s", invdir, strerror(errno));
+            fprintf(stderr, "mnp: could not create %s error: %s\n", invdir, strerror(errno));
+        }
+        if (verbose) syslog(LOG_USER | LOG_INFO, "invoices dir is up : %s", invdir);
+        if (verbose) fprintf(stderr, "invoices dir is up : %s\n", invdir);
+        free(invdir);
 
         /*
          * create /tmp/mywallet/txid
@@ -681,23 +765,21 @@ int main(int argc, char **argv)
      * mnp --cleanup
      */
     if (cleanup) {
-        int retc = remove_directory(txdir);
-        if (retc == -1) {
-            syslog(LOG_USER | LOG_ERR, "could not del txdir %s error: %s", txdir, strerror(errno));
-            exit(EXIT_FAILURE);
-        } else {
-            if (verbose) syslog(LOG_USER | LOG_INFO, "transactions dir is down %s", txdir);
-            if (verbose) fprintf(stderr, "transactions dir is down %s\n", txdir);
-        }
-
-        retc = remove_directory(workdir);
-        if (retc == -1) {
+        /* rename is instant, the pipes and directories go in the background */
+        char *trash = NULL;
+        size_t len = strlen(workdir);
+        while (len > 1 && workdir[len - 1] == '/') len--;
+        asprintf(&trash, "%.*s%s%d", (int)len, workdir, TRASH_SUFFIX, (int)getpid());
+        if (rename(workdir, trash) == -1) {
             syslog(LOG_USER | LOG_ERR, "could not del workdir %s error: %s", workdir, strerror(errno));
+            fprintf(stderr, "mnp: could not del workdir %s error: %s\n", workdir, strerror(errno));
             exit(EXIT_FAILURE);
-        } else {
-            if (verbose) syslog(LOG_USER | LOG_INFO, "workdir is down %s", workdir);
-            if (verbose) fprintf(stderr, "workdir is down %s\n", workdir);
         }
+        if (verbose) syslog(LOG_USER | LOG_INFO, "workdir is down %s", workdir);
+        if (verbose) fprintf(stderr, "workdir is down %s\n", workdir);
+
+        empty_trash(workdir, (int)len);
+        free(trash);
         exit(EXIT_SUCCESS);
     }
 
@@ -709,15 +791,19 @@ int main(int argc, char **argv)
         goto cleanup;
     }
 
+    pending_begin(workdir, txid, notify, confirmation);
+
     /*
      * JAIL starts here
      */
     int jail = 1;
     running = jail;
     cJSON *transfers = NULL;
+    long long bc_height = 0;
 
     while (running) {
         int retcall = -1;
+        int waited = 0;
         if (0 > (retcall = rpc_call(&monero_wallet[GET_TXID]))) {
             syslog(LOG_USER | LOG_ERR, "could not connect to host: %s:%s", monero_wallet[GET_TXID].host,
                                                                            monero_wallet[GET_TXID].port);
@@ -740,14 +826,17 @@ int main(int argc, char **argv)
 
         transfers = get_transfers(&monero_wallet[GET_TXID]);
         if (transfers == NULL) {
+            pending_end(workdir, txid, PENDING_FAILED);
             ret = EXIT_FAILURE;
             fprintf(stderr, "ERROR RESPONSE\n");
             syslog(LOG_USER | LOG_ERR, "mnp ERROR");
             goto cleanup;
         }
         const cJSON *trans = cJSON_GetArrayItem(transfers, 0);
+        int needed = confirmation;
+        int level = strictest(transfers, notify, confirmation, &needed);
 
-        switch(notify) {
+        switch(level) {
             case TXPOOL:
                 if (DEBUG) fprintf(stderr, "Amount of Transfers: %d\n", cJSON_GetArraySize(transfers));
                 jail = 0;
@@ -756,15 +845,57 @@ int main(int argc, char **argv)
                 jail = 1;
                 char *conf = get_confirm(trans);
                 if (conf == NULL) asprintf(&conf, "0");
-                if (atoi(conf) >= confirmation) {
+                if (atoi(conf) >= needed) {
                     jail = 0;
                 }
                 break;
             case UNLOCKED:
                 jail = 1;
                 char *locked = get_locked(trans);
-                if (strncmp(locked, "false", MAX_DATA_SIZE) == 0) {
+                /* a CONFIRMED tier of another transfer may ask for more than the spendable age */
+                if (locked != NULL && strncmp(locked, "false", MAX_DATA_SIZE) == 0 &&
+                    get_number(trans, "confirmations") >= needed) {
                     jail = 0;
+                    break;
+                }
+
+                /*
+                 * The unlock point is known as soon as the tx is mined.
+                 * Wait on height changes only and ask for the transfer
+                 * once more to confirm. A txpool tx waits for the next block.
+                 */
+                long long unlock = get_unlock_height(trans, bc_height);
+                long long tx_height = get_number(trans, "height");
+                if (tx_height > 0 && tx_height + needed > unlock) unlock = tx_height + needed;
+                long long unlock_time = get_number(trans, "unlock_time");
+                if (unlock_time >= MAX_BLOCK_NUM) {
+                    /* unlock_time is a timestamp, the spendable age applies all the same */
+                    long long due = unlock_time - UNLOCK_DELTA - (long long)time(NULL);
+                    if (due > 0) {
+                        sleep(due);
+                        waited = 1;
+                    }
+                }
+                if (verbose) syslog(LOG_USER | LOG_INFO, "%s unlocks at height %lld", txid, unlock);
+                bc_height = wait_for_height(&monero_wallet[GET_HEIGHT], unlock, poll_interval, &waited);
+                if (bc_height < 0 && running) {
+                    syslog(LOG_USER | LOG_ERR, "could not connect to host: %s:%s", monero_wallet[GET_HEIGHT].host,
+                                                                                   monero_wallet[GET_HEIGHT].port);
+                    fprintf(stderr, "mnp: could not connect to host: %s:%s\n", monero_wallet[GET_HEIGHT].host,
+                                                                               monero_wallet[GET_HEIGHT].port);
+
+                    /* Write txid to rpc_connection_alert pipe on RPC connection error */
+                    if (workdir && monero_wallet[GET_TXID].txid) {
+                        char *rpc_conn_pipe = NULL;
+                        char *rpc_conn_content = NULL;
+                        asprintf(&rpc_conn_pipe, "%s/%s", workdir, RPC_CONN_ALERT);
+                        asprintf(&rpc_conn_content, "%s", monero_wallet[GET_TXID].txid);
+                        write_to_pipe(rpc_conn_pipe, rpc_conn_content);
+                        free(rpc_conn_pipe);
+                        free(rpc_conn_content);
+                    }
+                    ret = EXIT_FAILURE;
+                    goto cleanup;
                 }
                 break;
             default:
@@ -775,18 +906,18 @@ int main(int argc, char **argv)
     	    break;
         }
 
-        sleep(poll_interval);
+        if (!waited && jail) sleep(poll_interval);
         running = jail;
     }
 
     /*
-     * mkdir /tmp/mywallet/transactions/txid/
+     * mkdir /tmp/mywallet/transactions/txid/ or transactions/ab/cd/txid/
      */
-    asprintf(&txId, "%s/%s/%s", workdir, TRANSACTION_DIR, monero_wallet[GET_TXID].txid);
+    txId = txpath(workdir, monero_wallet[GET_TXID].txid, layout);
     if (stat(txId, &transfer) == 0 && S_ISDIR(transfer.st_mode)) {
         if (DEBUG) syslog(LOG_USER | LOG_DEBUG, "txId does exists : %s", txId);
     } else {
-        int status = mkdir(txId, mode);
+        int status = txpath_mkdir(workdir, monero_wallet[GET_TXID].txid, layout, mode);
         if (status == -1) {
             syslog(LOG_USER | LOG_ERR, "could not create txId %s error: %s", txId, strerror(errno));
             fprintf(stderr, "mnp: could not create txId %s error: %s\n", txId, strerror(errno));
@@ -852,55 +983,95 @@ int main(int argc, char **argv)
         if (verbose) syslog(LOG_USER | LOG_INFO, "named pipe fifo is up : %s", fifo);
         if (verbose) fprintf(stderr, "named pipe fifo is up : %s\n", fifo);
 
-        pid_t pid = fork();
-        if (pid < 0) {
-            syslog(LOG_USER | LOG_ERR, "error: fork: %s", strerror(errno));
-            fprintf(stderr, "mnp: error: fork: %s\n", strerror(errno));
-            ret = EXIT_FAILURE;
-            goto cleanup;
-        } else if (pid == 0) {
-            /* Child process: write to named pipe */
-            if (fifo && strlen(fifo) > 0) {
-                fd = open(fifo, O_WRONLY | O_CLOEXEC);
-                 if (fd == -1) {
-                    syslog(LOG_USER | LOG_ERR, "error: open fifo %s: %s", fifo, strerror(errno));
-                    fprintf(stderr, "mnp: error: open fifo %s: %s\n", fifo, strerror(errno));
+        /*
+         * Hand the pipe over to mnpd. Without mnpd, fork a child
+         * that blocks until a reader shows up.
+         */
+        cJSON *event = cJSON_CreateObject();
+        cJSON_AddStringToObject(event, "type", EV_TRANSFER);
+        cJSON_AddStringToObject(event, "txid", txid);
+        cJSON_AddStringToObject(event, "address", cur_address);
+        cJSON_AddStringToObject(event, "payment_id", cur_payment_id);
+        cJSON_AddStringToObject(event, "amount", cur_amount);
+        cJSON_AddStringToObject(event, "fifo", fifo);
+        cJSON *subaddr_index = cJSON_GetObjectItem(trans, "subaddr_index");
+        if (cJSON_IsNumber(cJSON_GetObjectItem(subaddr_index, "major"))) {
+            cJSON_AddNumberToObject(event, "account", cJSON_GetObjectItem(subaddr_index, "major")->valuedouble);
+            cJSON_AddNumberToObject(event, "subaddr_index", cJSON_GetObjectItem(subaddr_index, "minor")->valuedouble);
+        }
+        if (cJSON_IsNumber(cJSON_GetObjectItem(trans, "confirmations"))) {
+            cJSON_AddNumberToObject(event, "confirmations", cJSON_GetObjectItem(trans, "confirmations")->valuedouble);
+        }
+        if (cJSON_IsNumber(cJSON_GetObjectItem(trans, "height"))) {
+            cJSON_AddNumberToObject(event, "height", cJSON_GetObjectItem(trans, "height")->valuedouble);
+        }
+        cJSON_AddBoolToObject(event, "double_spend", cJSON_IsTrue(double_spend));
+        int tier_notify, tier_confirmation;
+        if (!cJSON_IsTrue(double_spend) && policy_eval(&policy, strtoull(cur_amount, NULL, 10),
+                        cJSON_IsNumber(cJSON_GetObjectItem(subaddr_index, "major")) ?
+                        (long)cJSON_GetObjectItem(subaddr_index, "major")->valuedouble : -1,
+                        cJSON_IsNumber(cJSON_GetObjectItem(subaddr_index, "minor")) ?
+                        (long)cJSON_GetObjectItem(subaddr_index, "minor")->valuedouble : -1,
+                        &tier_notify, &tier_confirmation)) {
+            /* released as the policy asks, mnpd may count it without confirmation; never a double spend */
+            cJSON_AddBoolToObject(event, "accepted", 1);
+        }
+        int handed = ipc_send(workdir, event) == 0;
+        cJSON_Delete(event);
+
+        if (handed) {
+            if (verbose) syslog(LOG_USER | LOG_INFO, "named pipe fifo handed to mnpd : %s", fifo);
+        } else {
+            pid_t pid = fork();
+            if (pid < 0) {
+                syslog(LOG_USER | LOG_ERR, "error: fork: %s", strerror(errno));
+                fprintf(stderr, "mnp: error: fork: %s\n", strerror(errno));
+                ret = EXIT_FAILURE;
+                goto cleanup;
+            } else if (pid == 0) {
+                /* Child process: write to named pipe */
+                if (fifo && strlen(fifo) > 0) {
+                    fd = open(fifo, O_WRONLY | O_CLOEXEC);
+                     if (fd == -1) {
+                        syslog(LOG_USER | LOG_ERR, "error: open fifo %s: %s", fifo, strerror(errno));
+                        fprintf(stderr, "mnp: error: open fifo %s: %s\n", fifo, strerror(errno));
+                        ret = EXIT_FAILURE;
+                        goto cleanup;
+                    }
+                }
+
+                ssize_t retw = dprintf(fd, "%s\n", cur_amount);
+                if (retw == -1) {
+                    syslog(LOG_USER | LOG_ERR, "error: write %s", strerror(errno));
+                    fprintf(stderr, "mnp: error: %s", strerror(errno));
                     ret = EXIT_FAILURE;
                     goto cleanup;
                 }
-            }
 
-            ssize_t retw = dprintf(fd, "%s\n", cur_amount);
-            if (retw == -1) {
-                syslog(LOG_USER | LOG_ERR, "error: write %s", strerror(errno));
-                fprintf(stderr, "mnp: error: %s", strerror(errno));
-                ret = EXIT_FAILURE;
-                goto cleanup;
-            }
+                if (unlink(fifo) == -1) {
+                    syslog(LOG_USER | LOG_ERR, "error: unlink fifo %s: %s", fifo, strerror(errno));
+                    fprintf(stderr, "mnp: error: unlink fifo %s: %s\n", fifo, strerror(errno));
+                    ret = EXIT_FAILURE;
+                    goto cleanup;
+                }
 
-            if (unlink(fifo) == -1) {
-                syslog(LOG_USER | LOG_ERR, "error: unlink fifo %s: %s", fifo, strerror(errno));
-                fprintf(stderr, "mnp: error: unlink fifo %s: %s\n", fifo, strerror(errno));
-                ret = EXIT_FAILURE;
+                close(fd);
+                ret = EXIT_SUCCESS;
                 goto cleanup;
             }
-
-            close(fd);
-            ret = EXIT_SUCCESS;
-            goto cleanup;
-        } else {
             /* Partent process continue the loop */
             if (DEBUG) fprintf(stderr, "Parent process continues. Child PID: %d\n", pid);
+        }
 
-            char *txid_content = NULL;
-            asprintf(&txid_content, "%s %s", txid, adrorpay);
-            asprintf(&txid_pipe, "%s/%s", workdir, TXID_PIPE);
-            write_to_pipe(txid_pipe, txid_content);
+        char *txid_content = NULL;
+        asprintf(&txid_content, "%s %s", txid, adrorpay);
+        asprintf(&txid_pipe, "%s/%s", workdir, TXID_PIPE);
+        write_to_pipe(txid_pipe, txid_content);
 
-            /*Free the fifo variable to avoid potential memory leaks */
-            free(fifo);
-        }
+        /*Free the fifo variable to avoid potential memory leaks */
+        free(fifo);
     }
+    pending_end(workdir, txid, PENDING_DONE);
 
 cleanup:
     //if (transfers != NULL) cJSON_Delete(transfers);
@@ -909,6 +1080,7 @@ cleanup:
     if (txid && txid_from_stdin) free(txid);
     if (home) free(home);
     if (ini) free(ini);
+    policy_free(&policy);
     closelog();
     exit(ret);
 }
@@ -920,11 +1092,25 @@ cleanup:
  * @pipe:    Path to the pipe (e.g. "/tmp/mypipe").
  * @content: Message to write.
  *
- * Opens the given FIFO for writing and sends the message.
- * Blocks until a reader is connected. Prints an error if the
- * pipe cannot be opened or written to.
+ * Queues the message on the alert bus of mnpd, which writes it in
+ * order once a reader is connected. Without mnpd a child is forked
+ * that opens the FIFO and blocks until a reader is connected. Prints
+ * an error if the pipe cannot be opened or written to.
  */
 void write_to_pipe(const char *pipe, const char *content) {
+    const char *name = strrchr(pipe, '/');
+    if (name != NULL) {
+        char *dir = strndup(pipe, name - pipe);
+        cJSON *event = cJSON_CreateObject();
+        cJSON_AddStringToObject(event, "type", EV_ALERT);
+        cJSON_AddStringToObject(event, "pipe", name + 1);
+        cJSON_AddStringToObject(event, "msg", content);
+        int handed = ipc_send(dir, event) == 0;
+        cJSON_Delete(event);
+        free(dir);
+        if (handed) return;
+    }
+
     pid_t pid = fork();
     if (pid < 0) {
         syslog(LOG_USER | LOG_ERR, "error: fork write_to_pipe: %s - %s", pipe, strerror(errno));
@@ -953,6 +1139,69 @@ void write_to_pipe(const char *pipe, const char *content) {
 }
 
 
+/**
+ * Resumes every payment left pending by a crashed mnp process.
+ *
+ * Replays the pending journal and starts one mnp --retry per orphaned
+ * txid with the --notify-at and --confirmation it was started with.
+ * The wallet options mnp --recover was given are passed on, so a
+ * tracker started against another wallet than .mnp.ini's resumes there.
+ *
+ * @param workdir The work directory.
+ * @param rpc_args NULL terminated --rpc_* and --account options with their values.
+ * @return Number of resumed payments, or -1 on error.
+ */
+static int recover(const char *workdir, char *const *rpc_args)
+{
+    struct pending_rec *recs = NULL;
+    size_t count = 0;
+    int resumed = 0;
+
+    if (pending_replay(workdir, &recs, &count) < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not replay pending journal in %s", workdir);
+        fprintf(stderr, "mnp: could not replay pending journal in %s\n", workdir);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char hex[2 * TXID_BIN_SIZE + 1];
+        char notify[16];
+        char confirmation[16];
+
+        if (recs[i].pid > 0 && (kill(recs[i].pid, 0) == 0 || errno != ESRCH)) continue;
+
+        bin2hex(recs[i].txid, TXID_BIN_SIZE, hex);
+        snprintf(notify, sizeof(notify), "%d", recs[i].notify);
+        snprintf(confirmation, sizeof(confirmation), "%u", recs[i].confirmation);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            syslog(LOG_USER | LOG_ERR, "error: fork recover: %s", strerror(errno));
+            fprintf(stderr, "mnp: error: fork recover: %s\n", strerror(errno));
+            break;
+        } else if (pid == 0) {
+            char *args[20] = { "mnp", "--retry", "--workdir", (char *)workdir, "--notify-at", notify,
+                               "--confirmation", confirmation };
+            int n = 8;
+            while (*rpc_args != NULL) args[n++] = *rpc_args++;
+            args[n++] = hex;
+            args[n] = NULL;
+            setsid();
+            execv("/proc/self/exe", args);
+            syslog(LOG_USER | LOG_ERR, "error: exec recover: %s", strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+
+        if (verbose) syslog(LOG_USER | LOG_INFO, "resumed %s (pid %d)", hex, pid);
+        if (verbose) fprintf(stderr, "resumed %s (pid %d)\n", hex, pid);
+        resumed++;
+    }
+
+    free(recs);
+    return resumed;
+}
+
+
 /**
  * Retrieves the list of transfers from the Monero wallet RPC response.
  *
@@ -1021,6 +1270,81 @@ static char *get_locked(const cJSON *transfer)
 }
 
 
+/**
+ * Extracts an integer field (height, unlock_time, ...) from a transfer.
+ *
+ * @param transfer A pointer to the cJSON object representing the transfer.
+ * @param name The name of the field.
+ * @return The value of the field, or 0 if the field is missing.
+ */
+static long long get_number(const cJSON *transfer, const char *name)
+{
+    assert (transfer != NULL);
+
+    cJSON *number = cJSON_GetObjectItem(transfer, name);
+    if (!cJSON_IsNumber(number)) return 0;
+
+    return (long long)number->valuedouble;
+}
+
+
+/**
+ * Computes the blockchain height at which a transfer becomes unlocked.
+ *
+ * A mined transfer is spendable after SPENDABLE_AGE blocks on top of
+ * its inclusion height, or later if unlock_time holds a block height.
+ * A transfer still in the txpool can not unlock before the next block.
+ * An unlock_time that is a timestamp is left to the caller.
+ *
+ * @param transfer A pointer to the cJSON object representing the transfer.
+ * @param height The last known blockchain height (0 if unknown).
+ * @return The unlock height.
+ */
+static long long get_unlock_height(const cJSON *transfer, long long height)
+{
+    assert (transfer != NULL);
+
+    long long tx_height = get_number(transfer, "height");
+    if (tx_height <= 0) return height + 1;
+
+    long long unlock_time = get_number(transfer, "unlock_time");
+    long long unlock = tx_height + SPENDABLE_AGE;
+    if (unlock_time < MAX_BLOCK_NUM && unlock_time > unlock) unlock = unlock_time;
+
+    return unlock;
+}
+
+
+/**
+ * Polls the (cheap) blockchain height until it reaches the target.
+ *
+ * @param monero_wallet A pointer to the rpc_wallet structure used for GET_HEIGHT.
+ * @param target The height to wait for.
+ * @param poll_interval Seconds between two height requests.
+ * @param slept Set to 1 if it had to wait, untouched otherwise.
+ * @return The reached height, or -1 on rpc error or shutdown.
+ */
+static long long wait_for_height(struct rpc_wallet *monero_wallet, long long target, int poll_interval,
+                                 int *slept)
+{
+    assert (monero_wallet != NULL);
+
+    while (running) {
+        if (0 > rpc_call(monero_wallet)) return -1;
+
+        cJSON *result = cJSON_GetObjectItem(monero_wallet->reply, "result");
+        long long height = get_number(result, "height");
+        cJSON_Delete(monero_wallet->reply);
+        monero_wallet->reply = NULL;
+
+        if (height >= target) return height;
+        sleep(poll_interval);
+        *slept = 1;
+    }
+    return -1;
+}
+
+
 /**
  * Extracts the signiture (good) status from the Monero wallet RPC response.
  *
@@ -1109,7 +1433,9 @@ static void usage(int status)
     "               2, confirmed\n"
     "               3, unlocked\n\n"
     "      --confirmation [n] default = 1\n"
-    "               amount of blocks needed to confirm transaction.\n\n"
+    "               amount of blocks needed to confirm transaction.\n"
+    "               [policy] tiers in ~/.mnp.ini take precedence\n"
+    "               for the amounts they match.\n\n"
     "      ########################################################\n\n"
     "      --spend-proof\n"
     "               check spend proof. SIGNATURE is required.\n\n"
@@ -1127,8 +1453,15 @@ static void usage(int status)
     "               create workdir for usage.\n\n"
     "      --cleanup\n"
     "               delete workdir.\n\n"
+    "      --migrate\n"
+    "               move the transaction directories to the layout\n"
+    "               set in .mnp.ini. Stop mnpd first.\n\n"
     "      --retry\n"
     "               if rpc_connection_alert is triggered - use retry.\n\n"
+    "      --recover\n"
+    "               resume every payment left pending by a crash.\n"
+    "               the rpc options and --account given here are\n"
+    "               passed on, otherwise .mnp.ini applies.\n\n"
     "  -v, --version\n"
     "               Display the version number of mnp.\n\n"
     "      --verbose\n"
@@ -1202,6 +1535,12 @@ static int handler(void *user, const char *section, const char *name,
         pconfig->cfg_mode = strndup(value, MAX_DATA_SIZE);
     } else if (MATCH("cfg", "pipe")) {
         pconfig->cfg_pipe = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "txid_retention")) {
+        pconfig->cfg_retention = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "layout")) {
+        pconfig->cfg_layout = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("policy", "tier")) {
+        return policy_add(&policy, value) == 0;
     } else {
         return 0;  /* unknown section/name, error */
     }
@@ -1209,6 +1548,51 @@ static int handler(void *user, const char *section, const char *name,
 }
 
 
+/**
+ * Finds what a transaction has to wait for. Every transfer in it is
+ * looked up in the [policy] tiers, one no tier matches needs --notify-at
+ * and --confirmation. The strictest of them applies to the transaction,
+ * all its transfers are handed over together. The confirmations are the
+ * most any of them asks for, whatever its notify level, so an unlocked
+ * tier does not cut short a confirmed one.
+ *
+ * @param transfers The transfers of the transaction.
+ * @param notify --notify-at.
+ * @param confirmation --confirmation.
+ * @param needed Set to the confirmations needed at notify level confirmed or unlocked.
+ * @return The notify level.
+ */
+static int strictest(const cJSON *transfers, int notify, int confirmation, int *needed)
+{
+    const cJSON *trans = NULL;
+    int level = -1;
+
+    *needed = 0;
+    cJSON_ArrayForEach(trans, transfers) {
+        const cJSON *amount = cJSON_GetObjectItem(trans, "amount");
+        const cJSON *index = cJSON_GetObjectItem(trans, "subaddr_index");
+        const cJSON *major = cJSON_GetObjectItem(index, "major");
+        const cJSON *minor = cJSON_GetObjectItem(index, "minor");
+        int n = notify;
+        int c = confirmation;
+
+        if (cJSON_IsNumber(amount)) {
+            policy_eval(&policy, (uint64_t)amount->valuedouble,
+                        cJSON_IsNumber(major) ? (long)major->valuedouble : -1,
+                        cJSON_IsNumber(minor) ? (long)minor->valuedouble : -1, &n, &c);
+        }
+        if (n > level) level = n;
+        if (c > *needed) *needed = c;
+    }
+    if (level < 0) {
+        *needed = confirmation;
+        return notify;
+    }
+    if (verbose && policy.count > 0) syslog(LOG_USER | LOG_INFO, "policy: notify-at %d, %d confirmations", level, *needed);
+    return level;
+}
+
+
 int get_env_int(const char *name, int fallback) {
     char *val = getenv(name);
     if (val && *val) {
@@ -1270,6 +1654,54 @@ static int remove_directory(const char *path) {
 }
 
 
+/**
+ * Removes the trash directories of a workdir (the one just renamed and
+ * those an earlier cleanup left behind) in a detached grandchild, so
+ * mnp --cleanup returns at once.
+ *
+ * Parameters:
+ *   - workdir: Path of the work directory.
+ *   - len: Length of workdir without trailing slashes.
+ */
+static void empty_trash(const char *workdir, int len) {
+    char *pattern = NULL;
+    glob_t g;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        syslog(LOG_USER | LOG_ERR, "error: fork: %s", strerror(errno));
+        return;
+    } else if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    setsid();
+    if (fork() != 0) _exit(EXIT_SUCCESS);
+
+    int fd = open("/dev/null", O_RDWR);
+    if (fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO) close(fd);
+    }
+    nice(10);
+
+    asprintf(&pattern, "%.*s%s*", len, workdir, TRASH_SUFFIX);
+    if (glob(pattern, GLOB_NOSORT, NULL, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            if (remove_directory(g.gl_pathv[i]) == -1) {
+                syslog(LOG_USER | LOG_ERR, "could not del %s error: %s", g.gl_pathv[i], strerror(errno));
+            }
+        }
+        globfree(&g);
+    }
+    free(pattern);
+    _exit(EXIT_SUCCESS);
+}
+
+
 /**
  * Prints the version information of Monero Named Pipes.
  */
@@ -32,9 +32,11 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* system headers */
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <syslog.h>
 
@@ -44,7 +46,26 @@
 #include "./inih/ini.h"
 
 /* local headers */
+#include "alertbus.h"
+#include "evloop.h"
+#include "fifod.h"
 #include "globaldefs.h"
+#include "ipc.h"
+#include "journal.h"
+#include "pubsub.h"
+#include "shmring.h"
+#include "webhook.h"
+#include "hooks.h"
+#include "expect.h"
+#include "txpath.h"
+#include "gc.h"
+#include "invoice.h"
+#include "ledger.h"
+#include "dswatch.h"
+#include "policy.h"
+#include "reorg.h"
+#include "addrpool.h"
+#include "subaddr.h"
 #include "rpc_call.h"
 #include "wallet.h"
 
@@ -52,6 +73,7 @@
 int verbose = 0;
 
 static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t stats = 0;
 
 static const struct option options[] = {
     {"help"         , no_argument      , NULL, 'h'},
@@ -70,11 +92,55 @@ static char *optstring = "hu:r:i:p:a:w:vl";
 static void usage(int status);
 static int handler(void *user, const char *section, const char *name, const char *value);
 static void initshutdown(int);
+static void initstats(int);
 static void printmnp(void);
 static char *balance(const struct rpc_wallet *monero_wallet);
 static char *bcheight(const struct rpc_wallet *monero_wallet);
 static int get_env_int(const char *name, int fallback);
 static char *get_env_str(const char *name, const char *fallback);
+static void on_message(struct ev_source *src, uint32_t events);
+static void on_held(void *data);
+static void on_journal(void *data);
+static void publish(cJSON *event);
+static cJSON *classify(cJSON *event);
+static int zero_conf(int kind, uint64_t id, long major, long minor);
+static void hold(const cJSON *event);
+static void unmined_check(struct rpc_wallet *rpc);
+static void on_reorg(cJSON *event);
+static void uncount(cJSON *event, int pool);
+static void on_double_spend(const struct dswatch_tx *tx);
+static cJSON *alert_event(const char *pipe, const char *text);
+
+static struct evloop loop;
+static struct fifod fifod;
+static struct alertbus alertbus;
+static struct journal journal;
+static struct pubsub pubsub;
+static struct shmring ring;
+static struct webhook webhook;
+static struct hooks hooks;
+static struct gc gc;
+static struct expect expect = { .fd = -1 };
+static struct invoice invoice;
+static struct ledger ledger;
+static struct dswatch dswatch;
+static struct reorg reorg;
+static struct addrpool addrpool;
+static struct ev_source ipc = { -1, on_message, NULL };
+static cJSON *held = NULL;
+/* height of the last turn, the txpool transfers coming in are above it */
+static long long chain_height = 0;
+
+/* [policy] tiers of .mnp.ini, the same mnp releases transfers by */
+static struct policy tiers;
+
+/* accepted txpool transfers whose invoice needs a confirmation, counted once mined */
+struct unmined {
+    cJSON *event;
+    time_t added;
+};
+static struct unmined *unmined = NULL;
+static size_t nunmined = 0;
 
 
 /**
@@ -95,6 +161,7 @@ int main(int argc, char **argv)
     signal(SIGQUIT, initshutdown);
     signal(SIGTERM, initshutdown);
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, initstats);
 
     /* variables are set by getopt and/or config parser handler()*/
     int opt, lindex = -1;
@@ -121,12 +188,17 @@ int main(int argc, char **argv)
 
     /* parse config ini file */
     struct Config config;
+    memset(&config, 0, sizeof config);
 
     if (ini_parse(ini, handler, &config) < 0) {
         fprintf(stderr, "can't load %s. try make install.\n", ini);
         exit(EXIT_FAILURE);
     }
     free(ini);
+    if (tiers.invalid) {
+        fprintf(stderr, "mnpd: invalid tier in [policy]\n");
+        exit(EXIT_FAILURE);
+    }
 
    /* get command line options */
     while((opt = getopt_long(argc, argv, optstring, options, &lindex)) != -1) {
@@ -220,6 +292,7 @@ int main(int argc, char **argv)
         monero_wallet[i].locked = NULL;
         monero_wallet[i].fifo = NULL;
         monero_wallet[i].idx = 0;
+        monero_wallet[i].min_height = 0;
         monero_wallet[i].reply = NULL;
     }
 
@@ -283,6 +356,129 @@ int main(int argc, char **argv)
 
     fprintf(stdout, "Working directory: %s\n", workdir);
 
+    /*
+     * mnp hands over events on a unix socket in the workdir.
+     * Transfer pipes are served by one epoll loop.
+     */
+    if (evloop_init(&loop) < 0 || (ipc.fd = ipc_listen(workdir, pmode)) < 0 ||
+        evloop_add(&loop, &ipc, EPOLLIN) < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not listen on %s/%s", workdir, IPC_SOCKET);
+        fprintf(stderr, "mnpd: could not listen on %s/%s\n", workdir, IPC_SOCKET);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t fifo_max = config.mnpd_fifo_max ? strtoul(config.mnpd_fifo_max, NULL, 10) : FIFO_MAX;
+    if (fifod_init(&fifod, &loop, fifo_max) < 0) {
+        fprintf(stderr, "mnpd: could not start fifo delivery\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t alert_ring = config.mnpd_alert_ring ? strtoul(config.mnpd_alert_ring, NULL, 10) : ALERT_RING;
+    int policy = config.mnpd_alert_overflow ? alertbus_policy(config.mnpd_alert_overflow) : ALERT_SPILL;
+    if (policy < 0) {
+        fprintf(stderr, "mnpd: alert_overflow must be block, drop-oldest or spill\n");
+        exit(EXIT_FAILURE);
+    }
+    if (alertbus_init(&alertbus, &loop, workdir, alert_ring, policy) < 0 ||
+        evloop_tick(&loop, ALERT_POLL_MS, on_held, NULL) < 0) {
+        fprintf(stderr, "mnpd: could not start alert bus\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t seg_size = config.mnpd_journal_segment ? strtoul(config.mnpd_journal_segment, NULL, 10) : JOURNAL_SEGMENT;
+    uint64_t max_bytes = config.mnpd_journal_max_bytes ? strtoull(config.mnpd_journal_max_bytes, NULL, 10) : JOURNAL_MAX_BYTES;
+    time_t max_age = (config.mnpd_journal_retention ? atol(config.mnpd_journal_retention) : JOURNAL_RETENTION) * 86400L;
+    if (journal_open(&journal, workdir, seg_size, max_bytes, max_age, mode, pmode) < 0 ||
+        evloop_tick(&loop, JOURNAL_SYNC_MS, on_journal, NULL) < 0) {
+        fprintf(stderr, "mnpd: could not open journal in %s\n", workdir);
+        exit(EXIT_FAILURE);
+    }
+    journal_retain(&journal);
+
+    if (config.mnpd_ledger != NULL && config.mnpd_ledger[0] != '\0' &&
+        ledger_open(&ledger, workdir, config.mnpd_ledger) < 0) {
+        fprintf(stderr, "mnpd: could not open the ledger %s\n", config.mnpd_ledger);
+        exit(EXIT_FAILURE);
+    }
+
+    /* without it transfers are published without verdict */
+    if (expect_open(&expect, workdir) < 0) {
+        fprintf(stderr, "mnpd: could not open %s/%s\n", workdir, EXPECT_FILE);
+    } else if (invoice_init(&invoice, &loop, &expect, workdir, publish) < 0) {
+        fprintf(stderr, "mnpd: could not start the invoice timers\n");
+    }
+
+    size_t pub_max = config.mnpd_pub_max_subscribers ? strtoul(config.mnpd_pub_max_subscribers, NULL, 10) : PUB_MAX_SUBS;
+    size_t pub_queue = config.mnpd_pub_queue ? strtoul(config.mnpd_pub_queue, NULL, 10) : PUB_QUEUE;
+    if (pubsub_init(&pubsub, &loop, workdir, pmode, pub_max, pub_queue) < 0) {
+        fprintf(stderr, "mnpd: could not listen on %s/%s\n", workdir, PUB_SOCKET);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t ring_slots = config.mnpd_shm_ring ? strtoul(config.mnpd_shm_ring, NULL, 10) : 0;
+    if (ring_slots > 0 && shmring_open(&ring, workdir, ring_slots, pmode) < 0) {
+        fprintf(stderr, "mnpd: could not create %s/%s\n", workdir, SHM_RING_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.mnpd_webhook_url != NULL && config.mnpd_webhook_url[0] != '\0') {
+        size_t batch = config.mnpd_webhook_batch ? strtoul(config.mnpd_webhook_batch, NULL, 10) : WEBHOOK_BATCH;
+        long long window = config.mnpd_webhook_window ? atoll(config.mnpd_webhook_window) : WEBHOOK_WINDOW;
+        long timeout = config.mnpd_webhook_timeout ? atol(config.mnpd_webhook_timeout) : WEBHOOK_TIMEOUT;
+        if (webhook_init(&webhook, &loop, workdir, config.mnpd_webhook_url, journal_next(&journal),
+                         batch, window, timeout) < 0) {
+            fprintf(stderr, "mnpd: could not start webhook %s\n", config.mnpd_webhook_url);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.mnpd_hook_cmd != NULL && config.mnpd_hook_cmd[0] != '\0') {
+        size_t workers = config.mnpd_hook_workers ? strtoul(config.mnpd_hook_workers, NULL, 10) : HOOK_WORKERS;
+        size_t queue = config.mnpd_hook_queue ? strtoul(config.mnpd_hook_queue, NULL, 10) : HOOK_QUEUE;
+        long timeout = config.mnpd_hook_timeout ? atol(config.mnpd_hook_timeout) : HOOK_TIMEOUT;
+        int retries = config.mnpd_hook_retries ? atoi(config.mnpd_hook_retries) : HOOK_RETRIES;
+        if (hooks_init(&hooks, &loop, config.mnpd_hook_cmd, config.mnpd_hook_types,
+                       workers, queue, timeout, retries) < 0) {
+            fprintf(stderr, "mnpd: could not start hook %s\n", config.mnpd_hook_cmd);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        /* forked fallback writers are reaped by the kernel, with hooks by their tick */
+        signal(SIGCHLD, SIG_IGN);
+    }
+
+    long long ds_depth = config.mnpd_ds_watch_depth ? atoll(config.mnpd_ds_watch_depth) : DS_WATCH_DEPTH;
+    dswatch_init(&dswatch, ds_depth, on_double_spend);
+
+    long long reorg_depth = config.mnpd_reorg_depth ? atoll(config.mnpd_reorg_depth) : REORG_DEPTH;
+    if (config.mnpd_daemon != NULL && config.mnpd_daemon[0] != '\0' && reorg_depth > 0 &&
+        reorg_init(&reorg, workdir, config.mnpd_daemon, reorg_depth, on_reorg) < 0) {
+        fprintf(stderr, "mnpd: could not load %s/%s\n", workdir, REORG_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t pool_size = config.mnpd_addr_pool ? strtoul(config.mnpd_addr_pool, NULL, 10) : 0;
+    if (pool_size > 0 && addrpool_open(&addrpool, workdir, atol(monero_wallet[NEW_SUBADDR].account),
+                                       pool_size, pmode) < 0) {
+        fprintf(stderr, "mnpd: could not create %s/%s\n", workdir, ADDR_POOL_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    int layout = txpath_layout(config.cfg_layout);
+    if (layout < 0) {
+        fprintf(stderr, "mnpd: layout %s is neither flat nor sharded\n", config.cfg_layout);
+        exit(EXIT_FAILURE);
+    }
+    time_t gc_retention = config.mnpd_gc_retention ? atol(config.mnpd_gc_retention) : GC_RETENTION;
+    time_t gc_expire = config.mnpd_gc_expire ? atol(config.mnpd_gc_expire) : GC_EXPIRE;
+    long gc_rate = config.mnpd_gc_rate ? atol(config.mnpd_gc_rate) : GC_RATE;
+    time_t txid_age = (config.cfg_retention ? atol(config.cfg_retention) : TXID_RETENTION) * 86400L;
+    if ((gc_retention > 0 || gc_expire > 0 || txid_age > 0) &&
+        gc_init(&gc, &loop, workdir, layout, gc_retention, gc_expire, gc_rate, txid_age) < 0) {
+        fprintf(stderr, "mnpd: could not start the garbage collector in %s\n", workdir);
+        exit(EXIT_FAILURE);
+    }
+
     /*
      * Start main loop
      */
@@ -311,6 +507,10 @@ int main(int argc, char **argv)
 
                    asprintf(&monero_wallet[i].file, "%s/%s", workdir, BC_HEIGHT_FILE);
                    asprintf(&monero_wallet[i].height, "%s", bcheight(&monero_wallet[i]));
+                   ledger_block(&ledger, atoll(monero_wallet[i].height));
+                   if (reorg_tip(&reorg, &monero_wallet[GET_TRANSFERS], atoll(monero_wallet[i].height)) < 0) {
+                       fprintf(stderr, "mnpd: could not check the chain for a reorg\n");
+                   }
 
                    FILE *fdh = fopen(monero_wallet[i].file, "w");
                        if (fdh == NULL) {
@@ -381,14 +581,480 @@ int main(int argc, char **argv)
                     break;
             }
         } /* end for loop */
-        ret = sleep(poll_interval);
+        chain_height = atoll(monero_wallet[GET_HEIGHT].height);
+        if (dswatch_check(&dswatch, &monero_wallet[GET_TRANSFERS], chain_height) < 0) {
+            fprintf(stderr, "mnpd: could not check the watched transfers\n");
+        }
+        unmined_check(&monero_wallet[GET_TXID]);
+        /* derived subaddresses take the indices, the pool would hand them out twice */
+        int derived = subaddr_sync(workdir, monero_wallet);
+        if (derived < 0) {
+            fprintf(stderr, "mnpd: could not tell the wallet about the derived subaddresses\n");
+        } else if (derived == 0 && addrpool_refill(&addrpool, &monero_wallet[NEW_SUBADDR]) < 0) {
+            fprintf(stderr, "mnpd: could not refill the address pool\n");
+        }
+        ret = evloop_run(&loop, poll_interval * 1000LL);
+        if (stats) {
+            stats = 0;
+            alertbus_stats(&alertbus);
+            webhook_stats(&webhook);
+            hooks_stats(&hooks);
+            gc_stats(&gc);
+            invoice_stats(&invoice);
+            ledger_stats(&ledger);
+            dswatch_stats(&dswatch);
+            reorg_stats(&reorg);
+            addrpool_stats(&addrpool);
+        }
     } /* end while loop */
 
+    ipc_unlink(workdir);
+    if (verbose) alertbus_stats(&alertbus);
+    if (verbose) webhook_stats(&webhook);
+    if (verbose) hooks_stats(&hooks);
+    if (verbose) gc_stats(&gc);
+    if (verbose) invoice_stats(&invoice);
+    if (verbose) ledger_stats(&ledger);
+    if (verbose) dswatch_stats(&dswatch);
+    if (verbose) reorg_stats(&reorg);
+    if (verbose) addrpool_stats(&addrpool);
+    alertbus_close(&alertbus);
+    journal_close(&journal);
+    pubsub_close(&pubsub);
+    hooks_close(&hooks);
+    gc_close(&gc);
+    invoice_close(&invoice);
+    ledger_close(&ledger);
+    dswatch_close(&dswatch);
+    reorg_close(&reorg);
+    addrpool_close(&addrpool);
+    while (nunmined > 0) cJSON_Delete(unmined[--nunmined].event);
+    free(unmined);
+    policy_free(&tiers);
+    expect_close(&expect);
+    webhook_close(&webhook);
+    shmring_close(&ring);
+    fifod_close(&fifod);
+    evloop_close(&loop);
     free(monero_wallet);
     exit(EXIT_SUCCESS);
 }
 
 
+/**
+ * Dispatches the events mnp hands over on the mnpd socket.
+ *
+ * @param src The ipc socket.
+ * @param events The epoll events.
+ */
+static void on_message(struct ev_source *src, uint32_t events)
+{
+    cJSON *msg = NULL;
+
+    while (held == NULL && (msg = ipc_recv(src->fd)) != NULL) {
+        const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "type"));
+        const char *fifo = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "fifo"));
+        const char *amount = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "amount"));
+        const char *pipe = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "pipe"));
+        const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(msg, "msg"));
+
+        if (type != NULL && strcmp(type, EV_TRANSFER) == 0 && fifo != NULL && amount != NULL) {
+            cJSON *next = classify(msg);
+            publish(msg);
+            dswatch_add(&dswatch, msg, chain_height);
+            reorg_add(&reorg, msg);
+            cJSON *item = NULL;
+            cJSON_ArrayForEach(item, next) publish(item);
+            cJSON_Delete(next);
+            if (fifod_deliver(&fifod, fifo, amount) < 0) {
+                fprintf(stderr, "mnpd: could not deliver %s\n", fifo);
+            }
+        } else if (type != NULL && strcmp(type, EV_ALERT) == 0 && pipe != NULL && text != NULL) {
+            int retp = alertbus_post(&alertbus, pipe, text);
+            if (retp == 1) {
+                /* overflow policy block: stop reading until the ring has room */
+                held = msg;
+                evloop_mod(&loop, src, 0);
+                continue;
+            } else if (retp < 0) {
+                fprintf(stderr, "mnpd: could not queue alert for %s\n", pipe);
+            }
+            cJSON *event = alert_event(pipe, text);
+            publish(event);
+            cJSON_Delete(event);
+        } else if (type != NULL && strcmp(type, EV_INVOICE) == 0) {
+            if (invoice_watch(&invoice, msg) < 0) {
+                fprintf(stderr, "mnpd: no such invoice\n");
+            }
+        }
+        cJSON_Delete(msg);
+    }
+}
+
+
+/**
+ * Retries the alert held back by the block policy.
+ *
+ * @param data Unused.
+ */
+static void on_held(void *data)
+{
+    if (held == NULL) return;
+
+    const char *pipe = cJSON_GetStringValue(cJSON_GetObjectItem(held, "pipe"));
+    const char *text = cJSON_GetStringValue(cJSON_GetObjectItem(held, "msg"));
+    if (alertbus_post(&alertbus, pipe, text) == 1) return;
+
+    cJSON *event = alert_event(pipe, text);
+    publish(event);
+    cJSON_Delete(event);
+    cJSON_Delete(held);
+    held = NULL;
+    evloop_mod(&loop, &ipc, EPOLLIN);
+    on_message(&ipc, EPOLLIN);
+}
+
+
+/**
+ * Stamps an event with its sequence number and time and hands it to
+ * the event outputs: journal, subscribers, the shared-memory ring, the
+ * exec hooks and the ledger. The webhooks read the journal.
+ *
+ * @param event The event. "seq" and "time" are added.
+ */
+static void publish(cJSON *event)
+{
+    cJSON_DeleteItemFromObject(event, "seq");
+    cJSON_DeleteItemFromObject(event, "time");
+    cJSON_AddNumberToObject(event, "seq", (double)journal_next(&journal));
+    cJSON_AddNumberToObject(event, "time", (double)time(NULL));
+
+    char *line = cJSON_PrintUnformatted(event);
+    if (line == NULL) return;
+    size_t len = strlen(line);
+    if (journal_append(&journal, line, len) < 0) {
+        fprintf(stderr, "mnpd: could not journal event %s\n", line);
+    }
+    pubsub_publish(&pubsub, event, line, len);
+    shmring_publish(&ring, event);
+    hooks_post(&hooks, event, line);
+    ledger_record(&ledger, event);
+    free(line);
+}
+
+
+/**
+ * Matches a transfer against the payments registered by mnp-payment and
+ * adds the verdict: exact, underpaid, overpaid, expired, unexpected
+ * (already paid), duplicate (counted before) or unknown (nothing
+ * registered). A payment id is looked up first, then the subaddress.
+ * Confirmed transfers add up until the expected amount is reached. A
+ * txpool transfer mnp accepted by its policy counts only if the amount
+ * of the invoice is in a zero-confirmation tier as well; otherwise it is
+ * held until it is mined, so small transfers can not pay a large
+ * invoice from the txpool. A change of the invoice state is written to
+ * its status file.
+ *
+ * @param event The transfer event. "verdict", "expected" and "received" are added.
+ * @return Array of the events to publish after the transfer: progress or
+ *         paid-in-full, and invoice if the state changed. NULL if none.
+ */
+static cJSON *classify(cJSON *event)
+{
+    const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+    const char *amount = cJSON_GetStringValue(cJSON_GetObjectItem(event, "amount"));
+    const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+    const cJSON *account = cJSON_GetObjectItem(event, "account");
+    const cJSON *subaddr = cJSON_GetObjectItem(event, "subaddr_index");
+    const cJSON *confirmations = cJSON_GetObjectItem(event, "confirmations");
+    long major = cJSON_IsNumber(account) ? (long)account->valuedouble : -1;
+    long minor = cJSON_IsNumber(subaddr) ? (long)subaddr->valuedouble : -1;
+    int mined = cJSON_IsNumber(confirmations) && confirmations->valuedouble >= 1;
+    /* accepted: mnp released it earlier because its [policy] tier says so */
+    int accepted = !mined && cJSON_IsTrue(cJSON_GetObjectItem(event, "accepted")) &&
+                   !cJSON_IsTrue(cJSON_GetObjectItem(event, "double_spend"));
+    int confirmed = mined;
+    struct expect_rec rec;
+    int verdict = VERDICT_UNKNOWN;
+    int changed = 0;
+    int kind = -1;
+    uint64_t id;
+    char num[24];
+
+    if (expect.path == NULL || amount == NULL) return NULL;
+    uint64_t value = strtoull(amount, NULL, 10);
+
+    if (expect_key(payment_id, major, minor, &kind, &id) == 0) {
+        confirmed = mined || (accepted && zero_conf(kind, id, major, minor));
+        verdict = expect_match(&expect, kind, id, txid, value, confirmed, &rec, &changed);
+    }
+    if (verdict == VERDICT_UNKNOWN && kind == EXPECT_PAYID && expect_key(NULL, major, minor, &kind, &id) == 0) {
+        confirmed = mined || (accepted && zero_conf(kind, id, major, minor));
+        verdict = expect_match(&expect, kind, id, txid, value, confirmed, &rec, &changed);
+    }
+    if (verdict < 0) return NULL;
+    if (accepted && !confirmed && (verdict == VERDICT_EXACT || verdict == VERDICT_UNDERPAID ||
+                                   verdict == VERDICT_OVERPAID)) {
+        hold(event);
+    }
+
+    cJSON_DeleteItemFromObject(event, "verdict");
+    cJSON_DeleteItemFromObject(event, "expected");
+    cJSON_DeleteItemFromObject(event, "received");
+    cJSON_AddStringToObject(event, "verdict", expect_verdict_name(verdict));
+    if (verbose) syslog(LOG_USER | LOG_INFO, "transfer %s %s: %s", txid, amount, expect_verdict_name(verdict));
+    if (verdict == VERDICT_UNKNOWN) return NULL;
+
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec.amount);
+    cJSON_AddStringToObject(event, "expected", num);
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec.received);
+    cJSON_AddStringToObject(event, "received", num);
+
+    /* only a transfer that was counted moves the payment on */
+    int counted = confirmed && (verdict == VERDICT_EXACT || verdict == VERDICT_UNDERPAID ||
+                                verdict == VERDICT_OVERPAID);
+    if (!counted && !changed) return NULL;
+
+    cJSON *list = cJSON_CreateArray();
+    if (!counted) {
+        cJSON_AddItemToArray(list, invoice_changed(&invoice, &rec, txid));
+        return list;
+    }
+
+    cJSON *next = cJSON_CreateObject();
+    cJSON_AddStringToObject(next, "type", rec.state == EXPECT_COMPLETED ? EV_PAID : EV_PROGRESS);
+    cJSON_AddStringToObject(next, "txid", txid);
+    if (kind == EXPECT_PAYID) {
+        cJSON_AddStringToObject(next, "payment_id", payment_id);
+    } else {
+        cJSON_AddNumberToObject(next, "account", (double)major);
+        cJSON_AddNumberToObject(next, "subaddr_index", (double)minor);
+    }
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec.received);
+    cJSON_AddStringToObject(next, "amount", num);
+    snprintf(num, sizeof(num), "%llu", (unsigned long long)rec.amount);
+    cJSON_AddStringToObject(next, "expected", num);
+    if (rec.state == EXPECT_COMPLETED) {
+        cJSON_AddStringToObject(next, "verdict", expect_verdict_name(verdict));
+    } else {
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)(rec.amount - rec.received));
+        cJSON_AddStringToObject(next, "remaining", num);
+    }
+    cJSON_AddNumberToObject(next, "transfers", rec.transfers);
+    cJSON_AddItemToArray(list, next);
+    if (changed) cJSON_AddItemToArray(list, invoice_changed(&invoice, &rec, txid));
+    return list;
+}
+
+
+/* the invoice may be paid from the txpool: its amount is in a zero-confirmation tier */
+static int zero_conf(int kind, uint64_t id, long major, long minor)
+{
+    struct expect_rec rec;
+    int notify, confirmation;
+
+    if (expect_get(&expect, kind, id, &rec) != 1) return 0;
+    if (!policy_eval(&tiers, rec.amount, major, minor, &notify, &confirmation)) return 0;
+    return notify == TXPOOL || (notify == CONFIRMED && confirmation == 0);
+}
+
+
+/* keeps a copy of an accepted transfer until unmined_check sees it mined */
+static void hold(const cJSON *event)
+{
+    struct unmined *u = realloc(unmined, (nunmined + 1) * sizeof(*u));
+    if (u == NULL) return;
+    unmined = u;
+    unmined[nunmined].event = cJSON_Duplicate(event, 1);
+    unmined[nunmined].added = time(NULL);
+    if (unmined[nunmined].event == NULL) return;
+    cJSON_DeleteItemFromObject(unmined[nunmined].event, "accepted");
+    nunmined++;
+    if (verbose) syslog(LOG_USER | LOG_INFO, "invoice of %s waits for a confirmation",
+                        cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid")));
+}
+
+
+/**
+ * Counts the held transfers that have been mined since, with one
+ * get_transfer_by_txid each. A double spend is dropped, dswatch reports
+ * it; one not mined within DS_WATCH_MAX seconds is given up.
+ *
+ * @param rpc The GET_TXID rpc of mnpd.
+ */
+static void unmined_check(struct rpc_wallet *rpc)
+{
+    time_t now = time(NULL);
+
+    for (size_t i = nunmined; i-- > 0;) {
+        cJSON *event = unmined[i].event;
+        double confirmations = 0;
+        double height = 0;
+        int double_spend = 0;
+
+        rpc->txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+        if (rpc_call(rpc) < 0) {
+            /* rpc_call has freed the error part of it already */
+            rpc->reply = NULL;
+        } else {
+            const cJSON *transfer = cJSON_GetObjectItem(cJSON_GetObjectItem(rpc->reply, "result"), "transfer");
+            const cJSON *n = cJSON_GetObjectItem(transfer, "confirmations");
+            confirmations = cJSON_IsNumber(n) ? n->valuedouble : 0;
+            n = cJSON_GetObjectItem(transfer, "height");
+            height = cJSON_IsNumber(n) ? n->valuedouble : 0;
+            double_spend = cJSON_IsTrue(cJSON_GetObjectItem(transfer, "double_spend_seen"));
+            cJSON_Delete(rpc->reply);
+            rpc->reply = NULL;
+        }
+        rpc->txid = NULL;
+
+        if (!double_spend && confirmations < 1 && now - unmined[i].added <= DS_WATCH_MAX) continue;
+        if (!double_spend && confirmations >= 1) {
+            cJSON_DeleteItemFromObject(event, "confirmations");
+            cJSON_AddNumberToObject(event, "confirmations", confirmations);
+            cJSON_DeleteItemFromObject(event, "height");
+            cJSON_AddNumberToObject(event, "height", height);
+            cJSON *next = classify(event);
+            cJSON *item = NULL;
+            cJSON_ArrayForEach(item, next) publish(item);
+            cJSON_Delete(next);
+            /* counted now, a reorg has to take it back out */
+            reorg_add(&reorg, event);
+        }
+        cJSON_Delete(event);
+        unmined[i] = unmined[--nunmined];
+    }
+}
+
+
+/* publish of the reorg detection: a revoked transfer is taken back out of its invoice */
+static void on_reorg(cJSON *event)
+{
+    const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(event, "type"));
+    const char *state = cJSON_GetStringValue(cJSON_GetObjectItem(event, "state"));
+
+    publish(event);
+    if (type == NULL || state == NULL || strcmp(type, EV_REVOKED) != 0) return;
+    if (strcmp(state, "gone") == 0) uncount(event, 0);
+    else if (strcmp(state, "pool") == 0) uncount(event, 1);
+}
+
+
+/**
+ * Takes a revoked transfer out of the invoice it was counted for, the
+ * same way classify found it, and publishes the invoice change. One
+ * back in the txpool is held and counted again once it is mined; mnp
+ * does not hand a transaction over twice.
+ *
+ * @param event The revoked event.
+ * @param pool 1 if the transfer is in the txpool again.
+ */
+static void uncount(cJSON *event, int pool)
+{
+    const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+    const char *amount = cJSON_GetStringValue(cJSON_GetObjectItem(event, "amount"));
+    const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+    const cJSON *account = cJSON_GetObjectItem(event, "account");
+    const cJSON *subaddr = cJSON_GetObjectItem(event, "subaddr_index");
+    long major = cJSON_IsNumber(account) ? (long)account->valuedouble : -1;
+    long minor = cJSON_IsNumber(subaddr) ? (long)subaddr->valuedouble : -1;
+    cJSON *changed = NULL;
+    int kind = -1;
+    uint64_t id;
+
+    if (expect.path == NULL || amount == NULL || txid == NULL) return;
+    uint64_t value = strtoull(amount, NULL, 10);
+
+    if (expect_key(payment_id, major, minor, &kind, &id) == 0) {
+        changed = invoice_revoke(&invoice, kind, id, txid, value);
+    }
+    if (changed == NULL && kind == EXPECT_PAYID && expect_key(NULL, major, minor, &kind, &id) == 0) {
+        changed = invoice_revoke(&invoice, kind, id, txid, value);
+    }
+    if (changed == NULL) return;
+    publish(changed);
+    cJSON_Delete(changed);
+
+    if (pool) {
+        cJSON_DeleteItemFromObject(event, "confirmations");
+        cJSON_AddNumberToObject(event, "confirmations", 0);
+        hold(event);
+    }
+}
+
+
+/**
+ * Reports a flip of a watched zero-conf transfer on double_spend_alert:
+ * double_spend_seen changed, or it left the txpool without being mined.
+ *
+ * @param tx The watched transaction.
+ */
+static void on_double_spend(const struct dswatch_tx *tx)
+{
+    char *text = NULL;
+
+    if (asprintf(&text, "%s %s", tx->txid, tx->recipient) == -1) return;
+    syslog(LOG_USER | LOG_WARNING, "double spend watch: %s double_spend_seen %s, %s", tx->txid,
+           tx->double_spend ? "true" : "false", dswatch_state_name(tx->state));
+    if (alertbus_post(&alertbus, DS_ALERT_PIPE, text) != 0) {
+        fprintf(stderr, "mnpd: could not queue alert for %s\n", DS_ALERT_PIPE);
+    }
+
+    cJSON *event = alert_event(DS_ALERT_PIPE, text);
+    cJSON_AddBoolToObject(event, "double_spend", tx->double_spend);
+    cJSON_AddStringToObject(event, "state", dswatch_state_name(tx->state));
+    cJSON_AddNumberToObject(event, "confirmations", (double)tx->confirmations);
+    publish(event);
+    cJSON_Delete(event);
+    free(text);
+}
+
+
+/**
+ * Turns a line for a shared pipe ("txid address") into an event.
+ *
+ * @param pipe Name of the pipe.
+ * @param text The line.
+ * @return The event, to be freed with cJSON_Delete.
+ */
+static cJSON *alert_event(const char *pipe, const char *text)
+{
+    cJSON *event = cJSON_CreateObject();
+    size_t len = strcspn(text, " ");
+    char *txid = strndup(text, len);
+
+    if (strcmp(pipe, DS_ALERT_PIPE) == 0) {
+        cJSON_AddStringToObject(event, "type", EV_DOUBLE_SPEND);
+    } else if (strcmp(pipe, RPC_CONN_ALERT) == 0) {
+        cJSON_AddStringToObject(event, "type", EV_RPC_ALERT);
+    } else {
+        cJSON_AddStringToObject(event, "type", EV_TXID);
+    }
+    cJSON_AddStringToObject(event, "txid", txid);
+    if (text[len] == ' ') cJSON_AddStringToObject(event, "recipient", text + len + 1);
+    free(txid);
+
+    return event;
+}
+
+
+/**
+ * Flushes the journal and applies its retention once a minute.
+ *
+ * @param data Unused.
+ */
+static void on_journal(void *data)
+{
+    static int ticks = 0;
+
+    journal_sync(&journal);
+    if (++ticks * JOURNAL_SYNC_MS >= 60000) {
+        ticks = 0;
+        journal_retain(&journal);
+    }
+}
+
+
 /**
  * Extracts the total balance from the Monero wallet RPC response.
  *
@@ -495,6 +1161,66 @@ static int handler(void *user, const char *section, const char *name,
         pconfig->cfg_mode = strndup(value, MAX_DATA_SIZE);
     } else if (MATCH("cfg", "pipe")) {
         pconfig->cfg_pipe = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "txid_retention")) {
+        pconfig->cfg_retention = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("cfg", "layout")) {
+        pconfig->cfg_layout = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "fifo_max")) {
+        pconfig->mnpd_fifo_max = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "alert_ring")) {
+        pconfig->mnpd_alert_ring = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "alert_overflow")) {
+        pconfig->mnpd_alert_overflow = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "journal_segment")) {
+        pconfig->mnpd_journal_segment = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "journal_max_bytes")) {
+        pconfig->mnpd_journal_max_bytes = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "journal_retention")) {
+        pconfig->mnpd_journal_retention = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "pub_max_subscribers")) {
+        pconfig->mnpd_pub_max_subscribers = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "pub_queue")) {
+        pconfig->mnpd_pub_queue = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "shm_ring")) {
+        pconfig->mnpd_shm_ring = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "webhook_url")) {
+        pconfig->mnpd_webhook_url = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "webhook_batch")) {
+        pconfig->mnpd_webhook_batch = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "webhook_window")) {
+        pconfig->mnpd_webhook_window = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "webhook_timeout")) {
+        pconfig->mnpd_webhook_timeout = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_cmd")) {
+        pconfig->mnpd_hook_cmd = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_types")) {
+        pconfig->mnpd_hook_types = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_workers")) {
+        pconfig->mnpd_hook_workers = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_queue")) {
+        pconfig->mnpd_hook_queue = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_timeout")) {
+        pconfig->mnpd_hook_timeout = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "hook_retries")) {
+        pconfig->mnpd_hook_retries = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "gc_retention")) {
+        pconfig->mnpd_gc_retention = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "gc_expire")) {
+        pconfig->mnpd_gc_expire = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "gc_rate")) {
+        pconfig->mnpd_gc_rate = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "ledger")) {
+        pconfig->mnpd_ledger = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "ds_watch_depth")) {
+        pconfig->mnpd_ds_watch_depth = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "daemon")) {
+        pconfig->mnpd_daemon = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "reorg_depth")) {
+        pconfig->mnpd_reorg_depth = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("mnpd", "addr_pool")) {
+        pconfig->mnpd_addr_pool = strndup(value, MAX_DATA_SIZE);
+    } else if (MATCH("policy", "tier")) {
+        return policy_add(&tiers, value) == 0;
     } else {
         return 0;  /* unknown section/name, error */
     }
@@ -531,6 +1257,17 @@ static void initshutdown(int sig)
 }
 
 
+/**
+ * Requests the alert bus counters on SIGUSR1.
+ *
+ * @param sig The signal number received.
+ */
+static void initstats(int sig)
+{
+    stats = 1;
+}
+
+
 /**
  * Prints the version information of Monero Named Pipes.
  */
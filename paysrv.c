@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "paysrv.h"
+
+/*
+ * Request socket of mnp-payment --serve, a unix stream socket in the
+ * workdir. A client writes request lines and reads one answer line per
+ * address, in order, as with --batch. The lines a read brings are
+ * answered together, so pipelined requests share their wallet calls.
+ * While an answer is not written out, the client is not read from.
+ *
+ * The answers, and with them all wallet calls, are made by one worker
+ * thread, so the event loop keeps accepting, reading and writing while
+ * the wallet is slow. There is one wallet connection: the batches of
+ * all clients are answered one after the other, and a batch waits for
+ * the wallet calls of those queued before it.
+ */
+static void paysrv_accept(struct ev_source *src, uint32_t events);
+static void paysrv_done(struct ev_source *src, uint32_t events);
+static void *paysrv_worker(void *arg);
+static void client_event(struct ev_source *src, uint32_t events);
+static void client_serve(struct pay_client *c);
+static void client_flush(struct pay_client *c);
+static void client_close(struct pay_client *c);
+
+
+/**
+ * Binds the request socket. It is refused if another server answers on it.
+ *
+ * @param srv The server.
+ * @param loop The event loop.
+ * @param workdir The work directory.
+ * @param mode Permission of the socket file.
+ * @param max Maximum number of clients at once.
+ * @param answer Called with the complete request lines of a client.
+ * @param data Handed to answer.
+ * @return 0 on success, -1 on error.
+ */
+int paysrv_init(struct paysrv *srv, struct evloop *loop, const char *workdir, mode_t mode, size_t max,
+                paysrv_answer answer, void *data)
+{
+    struct sockaddr_un addr;
+
+    memset(srv, 0, sizeof(*srv));
+    srv->loop = loop;
+    srv->listen.fd = -1;
+    srv->done.fd = -1;
+    srv->notify = -1;
+    srv->max = max > 0 ? max : PAY_MAX_CLIENTS;
+    srv->answer = answer;
+    srv->data = data;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", workdir, PAY_SOCKET);
+    if (len < 0 || len >= (int)sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        goto error;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) goto error;
+    int alive = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    close(probe);
+    if (alive) {
+        syslog(LOG_USER | LOG_ERR, "another mnp-payment --serve is listening on %s", addr.sun_path);
+        return -1;
+    }
+
+    srv->path = strdup(addr.sun_path);
+    srv->client = calloc(srv->max, sizeof(struct pay_client));
+    srv->queue = calloc(srv->max, sizeof(struct pay_client *));
+    if (srv->path == NULL || srv->client == NULL || srv->queue == NULL) goto error;
+    for (size_t i = 0; i < srv->max; i++) srv->client[i].src.fd = -1;
+
+    /* the worker hands finished clients back through a pipe */
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) goto error;
+    srv->done.fd = fds[0];
+    srv->notify = fds[1];
+    srv->done.handler = paysrv_done;
+    srv->done.data = srv;
+    if (fcntl(srv->done.fd, F_SETFL, O_NONBLOCK) == -1 || evloop_add(loop, &srv->done, EPOLLIN) == -1) goto error;
+
+    /* signals stay with the thread of the event loop */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_mutex_init(&srv->lock, NULL);
+    pthread_cond_init(&srv->wake, NULL);
+    srv->started = pthread_create(&srv->worker, NULL, paysrv_worker, srv) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!srv->started) {
+        pthread_mutex_destroy(&srv->lock);
+        pthread_cond_destroy(&srv->wake);
+        errno = EAGAIN;
+        goto error;
+    }
+
+    unlink(srv->path);
+    srv->listen.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    srv->listen.handler = paysrv_accept;
+    srv->listen.data = srv;
+    if (srv->listen.fd == -1 ||
+        bind(srv->listen.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(srv->path, mode) == -1 ||
+        listen(srv->listen.fd, SOMAXCONN) == -1 ||
+        evloop_add(loop, &srv->listen, EPOLLIN) == -1) {
+        goto error;
+    }
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "payment socket is up : %s", srv->path);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start payment socket in %s: %s", workdir, strerror(errno));
+    paysrv_close(srv);
+    return -1;
+}
+
+
+/**
+ * Prints the counters of the server.
+ *
+ * @param srv The server.
+ */
+void paysrv_stats(const struct paysrv *srv)
+{
+    size_t connected = 0;
+
+    for (size_t i = 0; i < srv->max && srv->client != NULL; i++) {
+        if (srv->client[i].src.fd >= 0) connected++;
+    }
+    syslog(LOG_USER | LOG_INFO, "paysrv: %zu connected, %lu clients, %lu requests, %lu refused",
+           connected, srv->clients, srv->requests, srv->refused);
+    printf("paysrv: %zu connected, %lu clients, %lu requests, %lu refused\n",
+           connected, srv->clients, srv->requests, srv->refused);
+    fflush(stdout);
+}
+
+
+/**
+ * Stops the worker after the batch it is answering, disconnects all
+ * clients and removes the socket file.
+ *
+ * @param srv The server.
+ */
+void paysrv_close(struct paysrv *srv)
+{
+    if (srv->started) {
+        pthread_mutex_lock(&srv->lock);
+        srv->stop = 1;
+        pthread_cond_signal(&srv->wake);
+        pthread_mutex_unlock(&srv->lock);
+        pthread_join(srv->worker, NULL);
+        pthread_mutex_destroy(&srv->lock);
+        pthread_cond_destroy(&srv->wake);
+        srv->started = 0;
+    }
+    if (srv->done.fd >= 0) {
+        evloop_del(srv->loop, &srv->done);
+        close(srv->done.fd);
+        close(srv->notify);
+        srv->done.fd = -1;
+        srv->notify = -1;
+    }
+    if (srv->client != NULL) {
+        for (size_t i = 0; i < srv->max; i++) {
+            if (srv->client[i].src.fd >= 0) client_close(&srv->client[i]);
+        }
+    }
+    if (srv->listen.fd >= 0) {
+        close(srv->listen.fd);
+        unlink(srv->path);
+    }
+    free(srv->client);
+    free(srv->queue);
+    free(srv->path);
+    srv->client = NULL;
+    srv->queue = NULL;
+    srv->path = NULL;
+    srv->listen.fd = -1;
+}
+
+
+static void paysrv_accept(struct ev_source *src, uint32_t events)
+{
+    struct paysrv *srv = src->data;
+    int fd;
+
+    while ((fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct pay_client *c = NULL;
+        for (size_t i = 0; i < srv->max && c == NULL; i++) {
+            if (srv->client[i].src.fd < 0) c = &srv->client[i];
+        }
+        if (c == NULL) {
+            syslog(LOG_USER | LOG_ERR, "%zu payment clients connected, client refused", srv->max);
+            srv->refused++;
+            close(fd);
+            continue;
+        }
+
+        memset(c, 0, sizeof(*c));
+        c->srv = srv;
+        c->src.fd = fd;
+        c->src.handler = client_event;
+        c->src.data = c;
+        if (evloop_add(srv->loop, &c->src, EPOLLIN) == -1) {
+            close(fd);
+            c->src.fd = -1;
+            continue;
+        }
+        srv->clients++;
+        if (verbose) syslog(LOG_USER | LOG_INFO, "payment client %d connected", fd);
+    }
+}
+
+
+static void client_event(struct ev_source *src, uint32_t events)
+{
+    struct pay_client *c = src->data;
+
+    if (events & EPOLLOUT) client_flush(c);
+    if (c->src.fd < 0 || c->outlen > 0) return;
+
+    /* lines that came in while the last answer was written out */
+    client_serve(c);
+    if (c->src.fd < 0 || c->busy || c->outlen > 0 || !(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+    for (;;) {
+        ssize_t n = recv(c->src.fd, c->in + c->inlen, sizeof(c->in) - c->inlen, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            client_close(c);
+            return;
+        }
+        c->inlen += n;
+
+        client_serve(c);
+        if (c->src.fd < 0 || c->busy || c->outlen > 0) return;
+        if (c->inlen == sizeof(c->in)) {
+            syslog(LOG_USER | LOG_ERR, "payment client %d: line longer than %d bytes", c->src.fd, PAY_MAX_LINE);
+            client_close(c);
+            return;
+        }
+    }
+}
+
+
+/* queues the complete lines in the input for the worker, PAYMENT_BATCH at a time */
+static void client_serve(struct pay_client *c)
+{
+    struct paysrv *srv = c->srv;
+    char *p = c->in;
+    char *nl;
+
+    if (c->busy || c->outlen > 0) return;
+    c->n = 0;
+    while (c->n < PAYMENT_BATCH && (nl = memchr(p, '\n', c->inlen - (p - c->in))) != NULL) {
+        *nl = '\0';
+        if (nl > p && nl[-1] == '\r') nl[-1] = '\0';
+        c->line[c->n++] = p;
+        p = nl + 1;
+    }
+    if (c->n == 0) return;
+
+    /* not polled until the answer is back, the input stays as it is */
+    c->used = p - c->in;
+    c->busy = 1;
+    evloop_del(srv->loop, &c->src);
+    pthread_mutex_lock(&srv->lock);
+    srv->queue[(srv->head + srv->queued++) % srv->max] = c;
+    pthread_cond_signal(&srv->wake);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+
+/* answers the queued clients one after the other, out is NULL if it failed */
+static void *paysrv_worker(void *arg)
+{
+    struct paysrv *srv = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&srv->lock);
+        while (!srv->stop && srv->queued == 0) pthread_cond_wait(&srv->wake, &srv->lock);
+        if (srv->stop) {
+            pthread_mutex_unlock(&srv->lock);
+            return NULL;
+        }
+        struct pay_client *c = srv->queue[srv->head];
+        srv->head = (srv->head + 1) % srv->max;
+        srv->queued--;
+        pthread_mutex_unlock(&srv->lock);
+
+        FILE *out = open_memstream(&c->out, &c->outlen);
+        if (out != NULL) {
+            srv->answer(srv->data, c->line, c->n, out);
+            fclose(out);
+        }
+
+        size_t idx = (size_t)(c - srv->client);
+        while (write(srv->notify, &idx, sizeof(idx)) == -1 && errno == EINTR);
+    }
+}
+
+
+/* takes the answered clients back into the event loop and writes their answers */
+static void paysrv_done(struct ev_source *src, uint32_t events)
+{
+    struct paysrv *srv = src->data;
+    size_t idx[PAY_MAX_CLIENTS];
+    ssize_t got;
+
+    while ((got = read(src->fd, idx, sizeof(idx))) > 0) {
+        for (size_t i = 0; i < (size_t)got / sizeof(idx[0]); i++) {
+            struct pay_client *c = &srv->client[idx[i]];
+
+            c->busy = 0;
+            c->inlen -= c->used;
+            memmove(c->in, c->in + c->used, c->inlen);
+            c->woff = 0;
+            c->served += c->n;
+            srv->requests += c->n;
+            if (c->out == NULL || evloop_add(srv->loop, &c->src, EPOLLIN) == -1) {
+                client_close(c);
+                continue;
+            }
+
+            client_flush(c);
+            /* lines that came with the answered ones */
+            if (c->src.fd >= 0) client_serve(c);
+        }
+    }
+}
+
+
+static void client_flush(struct pay_client *c)
+{
+    struct paysrv *srv = c->srv;
+
+    while (c->woff < c->outlen) {
+        ssize_t n = send(c->src.fd, c->out + c->woff, c->outlen - c->woff, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* not read from until the answer is out */
+            if (!c->writing && evloop_mod(srv->loop, &c->src, EPOLLOUT) == 0) c->writing = 1;
+            return;
+        }
+        if (n < 0) {
+            client_close(c);
+            return;
+        }
+        c->woff += n;
+    }
+
+    free(c->out);
+    c->out = NULL;
+    c->outlen = 0;
+    c->woff = 0;
+    if (c->writing && evloop_mod(srv->loop, &c->src, EPOLLIN) == 0) c->writing = 0;
+}
+
+
+static void client_close(struct pay_client *c)
+{
+    struct paysrv *srv = c->srv;
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "payment client %d gone: %lu requests", c->src.fd, c->served);
+    evloop_del(srv->loop, &c->src);
+    close(c->src.fd);
+    c->src.fd = -1;
+    free(c->out);
+    c->out = NULL;
+    c->outlen = 0;
+}
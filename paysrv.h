@@ -0,0 +1,59 @@
+#ifndef PAYSRV_H
+#define PAYSRV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "globaldefs.h"
+#include "evloop.h"
+
+/* answers n request lines, in order, to out; called on the worker thread */
+typedef void (*paysrv_answer)(void *data, char **line, size_t n, FILE *out);
+
+struct pay_client {
+    struct ev_source src;
+    struct paysrv *srv;
+    char in[PAY_MAX_LINE];
+    size_t inlen;
+    char *line[PAYMENT_BATCH];
+    size_t n;
+    size_t used;
+    int busy;
+    char *out;
+    size_t outlen;
+    size_t woff;
+    int writing;
+    unsigned long served;
+};
+
+struct paysrv {
+    struct evloop *loop;
+    struct ev_source listen;
+    char *path;
+    struct pay_client *client;
+    size_t max;
+    paysrv_answer answer;
+    void *data;
+    struct ev_source done;
+    int notify;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct pay_client **queue;
+    size_t head;
+    size_t queued;
+    int started;
+    int stop;
+    unsigned long clients;
+    unsigned long requests;
+    unsigned long refused;
+};
+
+int paysrv_init(struct paysrv *srv, struct evloop *loop, const char *workdir, mode_t mode, size_t max,
+                paysrv_answer answer, void *data);
+void paysrv_stats(const struct paysrv *srv);
+void paysrv_close(struct paysrv *srv);
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "globaldefs.h"
+#include "hex.h"
+#include "pending.h"
+
+/*
+ * .mnp.pending is an append-only journal of state transitions of the
+ * payments tracked by mnp. Records have a fixed size and carry a CRC.
+ * A corrupt record is skipped on replay, a torn record at the tail
+ * (crash while writing) is cut off by the next append. Once the journal
+ * grows beyond PENDING_SNAP_SIZE, the live entries are written into
+ * .mnp.pending.snap and the journal starts over.
+ *
+ * Appending and replaying take a shared flock, the snapshot takes an
+ * exclusive one.
+ */
+struct pending_table {
+    struct pending_rec *rec;
+    size_t slots;
+    size_t used;
+};
+
+static int pending_append(const char *workdir, const char *txid, enum pending_state state,
+                          int notify, int confirmation);
+static int pending_load(const char *workdir, struct pending_table *table);
+static int pending_read(const char *path, struct pending_table *table);
+static int pending_snapshot(const char *workdir, int fd);
+static int pending_valid(const struct pending_rec *rec);
+static struct pending_rec *table_find(struct pending_table *table, const unsigned char *txid, int create);
+static char *pending_path(const char *workdir, const char *file);
+
+
+/**
+ * Journals that mnp starts (or resumes) to track a payment.
+ *
+ * @param workdir The work directory.
+ * @param txid The txid as 64 hex characters.
+ * @param notify The --notify-at level.
+ * @param confirmation The --confirmation count.
+ * @return 0 on success, -1 on error.
+ */
+int pending_begin(const char *workdir, const char *txid, int notify, int confirmation)
+{
+    return pending_append(workdir, txid, PENDING_BEGIN, notify, confirmation);
+}
+
+
+/**
+ * Journals that a payment is no longer pending.
+ *
+ * @param workdir The work directory.
+ * @param txid The txid as 64 hex characters.
+ * @param state PENDING_DONE or PENDING_FAILED.
+ * @return 0 on success, -1 on error.
+ */
+int pending_end(const char *workdir, const char *txid, enum pending_state state)
+{
+    return pending_append(workdir, txid, state, 0, 0);
+}
+
+
+/**
+ * Replays snapshot and journal.
+ *
+ * @param workdir The work directory.
+ * @param recs Set to a malloc'd array of every payment still pending.
+ * @param count Set to the number of entries in recs.
+ * @return 0 on success, -1 on error.
+ */
+int pending_replay(const char *workdir, struct pending_rec **recs, size_t *count)
+{
+    struct pending_table table = { NULL, 0, 0 };
+
+    *recs = NULL;
+    *count = 0;
+
+    if (pending_load(workdir, &table) < 0) {
+        free(table.rec);
+        return -1;
+    }
+
+    *recs = malloc((table.used + 1) * sizeof(struct pending_rec));
+    if (*recs == NULL) {
+        free(table.rec);
+        return -1;
+    }
+
+    for (size_t i = 0; i < table.slots; i++) {
+        if (table.rec[i].state == PENDING_BEGIN) (*recs)[(*count)++] = table.rec[i];
+    }
+    free(table.rec);
+    return 0;
+}
+
+
+/**
+ * Tests if a payment is pending but the mnp process tracking it is gone.
+ *
+ * @param workdir The work directory.
+ * @param txid The txid as 64 hex characters.
+ * @return 1 if orphaned, 0 otherwise.
+ */
+int pending_orphaned(const char *workdir, const char *txid)
+{
+    struct pending_rec *recs = NULL;
+    size_t count = 0;
+    unsigned char bin[TXID_BIN_SIZE];
+    int orphaned = 0;
+
+    if (hex2bin(txid, bin, TXID_BIN_SIZE) < 0) return 0;
+    if (pending_replay(workdir, &recs, &count) < 0) return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (memcmp(recs[i].txid, bin, TXID_BIN_SIZE) == 0) {
+            orphaned = recs[i].pid <= 0 || (kill(recs[i].pid, 0) == -1 && errno == ESRCH);
+            break;
+        }
+    }
+    free(recs);
+    return orphaned;
+}
+
+
+static int pending_append(const char *workdir, const char *txid, enum pending_state state,
+                          int notify, int confirmation)
+{
+    struct pending_rec rec;
+    struct stat st;
+
+    memset(&rec, 0, sizeof(rec));
+    if (hex2bin(txid, rec.txid, TXID_BIN_SIZE) < 0) return -1;
+    rec.state = state;
+    rec.notify = notify;
+    rec.confirmation = confirmation;
+    rec.pid = getpid();
+    rec.stamp = time(NULL);
+    rec.crc = crc32(0, (const char *)&rec + sizeof(rec.crc), sizeof(rec) - sizeof(rec.crc));
+
+    char *path = pending_path(workdir, PENDING_FILE);
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not open %s: %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    int ret = 0;
+    if (fstat(fd, &st) == 0 && st.st_size % sizeof(rec) != 0) {
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size - st.st_size % sizeof(rec)) == 0) {
+            syslog(LOG_USER | LOG_ERR, "cut torn record at the end of %s", path);
+        }
+        flock(fd, LOCK_UN);
+    }
+
+    flock(fd, LOCK_SH);
+    if (write(fd, &rec, sizeof(rec)) != sizeof(rec) || fdatasync(fd) == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not write %s: %s", path, strerror(errno));
+        ret = -1;
+    }
+    flock(fd, LOCK_UN);
+
+    if (ret == 0 && fstat(fd, &st) == 0 && st.st_size > PENDING_SNAP_SIZE * (off_t)sizeof(rec)) {
+        ret = pending_snapshot(workdir, fd);
+    }
+
+    close(fd);
+    free(path);
+    return ret;
+}
+
+
+/* Replays the snapshot, then the journal on top of it. */
+static int pending_load(const char *workdir, struct pending_table *table)
+{
+    char *journal = pending_path(workdir, PENDING_FILE);
+    char *snap = pending_path(workdir, PENDING_SNAP_FILE);
+    int ret = -1;
+
+    int fd = open(journal, O_RDONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd != -1) {
+        flock(fd, LOCK_SH);
+        if (pending_read(snap, table) == 0 && pending_read(journal, table) == 0) ret = 0;
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    free(journal);
+    free(snap);
+    return ret;
+}
+
+
+static int pending_read(const char *path, struct pending_table *table)
+{
+    struct pending_rec rec;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return errno == ENOENT ? 0 : -1;
+
+    while (fread(&rec, sizeof(rec), 1, file) == 1) {
+        if (!pending_valid(&rec)) {
+            syslog(LOG_USER | LOG_ERR, "corrupt record in %s at %ld skipped",
+                   path, ftell(file) - (long)sizeof(rec));
+            continue;
+        }
+        struct pending_rec *entry = table_find(table, rec.txid, 1);
+        if (entry == NULL) {
+            fclose(file);
+            return -1;
+        }
+        if (rec.state == PENDING_BEGIN) {
+            *entry = rec;
+        } else {
+            entry->state = rec.state;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+
+/*
+ * Writes the live entries into a new snapshot and truncates the journal.
+ * Crashing in between is harmless: replaying a journal twice on top of
+ * a snapshot ends in the same state.
+ */
+static int pending_snapshot(const char *workdir, int fd)
+{
+    struct pending_table table = { NULL, 0, 0 };
+    struct stat st;
+    int ret = -1;
+
+    if (flock(fd, LOCK_EX) == -1) return -1;
+
+    /* another process may have just taken the snapshot */
+    if (fstat(fd, &st) == -1 || st.st_size <= PENDING_SNAP_SIZE * (off_t)sizeof(struct pending_rec)) {
+        flock(fd, LOCK_UN);
+        return 0;
+    }
+
+    char *journal = pending_path(workdir, PENDING_FILE);
+    char *snap = pending_path(workdir, PENDING_SNAP_FILE);
+    char *tmp = NULL;
+    asprintf(&tmp, "%s.%d", snap, (int)getpid());
+
+    if (pending_read(snap, &table) == 0 && pending_read(journal, &table) == 0) {
+        int snapfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        FILE *file = snapfd != -1 ? fdopen(snapfd, "w") : NULL;
+        if (file != NULL) {
+            size_t live = 0;
+            for (size_t i = 0; i < table.slots; i++) {
+                if (table.rec[i].state != PENDING_BEGIN) continue;
+                fwrite(&table.rec[i], sizeof(struct pending_rec), 1, file);
+                live++;
+            }
+            if (fflush(file) == 0 && fsync(fileno(file)) == 0 && fclose(file) == 0 &&
+                rename(tmp, snap) == 0 && ftruncate(fd, 0) == 0) {
+                fsync(fd);
+                if (verbose) syslog(LOG_USER | LOG_INFO, "pending snapshot: %zu payments", live);
+                ret = 0;
+            }
+        }
+    }
+
+    if (ret < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not write snapshot %s: %s", snap, strerror(errno));
+        unlink(tmp);
+    }
+
+    flock(fd, LOCK_UN);
+    free(table.rec);
+    free(journal);
+    free(snap);
+    free(tmp);
+    return ret;
+}
+
+
+static int pending_valid(const struct pending_rec *rec)
+{
+    uint32_t crc = crc32(0, (const char *)rec + sizeof(rec->crc), sizeof(*rec) - sizeof(rec->crc));
+
+    return crc == rec->crc && rec->state > PENDING_NONE && rec->state <= PENDING_FAILED;
+}
+
+
+/* Open addressing table keyed by the binary txid. Grows at 1/2 load. */
+static struct pending_rec *table_find(struct pending_table *table, const unsigned char *txid, int create)
+{
+    if (create && (table->used + 1) * 2 > table->slots) {
+        struct pending_table grown = { NULL, table->slots ? table->slots * 2 : 64, 0 };
+        grown.rec = calloc(grown.slots, sizeof(struct pending_rec));
+        if (grown.rec == NULL) return NULL;
+
+        for (size_t i = 0; i < table->slots; i++) {
+            if (table->rec[i].state == PENDING_NONE) continue;
+            *table_find(&grown, table->rec[i].txid, 1) = table->rec[i];
+        }
+        free(table->rec);
+        *table = grown;
+    }
+
+    if (table->slots == 0) return NULL;
+
+    uint64_t hash;
+    memcpy(&hash, txid, sizeof(hash));
+
+    for (size_t i = 0; i < table->slots; i++) {
+        struct pending_rec *rec = &table->rec[(hash + i) & (table->slots - 1)];
+        if (rec->state == PENDING_NONE) {
+            if (!create) return NULL;
+            memcpy(rec->txid, txid, TXID_BIN_SIZE);
+            rec->state = PENDING_FAILED;
+            table->used++;
+            return rec;
+        }
+        if (memcmp(rec->txid, txid, TXID_BIN_SIZE) == 0) return rec;
+    }
+    return NULL;
+}
+
+
+static char *pending_path(const char *workdir, const char *file)
+{
+    char *path = NULL;
+
+    asprintf(&path, "%s/%s", workdir, file);
+    return path;
+}
@@ -0,0 +1,31 @@
+#ifndef PENDING_H
+#define PENDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "txindex.h"
+
+enum pending_state {
+    PENDING_NONE,
+    PENDING_BEGIN,
+    PENDING_DONE,
+    PENDING_FAILED,
+};
+
+struct pending_rec {
+    uint32_t crc;
+    uint8_t  state;
+    uint8_t  notify;
+    uint16_t reserved;
+    uint32_t confirmation;
+    int32_t  pid;
+    int64_t  stamp;
+    unsigned char txid[TXID_BIN_SIZE];
+};
+
+int pending_begin(const char *workdir, const char *txid, int notify, int confirmation);
+int pending_end(const char *workdir, const char *txid, enum pending_state state);
+int pending_replay(const char *workdir, struct pending_rec **recs, size_t *count);
+int pending_orphaned(const char *workdir, const char *txid);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "globaldefs.h"
+#include "policy.h"
+
+/*
+ * Confirmation policy of mnp: which notify level and how many
+ * confirmations a transfer needs, by its amount and optionally by the
+ * account and subaddress it was paid to. One [policy] tier per line,
+ *
+ *   tier = AMOUNT NOTIFY CONFIRMATIONS [ACCOUNT [SUBADDR]]
+ *
+ * AMOUNT, ACCOUNT and SUBADDR are ranges: MIN-MAX, MIN- (no upper
+ * bound), a single number or * (anything). AMOUNT is in piconero,
+ * NOTIFY is 1 (txpool), 2 (confirmed) or 3 (unlocked) as --notify-at.
+ * The first tier that matches wins; a transfer no tier matches keeps
+ * --notify-at and --confirmation.
+ */
+static int parse_range(const char *s, struct policy_range *r);
+static int in_range(const struct policy_range *r, uint64_t v);
+
+
+/**
+ * Parses a tier and appends it to the policy. A bad tier marks the
+ * policy invalid, so the caller can refuse to run with half of it.
+ *
+ * @param pol The policy.
+ * @param spec The tier, see above.
+ * @return 0 on success, -1 on error.
+ */
+int policy_add(struct policy *pol, const char *spec)
+{
+    struct policy_tier t = { .account = { 0, UINT64_MAX }, .subaddr = { 0, UINT64_MAX } };
+    char amount[64], account[64], subaddr[64];
+    char tail;
+
+    int n = sscanf(spec, "%63s %d %d %63s %63s %c", amount, &t.notify, &t.confirmation, account, subaddr, &tail);
+    if (n < 3 || n > 5 || parse_range(amount, &t.amount) < 0 ||
+        (n >= 4 && parse_range(account, &t.account) < 0) ||
+        (n == 5 && parse_range(subaddr, &t.subaddr) < 0) ||
+        t.notify < TXPOOL || t.notify > UNLOCKED || t.confirmation < 0) {
+        syslog(LOG_USER | LOG_ERR, "invalid policy tier: %s", spec);
+        fprintf(stderr, "mnp: invalid policy tier: %s\n", spec);
+        pol->invalid = 1;
+        return -1;
+    }
+
+    struct policy_tier *tiers = realloc(pol->tiers, (pol->count + 1) * sizeof(*tiers));
+    if (tiers == NULL) {
+        pol->invalid = 1;
+        return -1;
+    }
+    pol->tiers = tiers;
+    pol->tiers[pol->count++] = t;
+    return 0;
+}
+
+
+/**
+ * Looks up the tier of a transfer.
+ *
+ * @param pol The policy.
+ * @param amount Amount of the transfer in piconero.
+ * @param account Account it was paid to, -1 if unknown.
+ * @param subaddr Subaddress index it was paid to, -1 if unknown.
+ * @param notify Set to the notify level of the tier.
+ * @param confirmation Set to the confirmations of the tier.
+ * @return 1 if a tier matched, 0 if not.
+ */
+int policy_eval(const struct policy *pol, uint64_t amount, long account, long subaddr,
+                int *notify, int *confirmation)
+{
+    for (size_t i = 0; i < pol->count; i++) {
+        const struct policy_tier *t = &pol->tiers[i];
+        if (!in_range(&t->amount, amount)) continue;
+        /* an unknown subaddress only matches a tier that does not ask */
+        if (account < 0 ? t->account.min > 0 || t->account.max < UINT64_MAX : !in_range(&t->account, account)) continue;
+        if (subaddr < 0 ? t->subaddr.min > 0 || t->subaddr.max < UINT64_MAX : !in_range(&t->subaddr, subaddr)) continue;
+        *notify = t->notify;
+        *confirmation = t->confirmation;
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Frees the tiers.
+ *
+ * @param pol The policy.
+ */
+void policy_free(struct policy *pol)
+{
+    free(pol->tiers);
+    pol->tiers = NULL;
+    pol->count = 0;
+}
+
+
+static int parse_range(const char *s, struct policy_range *r)
+{
+    char *end;
+
+    if (strcmp(s, "*") == 0) {
+        r->min = 0;
+        r->max = UINT64_MAX;
+        return 0;
+    }
+    if (!isdigit((unsigned char)s[0])) return -1;
+    errno = 0;
+    r->min = strtoull(s, &end, 10);
+    if (errno != 0) return -1;
+    if (*end == '\0') {
+        r->max = r->min;
+        return 0;
+    }
+    if (*end++ != '-') return -1;
+    if (*end == '\0') {
+        r->max = UINT64_MAX;
+        return 0;
+    }
+    if (!isdigit((unsigned char)end[0])) return -1;
+    r->max = strtoull(end, &end, 10);
+    if (errno != 0 || *end != '\0' || r->max < r->min) return -1;
+    return 0;
+}
+
+
+static int in_range(const struct policy_range *r, uint64_t v)
+{
+    return v >= r->min && v <= r->max;
+}
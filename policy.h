@@ -0,0 +1,31 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct policy_range {
+    uint64_t min;
+    uint64_t max;
+};
+
+struct policy_tier {
+    struct policy_range amount;
+    struct policy_range account;
+    struct policy_range subaddr;
+    int notify;
+    int confirmation;
+};
+
+struct policy {
+    struct policy_tier *tiers;
+    size_t count;
+    int invalid;
+};
+
+int policy_add(struct policy *pol, const char *spec);
+int policy_eval(const struct policy *pol, uint64_t amount, long account, long subaddr,
+                int *notify, int *confirmation);
+void policy_free(struct policy *pol);
+
+#endif
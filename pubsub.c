@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "evloop.h"
+#include "pubsub.h"
+
+/*
+ * Publish/subscribe endpoint of mnpd on a unix stream socket in the
+ * workdir. A subscriber connects and sends a filter as one JSON line:
+ *
+ *   {"type": ["transfer"], "account": 0, "subaddr_index": 3,
+ *    "payment_id": "...", "min_amount": "1000000"}
+ *
+ * Every field is optional, {} subscribes to everything, a new line
+ * replaces the filter. Matching events are written back as JSON
+ * lines. Each event is serialised once and shared by reference
+ * between the subscriber queues. A queue holds at most pub_queue
+ * events. Events that do not fit are dropped for that subscriber only
+ * and an "overflow" line tells how many; the journal has them all.
+ */
+static void pubsub_accept(struct ev_source *src, uint32_t events);
+static void sub_event(struct ev_source *src, uint32_t events);
+static void sub_filter(struct pub_sub *sub, const char *line);
+static int sub_match(const struct pub_filter *f, const cJSON *event);
+static void sub_push(struct pub_sub *sub, struct pub_msg *m);
+static void sub_notice(struct pub_sub *sub, cJSON *notice);
+static void sub_flush(struct pub_sub *sub);
+static void sub_close(struct pub_sub *sub);
+static struct pub_msg *msg_new(const char *line, size_t len);
+static void msg_put(struct pub_msg *m);
+static uint64_t amount_of(const cJSON *item);
+
+
+/**
+ * Binds the publish socket and preallocates the subscriber queues.
+ *
+ * @param ps The pub/sub endpoint.
+ * @param loop The event loop of mnpd.
+ * @param workdir The work directory.
+ * @param mode Permission of the socket file.
+ * @param max Maximum number of subscribers.
+ * @param qlen Events queued per subscriber.
+ * @return 0 on success, -1 on error.
+ */
+int pubsub_init(struct pubsub *ps, struct evloop *loop, const char *workdir, mode_t mode,
+                size_t max, size_t qlen)
+{
+    struct sockaddr_un addr;
+
+    memset(ps, 0, sizeof(*ps));
+    ps->loop = loop;
+    ps->listen.fd = -1;
+    ps->max = max > 0 ? max : PUB_MAX_SUBS;
+    ps->qlen = qlen > 0 ? qlen : PUB_QUEUE;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", workdir, PUB_SOCKET);
+    if (len < 0 || len >= (int)sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        goto error;
+    }
+    ps->path = strdup(addr.sun_path);
+
+    ps->sub = calloc(ps->max, sizeof(struct pub_sub));
+    if (ps->path == NULL || ps->sub == NULL) goto error;
+    for (size_t i = 0; i < ps->max; i++) {
+        ps->sub[i].src.fd = -1;
+        ps->sub[i].queue = calloc(ps->qlen, sizeof(struct pub_msg *));
+        if (ps->sub[i].queue == NULL) goto error;
+    }
+
+    /* only one mnpd per workdir gets this far, see ipc_listen() */
+    unlink(ps->path);
+    ps->listen.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ps->listen.handler = pubsub_accept;
+    ps->listen.data = ps;
+    if (ps->listen.fd == -1 ||
+        bind(ps->listen.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(ps->path, mode) == -1 ||
+        listen(ps->listen.fd, SOMAXCONN) == -1 ||
+        evloop_add(loop, &ps->listen, EPOLLIN) == -1) {
+        goto error;
+    }
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "publish socket is up : %s", ps->path);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start publish socket %s: %s", workdir, strerror(errno));
+    pubsub_close(ps);
+    return -1;
+}
+
+
+/**
+ * Hands an event to every subscriber whose filter matches.
+ *
+ * @param ps The pub/sub endpoint.
+ * @param event The event.
+ * @param line The event serialised as JSON.
+ * @param len Length of line.
+ */
+void pubsub_publish(struct pubsub *ps, const cJSON *event, const char *line, size_t len)
+{
+    struct pub_msg *m = NULL;
+
+    for (size_t i = 0; i < ps->max; i++) {
+        struct pub_sub *sub = &ps->sub[i];
+        if (sub->src.fd < 0 || !sub->active || !sub_match(&sub->filter, event)) continue;
+
+        /* one reference per queue, the first one is ours */
+        if (m == NULL && (m = msg_new(line, len)) == NULL) return;
+        m->refs++;
+        sub_push(sub, m);
+    }
+
+    if (m != NULL) msg_put(m);
+}
+
+
+/**
+ * Disconnects all subscribers and removes the socket file.
+ *
+ * @param ps The pub/sub endpoint.
+ */
+void pubsub_close(struct pubsub *ps)
+{
+    if (ps->sub != NULL) {
+        for (size_t i = 0; i < ps->max; i++) {
+            if (ps->sub[i].src.fd >= 0) sub_close(&ps->sub[i]);
+            free(ps->sub[i].queue);
+        }
+    }
+    if (ps->listen.fd >= 0) {
+        close(ps->listen.fd);
+        unlink(ps->path);
+    }
+    free(ps->sub);
+    free(ps->path);
+    ps->sub = NULL;
+    ps->path = NULL;
+    ps->listen.fd = -1;
+}
+
+
+static void pubsub_accept(struct ev_source *src, uint32_t events)
+{
+    struct pubsub *ps = src->data;
+    int fd;
+
+    while ((fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct pub_sub *sub = NULL;
+        for (size_t i = 0; i < ps->max && sub == NULL; i++) {
+            if (ps->sub[i].src.fd < 0) sub = &ps->sub[i];
+        }
+        if (sub == NULL) {
+            syslog(LOG_USER | LOG_ERR, "pub_max_subscribers %zu reached, subscriber refused", ps->max);
+            close(fd);
+            continue;
+        }
+
+        struct pub_msg **queue = sub->queue;
+        memset(sub, 0, sizeof(*sub));
+        sub->queue = queue;
+        sub->ps = ps;
+        sub->src.fd = fd;
+        sub->src.handler = sub_event;
+        sub->src.data = sub;
+        if (evloop_add(ps->loop, &sub->src, EPOLLIN) == -1) {
+            close(fd);
+            sub->src.fd = -1;
+            continue;
+        }
+        if (verbose) syslog(LOG_USER | LOG_INFO, "subscriber %d connected", fd);
+    }
+}
+
+
+static void sub_event(struct ev_source *src, uint32_t events)
+{
+    struct pub_sub *sub = src->data;
+
+    if (events & EPOLLOUT) sub_flush(sub);
+    if (sub->src.fd < 0 || !(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+    for (;;) {
+        ssize_t n = recv(sub->src.fd, sub->in + sub->inlen, sizeof(sub->in) - sub->inlen, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            sub_close(sub);
+            return;
+        }
+        sub->inlen += n;
+
+        char *nl;
+        while ((nl = memchr(sub->in, '\n', sub->inlen)) != NULL) {
+            *nl = '\0';
+            sub_filter(sub, sub->in);
+            sub->inlen -= nl + 1 - sub->in;
+            memmove(sub->in, nl + 1, sub->inlen);
+            if (sub->src.fd < 0) return;
+        }
+        if (sub->inlen == sizeof(sub->in)) {
+            syslog(LOG_USER | LOG_ERR, "subscriber %d: filter longer than %d bytes", sub->src.fd, PUB_MAX_FILTER);
+            sub_close(sub);
+            return;
+        }
+    }
+}
+
+
+static void sub_filter(struct pub_sub *sub, const char *line)
+{
+    struct pub_filter f;
+    cJSON *json = cJSON_Parse(line);
+    cJSON *item = NULL;
+    cJSON *reply = cJSON_CreateObject();
+
+    memset(&f, 0, sizeof(f));
+    f.account = -1;
+    f.subaddr_index = -1;
+
+    if (!cJSON_IsObject(json)) goto invalid;
+
+    item = cJSON_GetObjectItem(json, "type");
+    if (cJSON_IsString(item)) {
+        snprintf(f.type[f.ntypes++], sizeof(f.type[0]), "%s", item->valuestring);
+    } else if (cJSON_IsArray(item)) {
+        cJSON *type = NULL;
+        cJSON_ArrayForEach(type, item) {
+            if (!cJSON_IsString(type) || f.ntypes == PUB_MAX_TYPES) goto invalid;
+            snprintf(f.type[f.ntypes++], sizeof(f.type[0]), "%s", type->valuestring);
+        }
+    } else if (item != NULL) {
+        goto invalid;
+    }
+
+    item = cJSON_GetObjectItem(json, "account");
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0) f.account = (long)item->valuedouble;
+    else if (item != NULL) goto invalid;
+
+    item = cJSON_GetObjectItem(json, "subaddr_index");
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0) f.subaddr_index = (long)item->valuedouble;
+    else if (item != NULL) goto invalid;
+
+    item = cJSON_GetObjectItem(json, "payment_id");
+    if (cJSON_IsString(item) && strlen(item->valuestring) <= MAX_PAYID_SIZE) {
+        snprintf(f.payment_id, sizeof(f.payment_id), "%s", item->valuestring);
+    } else if (item != NULL) {
+        goto invalid;
+    }
+
+    item = cJSON_GetObjectItem(json, "min_amount");
+    if (cJSON_IsString(item) || cJSON_IsNumber(item)) f.min_amount = amount_of(item);
+    else if (item != NULL) goto invalid;
+
+    sub->filter = f;
+    sub->active = 1;
+    cJSON_Delete(json);
+    cJSON_AddStringToObject(reply, "type", "subscribed");
+    sub_notice(sub, reply);
+    return;
+
+invalid:
+    cJSON_Delete(json);
+    cJSON_AddStringToObject(reply, "type", "error");
+    cJSON_AddStringToObject(reply, "error", "invalid filter");
+    sub_notice(sub, reply);
+}
+
+
+static int sub_match(const struct pub_filter *f, const cJSON *event)
+{
+    if (f->ntypes > 0) {
+        const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(event, "type"));
+        int found = 0;
+        for (int i = 0; type != NULL && i < f->ntypes && !found; i++) found = strcmp(type, f->type[i]) == 0;
+        if (!found) return 0;
+    }
+    if (f->account >= 0) {
+        const cJSON *item = cJSON_GetObjectItem(event, "account");
+        if (!cJSON_IsNumber(item) || (long)item->valuedouble != f->account) return 0;
+    }
+    if (f->subaddr_index >= 0) {
+        const cJSON *item = cJSON_GetObjectItem(event, "subaddr_index");
+        if (!cJSON_IsNumber(item) || (long)item->valuedouble != f->subaddr_index) return 0;
+    }
+    if (f->payment_id[0] != '\0') {
+        const char *payid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+        if (payid == NULL || strcmp(payid, f->payment_id) != 0) return 0;
+    }
+    if (f->min_amount > 0) {
+        const cJSON *item = cJSON_GetObjectItem(event, "amount");
+        if (item == NULL || amount_of(item) < f->min_amount) return 0;
+    }
+    return 1;
+}
+
+
+/* Takes over one reference of m. */
+static void sub_push(struct pub_sub *sub, struct pub_msg *m)
+{
+    struct pubsub *ps = sub->ps;
+
+    if (sub->count == ps->qlen) {
+        sub->gap++;
+        sub->dropped++;
+        msg_put(m);
+        return;
+    }
+    sub->queue[(sub->head + sub->count) % ps->qlen] = m;
+    sub->count++;
+    sub_flush(sub);
+}
+
+
+/* Queues a line meant for this subscriber only. */
+static void sub_notice(struct pub_sub *sub, cJSON *notice)
+{
+    char *line = cJSON_PrintUnformatted(notice);
+    cJSON_Delete(notice);
+    if (line == NULL) return;
+
+    struct pub_msg *m = msg_new(line, strlen(line));
+    free(line);
+    if (m != NULL) sub_push(sub, m);
+}
+
+
+static void sub_flush(struct pub_sub *sub)
+{
+    struct pubsub *ps = sub->ps;
+
+    for (;;) {
+        if (sub->count == 0 && sub->gap > 0) {
+            /* tell the subscriber what it missed, the events are in the journal */
+            cJSON *notice = cJSON_CreateObject();
+            cJSON_AddStringToObject(notice, "type", EV_OVERFLOW);
+            cJSON_AddNumberToObject(notice, "dropped", (double)sub->gap);
+            sub->gap = 0;
+            char *line = cJSON_PrintUnformatted(notice);
+            cJSON_Delete(notice);
+            struct pub_msg *m = line != NULL ? msg_new(line, strlen(line)) : NULL;
+            free(line);
+            if (m == NULL) break;
+            sub->queue[sub->head] = m;
+            sub->count = 1;
+        }
+        if (sub->count == 0) break;
+
+        struct pub_msg *m = sub->queue[sub->head];
+        ssize_t n = send(sub->src.fd, m->data + sub->woff, m->len - sub->woff, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!sub->out && evloop_mod(ps->loop, &sub->src, EPOLLIN | EPOLLOUT) == 0) sub->out = 1;
+            return;
+        }
+        if (n < 0) {
+            sub_close(sub);
+            return;
+        }
+
+        sub->woff += n;
+        if (sub->woff == m->len) {
+            msg_put(m);
+            sub->head = (sub->head + 1) % ps->qlen;
+            sub->count--;
+            sub->woff = 0;
+            sub->sent++;
+        }
+    }
+
+    if (sub->out && evloop_mod(ps->loop, &sub->src, EPOLLIN) == 0) sub->out = 0;
+}
+
+
+static void sub_close(struct pub_sub *sub)
+{
+    struct pubsub *ps = sub->ps;
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "subscriber %d gone: sent %lu dropped %lu",
+                        sub->src.fd, sub->sent, sub->dropped);
+    evloop_del(ps->loop, &sub->src);
+    close(sub->src.fd);
+    sub->src.fd = -1;
+    sub->active = 0;
+
+    while (sub->count > 0) {
+        msg_put(sub->queue[sub->head]);
+        sub->head = (sub->head + 1) % ps->qlen;
+        sub->count--;
+    }
+}
+
+
+static struct pub_msg *msg_new(const char *line, size_t len)
+{
+    struct pub_msg *m = malloc(sizeof(struct pub_msg) + len + 1);
+    if (m == NULL) return NULL;
+
+    m->refs = 1;
+    m->len = len + 1;
+    memcpy(m->data, line, len);
+    m->data[len] = '\n';
+    return m;
+}
+
+
+static void msg_put(struct pub_msg *m)
+{
+    if (--m->refs <= 0) free(m);
+}
+
+
+/* Amounts are strings of piconero, numbers are accepted too. */
+static uint64_t amount_of(const cJSON *item)
+{
+    if (cJSON_IsString(item)) return strtoull(item->valuestring, NULL, 10);
+    if (cJSON_IsNumber(item) && item->valuedouble > 0) return (uint64_t)item->valuedouble;
+    return 0;
+}
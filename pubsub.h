@@ -0,0 +1,57 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "evloop.h"
+
+struct pub_msg {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+struct pub_filter {
+    int ntypes;
+    char type[PUB_MAX_TYPES][32];
+    long account;
+    long subaddr_index;
+    char payment_id[MAX_PAYID_SIZE + 1];
+    uint64_t min_amount;
+};
+
+struct pub_sub {
+    struct ev_source src;
+    struct pubsub *ps;
+    int active;
+    struct pub_filter filter;
+    char in[PUB_MAX_FILTER];
+    size_t inlen;
+    struct pub_msg **queue;
+    size_t head;
+    size_t count;
+    size_t woff;
+    int out;
+    unsigned long sent;
+    unsigned long dropped;
+    unsigned long gap;
+};
+
+struct pubsub {
+    struct evloop *loop;
+    struct ev_source listen;
+    char *path;
+    struct pub_sub *sub;
+    size_t max;
+    size_t qlen;
+};
+
+int pubsub_init(struct pubsub *ps, struct evloop *loop, const char *workdir, mode_t mode,
+                size_t max, size_t qlen);
+void pubsub_publish(struct pubsub *ps, const cJSON *event, const char *line, size_t len);
+void pubsub_close(struct pubsub *ps);
+
+#endif
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "hex.h"
+#include "rpc_call.h"
+#include "txindex.h"
+#include "wallet.h"
+#include "reorg.h"
+
+/*
+ * Reorg detection of mnpd. mnp hands a payment over once; if the block
+ * it was confirmed in is later replaced, that decision has to be taken
+ * back by whoever acted on it.
+ *
+ * Every transfer mnpd gets with a confirmation is kept with the height
+ * and hash of its block in an array ordered by height, .mnp.confirmed
+ * on disk. mnpd also keeps the hashes of the last reorg_depth blocks.
+ * When the tip changes, the headers of those blocks are fetched from
+ * monerod in one call and compared from the top: the highest block
+ * that did not change is the fork point. Only the transfers above it
+ * are looked at, found by binary search, and asked for with one
+ * get_transfers call to the wallet. Each of them gets a "revoked"
+ * event with where it is now: mined at another height, back in the
+ * txpool, or gone. Transfers deeper than reorg_depth are dropped.
+ *
+ * A transfer is kept with its amount and recipient, so the revoked
+ * event can take it back out of its invoice.
+ */
+static int fetch(struct reorg *rg, long long from, long long to, struct reorg_block **out, size_t *n);
+static const struct reorg_block *block_at(const struct reorg_block *b, size_t n, int64_t height);
+static size_t above(const struct reorg *rg, int64_t height);
+static void insert(struct reorg *rg, const struct reorg_tx *tx);
+static void rollback(struct reorg *rg, long long fork, long long old_tip, struct rpc_wallet *rpc);
+static int load(struct reorg *rg);
+static int save(struct reorg *rg);
+
+
+/**
+ * Loads the confirmed transfers of the last run.
+ *
+ * @param rg The reorg detection.
+ * @param workdir The work directory.
+ * @param daemon host:port of monerod.
+ * @param depth Blocks a confirmed transfer is watched for.
+ * @param publish Called with the reorg and revoked events.
+ * @return 0 on success, -1 on error.
+ */
+int reorg_init(struct reorg *rg, const char *workdir, const char *daemon, long long depth,
+               void (*publish)(cJSON *event))
+{
+    memset(rg, 0, sizeof(*rg));
+    rg->depth = depth;
+    rg->tip = -1;
+    rg->publish = publish;
+
+    if (asprintf(&rg->path, "%s/%s", workdir, REORG_FILE) == -1) {
+        rg->path = NULL;
+        return -1;
+    }
+    if (asprintf(&rg->daemon, "http://%s/json_rpc", daemon) == -1) {
+        rg->daemon = NULL;
+        reorg_close(rg);
+        return -1;
+    }
+    if (load(rg) < 0) {
+        reorg_close(rg);
+        return -1;
+    }
+    if (verbose) syslog(LOG_USER | LOG_INFO, "reorg: %zu confirmed transfers watched", rg->count);
+    return 0;
+}
+
+
+/**
+ * Remembers a transfer that came with a confirmation. The hash of its
+ * block is filled in at the next tip. Transfers of one transaction are
+ * kept one by one.
+ *
+ * @param rg The reorg detection.
+ * @param event The transfer event, with height.
+ * @return 1 if it is watched now, 0 if not.
+ */
+int reorg_add(struct reorg *rg, const cJSON *event)
+{
+    const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+    const cJSON *height = cJSON_GetObjectItem(event, "height");
+    const cJSON *confirmations = cJSON_GetObjectItem(event, "confirmations");
+    const char *amount = cJSON_GetStringValue(cJSON_GetObjectItem(event, "amount"));
+    const char *payment_id = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"));
+    const cJSON *account = cJSON_GetObjectItem(event, "account");
+    const cJSON *subaddr = cJSON_GetObjectItem(event, "subaddr_index");
+    struct reorg_tx tx;
+
+    if (rg->path == NULL || txid == NULL || !cJSON_IsNumber(height) || height->valuedouble < 1) return 0;
+    if (!cJSON_IsNumber(confirmations) || confirmations->valuedouble < 1) return 0;
+    memset(&tx, 0, sizeof(tx));
+    if (hex2bin(txid, tx.txid, TXID_BIN_SIZE) < 0) return 0;
+
+    tx.height = (int64_t)height->valuedouble;
+    tx.amount = amount != NULL ? strtoull(amount, NULL, 10) : 0;
+    tx.payid = payment_id != NULL && strlen(payment_id) == MAX_PAYID_SIZE ? strtoull(payment_id, NULL, 16) : 0;
+    tx.account = cJSON_IsNumber(account) ? (int32_t)account->valuedouble : -1;
+    tx.subaddr = cJSON_IsNumber(subaddr) ? (int32_t)subaddr->valuedouble : -1;
+    for (size_t i = above(rg, tx.height - 1); i < rg->count && rg->tx[i].height == tx.height; i++) {
+        const struct reorg_tx *t = &rg->tx[i];
+        if (memcmp(t->txid, tx.txid, TXID_BIN_SIZE) == 0 && t->amount == tx.amount && t->payid == tx.payid &&
+            t->account == tx.account && t->subaddr == tx.subaddr) return 1;
+    }
+    const struct reorg_block *b = block_at(rg->blocks, rg->nblocks, tx.height);
+    if (b != NULL) memcpy(tx.hash, b->hash, TXID_BIN_SIZE);
+    else memset(tx.hash, 0, TXID_BIN_SIZE);
+    insert(rg, &tx);
+    return 1;
+}
+
+
+/**
+ * Checks a new tip for a reorg. Called whenever the height changes.
+ *
+ * @param rg The reorg detection.
+ * @param rpc The GET_TRANSFERS rpc of mnpd.
+ * @param tip The new height.
+ * @return 1 if there was a reorg, 0 if not, -1 if monerod could not be asked.
+ */
+int reorg_tip(struct reorg *rg, struct rpc_wallet *rpc, long long tip)
+{
+    struct reorg_block *blocks = NULL;
+    size_t n = 0;
+    int ret = 0;
+
+    if (rg->path == NULL || tip < 1) return 0;
+
+    /* the chain height counts the genesis block, the top block is one less */
+    long long top = tip - 1;
+    long long from = top - rg->depth + 1 > 0 ? top - rg->depth + 1 : 0;
+    if (fetch(rg, from, top, &blocks, &n) < 0) return -1;
+    rg->checks++;
+
+    /* from the top down to the first block that is still there */
+    long long fork = -1;
+    int changed = 0;
+    for (size_t i = rg->nblocks; i-- > 0;) {
+        const struct reorg_block *b = block_at(blocks, n, rg->blocks[i].height);
+        if (b != NULL && memcmp(b->hash, rg->blocks[i].hash, TXID_BIN_SIZE) == 0) {
+            fork = rg->blocks[i].height;
+            break;
+        }
+        if (b != NULL || rg->blocks[i].height > top) changed = 1;
+    }
+
+    /* after a restart only the blocks of the transfers are known */
+    if (rg->nblocks == 0) {
+        static const unsigned char zero[TXID_BIN_SIZE];
+        for (size_t i = 0; i < rg->count; i++) {
+            const struct reorg_block *b = block_at(blocks, n, rg->tx[i].height);
+            if (memcmp(rg->tx[i].hash, zero, TXID_BIN_SIZE) == 0) continue;
+            if ((b != NULL && memcmp(b->hash, rg->tx[i].hash, TXID_BIN_SIZE) != 0) || rg->tx[i].height > top) {
+                fork = rg->tx[i].height - 1;
+                changed = 1;
+                break;
+            }
+        }
+    }
+    if (changed) {
+        if (fork < 0) fork = from - 1;
+        rg->reorgs++;
+        syslog(LOG_USER | LOG_WARNING, "reorg: chain changed above height %lld, tip %lld -> %lld", fork, rg->tip, tip);
+        rollback(rg, fork, rg->tip, rpc);
+        ret = 1;
+    }
+
+    free(rg->blocks);
+    rg->blocks = blocks;
+    rg->nblocks = n;
+    rg->tip = tip;
+
+    /* fill in the hashes of new transfers, forget the deep ones */
+    size_t keep = 0;
+    for (size_t i = 0; i < rg->count; i++) {
+        struct reorg_tx *tx = &rg->tx[i];
+        if (tx->height < from) {
+            rg->dirty = 1;
+            continue;
+        }
+        static const unsigned char zero[TXID_BIN_SIZE];
+        const struct reorg_block *b = block_at(rg->blocks, rg->nblocks, tx->height);
+        if (b != NULL && memcmp(tx->hash, zero, TXID_BIN_SIZE) == 0) {
+            memcpy(tx->hash, b->hash, TXID_BIN_SIZE);
+            rg->dirty = 1;
+        }
+        rg->tx[keep++] = *tx;
+    }
+    rg->count = keep;
+    if (rg->dirty && save(rg) == 0) rg->dirty = 0;
+    return ret;
+}
+
+
+/**
+ * Logs the counters and prints them to stdout.
+ *
+ * @param rg The reorg detection.
+ */
+void reorg_stats(const struct reorg *rg)
+{
+    if (rg->path == NULL) return;
+    syslog(LOG_USER | LOG_INFO, "reorg: %zu watched, %lu checks, %lu reorgs, %lu revoked",
+           rg->count, rg->checks, rg->reorgs, rg->revoked);
+    printf("reorg: %zu watched, %lu checks, %lu reorgs, %lu revoked\n",
+           rg->count, rg->checks, rg->reorgs, rg->revoked);
+    fflush(stdout);
+}
+
+
+/**
+ * Saves the confirmed transfers and frees the detection.
+ *
+ * @param rg The reorg detection.
+ */
+void reorg_close(struct reorg *rg)
+{
+    if (rg->path != NULL && rg->dirty) save(rg);
+    free(rg->path);
+    free(rg->daemon);
+    free(rg->blocks);
+    free(rg->tx);
+    memset(rg, 0, sizeof(*rg));
+}
+
+
+/* headers from..to of monerod, one call, ordered by height */
+static int fetch(struct reorg *rg, long long from, long long to, struct reorg_block **out, size_t *n)
+{
+    char *answer = NULL;
+    char *cmd = NULL;
+    int ret = -1;
+
+    *out = NULL;
+    *n = 0;
+    if (asprintf(&cmd, "{\"jsonrpc\":\"2.0\",\"id\":\"0\",\"method\":\"get_block_headers_range\","
+                       "\"params\":{\"start_height\":%lld,\"end_height\":%lld}}", from, to) == -1) return -1;
+    if (wallet(rg->daemon, cmd, NULL, &answer) < 0 || answer == NULL) {
+        syslog(LOG_USER | LOG_ERR, "reorg: could not ask %s", rg->daemon);
+        free(cmd);
+        return -1;
+    }
+    free(cmd);
+
+    cJSON *reply = cJSON_Parse(answer);
+    const cJSON *headers = cJSON_GetObjectItem(cJSON_GetObjectItem(reply, "result"), "headers");
+    int size = cJSON_GetArraySize(headers);
+    if (cJSON_IsArray(headers) && size > 0 && (*out = calloc((size_t)size, sizeof(**out))) != NULL) {
+        const cJSON *h = NULL;
+        cJSON_ArrayForEach(h, headers) {
+            const cJSON *height = cJSON_GetObjectItem(h, "height");
+            const char *hash = cJSON_GetStringValue(cJSON_GetObjectItem(h, "hash"));
+            if (!cJSON_IsNumber(height) || hash == NULL) continue;
+            if (hex2bin(hash, (*out)[*n].hash, TXID_BIN_SIZE) < 0) continue;
+            (*out)[(*n)++].height = (int64_t)height->valuedouble;
+        }
+        ret = 0;
+    } else {
+        syslog(LOG_USER | LOG_ERR, "reorg: no headers %lld..%lld from %s", from, to, rg->daemon);
+    }
+    cJSON_Delete(reply);
+    free(answer);
+    return ret;
+}
+
+
+static const struct reorg_block *block_at(const struct reorg_block *b, size_t n, int64_t height)
+{
+    if (n == 0 || height < b[0].height || (size_t)(height - b[0].height) >= n) return NULL;
+    const struct reorg_block *hit = &b[height - b[0].height];
+    return hit->height == height ? hit : NULL;
+}
+
+
+/* index of the first transfer above height */
+static size_t above(const struct reorg *rg, int64_t height)
+{
+    size_t lo = 0, hi = rg->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rg->tx[mid].height <= height) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+static void insert(struct reorg *rg, const struct reorg_tx *tx)
+{
+    struct reorg_tx *list = realloc(rg->tx, (rg->count + 1) * sizeof(*list));
+    if (list == NULL) return;
+    rg->tx = list;
+    size_t at = above(rg, tx->height);
+    memmove(&rg->tx[at + 1], &rg->tx[at], (rg->count - at) * sizeof(*list));
+    rg->tx[at] = *tx;
+    rg->count++;
+    rg->dirty = 1;
+}
+
+
+/* asks the wallet where the transfers above the fork are now and publishes it */
+static void rollback(struct reorg *rg, long long fork, long long old_tip, struct rpc_wallet *rpc)
+{
+    size_t first = above(rg, fork);
+    size_t affected = rg->count - first;
+    char hex[2 * TXID_BIN_SIZE + 1];
+
+    cJSON *event = cJSON_CreateObject();
+    cJSON_AddStringToObject(event, "type", EV_REORG);
+    cJSON_AddNumberToObject(event, "fork", (double)fork);
+    cJSON_AddNumberToObject(event, "old_tip", (double)old_tip);
+    cJSON_AddNumberToObject(event, "affected", (double)affected);
+    rg->publish(event);
+    cJSON_Delete(event);
+    if (affected == 0) return;
+
+    /* the wallet has seen the new chain already, mnpd got the tip from it */
+    rpc->min_height = fork;
+    cJSON *result = NULL;
+    int asked = rpc_call(rpc) >= 0;
+    if (asked) result = cJSON_GetObjectItem(rpc->reply, "result");
+
+    struct reorg_tx *moved = malloc(affected * sizeof(*moved));
+    size_t nmoved = 0;
+    for (size_t i = first; i < rg->count; i++) {
+        struct reorg_tx *tx = &rg->tx[i];
+        const char *state = "gone";
+        long long height = 0;
+        long long confirmations = 0;
+
+        bin2hex(tx->txid, TXID_BIN_SIZE, hex);
+        const char *lists[] = { "in", "pool" };
+        for (int l = 0; l < 2 && strcmp(state, "gone") == 0; l++) {
+            const cJSON *trans = NULL;
+            cJSON_ArrayForEach(trans, cJSON_GetObjectItem(result, lists[l])) {
+                const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(trans, "txid"));
+                if (txid == NULL || strcmp(txid, hex) != 0) continue;
+                const cJSON *h = cJSON_GetObjectItem(trans, "height");
+                const cJSON *c = cJSON_GetObjectItem(trans, "confirmations");
+                state = l == 0 ? "mined" : "pool";
+                height = l == 0 && cJSON_IsNumber(h) ? (long long)h->valuedouble : 0;
+                confirmations = l == 0 && cJSON_IsNumber(c) ? (long long)c->valuedouble : 0;
+                break;
+            }
+        }
+        if (result == NULL) state = "unknown";
+
+        char num[24];
+        event = cJSON_CreateObject();
+        cJSON_AddStringToObject(event, "type", EV_REVOKED);
+        cJSON_AddStringToObject(event, "txid", hex);
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)tx->amount);
+        cJSON_AddStringToObject(event, "amount", num);
+        if (tx->payid != 0) {
+            snprintf(num, sizeof(num), "%016llx", (unsigned long long)tx->payid);
+            cJSON_AddStringToObject(event, "payment_id", num);
+        }
+        if (tx->account >= 0) cJSON_AddNumberToObject(event, "account", tx->account);
+        if (tx->subaddr >= 0) cJSON_AddNumberToObject(event, "subaddr_index", tx->subaddr);
+        cJSON_AddNumberToObject(event, "height", (double)tx->height);
+        cJSON_AddStringToObject(event, "state", state);
+        cJSON_AddNumberToObject(event, "new_height", (double)height);
+        cJSON_AddNumberToObject(event, "confirmations", (double)confirmations);
+        cJSON_AddNumberToObject(event, "fork", (double)fork);
+        rg->publish(event);
+        cJSON_Delete(event);
+        rg->revoked++;
+        syslog(LOG_USER | LOG_WARNING, "reorg: revoked %s at height %lld, now %s", hex, (long long)tx->height, state);
+
+        /* mined again: watched at the new height, its hash comes with the blocks */
+        if (height > 0 && moved != NULL) {
+            moved[nmoved] = *tx;
+            moved[nmoved].height = height;
+            memset(moved[nmoved].hash, 0, TXID_BIN_SIZE);
+            nmoved++;
+        }
+    }
+    /* rpc_call has freed the error part of a failed reply already */
+    if (asked) cJSON_Delete(rpc->reply);
+    rpc->reply = NULL;
+
+    rg->count = first;
+    rg->dirty = 1;
+    for (size_t i = 0; i < nmoved; i++) insert(rg, &moved[i]);
+    free(moved);
+}
+
+
+static int load(struct reorg *rg)
+{
+    struct stat st;
+
+    int fd = open(rg->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size % sizeof(struct reorg_tx) != 0) {
+        /* written by an older mnpd without the amounts, watched anew from here */
+        syslog(LOG_USER | LOG_WARNING, "reorg: %s has another layout, starting empty", rg->path);
+        close(fd);
+        return 0;
+    }
+    size_t count = (size_t)st.st_size / sizeof(struct reorg_tx);
+    rg->tx = malloc((count + 1) * sizeof(struct reorg_tx));
+    if (rg->tx == NULL) {
+        close(fd);
+        return -1;
+    }
+    ssize_t len = read(fd, rg->tx, count * sizeof(struct reorg_tx));
+    close(fd);
+    if (len < 0) return -1;
+    rg->count = (size_t)len / sizeof(struct reorg_tx);
+    return 0;
+}
+
+
+/* the whole list, into a new file renamed over the old one */
+static int save(struct reorg *rg)
+{
+    char *tmp = NULL;
+    int ret = -1;
+
+    if (asprintf(&tmp, "%s.tmp", rg->path) == -1) return -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd != -1) {
+        size_t size = rg->count * sizeof(struct reorg_tx);
+        ssize_t len = size > 0 ? write(fd, rg->tx, size) : 0;
+        if (close(fd) == 0 && len == (ssize_t)size && rename(tmp, rg->path) == 0) ret = 0;
+    }
+    if (ret < 0) {
+        syslog(LOG_USER | LOG_ERR, "reorg: could not write %s: %s", rg->path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef REORG_H
+#define REORG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./cjson/cJSON.h"
+#include "rpc_call.h"
+#include "txindex.h"
+
+struct reorg_block {
+    int64_t height;
+    unsigned char hash[TXID_BIN_SIZE];
+};
+
+struct reorg_tx {
+    int64_t height;
+    unsigned char hash[TXID_BIN_SIZE];
+    unsigned char txid[TXID_BIN_SIZE];
+    uint64_t amount;
+    uint64_t payid;
+    int32_t account;
+    int32_t subaddr;
+};
+
+struct reorg {
+    char *path;
+    char *daemon;
+    long long depth;
+    long long tip;
+    struct reorg_block *blocks;
+    size_t nblocks;
+    struct reorg_tx *tx;
+    size_t count;
+    int dirty;
+    void (*publish)(cJSON *event);
+    unsigned long checks;
+    unsigned long reorgs;
+    unsigned long revoked;
+};
+
+int reorg_init(struct reorg *rg, const char *workdir, const char *daemon, long long depth,
+               void (*publish)(cJSON *event));
+int reorg_add(struct reorg *rg, const cJSON *event);
+int reorg_tip(struct reorg *rg, struct rpc_wallet *rpc, long long tip);
+void reorg_stats(const struct reorg *rg);
+void reorg_close(struct reorg *rg);
+
+#endif
@@ -97,6 +97,9 @@ int rpc_call(struct rpc_wallet *monero_wallet)
         case NEW_SUBADDR:
             if (cJSON_AddNumberToObject(rpc_params, "account_index",
                         atoi(monero_wallet->account)) == NULL) ret = -1;
+            /* idx > 1 asks for a batch, the wallet takes up to 64 */
+            if (monero_wallet->idx > 1 &&
+                cJSON_AddNumberToObject(rpc_params, "count", monero_wallet->idx) == NULL) ret = -1;
             break;
         case MK_IADDR:
               if (cJSON_AddNumberToObject(rpc_params, "account_index",
@@ -150,6 +153,17 @@ int rpc_call(struct rpc_wallet *monero_wallet)
               if (cJSON_AddStringToObject(rpc_params, "signature",
                           monero_wallet->signature) == NULL) ret = -1;
             break;
+        case GET_TRANSFERS:
+            /* incoming and txpool transfers of all accounts in one call */
+            if (cJSON_AddTrueToObject(rpc_params, "in") == NULL) ret = -1;
+            if (cJSON_AddTrueToObject(rpc_params, "pool") == NULL) ret = -1;
+            if (cJSON_AddTrueToObject(rpc_params, "all_accounts") == NULL) ret = -1;
+            if (monero_wallet->min_height > 0) {
+                if (cJSON_AddTrueToObject(rpc_params, "filter_by_height") == NULL) ret = -1;
+                if (cJSON_AddNumberToObject(rpc_params, "min_height",
+                            (double)monero_wallet->min_height) == NULL) ret = -1;
+            }
+            break;
         default:
             rpc_params = NULL;
             break;
@@ -256,6 +270,9 @@ char* get_method(enum monero_rpc_method method)
         case CHECK_TX_PROOF:
             asprintf(&mtd, "%s", TX_PROOF_CMD);
                 break;
+        case GET_TRANSFERS:
+            asprintf(&mtd, "%s", GET_TRANSFERS_CMD);
+                break;
         default:
                 break;
     }
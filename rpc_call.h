@@ -15,6 +15,7 @@ enum monero_rpc_method {
     SPLIT_IADDR,
     CHECK_SPEND_PROOF,
     CHECK_TX_PROOF,
+    GET_TRANSFERS,
     END_RPC_SIZE
 };
 
@@ -30,6 +31,7 @@ struct rpc_wallet {
        char *balance;
        char *height;
        char *file;
+       long long min_height;
        /* mnp usage */
        char *txid;
        char *payid;
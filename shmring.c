@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "./cjson/cJSON.h"
+#include "globaldefs.h"
+#include "hex.h"
+#include "shmring.h"
+
+/*
+ * Producer side of the shared-memory event ring, see mnp-ring.h for
+ * the layout and the reader. mnpd is the only writer. A slot is
+ * claimed by clearing its stamp, filled, and published by writing
+ * the sequence number to the stamp and then to head. Readers compare
+ * the stamp before and after copying, so a slot overwritten meanwhile
+ * is detected instead of returned torn.
+ */
+
+
+/**
+ * Creates a fresh ring in the workdir. A ring left by a previous mnpd
+ * is replaced; its readers see mnp_ring_stale().
+ *
+ * @param ring The ring.
+ * @param workdir The work directory.
+ * @param slots Number of events kept, rounded up to a power of two.
+ * @param mode Permission of the ring file.
+ * @return 0 on success, -1 on error.
+ */
+int shmring_open(struct shmring *ring, const char *workdir, size_t slots, mode_t mode)
+{
+    char *tmp = NULL;
+    int fd = -1;
+
+    memset(ring, 0, sizeof(*ring));
+    asprintf(&ring->path, "%s/%s", workdir, SHM_RING_FILE);
+    asprintf(&tmp, "%s.%d", ring->path, getpid());
+
+    size_t n = 64;
+    while (n < slots && n < SHM_RING_MAX) n *= 2;
+    ring->size = sizeof(struct mnp_ring_head) + n * sizeof(struct mnp_ring_slot);
+
+    /* built aside and renamed, so readers never map a half initialised ring */
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == -1 || fchmod(fd, mode) == -1 || ftruncate(fd, ring->size) == -1) goto error;
+
+    ring->head = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring->head == MAP_FAILED) {
+        ring->head = NULL;
+        goto error;
+    }
+    ring->slot = (struct mnp_ring_slot *)(ring->head + 1);
+
+    ring->head->version = MNP_RING_VERSION;
+    ring->head->slots = n;
+    ring->head->slot_size = sizeof(struct mnp_ring_slot);
+    ring->head->created = time(NULL);
+    ring->head->head = 1;
+    __atomic_store_n(&ring->head->magic, MNP_RING_MAGIC, __ATOMIC_RELEASE);
+
+    if (rename(tmp, ring->path) == -1) goto error;
+    close(fd);
+    free(tmp);
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "event ring is up : %s %zu slots", ring->path, n);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not create event ring %s: %s", ring->path, strerror(errno));
+    if (fd >= 0) close(fd);
+    unlink(tmp);
+    free(tmp);
+    shmring_close(ring);
+    return -1;
+}
+
+
+/**
+ * Publishes one event to the ring.
+ *
+ * @param ring The ring.
+ * @param event The event as journaled.
+ */
+void shmring_publish(struct shmring *ring, const cJSON *event)
+{
+    struct mnp_ring_event ev;
+    const cJSON *item;
+
+    if (ring->head == NULL) return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.id = (uint64_t)cJSON_GetNumberValue(cJSON_GetObjectItem(event, "seq"));
+    ev.time = (int64_t)cJSON_GetNumberValue(cJSON_GetObjectItem(event, "time"));
+
+    item = cJSON_GetObjectItem(event, "amount");
+    if (cJSON_IsString(item)) ev.amount = strtoull(item->valuestring, NULL, 10);
+    else if (cJSON_IsNumber(item) && item->valuedouble > 0) ev.amount = (uint64_t)item->valuedouble;
+
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(event, "account"))) ev.account = item->valuedouble;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(event, "subaddr_index"))) ev.subaddr_index = item->valuedouble;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(event, "confirmations"))) ev.confirmations = item->valuedouble;
+    if (cJSON_IsTrue(cJSON_GetObjectItem(event, "double_spend")) ||
+        strcmp(cJSON_GetStringValue(cJSON_GetObjectItem(event, "type")) ?: "", EV_DOUBLE_SPEND) == 0) {
+        ev.flags |= MNP_RING_DOUBLE_SPEND;
+    }
+
+    const char *txid = cJSON_GetStringValue(cJSON_GetObjectItem(event, "txid"));
+    if (txid != NULL && strlen(txid) == 2 * sizeof(ev.txid)) hex2bin(txid, ev.txid, sizeof(ev.txid));
+
+    const char *str = NULL;
+    if ((str = cJSON_GetStringValue(cJSON_GetObjectItem(event, "type"))) != NULL) {
+        snprintf(ev.type, sizeof(ev.type), "%s", str);
+    }
+    if ((str = cJSON_GetStringValue(cJSON_GetObjectItem(event, "payment_id"))) != NULL) {
+        snprintf(ev.payment_id, sizeof(ev.payment_id), "%s", str);
+    }
+    if ((str = cJSON_GetStringValue(cJSON_GetObjectItem(event, "address"))) != NULL ||
+        (str = cJSON_GetStringValue(cJSON_GetObjectItem(event, "recipient"))) != NULL) {
+        snprintf(ev.address, sizeof(ev.address), "%s", str);
+    }
+
+    uint64_t seq = ring->head->head;
+    struct mnp_ring_slot *s = &ring->slot[seq & (ring->head->slots - 1)];
+
+    __atomic_store_n(&s->stamp, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&s->ev, &ev, sizeof(ev));
+    __atomic_store_n(&s->stamp, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head->head, seq + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&ring->head->futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &ring->head->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+
+/**
+ * Unmaps the ring and removes the file.
+ *
+ * @param ring The ring.
+ */
+void shmring_close(struct shmring *ring)
+{
+    if (ring->head != NULL) {
+        munmap(ring->head, ring->size);
+        unlink(ring->path);
+    }
+    free(ring->path);
+    ring->head = NULL;
+    ring->path = NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "./cjson/cJSON.h"
+#include "mnp-ring.h"
+
+struct shmring {
+    char *path;
+    size_t size;
+    struct mnp_ring_head *head;
+    struct mnp_ring_slot *slot;
+};
+
+int shmring_open(struct shmring *ring, const char *workdir, size_t slots, mode_t mode);
+void shmring_publish(struct shmring *ring, const cJSON *event);
+void shmring_close(struct shmring *ring);
+
+#endif
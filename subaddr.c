@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "./cjson/cJSON.h"
+#include "address.h"
+#include "crc32.h"
+#include "ed25519.h"
+#include "globaldefs.h"
+#include "hex.h"
+#include "keccak.h"
+#include "rpc_call.h"
+#include "subaddr.h"
+
+/*
+ * Subaddresses without the wallet. For the index (major, minor)
+ *
+ *   m = Hs("SubAddr\0" | a | major | minor)     Keccak-256 mod l
+ *   D = B + m G                                 public spend key
+ *   C = a D                                     public view key
+ *
+ * with a the private view key and B the public spend key of the
+ * primary address. (0, 0) is the primary address itself.
+ *
+ * The wallet still has to know about every subaddress handed out, or
+ * a payment to one beyond its lookahead is not found. The indices are
+ * therefore taken from a counter per account in .mnp.subaddr: next is
+ * the first index not handed out, told the first one the wallet has
+ * not created. mnpd tells the wallet with create_address whenever
+ * next is ahead; mnp-payment does it itself before it would hand out
+ * more than the lookahead of the wallet. The file is locked with flock
+ * while a record is read and written.
+ */
+#define SUBADDR_SALT        "SubAddr"
+#define SUBADDR_MIN_THREAD  (64)
+
+struct job {
+    const struct subaddr *sa;
+    uint32_t major;
+    uint32_t first;
+    size_t count;
+    char (*out)[MAX_ADDR_SIZE];
+    int ret;
+};
+
+static void *worker(void *arg);
+static int lock(const char *workdir, int create);
+static int find(int fd, uint32_t account, struct subaddr_rec *rec, off_t *at);
+static int load(int fd, struct rpc_wallet *monero_wallet, struct subaddr_rec *rec, off_t *at);
+static int store(int fd, struct subaddr_rec *rec, off_t at);
+static int tell(struct subaddr_rec *rec, struct rpc_wallet *create);
+static long wallet_count(struct rpc_wallet *list);
+
+
+/**
+ * Sets up the derivation for a primary address. The view key has to
+ * belong to it.
+ *
+ * @param sa The derivation.
+ * @param address The primary (standard) address.
+ * @param view_key The private view key, 64 hex characters.
+ * @return 0 on success, -1 if the address or key is invalid or they do not match.
+ */
+int subaddr_init(struct subaddr *sa, const char *address, const char *view_key)
+{
+    struct ed25519_point view;
+    unsigned char pub[ED25519_SIZE];
+
+    memset(sa, 0, sizeof(*sa));
+    if (address_decode(address, &sa->primary) < 0 || sa->primary.type != ADDRESS_STANDARD) return -1;
+    if (view_key == NULL || strlen(view_key) != 2 * ED25519_SIZE ||
+        hex2bin(view_key, sa->view_key, ED25519_SIZE) < 0 || !ed25519_scalar_valid(sa->view_key)) goto invalid;
+    if (ed25519_decompress(&sa->spend, sa->primary.spend) < 0) goto invalid;
+
+    ed25519_scalarmult_base(&view, sa->view_key);
+    ed25519_compress(pub, &view);
+    if (memcmp(pub, sa->primary.view, ED25519_SIZE) != 0) goto invalid;
+    return 0;
+
+invalid:
+    subaddr_wipe(sa);
+    return -1;
+}
+
+
+/**
+ * Derives one subaddress.
+ *
+ * @param sa The derivation.
+ * @param major The account.
+ * @param minor The index within the account.
+ * @param str Set to the subaddress.
+ * @param size Size of str, at least MAX_ADDR_SIZE.
+ * @return 0 on success, -1 on error.
+ */
+int subaddr_derive(const struct subaddr *sa, uint32_t major, uint32_t minor, char *str, size_t size)
+{
+    unsigned char data[sizeof(SUBADDR_SALT) + ED25519_SIZE + 2 * sizeof(uint32_t)];
+    unsigned char m[KECCAK_HASH_SIZE];
+    struct ed25519_point d, c;
+    struct address out;
+
+    if (major == 0 && minor == 0) return address_encode(&sa->primary, str, size) < 0 ? -1 : 0;
+
+    memcpy(data, SUBADDR_SALT, sizeof(SUBADDR_SALT));
+    memcpy(data + sizeof(SUBADDR_SALT), sa->view_key, ED25519_SIZE);
+    for (int i = 0; i < 4; i++) {
+        data[sizeof(SUBADDR_SALT) + ED25519_SIZE + i] = (unsigned char)(major >> (8 * i));
+        data[sizeof(SUBADDR_SALT) + ED25519_SIZE + 4 + i] = (unsigned char)(minor >> (8 * i));
+    }
+    keccak256(data, sizeof(data), m);
+    ed25519_reduce(m);
+
+    ed25519_scalarmult_base(&d, m);
+    ed25519_add(&d, &sa->spend, &d);
+    ed25519_scalarmult(&c, sa->view_key, &d);
+
+    memset(&out, 0, sizeof(out));
+    out.net = sa->primary.net;
+    out.type = ADDRESS_SUBADDRESS;
+    ed25519_compress(out.spend, &d);
+    ed25519_compress(out.view, &c);
+    memset(data, 0, sizeof(data));
+    return address_encode(&out, str, size) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Derives count subaddresses from first on, on all cores.
+ *
+ * @param sa The derivation.
+ * @param major The account.
+ * @param first The first index.
+ * @param count Number of subaddresses.
+ * @param out Set to the subaddresses, count of them.
+ * @return 0 on success, -1 on error.
+ */
+int subaddr_bulk(const struct subaddr *sa, uint32_t major, uint32_t first, size_t count,
+                 char (*out)[MAX_ADDR_SIZE])
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cores > 1 ? (size_t)cores : 1;
+    if (threads > count / SUBADDR_MIN_THREAD) threads = count / SUBADDR_MIN_THREAD;
+    if (threads < 1) threads = 1;
+
+    struct job *jobs = calloc(threads, sizeof(*jobs));
+    pthread_t *tid = calloc(threads, sizeof(*tid));
+    if (jobs == NULL || tid == NULL) {
+        free(jobs);
+        free(tid);
+        return -1;
+    }
+
+    size_t at = 0;
+    for (size_t i = 0; i < threads; i++) {
+        size_t n = count / threads + (i < count % threads ? 1 : 0);
+        jobs[i] = (struct job){ sa, major, first + (uint32_t)at, n, out + at, 0 };
+        at += n;
+    }
+
+    /* the first share is done by the caller, it would only wait otherwise */
+    size_t started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&tid[started], NULL, worker, &jobs[started]) != 0) break;
+    }
+    for (size_t i = started; i < threads; i++) worker(&jobs[i]);
+    worker(&jobs[0]);
+
+    int ret = jobs[0].ret;
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(tid[i], NULL);
+        if (jobs[i].ret < 0) ret = -1;
+    }
+    for (size_t i = started; i < threads; i++) {
+        if (jobs[i].ret < 0) ret = -1;
+    }
+    free(jobs);
+    free(tid);
+    return ret;
+}
+
+
+/**
+ * Takes count indices of the account of the NEW_SUBADDR rpc for local
+ * derivation. The first call of an account asks the wallet how many
+ * subaddresses it has. If the wallet would fall more than its
+ * lookahead behind, it is told about the indices handed out first.
+ *
+ * @param workdir The work directory.
+ * @param monero_wallet The rpc calls, GET_LIST and NEW_SUBADDR are used.
+ * @param count Number of indices.
+ * @param first Set to the first index.
+ * @return 0 on success, -1 on error.
+ */
+int subaddr_next(const char *workdir, struct rpc_wallet *monero_wallet, uint32_t count, uint32_t *first)
+{
+    struct subaddr_rec rec;
+    off_t at = -1;
+    int ret = -1;
+
+    int fd = lock(workdir, 1);
+    if (fd < 0) return -1;
+
+    if (load(fd, monero_wallet, &rec, &at) < 0) goto out;
+
+    if (rec.next + count - rec.told > SUBADDR_LOOKAHEAD && tell(&rec, &monero_wallet[NEW_SUBADDR]) < 0) {
+        store(fd, &rec, at);
+        goto out;
+    }
+    if (rec.next + count - rec.told > SUBADDR_LOOKAHEAD) {
+        syslog(LOG_USER | LOG_ERR, "subaddr: %u indices are more than the wallet looks ahead", count);
+        goto out;
+    }
+    *first = rec.next;
+    rec.next += count;
+    ret = store(fd, &rec, at);
+
+out:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ret;
+}
+
+
+/**
+ * Checks that the wallet of the NEW_SUBADDR account watches index
+ * before its address is derived for a payment. An index handed out but
+ * not yet told is told right away; one never handed out is refused, the
+ * wallet would not see payments to it.
+ *
+ * @param workdir The work directory.
+ * @param monero_wallet The rpc calls, GET_LIST and NEW_SUBADDR are used.
+ * @param index The subaddress index.
+ * @return 1 if the wallet knows index, 0 if not, -1 on error.
+ */
+int subaddr_known(const char *workdir, struct rpc_wallet *monero_wallet, uint32_t index)
+{
+    struct subaddr_rec rec;
+    off_t at = -1;
+    int ret = -1;
+
+    int fd = lock(workdir, 1);
+    if (fd < 0) return -1;
+
+    if (load(fd, monero_wallet, &rec, &at) < 0) goto out;
+    if (index >= rec.next) {
+        ret = 0;
+        if (at < 0) store(fd, &rec, at);
+        goto out;
+    }
+    if (index >= rec.told && tell(&rec, &monero_wallet[NEW_SUBADDR]) < 0) {
+        store(fd, &rec, at);
+        goto out;
+    }
+    ret = store(fd, &rec, at) < 0 ? -1 : 1;
+
+out:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ret;
+}
+
+
+/**
+ * Tells the wallet about the subaddresses handed out for the account
+ * of the NEW_SUBADDR rpc. Called by mnpd once per turn.
+ *
+ * @param workdir The work directory.
+ * @param monero_wallet The rpc calls, NEW_SUBADDR is used.
+ * @return 1 if the account is derived locally, 0 if not, -1 if the wallet failed.
+ */
+int subaddr_sync(const char *workdir, struct rpc_wallet *monero_wallet)
+{
+    struct subaddr_rec rec;
+    off_t at = -1;
+
+    int fd = lock(workdir, 0);
+    if (fd < 0) return 0;
+
+    int ret = find(fd, (uint32_t)atol(monero_wallet[NEW_SUBADDR].account), &rec, &at);
+    if (ret == 1 && rec.told < rec.next) {
+        if (tell(&rec, &monero_wallet[NEW_SUBADDR]) < 0) ret = -1;
+        store(fd, &rec, at);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ret;
+}
+
+
+/**
+ * Clears the private view key.
+ *
+ * @param sa The derivation.
+ */
+void subaddr_wipe(struct subaddr *sa)
+{
+    volatile unsigned char *p = (volatile unsigned char *)sa;
+    for (size_t i = 0; i < sizeof(*sa); i++) p[i] = 0;
+}
+
+
+static void *worker(void *arg)
+{
+    struct job *job = arg;
+
+    for (size_t i = 0; i < job->count; i++) {
+        if (subaddr_derive(job->sa, job->major, job->first + (uint32_t)i, job->out[i], MAX_ADDR_SIZE) < 0) {
+            job->ret = -1;
+        }
+    }
+    return NULL;
+}
+
+
+/* .mnp.subaddr, opened and locked; -1 if it does not exist and create is 0 */
+static int lock(const char *workdir, int create)
+{
+    char *path = NULL;
+
+    if (workdir == NULL || asprintf(&path, "%s/%s", workdir, SUBADDR_FILE) == -1) return -1;
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    if (fd == -1 && create) syslog(LOG_USER | LOG_ERR, "subaddr: could not open %s: %s", path, strerror(errno));
+    free(path);
+    if (fd == -1) return -1;
+    if (flock(fd, LOCK_EX) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/* record of the account and its offset, 1 found, 0 not, -1 on error */
+static int find(int fd, uint32_t account, struct subaddr_rec *rec, off_t *at)
+{
+    ssize_t n;
+
+    for (off_t off = 0; (n = pread(fd, rec, sizeof(*rec), off)) == sizeof(*rec); off += sizeof(*rec)) {
+        if (rec->crc != crc32(0, rec, offsetof(struct subaddr_rec, crc))) {
+            syslog(LOG_USER | LOG_ERR, "subaddr: %s is damaged", SUBADDR_FILE);
+            return -1;
+        }
+        if (rec->account == account) {
+            *at = off;
+            return 1;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+
+/* writes the record back, appended if at is -1 */
+static int store(int fd, struct subaddr_rec *rec, off_t at)
+{
+    if (at < 0 && (at = lseek(fd, 0, SEEK_END)) < 0) return -1;
+    at -= at % (off_t)sizeof(*rec);
+    rec->crc = crc32(0, rec, offsetof(struct subaddr_rec, crc));
+    if (pwrite(fd, rec, sizeof(*rec), at) != sizeof(*rec) || fdatasync(fd) == -1) {
+        syslog(LOG_USER | LOG_ERR, "subaddr: could not write %s: %s", SUBADDR_FILE, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+/* the record of the NEW_SUBADDR account, started from the wallet count on first use */
+static int load(int fd, struct rpc_wallet *monero_wallet, struct subaddr_rec *rec, off_t *at)
+{
+    uint32_t account = (uint32_t)atol(monero_wallet[NEW_SUBADDR].account);
+    int found = find(fd, account, rec, at);
+    if (found < 0) return -1;
+    if (found == 0) {
+        long n = wallet_count(&monero_wallet[GET_LIST]);
+        if (n < 1) return -1;
+        *rec = (struct subaddr_rec){ account, (uint32_t)n, (uint32_t)n, 0 };
+    }
+    return 0;
+}
+
+
+/* create_address until the wallet has every index below next */
+static int tell(struct subaddr_rec *rec, struct rpc_wallet *create)
+{
+    while (rec->told < rec->next) {
+        uint32_t count = rec->next - rec->told > ADDR_POOL_BATCH ? ADDR_POOL_BATCH : rec->next - rec->told;
+
+        create->idx = (int)count;
+        int ret = rpc_call(create);
+        create->idx = 0;
+        if (ret < 0) {
+            /* rpc_call has freed the error part of a failed reply already */
+            create->reply = NULL;
+            syslog(LOG_USER | LOG_ERR, "subaddr: create_address failed, wallet at %u of %u", rec->told, rec->next);
+            return -1;
+        }
+
+        cJSON *result = cJSON_GetObjectItem(create->reply, "result");
+        cJSON *indices = cJSON_GetObjectItem(result, "address_indices");
+        const cJSON *last = cJSON_GetArrayItem(indices, cJSON_GetArraySize(indices) - 1);
+        if (!cJSON_IsNumber(last)) last = cJSON_GetObjectItem(result, "address_index");
+        if (!cJSON_IsNumber(last)) {
+            cJSON_Delete(create->reply);
+            create->reply = NULL;
+            return -1;
+        }
+
+        /* someone else created addresses meanwhile: never hand those out again */
+        uint32_t told = (uint32_t)last->valuedouble + 1;
+        if (told != rec->told + count) {
+            syslog(LOG_USER | LOG_WARNING, "subaddr: wallet at %u, expected %u; addresses were created elsewhere",
+                   told, rec->told + count);
+        }
+        rec->told = told;
+        if (rec->next < told) rec->next = told;
+        cJSON_Delete(create->reply);
+        create->reply = NULL;
+    }
+    if (verbose) syslog(LOG_USER | LOG_INFO, "subaddr: wallet knows account %u up to %u", rec->account, rec->told);
+    return 0;
+}
+
+
+/* number of subaddresses the wallet has in the account of list, -1 on error */
+static long wallet_count(struct rpc_wallet *list)
+{
+    long n = -1;
+
+    if (rpc_call(list) < 0) {
+        list->reply = NULL;
+        return -1;
+    }
+    const cJSON *addresses = cJSON_GetObjectItem(cJSON_GetObjectItem(list->reply, "result"), "addresses");
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, addresses) {
+        const cJSON *index = cJSON_GetObjectItem(item, "address_index");
+        if (cJSON_IsNumber(index) && index->valuedouble >= n) n = (long)index->valuedouble + 1;
+    }
+    cJSON_Delete(list->reply);
+    list->reply = NULL;
+    return n;
+}
@@ -0,0 +1,33 @@
+#ifndef SUBADDR_H
+#define SUBADDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "address.h"
+#include "ed25519.h"
+#include "globaldefs.h"
+#include "rpc_call.h"
+
+struct subaddr {
+    struct address primary;
+    struct ed25519_point spend;
+    unsigned char view_key[ED25519_SIZE];
+};
+
+struct subaddr_rec {
+    uint32_t account;
+    uint32_t next;
+    uint32_t told;
+    uint32_t crc;
+};
+
+int subaddr_init(struct subaddr *sa, const char *address, const char *view_key);
+int subaddr_derive(const struct subaddr *sa, uint32_t major, uint32_t minor, char *str, size_t size);
+int subaddr_bulk(const struct subaddr *sa, uint32_t major, uint32_t first, size_t count,
+                 char (*out)[MAX_ADDR_SIZE]);
+int subaddr_next(const char *workdir, struct rpc_wallet *monero_wallet, uint32_t count, uint32_t *first);
+int subaddr_known(const char *workdir, struct rpc_wallet *monero_wallet, uint32_t index);
+int subaddr_sync(const char *workdir, struct rpc_wallet *monero_wallet);
+void subaddr_wipe(struct subaddr *sa);
+
+#endif
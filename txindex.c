@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "hex.h"
+#include "txindex.h"
+
+/*
+ * .mnp.txidx is a fixed-record, open-addressing hash table shared by
+ * every mnp process through mmap. A slot is claimed with a single
+ * compare-and-swap on its stamp, so two concurrent tx-notify calls can
+ * never both own the same txid. Compaction takes an exclusive flock,
+ * rebuilds the table into a new file and renames it over the old one.
+ *
+ * stamp: 0 = empty, 1 = being written, otherwise time of insertion.
+ */
+#define SLOT_EMPTY      (0)
+#define SLOT_BUSY       (1)
+#define BUSY_SPINS      (100000)
+
+static int txidx_attach(struct txidx *idx);
+static void txidx_detach(struct txidx *idx);
+static int txidx_stale(const struct txidx *idx);
+static int txidx_init(int fd, const char *path, uint32_t slots);
+static int txidx_probe(struct txidx_head *head, struct txidx_slot *slot,
+                       const unsigned char *txid, uint64_t stamp);
+static void txidx_import(struct txidx *idx);
+
+
+/**
+ * Opens (and creates if missing) the txid index in the work directory.
+ *
+ * @param idx The index handle to fill.
+ * @param workdir The work directory.
+ * @return 0 on success, -1 on error.
+ */
+int txidx_open(struct txidx *idx, const char *workdir)
+{
+    memset(idx, 0, sizeof(*idx));
+    idx->fd = -1;
+    asprintf(&idx->path, "%s/%s", workdir, TXID_INDEX_FILE);
+    if (idx->path == NULL) return -1;
+
+    if (txidx_attach(idx) < 0) {
+        free(idx->path);
+        idx->path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Inserts a txid into the index.
+ *
+ * @param idx The index handle.
+ * @param txid The txid as 64 hex characters.
+ * @return 1 if the txid is new, 0 if it was already known, -1 on error.
+ */
+int txidx_insert(struct txidx *idx, const char *txid)
+{
+    unsigned char bin[TXID_BIN_SIZE];
+    if (hex2bin(txid, bin, TXID_BIN_SIZE) < 0) return -1;
+
+    for (;;) {
+        if (flock(idx->fd, LOCK_SH) == -1) return -1;
+        if (!txidx_stale(idx)) break;
+        /* the table was compacted by another process */
+        flock(idx->fd, LOCK_UN);
+        txidx_detach(idx);
+        if (txidx_attach(idx) < 0) return -1;
+    }
+
+    int ret = txidx_probe(idx->head, idx->slot, bin, (uint64_t)time(NULL));
+    flock(idx->fd, LOCK_UN);
+
+    if (ret < 0) syslog(LOG_USER | LOG_ERR, "txid index is full: %s", idx->path);
+    return ret;
+}
+
+
+/**
+ * Tests if the index should be compacted (load factor above 3/4).
+ *
+ * @param idx The index handle.
+ * @return 1 if full, 0 otherwise.
+ */
+int txidx_full(const struct txidx *idx)
+{
+    uint64_t count = __atomic_load_n(&idx->head->count, __ATOMIC_RELAXED);
+    return count * 4 > (uint64_t)idx->head->slots * 3;
+}
+
+
+/**
+ * Drops every txid older than max_age and rebuilds the table. The table
+ * grows so that the remaining entries use at most half of the slots.
+ *
+ * @param idx The index handle.
+ * @param max_age Retention in seconds. 0 keeps every entry.
+ * @return 0 on success, -1 on error.
+ */
+int txidx_compact(struct txidx *idx, time_t max_age)
+{
+    if (flock(idx->fd, LOCK_EX) == -1) return -1;
+
+    if (txidx_stale(idx)) {
+        /* somebody else has just compacted */
+        flock(idx->fd, LOCK_UN);
+        txidx_detach(idx);
+        return txidx_attach(idx);
+    }
+
+    uint64_t cutoff = max_age > 0 ? (uint64_t)(time(NULL) - max_age) : 0;
+    uint64_t live = 0;
+    for (uint32_t i = 0; i < idx->head->slots; i++) {
+        uint64_t stamp = idx->slot[i].stamp;
+        if (stamp > SLOT_BUSY && stamp >= cutoff) live++;
+    }
+
+    uint32_t slots = idx->head->slots;
+    while (live * 2 > slots && slots < (UINT32_C(1) << 31)) slots *= 2;
+
+    char *tmp = NULL;
+    asprintf(&tmp, "%s.%d", idx->path, (int)getpid());
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1 || txidx_init(fd, tmp, slots) < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not compact %s: %s", idx->path, strerror(errno));
+        if (fd != -1) close(fd);
+        unlink(tmp);
+        free(tmp);
+        flock(idx->fd, LOCK_UN);
+        return -1;
+    }
+
+    size_t size = sizeof(struct txidx_head) + (size_t)slots * sizeof(struct txidx_slot);
+    struct txidx_head *head = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (head == MAP_FAILED) {
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        flock(idx->fd, LOCK_UN);
+        return -1;
+    }
+
+    struct txidx_slot *slot = (struct txidx_slot *)(head + 1);
+    for (uint32_t i = 0; i < idx->head->slots; i++) {
+        uint64_t stamp = idx->slot[i].stamp;
+        if (stamp > SLOT_BUSY && stamp >= cutoff) txidx_probe(head, slot, idx->slot[i].txid, stamp);
+    }
+    munmap(head, size);
+
+    int ret = rename(tmp, idx->path);
+    close(fd);
+    free(tmp);
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "txid index compacted: %llu entries, %u slots",
+                        (unsigned long long)live, slots);
+
+    flock(idx->fd, LOCK_UN);
+    txidx_detach(idx);
+    if (txidx_attach(idx) < 0) return -1;
+    return ret;
+}
+
+
+/**
+ * Unmaps and closes the index.
+ *
+ * @param idx The index handle.
+ */
+void txidx_close(struct txidx *idx)
+{
+    txidx_detach(idx);
+    free(idx->path);
+    idx->path = NULL;
+}
+
+
+/*
+ * Opens and maps idx->path. A new file gets initialised under an
+ * exclusive lock and picks up the entries of a legacy .mnp.txid.
+ */
+static int txidx_attach(struct txidx *idx)
+{
+    struct stat st;
+
+    idx->fd = open(idx->path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (idx->fd == -1) {
+        syslog(LOG_USER | LOG_ERR, "could not open %s: %s", idx->path, strerror(errno));
+        return -1;
+    }
+
+    if (flock(idx->fd, LOCK_EX) == -1 || fstat(idx->fd, &st) == -1) goto error;
+
+    int created = 0;
+    if (st.st_size < (off_t)sizeof(struct txidx_head)) {
+        if (txidx_init(idx->fd, idx->path, TXIDX_SLOTS) < 0) goto error;
+        created = 1;
+    }
+
+    struct txidx_head head;
+    if (pread(idx->fd, &head, sizeof(head), 0) != sizeof(head) || head.magic != TXIDX_MAGIC) {
+        syslog(LOG_USER | LOG_ERR, "%s is not a txid index", idx->path);
+        goto error;
+    }
+
+    idx->size = sizeof(struct txidx_head) + (size_t)head.slots * sizeof(struct txidx_slot);
+    idx->head = mmap(NULL, idx->size, PROT_READ | PROT_WRITE, MAP_SHARED, idx->fd, 0);
+    if (idx->head == MAP_FAILED) {
+        idx->head = NULL;
+        goto error;
+    }
+    idx->slot = (struct txidx_slot *)(idx->head + 1);
+    idx->ino = st.st_ino;
+
+    if (created) txidx_import(idx);
+    flock(idx->fd, LOCK_UN);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not map %s: %s", idx->path, strerror(errno));
+    close(idx->fd);
+    idx->fd = -1;
+    return -1;
+}
+
+
+static void txidx_detach(struct txidx *idx)
+{
+    if (idx->head != NULL) munmap(idx->head, idx->size);
+    if (idx->fd >= 0) close(idx->fd);
+    idx->head = NULL;
+    idx->slot = NULL;
+    idx->fd = -1;
+}
+
+
+/* Tests if idx->path was replaced by a compaction. */
+static int txidx_stale(const struct txidx *idx)
+{
+    struct stat st;
+
+    if (stat(idx->path, &st) == -1) return 1;
+    return st.st_ino != idx->ino;
+}
+
+
+static int txidx_init(int fd, const char *path, uint32_t slots)
+{
+    struct txidx_head head;
+
+    memset(&head, 0, sizeof(head));
+    head.magic = TXIDX_MAGIC;
+    head.version = 1;
+    head.slots = slots;
+
+    /* sparse file, pages are only backed once a slot is touched */
+    if (ftruncate(fd, sizeof(head) + (off_t)slots * sizeof(struct txidx_slot)) == -1) return -1;
+    if (pwrite(fd, &head, sizeof(head), 0) != sizeof(head)) return -1;
+    if (DEBUG) syslog(LOG_USER | LOG_DEBUG, "txid index %s created with %u slots", path, slots);
+    return 0;
+}
+
+
+/*
+ * Linear probing. The first 8 bytes of a txid are already uniformly
+ * distributed and serve as hash. Returns 1 on insert, 0 if found.
+ */
+static int txidx_probe(struct txidx_head *head, struct txidx_slot *slot,
+                       const unsigned char *txid, uint64_t stamp)
+{
+    uint64_t hash;
+    uint32_t mask = head->slots - 1;
+
+    memcpy(&hash, txid, sizeof(hash));
+
+    for (uint32_t i = 0; i < head->slots; i++) {
+        struct txidx_slot *s = &slot[(hash + i) & mask];
+        uint64_t cur = __atomic_load_n(&s->stamp, __ATOMIC_ACQUIRE);
+
+        if (cur == SLOT_EMPTY) {
+            uint64_t expected = SLOT_EMPTY;
+            if (__atomic_compare_exchange_n(&s->stamp, &expected, SLOT_BUSY, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                memcpy(s->txid, txid, TXID_BIN_SIZE);
+                __atomic_store_n(&s->stamp, stamp, __ATOMIC_RELEASE);
+                __atomic_add_fetch(&head->count, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            cur = expected;
+        }
+
+        /* another process is writing this slot right now */
+        for (int spin = 0; cur == SLOT_BUSY && spin < BUSY_SPINS; spin++) {
+            sched_yield();
+            cur = __atomic_load_n(&s->stamp, __ATOMIC_ACQUIRE);
+        }
+
+        if (cur > SLOT_BUSY && memcmp(s->txid, txid, TXID_BIN_SIZE) == 0) return 0;
+    }
+    return -1;
+}
+
+
+/* Moves the txids of a legacy .mnp.txid text file into the index. */
+static void txidx_import(struct txidx *idx)
+{
+    char *legacy = NULL;
+    struct stat st;
+
+    asprintf(&legacy, "%.*s%s", (int)(strrchr(idx->path, '/') - idx->path + 1), idx->path, TMP_TXID_FILE);
+    FILE *file = fopen(legacy, "r");
+    if (file == NULL) {
+        free(legacy);
+        return;
+    }
+
+    uint64_t stamp = (fstat(fileno(file), &st) == 0) ? (uint64_t)st.st_mtime : (uint64_t)time(NULL);
+    char line[MAX_TXID_SIZE + 2];
+    unsigned char bin[TXID_BIN_SIZE];
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (hex2bin(line, bin, TXID_BIN_SIZE) == 0) txidx_probe(idx->head, idx->slot, bin, stamp);
+    }
+    fclose(file);
+
+    if (verbose) syslog(LOG_USER | LOG_INFO, "imported %s into %s", legacy, idx->path);
+    unlink(legacy);
+    free(legacy);
+}
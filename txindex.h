@@ -0,0 +1,38 @@
+#ifndef TXINDEX_H
+#define TXINDEX_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define TXID_BIN_SIZE   (32)
+
+struct txidx_head {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint64_t count;
+    uint64_t reserved[5];
+};
+
+struct txidx_slot {
+    uint64_t stamp;
+    unsigned char txid[TXID_BIN_SIZE];
+};
+
+struct txidx {
+    int fd;
+    ino_t ino;
+    char *path;
+    size_t size;
+    struct txidx_head *head;
+    struct txidx_slot *slot;
+};
+
+int txidx_open(struct txidx *idx, const char *workdir);
+int txidx_insert(struct txidx *idx, const char *txid);
+int txidx_compact(struct txidx *idx, time_t max_age);
+int txidx_full(const struct txidx *idx);
+void txidx_close(struct txidx *idx);
+
+#endif
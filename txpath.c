@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "globaldefs.h"
+#include "txpath.h"
+
+/*
+ * Where the directory of a transaction lives:
+ *
+ *   flat:    <workdir>/transactions/<txid>
+ *   sharded: <workdir>/transactions/ab/cd/<txid>  (ab, cd = txid[0..3])
+ *
+ * Every binary that creates or reads transaction directories resolves
+ * them here, so the layout is a setting ([cfg] layout) and not an
+ * assumption spread over the sources.
+ */
+
+static int collect(const char *dir, int depth, char ***list, size_t *n);
+static void prune(const char *dir, int depth);
+
+
+/**
+ * Parses the layout setting.
+ *
+ * @param name "flat", "sharded" or NULL (flat).
+ * @return The layout, -1 if the name is unknown.
+ */
+int txpath_layout(const char *name)
+{
+    if (name == NULL || *name == '\0' || strcmp(name, "flat") == 0) return TX_LAYOUT_FLAT;
+    if (strcmp(name, "sharded") == 0) return TX_LAYOUT_SHARDED;
+    return -1;
+}
+
+
+/**
+ * Number of shard directories between transactions/ and a txid.
+ *
+ * @param layout The layout.
+ * @return 0 for flat, TX_SHARD_LEVELS for sharded.
+ */
+int txpath_shards(enum tx_layout layout)
+{
+    return layout == TX_LAYOUT_SHARDED ? TX_SHARD_LEVELS : 0;
+}
+
+
+/**
+ * Builds the path of a transaction directory.
+ *
+ * @param workdir The work directory.
+ * @param txid The transaction id.
+ * @param layout The layout.
+ * @return The path (to be freed), NULL on error.
+ */
+char *txpath(const char *workdir, const char *txid, enum tx_layout layout)
+{
+    char *path = NULL;
+    int ret;
+
+    if (layout == TX_LAYOUT_SHARDED && strlen(txid) >= TX_SHARD_LEVELS * TX_SHARD_WIDTH) {
+        /* one TX_SHARD_WIDTH slice of the txid per level */
+        char shards[TX_SHARD_LEVELS * (TX_SHARD_WIDTH + 1) + 1];
+        char *p = shards;
+        for (int i = 0; i < TX_SHARD_LEVELS; i++) {
+            memcpy(p, txid + i * TX_SHARD_WIDTH, TX_SHARD_WIDTH);
+            p += TX_SHARD_WIDTH;
+            *p++ = '/';
+        }
+        *p = '\0';
+        ret = asprintf(&path, "%s/%s/%s%s", workdir, TRANSACTION_DIR, shards, txid);
+    } else {
+        ret = asprintf(&path, "%s/%s/%s", workdir, TRANSACTION_DIR, txid);
+    }
+    return ret == -1 ? NULL : path;
+}
+
+
+/**
+ * Creates the directory of a transaction and its shard directories.
+ * Existing directories are fine.
+ *
+ * @param workdir The work directory.
+ * @param txid The transaction id.
+ * @param layout The layout.
+ * @param mode Permission of new directories.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+int txpath_mkdir(const char *workdir, const char *txid, enum tx_layout layout, mode_t mode)
+{
+    char *path = txpath(workdir, txid, layout);
+    if (path == NULL) return -1;
+
+    /* every '/' after transactions/ ends a shard directory */
+    size_t start = strlen(workdir) + strlen(TRANSACTION_DIR) + 2;
+    for (char *c = path + start; *c; c++) {
+        if (*c != '/') continue;
+        *c = '\0';
+        int retm = mkdir(path, mode);
+        *c = '/';
+        if (retm == -1 && errno != EEXIST) {
+            free(path);
+            return -1;
+        }
+    }
+
+    int ret = mkdir(path, mode);
+    free(path);
+    return ret == -1 && errno != EEXIST ? -1 : 0;
+}
+
+
+/**
+ * Moves every transaction directory of a workdir into a layout and
+ * removes shard directories left empty. Run it while mnp and mnpd
+ * are stopped: pipes keep their identity but not their path.
+ *
+ * @param workdir The work directory.
+ * @param layout The layout to move to.
+ * @param mode Permission of new shard directories.
+ * @return Number of directories moved, -1 on error.
+ */
+long txpath_migrate(const char *workdir, enum tx_layout layout, mode_t mode)
+{
+    char *txdir = NULL;
+    char **list = NULL;
+    size_t n = 0;
+    long moved = 0;
+
+    if (asprintf(&txdir, "%s/%s", workdir, TRANSACTION_DIR) == -1) return -1;
+
+    /* names first: the moves change the directories being read */
+    if (collect(txdir, 0, &list, &n) < 0) {
+        syslog(LOG_USER | LOG_ERR, "could not read %s: %s", txdir, strerror(errno));
+        moved = -1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const char *txid = strrchr(list[i], '/') + 1;
+        char *target = txpath(workdir, txid, layout);
+
+        if (target != NULL && strcmp(list[i], target) != 0) {
+            /* rename replaces the empty directory txpath_mkdir left at the target */
+            if (txpath_mkdir(workdir, txid, layout, mode) == 0 && rename(list[i], target) == 0) {
+                moved++;
+            } else {
+                syslog(LOG_USER | LOG_ERR, "could not move %s to %s: %s", list[i], target, strerror(errno));
+                fprintf(stderr, "mnp: could not move %s to %s: %s\n", list[i], target, strerror(errno));
+            }
+        }
+        free(target);
+        free(list[i]);
+    }
+
+    prune(txdir, 0);
+
+out:
+    free(list);
+    free(txdir);
+    return moved;
+}
+
+
+/**
+ * Tells whether a name is exactly len hex digits, as txids and shard
+ * directories are.
+ *
+ * @param s The name.
+ * @param len The number of digits.
+ * @return 1 if it is, 0 if not.
+ */
+int txpath_is_hex(const char *s, size_t len)
+{
+    size_t i = 0;
+    while (i < len && isxdigit((unsigned char)s[i])) i++;
+    return i == len && s[i] == '\0';
+}
+
+
+/* txids anywhere in the flat or the sharded layout */
+static int collect(const char *dir, int depth, char ***list, size_t *n)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    if (d == NULL) return -1;
+    while ((de = readdir(d)) != NULL) {
+        char *path = NULL;
+        struct stat sb;
+
+        if (de->d_name[0] == '.') continue;
+        if (asprintf(&path, "%s/%s", dir, de->d_name) == -1) continue;
+        if (lstat(path, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        if (depth < TX_SHARD_LEVELS && txpath_is_hex(de->d_name, TX_SHARD_WIDTH)) {
+            collect(path, depth + 1, list, n);
+            free(path);
+        } else if (txpath_is_hex(de->d_name, MAX_TXID_SIZE)) {
+            char **l = realloc(*list, (*n + 1) * sizeof(char *));
+            if (l == NULL) {
+                free(path);
+                break;
+            }
+            *list = l;
+            (*list)[(*n)++] = path;
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+
+/* removes empty shard directories */
+static void prune(const char *dir, int depth)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    if (d == NULL) return;
+    while ((de = readdir(d)) != NULL) {
+        char *path = NULL;
+        if (!txpath_is_hex(de->d_name, TX_SHARD_WIDTH)) continue;
+        if (asprintf(&path, "%s/%s", dir, de->d_name) == -1) continue;
+        if (depth + 1 < TX_SHARD_LEVELS) prune(path, depth + 1);
+        rmdir(path);
+        free(path);
+    }
+    closedir(d);
+}
@@ -0,0 +1,19 @@
+#ifndef TXPATH_H
+#define TXPATH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+enum tx_layout {
+    TX_LAYOUT_FLAT,
+    TX_LAYOUT_SHARDED,
+};
+
+int txpath_layout(const char *name);
+int txpath_shards(enum tx_layout layout);
+char *txpath(const char *workdir, const char *txid, enum tx_layout layout);
+int txpath_mkdir(const char *workdir, const char *txid, enum tx_layout layout, mode_t mode);
+long txpath_migrate(const char *workdir, enum tx_layout layout, mode_t mode);
+int txpath_is_hex(const char *s, size_t len);
+
+#endif
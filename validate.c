@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <stdint.h>
 #include <errno.h>
+#include "address.h"
 #include "globaldefs.h"
 
 
@@ -81,3 +82,49 @@ int val_amount(const char *amount) {
 
     return 0;
 }
+
+
+/*
+ * Validates a Monero address offline: base58, prefix and checksum.
+ *
+ * Parameters:
+ *   address: Pointer to the address
+ *
+ * Returns:
+ *   -1 if it is no standard, integrated or subaddress of a known network
+ *    0 if it is valid
+ */
+int val_address(const char *address) {
+
+    struct address addr;
+
+    if (address == NULL || address_decode(address, &addr) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Validates a payment id for an integrated address: 16 hex characters
+ * and not the all zero id that means none.
+ *
+ * Parameters:
+ *   payment_id: Pointer to the payment id
+ *
+ * Returns:
+ *   -1 if it is invalid
+ *    0 if it is valid
+ */
+int val_payment_id(const char *payment_id) {
+
+    if (payment_id == NULL || val_hex_input(payment_id, MAX_PAYID_SIZE) < 0) {
+        return -1;
+    }
+    if (strcmp(payment_id, PAYNULL) == 0) {
+        return -1;
+    }
+
+    return 0;
+}
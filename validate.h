@@ -3,5 +3,7 @@
 
 int val_hex_input(const char *hex, const unsigned int size);
 int val_amount(const char *amount);
+int val_address(const char *address);
+int val_payment_id(const char *payment_id);
 
 #endif
@@ -33,6 +33,9 @@
 /* defined redundant because of static */
 static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp);
 
+/* handle reused by wallet() between wallet_keepalive(1) and wallet_keepalive(0) */
+static CURL *kept = NULL;
+
 
 /**
  * Function to perform an HTTP POST request to a Monero wallet (monero-wallet-rpc).
@@ -48,8 +51,12 @@ int wallet(const char *urlport, const char *cmd, const char *userpwd, char **ans
     CURL *curl_handle;
     CURLcode res;
 
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl_handle = curl_easy_init();
+    if (kept != NULL) {
+        curl_handle = kept;
+    } else {
+        curl_global_init(CURL_GLOBAL_ALL);
+        curl_handle = curl_easy_init();
+    }
 
     struct curl_slist *headers = NULL;
     curl_slist_append(headers, CONTENT_TYPE);
@@ -87,14 +94,40 @@ int wallet(const char *urlport, const char *cmd, const char *userpwd, char **ans
         return -1;
     }
 
-    curl_easy_cleanup(curl_handle);
-    curl_global_cleanup();
+    if (curl_handle != kept) {
+        curl_easy_cleanup(curl_handle);
+        curl_global_cleanup();
+    }
 
     *answer = chunk.memory;
     return chunk.size;
 }
 
 
+/**
+ * Keeps one connection to the wallet open for all following calls,
+ * instead of a new one per call. The digest handshake is done once.
+ *
+ * @param on 1 to keep the connection, 0 to close it again.
+ * @return 0 on success, -1 on error.
+ */
+int wallet_keepalive(int on)
+{
+    if (on && kept == NULL) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        if ((kept = curl_easy_init()) == NULL) {
+            curl_global_cleanup();
+            return -1;
+        }
+    } else if (!on && kept != NULL) {
+        curl_easy_cleanup(kept);
+        curl_global_cleanup();
+        kept = NULL;
+    }
+    return 0;
+}
+
+
 /**
  * Callback function to write memory.
  *
@@ -2,5 +2,6 @@
 #define WALLET_H
 
 int wallet(const char *urlport, const char *cmd, const char *userpwd, char **answer);
+int wallet_keepalive(int on);
 
 #endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2025 d4ndo@proton.me
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <curl/curl.h>
+#include "globaldefs.h"
+#include "evloop.h"
+#include "journal.h"
+#include "webhook.h"
+
+/*
+ * Webhook sink of mnpd. Every target URL is a consumer of the journal,
+ * so the journal is the outbox: events are read from the consumer
+ * offset, POSTed as a JSON array and the offset is committed only when
+ * the receiver answered 2xx. After a failure or a restart the batch is
+ * read and sent again, receivers dedupe on "seq".
+ *
+ * All targets share one curl multi handle whose sockets are served by
+ * the event loop of mnpd. Each target keeps its easy handle, and with
+ * it a kept-alive connection, and has at most one request in flight so
+ * batches arrive in order.
+ */
+
+static void on_notify(struct ev_source *src, uint32_t events);
+static void on_socket(struct ev_source *src, uint32_t events);
+static void on_tick(void *data);
+static int sock_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp);
+static int timer_cb(CURLM *multi, long timeout_ms, void *userp);
+static void fill(struct webhook_target *t);
+static void send_batch(struct webhook_target *t);
+static void check_done(struct webhook *wh);
+static int append(struct webhook_target *t, const char *data, size_t len);
+static size_t discard(char *ptr, size_t size, size_t nmemb, void *userdata);
+
+
+/**
+ * Starts the webhook sink.
+ *
+ * @param wh The sink.
+ * @param loop Event loop of mnpd.
+ * @param workdir The work directory, holds the journal.
+ * @param urls Comma separated target URLs.
+ * @param start Sequence number a target without consumer offset starts at.
+ * @param batch Max. events per request.
+ * @param window_ms Max. time an event waits for its batch to fill.
+ * @param timeout Request timeout in seconds.
+ * @return 0 on success, -1 on error.
+ */
+int webhook_init(struct webhook *wh, struct evloop *loop, const char *workdir, const char *urls,
+                 uint64_t start, size_t batch, long long window_ms, long timeout)
+{
+    memset(wh, 0, sizeof(*wh));
+    wh->loop = loop;
+    wh->batch = batch > 0 ? batch : WEBHOOK_BATCH;
+    wh->window = window_ms;
+    wh->timeout = timeout > 0 ? timeout : WEBHOOK_TIMEOUT;
+    wh->timer = -1;
+    for (size_t i = 0; i < WEBHOOK_MAX_SOCKS; i++) {
+        wh->sock[i].src.fd = -1;
+        wh->sock[i].src.handler = on_socket;
+        wh->sock[i].src.data = &wh->sock[i];
+        wh->sock[i].wh = wh;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    wh->multi = curl_multi_init();
+    if (wh->multi == NULL) return -1;
+    curl_multi_setopt(wh->multi, CURLMOPT_SOCKETFUNCTION, sock_cb);
+    curl_multi_setopt(wh->multi, CURLMOPT_SOCKETDATA, wh);
+    curl_multi_setopt(wh->multi, CURLMOPT_TIMERFUNCTION, timer_cb);
+    curl_multi_setopt(wh->multi, CURLMOPT_TIMERDATA, wh);
+    wh->headers = curl_slist_append(NULL, "Content-Type: application/json");
+
+    char *list = strdup(urls);
+    char *save = NULL;
+    for (char *url = strtok_r(list, ", ", &save); url != NULL; url = strtok_r(NULL, ", ", &save)) {
+        if (wh->ntargets == WEBHOOK_MAX_URLS) {
+            fprintf(stderr, "mnpd: only %d webhook urls are served, %s is ignored\n", WEBHOOK_MAX_URLS, url);
+            continue;
+        }
+        struct webhook_target *t = &wh->target[wh->ntargets];
+        t->wh = wh;
+        t->url = strdup(url);
+        t->notify.fd = -1;
+        snprintf(t->consumer, sizeof(t->consumer), "%s-%zu", WEBHOOK_CONSUMER, wh->ntargets);
+        wh->ntargets++;
+
+        if (journal_reader_open(&t->reader, workdir, t->consumer) < 0) goto error;
+        if (access(t->reader.offset, F_OK) == -1) {
+            /* a new target gets what happens from now on, not the whole journal */
+            if (journal_reader_seek(&t->reader, start) < 0 || journal_reader_commit(&t->reader) < 0) goto error;
+        }
+
+        t->easy = curl_easy_init();
+        if (t->easy == NULL) goto error;
+        curl_easy_setopt(t->easy, CURLOPT_URL, t->url);
+        curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, wh->headers);
+        curl_easy_setopt(t->easy, CURLOPT_TIMEOUT, wh->timeout);
+        curl_easy_setopt(t->easy, CURLOPT_CONNECTTIMEOUT, (long)CONNECTTIMEOUT);
+        curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, discard);
+        curl_easy_setopt(t->easy, CURLOPT_USERAGENT, "mnpd/1.0");
+        curl_easy_setopt(t->easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+
+        /* the inotify fd of the reader tells when the journal grew */
+        t->notify.fd = t->reader.inotify;
+        t->notify.handler = on_notify;
+        t->notify.data = t;
+        if (evloop_add(loop, &t->notify, EPOLLIN) < 0) goto error;
+
+        if (verbose) syslog(LOG_USER | LOG_INFO, "webhook is up : %s as %s at %llu",
+                            t->url, t->consumer, (unsigned long long)t->reader.next);
+    }
+    free(list);
+    list = NULL;
+
+    if (evloop_tick(loop, WEBHOOK_POLL_MS, on_tick, wh) < 0) goto error;
+    for (size_t i = 0; i < wh->ntargets; i++) fill(&wh->target[i]);
+    return 0;
+
+error:
+    syslog(LOG_USER | LOG_ERR, "could not start webhook %s: %s", urls, strerror(errno));
+    free(list);
+    webhook_close(wh);
+    return -1;
+}
+
+
+/**
+ * Logs the counters of all targets and prints them to stdout.
+ *
+ * @param wh The sink.
+ */
+void webhook_stats(const struct webhook *wh)
+{
+    for (size_t i = 0; i < wh->ntargets; i++) {
+        const struct webhook_target *t = &wh->target[i];
+        syslog(LOG_USER | LOG_INFO, "webhook %s: sent %lu in %lu batches, %lu errors, at %llu",
+               t->url, t->sent, t->batches, t->errors, (unsigned long long)t->reader.next);
+        printf("webhook %s: sent %lu in %lu batches, %lu errors, at %llu\n",
+               t->url, t->sent, t->batches, t->errors, (unsigned long long)t->reader.next);
+    }
+    fflush(stdout);
+}
+
+
+/**
+ * Stops the sink. Batches in flight are not committed and are sent
+ * again by the next mnpd.
+ *
+ * @param wh The sink.
+ */
+void webhook_close(struct webhook *wh)
+{
+    for (size_t i = 0; i < wh->ntargets; i++) {
+        struct webhook_target *t = &wh->target[i];
+        if (t->easy != NULL) {
+            if (t->busy) curl_multi_remove_handle(wh->multi, t->easy);
+            curl_easy_cleanup(t->easy);
+        }
+        if (t->notify.fd >= 0) evloop_del(wh->loop, &t->notify);
+        journal_reader_close(&t->reader);
+        free(t->url);
+        free(t->body);
+    }
+    for (size_t i = 0; i < WEBHOOK_MAX_SOCKS; i++) {
+        if (wh->sock[i].src.fd >= 0) evloop_del(wh->loop, &wh->sock[i].src);
+    }
+    if (wh->multi != NULL) curl_multi_cleanup(wh->multi);
+    curl_slist_free_all(wh->headers);
+    memset(wh, 0, sizeof(*wh));
+}
+
+
+static void on_notify(struct ev_source *src, uint32_t events)
+{
+    char buf[4096] __attribute__((aligned(8)));
+    (void)events;
+
+    while (read(src->fd, buf, sizeof(buf)) > 0);
+    fill(src->data);
+}
+
+
+static void on_socket(struct ev_source *src, uint32_t events)
+{
+    struct webhook_sock *sock = src->data;
+    int flags = 0;
+    int running = 0;
+
+    /* the socket may have been released earlier in this round */
+    if (src->fd < 0) return;
+
+    if (events & EPOLLIN) flags |= CURL_CSELECT_IN;
+    if (events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+    if (events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+    curl_multi_socket_action(sock->wh->multi, src->fd, flags, &running);
+    check_done(sock->wh);
+}
+
+
+/* curl timeouts, batch windows and retry backoff */
+static void on_tick(void *data)
+{
+    struct webhook *wh = data;
+    long long now = evloop_now();
+    int running = 0;
+
+    if (wh->timer >= 0 && wh->timer <= now) {
+        wh->timer = -1;
+        curl_multi_socket_action(wh->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+    check_done(wh);
+    for (size_t i = 0; i < wh->ntargets; i++) {
+        struct webhook_target *t = &wh->target[i];
+        if (!t->busy && (t->count > 0 || t->retry_at > 0)) fill(t);
+    }
+}
+
+
+static int sock_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+    struct webhook *wh = userp;
+    struct webhook_sock *sock = socketp;
+    (void)easy;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (sock != NULL) {
+            evloop_del(wh->loop, &sock->src);
+            sock->src.fd = -1;
+            curl_multi_assign(wh->multi, s, NULL);
+        }
+        return 0;
+    }
+
+    uint32_t events = 0;
+    if (what & CURL_POLL_IN) events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) events |= EPOLLOUT;
+
+    if (sock != NULL) return evloop_mod(wh->loop, &sock->src, events) < 0 ? -1 : 0;
+
+    for (size_t i = 0; i < WEBHOOK_MAX_SOCKS; i++) {
+        if (wh->sock[i].src.fd >= 0) continue;
+        sock = &wh->sock[i];
+        sock->src.fd = s;
+        if (evloop_add(wh->loop, &sock->src, events) < 0) {
+            sock->src.fd = -1;
+            return -1;
+        }
+        curl_multi_assign(wh->multi, s, sock);
+        return 0;
+    }
+    syslog(LOG_USER | LOG_ERR, "webhook: all %d sockets in use", WEBHOOK_MAX_SOCKS);
+    return -1;
+}
+
+
+static int timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+    struct webhook *wh = userp;
+    (void)multi;
+
+    wh->timer = timeout_ms < 0 ? -1 : evloop_now() + timeout_ms;
+    return 0;
+}
+
+
+/*
+ * Reads new events of a target into its batch and sends the batch when
+ * it is full or its window is over.
+ */
+static void fill(struct webhook_target *t)
+{
+    struct webhook *wh = t->wh;
+    long long now = evloop_now();
+    uint64_t seq;
+    const char *data;
+    size_t len;
+
+    if (t->busy || t->retry_at > now) return;
+    t->retry_at = 0;
+
+    while (t->count < wh->batch && t->len < WEBHOOK_MAX_BODY) {
+        int ret = journal_reader_next(&t->reader, &seq, &data, &len, 0);
+        if (ret <= 0) break;
+        if (t->count == 0) {
+            t->first = seq;
+            t->due = now + wh->window;
+        }
+        if (append(t, t->count == 0 ? "[" : ",", 1) < 0 || append(t, data, len) < 0) {
+            syslog(LOG_USER | LOG_ERR, "webhook %s: out of memory", t->url);
+            return;
+        }
+        t->count++;
+    }
+
+    if (t->count > 0 && (t->count >= wh->batch || t->len >= WEBHOOK_MAX_BODY || t->due <= now)) {
+        send_batch(t);
+    }
+}
+
+
+static void send_batch(struct webhook_target *t)
+{
+    struct webhook *wh = t->wh;
+
+    if (append(t, "]", 1) < 0) return;
+    curl_easy_setopt(t->easy, CURLOPT_POSTFIELDSIZE, (long)t->len);
+    curl_easy_setopt(t->easy, CURLOPT_POSTFIELDS, t->body);
+    if (curl_multi_add_handle(wh->multi, t->easy) != CURLM_OK) {
+        t->len--;
+        return;
+    }
+    t->busy = 1;
+
+    /* start connecting now instead of on the next tick */
+    int running = 0;
+    wh->timer = -1;
+    curl_multi_socket_action(wh->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    if (DEBUG) syslog(LOG_USER | LOG_DEBUG, "webhook %s: POST %zu events from %llu",
+                      t->url, t->count, (unsigned long long)t->first);
+}
+
+
+/* Commits finished batches, or rewinds them for a retry. */
+static void check_done(struct webhook *wh)
+{
+    CURLMsg *msg;
+    int left;
+
+    while ((msg = curl_multi_info_read(wh->multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        struct webhook_target *t = NULL;
+        long status = 0;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+        CURLcode res = msg->data.result;
+        curl_multi_remove_handle(wh->multi, msg->easy_handle);
+        t->busy = 0;
+
+        if (res == CURLE_OK && status >= 200 && status < 300) {
+            if (journal_reader_commit(&t->reader) < 0) {
+                syslog(LOG_USER | LOG_ERR, "webhook %s: could not store offset", t->url);
+            }
+            t->sent += t->count;
+            t->batches++;
+            t->failures = 0;
+            if (verbose) syslog(LOG_USER | LOG_INFO, "webhook %s: delivered %zu events from %llu",
+                                t->url, t->count, (unsigned long long)t->first);
+        } else {
+            long long backoff = WEBHOOK_BACKOFF_MS << (t->failures < 6 ? t->failures : 6);
+            if (backoff > WEBHOOK_BACKOFF_MAX_MS) backoff = WEBHOOK_BACKOFF_MAX_MS;
+            t->failures++;
+            t->errors++;
+            t->retry_at = evloop_now() + backoff;
+            syslog(LOG_USER | LOG_ERR, "webhook %s: %s (HTTP %ld), retry %llu in %lld ms", t->url,
+                   res == CURLE_OK ? "rejected" : curl_easy_strerror(res), status,
+                   (unsigned long long)t->first, backoff);
+            if (journal_reader_seek(&t->reader, t->first) < 0) {
+                syslog(LOG_USER | LOG_ERR, "webhook %s: could not rewind journal", t->url);
+            }
+        }
+        t->len = 0;
+        t->count = 0;
+        fill(t);
+    }
+}
+
+
+static int append(struct webhook_target *t, const char *data, size_t len)
+{
+    if (t->len + len + 1 > t->cap) {
+        size_t cap = t->cap ? t->cap : MAX_DATA_SIZE;
+        while (cap < t->len + len + 1) cap *= 2;
+        char *body = realloc(t->body, cap);
+        if (body == NULL) return -1;
+        t->body = body;
+        t->cap = cap;
+    }
+    memcpy(t->body + t->len, data, len);
+    t->len += len;
+    t->body[t->len] = '\0';
+    return 0;
+}
+
+
+static size_t discard(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    (void)ptr;
+    (void)userdata;
+    return size * nmemb;
+}
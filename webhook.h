@@ -0,0 +1,57 @@
+#ifndef WEBHOOK_H
+#define WEBHOOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "evloop.h"
+#include "journal.h"
+#include "globaldefs.h"
+
+struct webhook;
+
+struct webhook_sock {
+    struct ev_source src;
+    struct webhook *wh;
+};
+
+struct webhook_target {
+    struct webhook *wh;
+    char *url;
+    char consumer[ALERT_NAME_SIZE];
+    struct journal_reader reader;
+    struct ev_source notify;
+    CURL *easy;
+    char *body;
+    size_t len;
+    size_t cap;
+    size_t count;
+    uint64_t first;
+    long long due;
+    long long retry_at;
+    int busy;
+    int failures;
+    unsigned long sent;
+    unsigned long batches;
+    unsigned long errors;
+};
+
+struct webhook {
+    struct evloop *loop;
+    CURLM *multi;
+    struct curl_slist *headers;
+    size_t batch;
+    long long window;
+    long timeout;
+    long long timer;
+    size_t ntargets;
+    struct webhook_target target[WEBHOOK_MAX_URLS];
+    struct webhook_sock sock[WEBHOOK_MAX_SOCKS];
+};
+
+int webhook_init(struct webhook *wh, struct evloop *loop, const char *workdir, const char *urls,
+                 uint64_t start, size_t batch, long long window_ms, long timeout);
+void webhook_stats(const struct webhook *wh);
+void webhook_close(struct webhook *wh);
+
+#endif